@@ -31,7 +31,9 @@
 #include "log.h"
 #include "misc.h"
 #include "setting.h"
+#include "file_cache.h"
 #include "file_list.h"
+#include "file_watcher.h"
 #include "file_tag.h"
 #include "browser.h"
 
@@ -53,6 +55,8 @@ static const GOptionEntry entries[] =
 {
     { "version", 'v', 0, G_OPTION_ARG_NONE, NULL,
       N_("Print the version and exit"), NULL },
+    { "batch", 0, 0, G_OPTION_ARG_NONE, NULL,
+      N_("Process files without user interface, see --batch --help"), NULL },
     { NULL }
 };
 
@@ -510,6 +514,10 @@ static void
 et_application_shutdown (GApplication *application)
 {
     Charset_Insert_Locales_Destroy ();
+    /* Join the reader thread of the directory watch. */
+    FileWatcher::Stop ();
+    /* Complete writing the tag cache. */
+    ET_FileCache::wait ();
 
     G_APPLICATION_CLASS (et_application_parent_class)->shutdown (application);
 }
@@ -0,0 +1,402 @@
+/* EasyTAG - tag editor for audio files
+ * Copyright (C) 2026  Marcel Müller <github@maazl.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "config.h"
+
+#include "batch.h"
+
+#include <glib/gi18n.h>
+
+#include "application.h"
+#include "file.h"
+#include "file_cache.h"
+#include "file_tag.h"
+#include "log.h"
+#include "mask.h"
+#include "misc.h"
+#include "replaygain.h"
+#include "setting.h"
+#include "xptr.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+using namespace std;
+
+
+// command line options
+static gboolean Batch;
+static gboolean NoRecursive;
+static gboolean Hidden;
+static gchar* FillMask;
+static gchar** Assignments;
+#ifdef ENABLE_REPLAYGAIN
+static gboolean ReplayGain;
+#endif
+static gboolean Force;
+static gboolean DryRun;
+static gint Threads;
+static gchar** Roots;
+
+static const GOptionEntry Options[] =
+{	{ "batch", 0, 0, G_OPTION_ARG_NONE, &Batch, N_("Run without user interface"), nullptr },
+	{ "no-recursive", 0, 0, G_OPTION_ARG_NONE, &NoRecursive, N_("Do not descend into subdirectories"), nullptr },
+	{ "hidden", 0, 0, G_OPTION_ARG_NONE, &Hidden, N_("Include hidden files and directories"), nullptr },
+	{ "fill", 'f', 0, G_OPTION_ARG_STRING, &FillMask, N_("Fill tag fields from the file path by a scanner mask"), N_("MASK") },
+	{ "set", 's', 0, G_OPTION_ARG_STRING_ARRAY, &Assignments, N_("Set a tag field, e.g. a=Artist; an empty value clears the field"), N_("CODE=VALUE") },
+#ifdef ENABLE_REPLAYGAIN
+	{ "replaygain", 'g', 0, G_OPTION_ARG_NONE, &ReplayGain, N_("Calculate ReplayGain"), nullptr },
+#endif
+	{ "force", 0, 0, G_OPTION_ARG_NONE, &Force, N_("Write the tags of all files, even if unchanged"), nullptr },
+	{ "dry-run", 'n', 0, G_OPTION_ARG_NONE, &DryRun, N_("Do not write anything"), nullptr },
+	{ "threads", 'j', 0, G_OPTION_ARG_INT, &Threads, N_("Number of worker threads"), N_("N") },
+	{ G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &Roots, nullptr, N_("PATH…") },
+	{ nullptr }
+};
+
+/// Parsed --set options
+static vector<pair<xStringD0 File_Tag::*, const gchar*>> FieldValues;
+/// Number of worker threads to use.
+static unsigned NumThreads;
+/// Number of failed operations.
+static atomic<unsigned> Errors;
+
+/// Serialize the progress output of the workers.
+static mutex OutputSync;
+
+/// Write one progress line to stdout.
+/// @details Format: step TAB done/total TAB path [TAB message]
+static void Progress(const char* step, size_t done, size_t total, const ET_File* file, const char* message = nullptr)
+{	lock_guard<mutex> lock(OutputSync);
+	printf("%s\t%zu/%zu\t%s", step, done, total, file->FilePath.get());
+	if (message)
+		printf("\t%s", message);
+	putchar('\n');
+	fflush(stdout);
+}
+
+/// Invoke \a fn for all indices 0 … count-1 using up to \ref NumThreads threads.
+static void ForEachParallel(size_t count, const function<void(size_t)>& fn)
+{	atomic<size_t> next(0);
+	auto worker = [&]()
+	{	for (size_t i; (i = next++) < count; )
+			fn(i);
+	};
+	vector<thread> threads;
+	for (size_t n = min<size_t>(NumThreads, count); n > 1; --n)
+		threads.emplace_back(worker);
+	worker();
+	for (auto& t : threads)
+		t.join();
+}
+
+/// Collect the supported audio files of a directory.
+static void Enumerate(GFile* dir, vector<gString>& paths)
+{	GError* error = nullptr;
+	gObject<GFileEnumerator> enumerator(g_file_enumerate_children(dir,
+		G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_STANDARD_TYPE "," G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN,
+		G_FILE_QUERY_INFO_NONE, nullptr, &error));
+	if (!enumerator)
+	{	gString path(g_file_get_path(dir));
+		Log_Print(LOG_ERROR, _("Error opening directory ‘%s’: %s"), path.get(), error->message);
+		g_error_free(error);
+		++Errors;
+		return;
+	}
+
+	gObject<GFileInfo> info;
+	while ((info = gObject<GFileInfo>(g_file_enumerator_next_file(enumerator.get(), nullptr, &error))))
+	{	if (!Hidden && g_file_info_get_is_hidden(info.get()))
+			continue;
+		switch (g_file_info_get_file_type(info.get()))
+		{case G_FILE_TYPE_REGULAR:
+			if (ET_File_Description::Get(g_file_info_get_name(info.get()))->IsSupported())
+			{	gObject<GFile> child(g_file_enumerator_get_child(enumerator.get(), info.get()));
+				paths.emplace_back(g_file_get_path(child.get()));
+			}
+			break;
+		 case G_FILE_TYPE_DIRECTORY:
+			if (!NoRecursive)
+			{	gObject<GFile> child(g_file_enumerator_get_child(enumerator.get(), info.get()));
+				Enumerate(child.get(), paths);
+			}
+		 default:;
+		}
+	}
+	if (error)
+	{	gString path(g_file_get_path(dir));
+		Log_Print(LOG_ERROR, _("Error opening directory ‘%s’: %s"), path.get(), error->message);
+		g_error_free(error);
+		++Errors;
+	}
+}
+
+/// Apply --fill and --set to a file.
+static void ProcessTag(ET_File* file)
+{	File_Tag* tag = FillMask ? et_fill_tag_with_mask(file, FillMask) : nullptr;
+	if (FieldValues.size())
+	{	if (!tag)
+			tag = new File_Tag(*file->FileTagNew());
+		for (const auto& fv : FieldValues)
+			(tag->*fv.first).assignNFC(fv.second);
+	}
+	if (tag)
+		file->apply_changes(nullptr, tag);
+}
+
+#ifdef ENABLE_REPLAYGAIN
+/// Calculate track and album gain like ReplayGain_For_Selected_Files.
+static void ProcessReplayGain(vector<xPtr<ET_File>> files)
+{
+	ReplayGainAnalyzer analyzer((EtReplayGainModel)g_settings_get_enum(MainSettings, "replaygain-model"));
+
+	gint (*album_comparer)(const ET_File *ETFile1, const ET_File *ETFile2) = nullptr;
+	unsigned compare_level = 1;
+	switch ((EtReplayGainGroupBy)g_settings_get_enum(MainSettings, "replaygain-groupby"))
+	{	EtSortMode mode;
+	case ET_REPLAYGAIN_GROUPBY_DISC:
+		compare_level = 2;
+	case ET_REPLAYGAIN_GROUPBY_ALBUM:
+		mode = ET_SORT_MODE_ALBUM;
+		goto sort;
+	case ET_REPLAYGAIN_GROUPBY_FILEPATH:
+		mode = ET_SORT_MODE_FILEPATH;
+	sort:
+		album_comparer = ET_File::get_comp_func(mode, FALSE);
+	default:;
+	}
+	if (album_comparer)
+		sort(files.begin(), files.end(),
+			[comp = album_comparer](const xPtr<ET_File>& l, const xPtr<ET_File>& r){ return comp(l, r) < 0; });
+
+	// analyze tracks in parallel
+	vector<unique_ptr<ReplayGainAnalyzer::Result>> results(files.size());
+	atomic<size_t> done(0);
+	ForEachParallel(files.size(), [&](size_t i)
+	{	ReplayGainAnalyzer track_analyzer(analyzer.Model);
+		string err = track_analyzer.AnalyzeFile(files[i]->FilePath);
+		if (err.empty())
+		{	results[i] = track_analyzer.TakeLastResult();
+			Progress("replaygain", ++done, files.size(), files[i].get(),
+				strprintf("%.1f dB, peak %.2f", results[i]->Gain(), results[i]->Peak()).c_str());
+		} else
+		{	++Errors;
+			Progress("error", ++done, files.size(), files[i].get(), err.c_str());
+		}
+	});
+
+	// aggregate album results strictly in order
+	auto first = files.begin();
+	bool error = false;
+	auto finish_album = [&](vector<xPtr<ET_File>>::iterator last)
+	{	if (last - first < 2) // album gain requires at least 2 files
+			return;
+		if (error)
+			return Log_Print(LOG_WARNING, _("Skip album gain because of previous errors."));
+		float album_gain = analyzer.GetAggregatedResult().Gain();
+		float album_peak = analyzer.GetAggregatedResult().Peak();
+		for (auto cur = first; cur != last; ++cur)
+		{	File_Tag* file_tag = new File_Tag(*(*cur)->FileTagNew());
+			file_tag->album_gain = album_gain;
+			file_tag->album_peak = album_peak;
+			(*cur)->apply_changes(nullptr, file_tag);
+		}
+		Log_Print(LOG_OK, _("ReplayGain of album is %.1f dB, peak %.2f"), album_gain, album_peak);
+	};
+
+	for (auto cur = first; cur != files.end(); ++cur)
+	{	ET_File* file = cur->get();
+		if (album_comparer && first != cur && (unsigned)(abs(album_comparer(*first, file)) - 1) < compare_level)
+		{	finish_album(cur);
+			analyzer.Reset();
+			error = false;
+			first = cur;
+		}
+
+		const auto& result = results[cur - files.begin()];
+		if (!result)
+		{	error = true;
+			continue;
+		}
+		analyzer.Aggregate(*result);
+
+		File_Tag* file_tag = new File_Tag(*file->FileTagNew());
+		file_tag->track_gain = result->Gain();
+		if (result->Peak() > ReplayGainAnalyzer::MaxPeak)
+			Log_Print(LOG_WARNING, _("Rejecting unreasonable large peak value %.1f. Possibly corrupted file '%s'."),
+				result->Peak(), file->FileNameCur()->full_name().get());
+		else
+			file_tag->track_peak = result->Peak();
+		file->apply_changes(nullptr, file_tag);
+	}
+	finish_album(files.end());
+}
+#endif
+
+/// Process all files of a root directory or a single file.
+static void ProcessRoot(const gchar* arg)
+{
+	gObject<GFile> gfile(g_file_new_for_commandline_arg(arg));
+	gString root(g_file_get_path(gfile.get()));
+	vector<gString> paths;
+
+	switch (g_file_query_file_type(gfile.get(), G_FILE_QUERY_INFO_NONE, nullptr))
+	{case G_FILE_TYPE_DIRECTORY:
+		Enumerate(gfile.get(), paths);
+		sort(paths.begin(), paths.end(), [](const gString& l, const gString& r) { return strcmp(l, r) < 0; });
+		break;
+	 case G_FILE_TYPE_REGULAR:
+		if (ET_File_Description::Get(root)->IsSupported())
+		{	paths.emplace_back(move(root));
+			root = gString(g_path_get_dirname(paths.front()));
+			break;
+		}
+	 default:
+		Log_Print(LOG_ERROR, _("Cannot open path ‘%s’"), arg);
+		++Errors;
+		return;
+	}
+
+	// read files
+	unique_ptr<const ET_FileCache> cache(g_settings_get_boolean(MainSettings, "scan-cache") ? new ET_FileCache(root) : nullptr);
+	vector<xPtr<ET_File>> files(paths.size());
+	atomic<size_t> done(0);
+	ForEachParallel(paths.size(), [&](size_t i)
+	{	ET_File* file = new ET_File(move(paths[i]));
+		files[i] = file;
+		GError* error = nullptr;
+		gObject<GFile> child(g_file_new_for_path(file->FilePath));
+		if (file->read_file(child.get(), root, &error, cache.get()))
+			Progress("read", ++done, files.size(), file);
+		else
+		{	++Errors;
+			Progress("error", ++done, files.size(), file, error ? error->message : nullptr);
+		}
+		if (error)
+			g_error_free(error);
+	});
+	files.erase(remove_if(files.begin(), files.end(), [](const xPtr<ET_File>& file) { return file->read_failed(); }), files.end());
+
+	// modify tags
+	for (ET_File* file : files)
+	{	if (file->autofix())
+			Log_Print(LOG_INFO, _("Automatic corrections applied for file ‘%s’"), file->FileNameNew()->full_name().get());
+		ProcessTag(file);
+	}
+#ifdef ENABLE_REPLAYGAIN
+	if (ReplayGain)
+		ProcessReplayGain(files);
+#endif
+
+	// save
+	vector<ET_File*> changed;
+	for (ET_File* file : files)
+	{	if (Force)
+			file->force_tag_save();
+		if (!file->is_filetag_saved())
+			changed.push_back(file);
+	}
+	if (DryRun)
+		for (size_t i = 0; i < changed.size(); ++i)
+			Progress("changed", i + 1, changed.size(), changed[i]);
+	else
+	{	vector<ET_File::Stat> stats(changed.size());
+		unique_ptr<gboolean[]> written(new gboolean[changed.size()]);
+		done = 0;
+		ForEachParallel(changed.size(), [&](size_t i)
+		{	GError* error = nullptr;
+			written[i] = changed[i]->write_file_tag(stats[i], &error);
+			if (written[i])
+				Progress("saved", ++done, changed.size(), changed[i]);
+			else
+			{	++Errors;
+				Progress("error", ++done, changed.size(), changed[i], error->message);
+				g_error_free(error);
+			}
+		});
+		for (size_t i = 0; i < changed.size(); ++i)
+			changed[i]->file_tag_written(stats[i], written[i]);
+
+		if (cache && (changed.size() || cache->modified(files.size())))
+			ET_FileCache::store(root, files);
+	}
+
+	ET_File::reset_undo_history();
+}
+
+int et_batch_run(int argc, char* argv[])
+{
+	GOptionContext* context = g_option_context_new(_("PATH… - Tag audio files without user interface"));
+	g_option_context_add_main_entries(context, Options, GETTEXT_PACKAGE);
+	GError* error = nullptr;
+	gboolean ok = g_option_context_parse(context, &argc, &argv, &error);
+	g_option_context_free(context);
+	if (!ok)
+	{	g_printerr("%s\n", error->message);
+		g_error_free(error);
+		return 2;
+	}
+	if (!Roots || !*Roots)
+	{	g_printerr("%s\n", _("No path given"));
+		return 2;
+	}
+	if (FillMask)
+	{	string err = et_check_mask(FillMask);
+		if (!err.empty())
+		{	g_printerr("%s: %s\n", FillMask, err.c_str());
+			return 2;
+		}
+	}
+	if (Assignments)
+		for (const gchar* const* a = Assignments; *a; ++a)
+		{	const gchar* code = *a;
+			if (*code == '%')
+				++code;
+			xStringD0 File_Tag::*field = code[0] && code[1] == '=' ? et_mask_field(code[0]) : nullptr;
+			if (!field)
+			{	g_printerr(_("Invalid field assignment ‘%s’\n"), *a);
+				return 2;
+			}
+			FieldValues.emplace_back(field, code + 2);
+		}
+
+	// no window => log messages go to stderr
+	MainThreadId = this_thread::get_id();
+	Init_Config_Variables();
+	File_Tag::init(MainSettings);
+	NumThreads = Threads > 0 ? Threads : max(g_settings_get_uint(MainSettings, "background-threads"), 1U);
+
+	for (const gchar* const* root = Roots; *root; ++root)
+		ProcessRoot(*root);
+
+	// The cache is written in the background.
+	ET_FileCache::wait();
+
+	g_strfreev(Roots);
+	g_strfreev(Assignments);
+	g_free(FillMask);
+	return Errors ? 1 : 0;
+}
@@ -0,0 +1,36 @@
+/* EasyTAG - tag editor for audio files
+ * Copyright (C) 2026  Marcel Müller <github@maazl.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef ET_BATCH_H_
+#define ET_BATCH_H_
+
+/// Command line option that selects the batch mode.
+#define ET_BATCH_OPTION "--batch"
+
+/// Process files without user interface.
+/// @details Loads the files below each root given on the command line,
+/// optionally fills tag fields from the file name by a scanner mask,
+/// assigns tag fields and calculates ReplayGain, and saves the changed tags.
+/// Progress is written to stdout, one tab separated line per file and step,
+/// messages of the log go to stderr.
+/// @param argc
+/// @param argv The first argument must be \ref ET_BATCH_OPTION.
+/// @return Exit status: 0 = success, 1 = some files failed, 2 = invalid arguments.
+int et_batch_run(int argc, char* argv[]);
+
+#endif /* ET_BATCH_H_ */
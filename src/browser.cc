@@ -38,6 +38,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#ifndef G_OS_WIN32
+#include <sys/stat.h>
+#endif
 
 #include "application_window.h"
 #include "charset.h"
@@ -55,8 +58,12 @@
 
 #include <functional>
 #include <deque>
+#include <unordered_set>
+#include <unordered_map>
+#include <string>
 #include <vector>
 #include <algorithm>
+#include <numeric>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
@@ -341,9 +348,29 @@ private: // state - synchronized access only!
 	mutex Sync;
 	condition_variable Cond;
 
+#ifndef G_OS_WIN32
+	/// Result of a sub directory check, valid as long as the directory is unchanged.
+	struct SubDirCheck
+	{	time_t MTime;
+		off_t Size;
+		nlink_t NLink;
+		bool ShowHidden;
+		bool HasSubDir;
+		bool Matches(const struct stat& st, bool show_hidden) const
+		{	return MTime == st.st_mtime && Size == st.st_size && NLink == st.st_nlink && ShowHidden == show_hidden; }
+	};
+	/// Results of HasSubDir by path.
+	unordered_map<string, SubDirCheck> SubDirCache;
+	/// Synchronize access to SubDirCache.
+	mutex SubDirCacheSync;
+#endif
+
 private: // Worker thread functions
 	/// Move the enumerator to the next matching directory.
 	GFileInfo* NextDir(GFileEnumerator* en);
+	/// Check whether a directory has at least one matching sub directory.
+	/// @param path Directory in file system encoding.
+	bool HasSubDir(const gchar* path);
 
 	/// Send \ref UpdateChildren to the UI thread.
 	/// @param item Work item where the update belongs to.
@@ -470,6 +497,47 @@ GFileInfo* ExpandDirectoryWorker::NextDir(GFileEnumerator* en)
 	}
 }
 
+bool ExpandDirectoryWorker::HasSubDir(const gchar* path)
+#ifndef G_OS_WIN32
+{	struct stat st;
+	if (stat(path, &st) != 0)
+		return false;
+	// Each sub directory adds a link to its parent by "..".
+	// The reverse is not true: Btrfs always reports 1 and links to directories do not count.
+	if (ShowHidden && st.st_nlink > 2)
+		return true;
+
+	string key(path);
+	{	lock_guard<mutex> lock(SubDirCacheSync);
+		auto it = SubDirCache.find(key);
+		if (it != SubDirCache.end() && it->second.Matches(st, ShowHidden))
+			return it->second.HasSubDir;
+	}
+
+	// Stop at the first match and use d_type rather than a stat call for each entry.
+	bool found = false;
+	LocalDirReader dir(path);
+	GFileType type;
+	const gchar* name;
+	while ((name = dir.next(type)))
+		if ((ShowHidden || !LocalDirReader::is_hidden(name))
+			&& (type == G_FILE_TYPE_DIRECTORY || (type == G_FILE_TYPE_UNKNOWN && dir.type_of(name) == G_FILE_TYPE_DIRECTORY)))
+		{	found = true;
+			break;
+		}
+
+	lock_guard<mutex> lock(SubDirCacheSync);
+	SubDirCache[move(key)] = SubDirCheck{ st.st_mtime, st.st_size, st.st_nlink, ShowHidden, found };
+	return found;
+}
+#else
+{	gObject<GFileEnumerator> en(g_file_enumerate_children(gObject<GFile>(g_file_new_for_path(path)).get(),
+		ShowHidden ? G_FILE_ATTRIBUTE_STANDARD_TYPE : G_FILE_ATTRIBUTE_STANDARD_TYPE "," G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN,
+		G_FILE_QUERY_INFO_NONE, NULL, NULL));
+	return gObject<GFileInfo>(NextDir(en.get())).get() != nullptr;
+}
+#endif
+
 bool ExpandDirectoryWorker::SendPacket(Entry* item)
 {	logworker("SendPacket(%p{{%p}, %s, %i, %zu})\n", item, item->Iter.user_data, item->FullPath.get(), item->Operation, item->Nodes.size());
 	sort(item->Nodes.begin(), item->Nodes.end(), [](const Node& l, const Node& r) { return l.DisplayName.compare(r.DisplayName) < 0; });
@@ -531,14 +599,22 @@ void ExpandDirectoryWorker::ItemWorker()
 		}
 		logworker("Item %p{{%i, %p}, %s, %u}\n", item, item->Iter.stamp, item->Iter.user_data, item->FullPath.get(), item->Operation);
 
+		if (item->Operation == SUBDIRCHECK)
+		{	if (HasSubDir(item->FullPath))
+			{	// found subdir => add dummy node
+				item->Nodes.reserve(1);
+				item->Nodes.emplace_back(Loading, nullptr, nullptr);
+				SendPacket(item);
+				item = nullptr;
+			}
+			// else no sub dirs found => discard item
+			continue;
+		}
+
 		// create enumerator
-		const char* attr = item->Operation == SUBDIRCHECK
-			? (ShowHidden
-				? G_FILE_ATTRIBUTE_STANDARD_TYPE
-				: G_FILE_ATTRIBUTE_STANDARD_TYPE "," G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN)
-			: (ShowHidden
-				? G_FILE_ATTRIBUTE_STANDARD_TYPE "," G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME "," G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_ACCESS_CAN_READ "," G_FILE_ATTRIBUTE_ACCESS_CAN_WRITE
-				: G_FILE_ATTRIBUTE_STANDARD_TYPE "," G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME "," G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_ACCESS_CAN_READ "," G_FILE_ATTRIBUTE_ACCESS_CAN_WRITE "," G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN);
+		const char* attr = ShowHidden
+			? G_FILE_ATTRIBUTE_STANDARD_TYPE "," G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME "," G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_ACCESS_CAN_READ "," G_FILE_ATTRIBUTE_ACCESS_CAN_WRITE
+			: G_FILE_ATTRIBUTE_STANDARD_TYPE "," G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME "," G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_ACCESS_CAN_READ "," G_FILE_ATTRIBUTE_ACCESS_CAN_WRITE "," G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN;
 		gObject<GFileEnumerator> en(g_file_enumerate_children(gObject<GFile>(g_file_new_for_path(item->FullPath)).get(), attr, G_FILE_QUERY_INFO_NONE, NULL, NULL));
 
 		// do the work
@@ -556,13 +632,6 @@ void ExpandDirectoryWorker::ItemWorker()
 					item = nullptr;
 				}
 				break;
-			} else if (item->Operation == SUBDIRCHECK)
-			{	// found subdir => add dummy node
-				item->Nodes.reserve(1);
-				item->Nodes.emplace_back(Loading, nullptr, nullptr);
-				SendPacket(item);
-				item = nullptr;
-				break;
 			} else if (item->Operation)
 			{	// add subdir
 				gboolean can_read = g_file_info_get_attribute_boolean(childinfo.get(), G_FILE_ATTRIBUTE_ACCESS_CAN_READ);
@@ -1216,7 +1285,7 @@ vector<ET_File*> EtBrowser::get_all_files()
 		[](GtkTreeModel* model, GtkTreePath* path, GtkTreeIter* iter, gpointer data)
 		{	ET_File* etfile;
 			gtk_tree_model_get(model, iter, LIST_FILE_POINTER, &etfile, -1);
-			((vector<xPtr<ET_File>>*)data)->emplace_back(etfile);
+			((vector<ET_File*>*)data)->emplace_back(etfile);
 			return FALSE;
 		}, &files);
 
@@ -1232,6 +1301,12 @@ void EtBrowser::reload_directory()
 
 	if (priv->directory_view && priv->current_path != NULL)
 	{
+		// Only read new or changed files if the directory is already loaded.
+		if (!ET_FileList::empty())
+		{	Reload_Directory(gString(g_strdup(priv->current_path_name)));
+			return;
+		}
+
 		/* Unselect files, to automatically reload the file of the directory. */
 		gtk_tree_selection_unselect_all(gtk_tree_view_get_selection(GTK_TREE_VIEW(priv->directory_view)));
 
@@ -1662,19 +1737,45 @@ static void set_zebra(GtkTreeModel* model)
 	GtkTreeIter iter;
 	if (!gtk_tree_model_get_iter_first(model, &iter))
 		return;
-	ET_File* last = nullptr;
-	auto cmp = ET_File::get_comp_func(
-		(EtSortMode)g_settings_get_enum(MainSettings, "sort-order"),
-		g_settings_get_boolean(MainSettings, "sort-descending"));
+	const ET_File::SortKey* last = nullptr;
+	EtSortMode mode = (EtSortMode)g_settings_get_enum(MainSettings, "sort-order");
 	bool activate_bg_color = false;
 	do
 	{	ET_File *file;
 		gtk_tree_model_get(model, &iter, LIST_FILE_POINTER, &file, -1);
-		file->activate_bg_color = activate_bg_color ^= last && abs(cmp(last, file)) == 1;
-		last = file;
+		const ET_File::SortKey& key = file->sort_key(mode);
+		file->activate_bg_color = activate_bg_color ^= last && abs(last->compare(key)) == 1;
+		last = &key;
 	} while (gtk_tree_model_iter_next(model, &iter));
 }
 
+/**
+ * Get the order of files according to the current sort order.
+ * @return Permutation of indices into \a files.
+ * @remarks The comparison uses the cached sort keys of the files,
+ * so only keys of changed files are calculated again.
+ */
+static vector<gint> get_sort_order(const vector<ET_File*>& files)
+{
+	EtSortMode mode = (EtSortMode)g_settings_get_enum(MainSettings, "sort-order");
+	bool desc = g_settings_get_boolean(MainSettings, "sort-descending");
+	if (ET_File::needs_tag(mode))
+		Read_Pending_Tags();
+
+	vector<const ET_File::SortKey*> keys;
+	keys.reserve(files.size());
+	for (const ET_File* file : files)
+		keys.emplace_back(&file->sort_key(mode));
+
+	vector<gint> order(files.size());
+	iota(order.begin(), order.end(), 0);
+	stable_sort(order.begin(), order.end(), [&keys, desc](gint l, gint r)
+	{	gint c = keys[l]->compare(*keys[r]);
+		return desc ? c > 0 : c < 0;
+	});
+	return order;
+}
+
 /*
  * Loads the current visible range of ET_FileList into the browser list.
  */
@@ -1685,15 +1786,22 @@ void EtBrowser::load_file_list()
 	et_browser_clear_file_model(this);
 
 	auto range = ET_FileList::visible_range();
+	vector<ET_File*> files;
+	files.reserve(range.second - range.first);
+	for (auto i = range.first; i != range.second; ++i)
+		files.emplace_back(i->get());
+
 	ET_File* etfile_to_select = MainWindow->get_displayed_file();
 	bool selected = false;
 	GtkTreeIter selected_iter;
-	for (auto i = range.first; i != range.second; ++i)
+	// The model is not sorted by GTK, so insert the rows in the final order.
+	for (gint index : get_sort_order(files))
 	{
+		ET_File* file = files[index];
 		GtkTreeIter iter;
-		gtk_list_store_insert_with_values(priv->file_model, &iter, G_MAXINT, LIST_FILE_POINTER, xPtr<ET_File>::toCptr(*i), -1);
+		gtk_list_store_insert_with_values(priv->file_model, &iter, G_MAXINT, LIST_FILE_POINTER, xPtr<ET_File>::toCptr(file), -1);
 
-		if (etfile_to_select == i->get())
+		if (etfile_to_select == file)
 		{	selected_iter = iter;
 			selected = true;
 			// update header
@@ -1714,6 +1822,62 @@ void EtBrowser::load_file_list()
 	set_zebra(GTK_TREE_MODEL(priv->file_model));
 }
 
+void EtBrowser::append_files(unsigned first)
+{
+	EtBrowserPrivate* priv = et_browser_get_instance_private(this);
+	GtkTreeModel* model = GTK_TREE_MODEL(priv->file_model);
+
+	GVariant* variant = g_action_group_get_action_state(G_ACTION_GROUP(MainWindow), "file-artist-view");
+	bool file_mode = strcmp(g_variant_get_string(variant, NULL), "file") == 0;
+	g_variant_unref(variant);
+
+	gint rows = gtk_tree_model_iter_n_children(model, NULL);
+	if (!file_mode || rows == 0)
+	{	// Nothing to merge into, also selects the first file.
+		et_application_window_browser_update_display_mode(MainWindow);
+		return;
+	}
+
+	EtSortMode mode = (EtSortMode)g_settings_get_enum(MainSettings, "sort-order");
+	bool desc = g_settings_get_boolean(MainSettings, "sort-descending");
+
+	const auto& all = ET_FileList::all_files();
+	vector<ET_File*> files;
+	files.reserve(all.size() - first);
+	for (auto i = all.begin() + first; i != all.end(); ++i)
+		files.emplace_back(i->get());
+
+	// Insert the new files in order, each one behind all equal rows.
+	gint pos = 0;
+	for (gint index : get_sort_order(files))
+	{	ET_File* file = files[index];
+		const ET_File::SortKey& key = file->sort_key(mode);
+		gint end = rows;
+		while (pos < end)
+		{	gint mid = (pos + end) / 2;
+			GtkTreeIter iter;
+			gtk_tree_model_iter_nth_child(model, &iter, NULL, mid);
+			ET_File* row;
+			gtk_tree_model_get(model, &iter, LIST_FILE_POINTER, &row, -1);
+			gint c = row->sort_key(mode).compare(key);
+			if (desc ? c < 0 : c > 0)
+				end = mid;
+			else
+				pos = mid + 1;
+		}
+		gtk_list_store_insert_with_values(priv->file_model, NULL, pos++, LIST_FILE_POINTER, xPtr<ET_File>::toCptr(file), -1);
+		++rows;
+	}
+
+	set_zebra(model);
+}
+
+void EtBrowser::refresh_rows()
+{
+	EtBrowserPrivate* priv = et_browser_get_instance_private(this);
+	if (priv->file_view)
+		gtk_widget_queue_draw(GTK_WIDGET(priv->file_view));
+}
 
 /*
  * Update state of files in the list after changes (without clearing the list model!)
@@ -2242,23 +2406,6 @@ void EtBrowser::clear()
 	et_browser_clear_album_model(this);
 }
 
-/*
- * Intelligently sort the file list based on the current sorting method
- * see also 'ET_Sort_File_List'
- */
-static gint
-Browser_List_Sort_Func (GtkTreeModel *model, GtkTreeIter *a, GtkTreeIter *b,
-                        gpointer data)
-{
-    ET_File *ETFile1;
-    ET_File *ETFile2;
-
-    gtk_tree_model_get(model, a, LIST_FILE_POINTER, &ETFile1, -1);
-    gtk_tree_model_get(model, b, LIST_FILE_POINTER, &ETFile2, -1);
-
-    return ((gint (*)(const ET_File*, const ET_File*))data)(ETFile1, ETFile2);
-}
-
 /*
  * Refresh the list sorting (call me after sort-* has changed)
  */
@@ -2267,10 +2414,10 @@ et_browser_refresh_sort (EtBrowser *self)
 {
 	g_return_if_fail (ET_BROWSER (self));
 	EtBrowserPrivate* priv = et_browser_get_instance_private (self);
-	gtk_tree_sortable_set_sort_func(GTK_TREE_SORTABLE(priv->file_model), 0, Browser_List_Sort_Func,
-		(gpointer)ET_File::get_comp_func(
-			(EtSortMode)g_settings_get_enum(MainSettings, "sort-order"),
-			g_settings_get_boolean(MainSettings, "sort-descending")), NULL);
+
+	vector<ET_File*> files = self->get_all_files();
+	if (files.size() > 1)
+		gtk_list_store_reorder(priv->file_model, get_sort_order(files).data());
 
 	set_zebra(GTK_TREE_MODEL(priv->file_model));
 }
@@ -2329,6 +2476,32 @@ void EtBrowser::invert_selection()
 	et_application_window_update_actions(MainWindow);
 }
 
+void EtBrowser::select_files(const vector<xPtr<ET_File>>& files)
+{
+	EtBrowserPrivate* priv = et_browser_get_instance_private(this);
+	GtkTreeModel* model = GTK_TREE_MODEL(priv->file_model);
+
+	unordered_set<const ET_File*> lookup;
+	for (const ET_File* file : files)
+		lookup.insert(file);
+
+	GtkTreeSelection* selection = gtk_tree_view_get_selection(priv->file_view);
+	GtkTreeIter iter;
+	if (lookup.size() && gtk_tree_model_get_iter_first(model, &iter))
+	{	// Must block the select signal to avoid displaying the files one by one.
+		g_signal_handler_block(selection, priv->file_selected_handler);
+		do
+		{	const ET_File* file;
+			gtk_tree_model_get(model, &iter, LIST_FILE_POINTER, &file, -1);
+			if (lookup.count(file))
+				gtk_tree_selection_select_iter(selection, &iter);
+		} while (gtk_tree_model_iter_next(model, &iter));
+		g_signal_handler_unblock(selection, priv->file_selected_handler);
+	}
+
+	et_application_window_update_actions(MainWindow);
+}
+
 pair<ET_File*, ET_File*> EtBrowser::prev_next_if(ET_File* file, bool (*predicate)(const ET_File*))
 {	pair<ET_File*, ET_File*> result(nullptr, nullptr);
 	if (!file) return result;
@@ -3089,6 +3262,12 @@ static void set_cell_data(GtkTreeViewColumn* column, GtkCellRenderer* cell, GtkT
 	const ET_File *file;
 	gtk_tree_model_get(model, iter, LIST_FILE_POINTER, &file, -1);
 	auto renderer = (const FileColumnRenderer*)data;
+	if (file->tag_pending() && ET_File::needs_tag(renderer->Column))
+	{	// Show the row immediately, the tag follows in the background.
+		Request_Tag(file);
+		FileColumnRenderer::SetText(GTK_CELL_RENDERER_TEXT(cell), "", file->activate_bg_color, FileColumnRenderer::NORMAL);
+		return;
+	}
 	string text = renderer->RenderText(file);
 	bool saved = file->is_saved();
 	bool changed = !saved
@@ -3205,8 +3384,6 @@ static void et_browser_init(EtBrowser *self)
 
     g_signal_connect_swapped(MainSettings, "changed::sort-order", G_CALLBACK(on_sort_order_changed), self);
     priv->file_sort_descending_handler = g_signal_connect_swapped(MainSettings, "changed::sort-descending", G_CALLBACK(on_sort_order_changed), self);
-    // To sort list
-    gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (priv->file_model), 0, GTK_SORT_ASCENDING);
     on_sort_order_changed(self, "sort-order", MainSettings);
 
     priv->file_selected_handler = g_signal_connect_swapped (gtk_tree_view_get_selection (priv->file_view),
@@ -48,6 +48,13 @@ private:
 
 public:
 	void load_file_list();
+	/// Show files that have just been appended to ET_FileList.
+	/// @param first Index of the first new file in ET_FileList.
+	/// @details In file mode the new rows are merged into the current sort order
+	/// without touching the existing rows, otherwise the view is reloaded.
+	void append_files(unsigned first);
+	/// Redraw the rows of the file list, e.g. after deferred tags have been read.
+	void refresh_rows();
 	void clear();
 
 	bool has_prev();
@@ -115,6 +122,8 @@ public:
 	void select_all();
 	void unselect_all();
 	void invert_selection();
+	/// Add the rows of some files to the selection, files that are not visible are ignored.
+	void select_files(const std::vector<xPtr<ET_File>>& files);
 
 	void collapse();
 
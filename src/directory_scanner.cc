@@ -0,0 +1,442 @@
+/* EasyTAG - tag editor for audio files
+ * Copyright (C) 2026  Marcel Müller <github@maazl.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "config.h"
+
+#include "directory_scanner.h"
+
+#include <unistd.h>
+#include <sys/types.h>
+#ifndef G_OS_WIN32
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
+
+#include "easytag.h"
+#include "file.h"
+#include "file_description.h"
+#include "picture.h"
+#include "setting.h"
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+using namespace std;
+
+
+DirectoryScanner::DirectoryScanner(gString&& path, unique_ptr<const ReloadState> reload)
+:	Recursive(g_settings_get_boolean(MainSettings, "browse-subdir"))
+,	BrowseHidden(g_settings_get_boolean(MainSettings, "browse-show-hidden"))
+,	NumWorkers(max(g_settings_get_uint(MainSettings, "background-threads"), 1U))
+,	Incremental(g_settings_get_boolean(MainSettings, "scan-incremental"))
+,	DeferTags(g_settings_get_boolean(MainSettings, "scan-defer-tags"))
+,	SniffType(g_settings_get_boolean(MainSettings, "scan-sniff-type"))
+,	IoSchedule(!DeferTags && g_settings_get_boolean(MainSettings, "scan-io-schedule"))
+,	WatchFiles(g_settings_get_boolean(MainSettings, "watch-files"))
+,	RootPath(move(path))
+,	Cache(g_settings_get_boolean(MainSettings, "scan-cache") ? new ET_FileCache(RootPath) : nullptr)
+,	Reload(move(reload))
+,	FilesTotal(0)
+,	Pending(0)
+,	Idle(0)
+{	Queues.reserve(NumWorkers);
+	for (size_t i = 0; i < NumWorkers; ++i)
+		Queues.emplace_back(new WorkerQueue());
+	// kick off root dir worker
+	Push(0, Job{ gObject<GFile>(g_file_new_for_path(RootPath)), true });
+}
+
+void DirectoryScanner::StartWorkers()
+{	// from here continue in background threads
+	Worker.reserve(NumWorkers);
+	for (size_t i = 0; i < NumWorkers; ++i)
+		Worker.emplace_back(&DirectoryScanner::ItemWorker, ref(*this), i);
+}
+
+DirectoryScanner::~DirectoryScanner()
+{	for (auto& w : Worker)
+		if (w.joinable())
+			w.join();
+}
+
+ET_FileList::list_type DirectoryScanner::TakeResults()
+{	ET_FileList::list_type results;
+	for (auto& q : Queues)
+	{	if (results.empty())
+			results.swap(q->Results);
+		else
+			results.insert(results.end(), make_move_iterator(q->Results.begin()), make_move_iterator(q->Results.end()));
+		q->Results.clear();
+	}
+	return results;
+}
+
+void DirectoryScanner::Push(size_t self, Job&& job)
+{	++Pending;
+	WorkerQueue& queue = *Queues[self];
+	if (IoSchedule && !job.IsDir)
+	{	queue.Batch.emplace_back(move(job));
+		return;
+	}
+	{	lock_guard<mutex> lock(queue.Sync);
+		if (job.IsDir)
+			queue.Jobs.emplace_front(move(job));
+		else
+			queue.Jobs.emplace_back(move(job));
+		queue.MaxDepth = max(queue.MaxDepth, queue.Jobs.size());
+	}
+	WakeIdle();
+}
+
+void DirectoryScanner::QueueBatch(WorkerQueue& queue)
+{	// The inode order is a cheap approximation of the physical order.
+	sort(queue.Batch.begin(), queue.Batch.end(), [](const Job& l, const Job& r)
+		{	return l.Device != r.Device ? l.Device < r.Device : l.Inode < r.Inode; });
+	queue.Jobs.insert(queue.Jobs.end(), make_move_iterator(queue.Batch.begin()), make_move_iterator(queue.Batch.end()));
+	queue.Batch.clear();
+	queue.MaxDepth = max(queue.MaxDepth, queue.Jobs.size());
+}
+
+void DirectoryScanner::WakeIdle()
+{	// wake up an idle worker to steal the job
+	if (Idle)
+	{	lock_guard<mutex> lock(IdleSync);
+		++IdleGeneration;
+		IdleCond.notify_one();
+	}
+}
+
+bool DirectoryScanner::Fetch(size_t self, Job& job)
+{	WorkerQueue& queue = *Queues[self];
+	while (true)
+	{	// local queue first
+		{	unique_lock<mutex> lock(queue.Sync);
+			// Directories first to complete the batch of files.
+			bool batch = queue.Batch.size() && (queue.Jobs.empty() || !queue.Jobs.front().IsDir);
+			if (batch)
+				QueueBatch(queue);
+			if (queue.Jobs.size())
+			{	job = move(queue.Jobs.front());
+				queue.Jobs.pop_front();
+				lock.unlock();
+				if (batch)
+					WakeIdle();
+				return true;
+			}
+		}
+		// steal from the end of the other queues
+		for (size_t i = 1; i < NumWorkers; ++i)
+		{	WorkerQueue& victim = *Queues[(self + i) % NumWorkers];
+			lock_guard<mutex> lock(victim.Sync);
+			if (victim.Jobs.size())
+			{	job = move(victim.Jobs.back());
+				victim.Jobs.pop_back();
+				++queue.Steals;
+				return true;
+			}
+		}
+		// wait for new jobs
+		unique_lock<mutex> lock(IdleSync);
+		if (!Pending)
+			return false;
+		++Idle;
+		// Check again after registration, Push might have missed us.
+		bool found = false;
+		for (auto& q : Queues)
+		{	lock_guard<mutex> qlock(q->Sync);
+			if ((found = q->Jobs.size() != 0))
+				break;
+		}
+		if (!found)
+		{	unsigned generation = IdleGeneration;
+			IdleCond.wait(lock, [this, generation]() { return IdleGeneration != generation || !Pending; });
+		}
+		--Idle;
+	}
+}
+
+void DirectoryScanner::AcquireDevice(guint64 device)
+{	unique_lock<mutex> lock(DeviceSync);
+	unsigned& readers = DeviceReaders[device];
+	DeviceCond.wait(lock, [&readers]() { return readers < ReadersPerDevice; });
+	++readers;
+}
+
+void DirectoryScanner::ReleaseDevice(guint64 device)
+{	{	lock_guard<mutex> lock(DeviceSync);
+		--DeviceReaders[device];
+	}
+	DeviceCond.notify_all();
+}
+
+void DirectoryScanner::Completed()
+{	if (--Pending)
+		return;
+	// Last job done => wake up all idle workers to terminate.
+	{	lock_guard<mutex> lock(IdleSync);
+		IdleCond.notify_all();
+	}
+	gIdleAdd(new function<void()>([this]() { OnFinished(); }));
+	EtPicture::GarbageCollector(); // release orphaned images
+	xStringD::garbage_collector(); // ... and strings
+}
+
+void DirectoryScanner::DirScan(size_t self, gObject<GFileEnumerator> dir_enumerator)
+{
+	GError *error = NULL;
+	gObject<GFileInfo> info;
+
+	while ((info = gObject<GFileInfo>(g_file_enumerator_next_file(dir_enumerator.get(), NULL, &error))))
+	{
+		if (Main_Stop_Button_Pressed)
+			return;
+
+		/* Hidden directory like '.mydir' will also be browsed if allowed. */
+		if (!BrowseHidden && g_file_info_get_is_hidden(info.get()))
+			continue;
+
+		const char *file_name = g_file_info_get_name(info.get());
+		GFileType type = g_file_info_get_file_type(info.get());
+		switch (type)
+		{case G_FILE_TYPE_REGULAR:
+			if (ET_File_Description::Get(file_name)->IsSupported())
+				break;
+			continue;
+		 case G_FILE_TYPE_DIRECTORY:
+			if (Recursive)
+				break;
+		 default:
+			continue;
+		}
+
+		GFile* file = g_file_enumerator_get_child(dir_enumerator.get(), info.get());
+		if (type == G_FILE_TYPE_REGULAR)
+			++FilesTotal;
+		// The unix attributes are only queried if IoSchedule and might be unavailable, i.e. 0.
+		Push(self, Job{ gObject<GFile>(file), type == G_FILE_TYPE_DIRECTORY,
+			g_file_info_get_attribute_uint64(info.get(), G_FILE_ATTRIBUTE_UNIX_INODE),
+			g_file_info_get_attribute_uint32(info.get(), G_FILE_ATTRIBUTE_UNIX_DEVICE) });
+	}
+
+	if (error)
+	{	gObject<GFile> child_dir(G_FILE(g_object_ref(g_file_enumerator_get_container(dir_enumerator.get()))));
+		gIdleAdd(new function<void()>([this, child_dir = move(child_dir), msg = xString(error->message)]()
+			{	OnDirCompleted(child_dir.get(), msg); }));
+		g_error_free(error);
+	}
+}
+
+#ifndef G_OS_WIN32
+void DirectoryScanner::LocalDirScan(size_t self, const gchar* path, LocalDirReader& dir)
+{	const guint64 device = IoSchedule ? dir.device() : 0;
+	GFileType type;
+	const gchar* file_name;
+	while ((file_name = dir.next(type)))
+	{
+		if (Main_Stop_Button_Pressed)
+			return;
+
+		if (!BrowseHidden && LocalDirReader::is_hidden(file_name))
+			continue;
+
+		// Check the extension before any further system call.
+		if (type != G_FILE_TYPE_DIRECTORY && !ET_File_Description::Get(file_name)->IsSupported())
+		{	if (type != G_FILE_TYPE_UNKNOWN || !Recursive)
+				continue;
+			// Might be a link to a directory.
+			if (dir.type_of(file_name) != G_FILE_TYPE_DIRECTORY)
+				continue;
+			type = G_FILE_TYPE_DIRECTORY;
+		}
+		if (type == G_FILE_TYPE_UNKNOWN)
+			type = dir.type_of(file_name);
+		switch (type)
+		{case G_FILE_TYPE_REGULAR:
+			++FilesTotal;
+			break;
+		 case G_FILE_TYPE_DIRECTORY:
+			if (Recursive)
+				break;
+		 default:
+			continue;
+		}
+
+		gString child_path(g_build_filename(path, file_name, NULL));
+		Push(self, Job{ gObject<GFile>(g_file_new_for_path(child_path)), type == G_FILE_TYPE_DIRECTORY, dir.inode(), device });
+	}
+
+	if (dir.error())
+		gIdleAdd(new function<void()>([this, child_dir = gObject<GFile>(g_file_new_for_path(path)), msg = xString(g_strerror(dir.error()))]()
+			{	OnDirCompleted(child_dir.get(), msg); }));
+}
+#endif
+
+/// Open a file and ask the system to read the regions in advance where tags usually reside,
+/// i.e. the start and the end of the file.
+/// @return File to hand over to the reader or \c nullptr if read-ahead is not supported.
+static unique_ptr<ET_FileHead> PrefetchTagRegions(const gchar* path)
+{
+#ifdef POSIX_FADV_WILLNEED
+	constexpr off_t head = 128 * 1024; // header, ID3v2, Vorbis comments ...
+	constexpr off_t tail = 16 * 1024; // ID3v1, APE, Lyrics3 ...
+	unique_ptr<ET_FileHead> file(new ET_FileHead());
+	if (!file->open(path))
+		return nullptr;
+	struct stat st;
+	if (fstat(file->Fd, &st) == 0)
+	{	posix_fadvise(file->Fd, 0, head, POSIX_FADV_WILLNEED);
+		if (st.st_size > head)
+			posix_fadvise(file->Fd, max(st.st_size - tail, head), 0, POSIX_FADV_WILLNEED);
+	}
+	return file;
+#else
+	return nullptr;
+#endif
+}
+
+void DirectoryScanner::Prefetch(size_t self)
+{	WorkerQueue& queue = *Queues[self];
+	// Directories are at the front, so the n-th file job is searched.
+	for (size_t n = 0; n < PrefetchDistance; ++n)
+	{	gObject<GFile> file;
+		{	lock_guard<mutex> lock(queue.Sync);
+			size_t files = 0;
+			for (const Job& job : queue.Jobs)
+				if (!job.IsDir && files++ == n)
+				{	if (!job.Head)
+						file = job.File;
+					break;
+				}
+			if (files <= n)
+				return; // queue exhausted
+		}
+		if (!file)
+			continue; // already done
+		gString path(g_file_get_path(file.get()));
+		// Files that are likely not read need no read-ahead.
+		if (!path || (Cache && Cache->contains(path)) || (Reload && Reload->Files.count(path.get())))
+			continue;
+		unique_ptr<ET_FileHead> head(PrefetchTagRegions(path));
+		if (!head)
+			return;
+		// Attach the descriptor unless the job has been taken in the meantime.
+		// It can only move to the front.
+		lock_guard<mutex> lock(queue.Sync);
+		size_t files = 0;
+		for (Job& job : queue.Jobs)
+			if (job.File.get() == file.get())
+			{	job.Head = move(head);
+				break;
+			} else if (!job.IsDir && files++ == n)
+				break;
+	}
+}
+
+void DirectoryScanner::ItemWorker(size_t self)
+{	WorkerQueue& queue = *Queues[self];
+	Job job;
+	while (Fetch(self, job))
+	{	// After cancellation just drain the queues.
+		if (Main_Stop_Button_Pressed)
+		{	Completed();
+			continue;
+		}
+		++queue.Executed;
+
+		GError *error = NULL;
+
+		if (!job.IsDir)
+		{	gString path(g_file_get_path(job.File.get()));
+			xPtr<ET_File> ETFile;
+			if (Reload && (ETFile = Reuse(path, job.File.get())))
+			{	queue.Results.emplace_back(ETFile);
+				OnFileCompleted(move(ETFile), xString(), true);
+			} else
+			{	// Devices of remote files are unknown, so they are not throttled.
+				bool throttle = IoSchedule && job.Device;
+				if (IoSchedule)
+					Prefetch(self);
+				if (throttle)
+					AcquireDevice(job.Device);
+
+				/* Get description of the file */
+				ETFile = xPtr<ET_File>(new ET_File(move(path)));
+
+				ETFile->read_file(job.File.get(), RootPath, &error, Cache.get(), DeferTags, SniffType, job.Head.get());
+				job.Head.reset();
+
+				if (throttle)
+					ReleaseDevice(job.Device);
+
+				/* Add the item to the "result list" */
+				queue.Results.emplace_back(ETFile);
+
+				OnFileCompleted(move(ETFile), xString(error ? error->message : nullptr));
+			}
+		} else
+		{	// Searching for files recursively.
+#ifndef G_OS_WIN32
+			gString path(g_file_is_native(job.File.get()) ? g_file_get_path(job.File.get()) : nullptr);
+			if (path)
+			{	LocalDirReader dir(path);
+				if (dir.is_open())
+				{	if (WatchFiles)
+						queue.Dirs.emplace_back(job.File);
+					LocalDirScan(self, path, dir);
+				} else
+					gIdleAdd(new function<void()>([this, child_dir = move(job.File), msg = xString(g_strerror(dir.error()))]()
+						{	OnDirCompleted(child_dir.get(), msg); }));
+			} else
+#endif
+			{	// Non-local directories through GIO.
+				gObject<GFileEnumerator> childdir_enumerator(g_file_enumerate_children(job.File.get(),
+					IoSchedule
+					?	G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_STANDARD_TYPE "," G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN ","
+						G_FILE_ATTRIBUTE_UNIX_INODE "," G_FILE_ATTRIBUTE_UNIX_DEVICE
+					:	G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_STANDARD_TYPE "," G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN,
+					G_FILE_QUERY_INFO_NONE, NULL, &error));
+				if (childdir_enumerator)
+				{	if (WatchFiles)
+						queue.Dirs.emplace_back(job.File);
+					DirScan(self, move(childdir_enumerator));
+				} else
+					gIdleAdd(new function<void()>([this, child_dir = move(job.File), msg = xString(error->message)]()
+						{	OnDirCompleted(child_dir.get(), msg); }));
+			}
+		}
+
+		if (error)
+			g_error_free(error);
+
+		Completed();
+	}
+}
+
+xPtr<ET_File> DirectoryScanner::Reuse(const gchar* path, GFile* file) const
+{	auto it = Reload->Files.find(path);
+	if (it == Reload->Files.end() || it->second->read_failed())
+		return nullptr;
+	// Never discard unsaved changes, saving checks for modifications anyway.
+	if (!it->second->is_saved())
+		return it->second;
+	ET_File::Stat stat;
+	if (!ET_File::query_fileinfo(file, stat)
+		|| stat.Size != it->second->FileSize || stat.ModificationTime != it->second->FileModificationTime)
+		return nullptr;
+	return it->second;
+}
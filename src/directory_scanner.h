@@ -0,0 +1,210 @@
+/* EasyTAG - tag editor for audio files
+ * Copyright (C) 2026  Marcel Müller <github@maazl.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef ET_DIRECTORY_SCANNER_H_
+#define ET_DIRECTORY_SCANNER_H_
+
+#include <gio/gio.h>
+
+#include "file_cache.h"
+#include "file_description.h"
+#include "file_list.h"
+#include "misc.h"
+#include "xptr.h"
+#include "xstring.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class ET_File;
+
+/// Background scan of a directory tree and reading of the audio files.
+/// @details Each worker thread owns a job queue. Directory enumeration feeds
+/// the local queue of the enumerating worker, so the common case needs no
+/// interaction between threads. A worker with an empty queue steals jobs
+/// from the end of the other queues, i.e. preferably file-read jobs.
+///
+/// This class has no UI. Derived classes receive the results
+/// by the virtual functions.
+class DirectoryScanner : public xObj
+{
+public:
+	/// State of the file list before an incremental reload.
+	struct ReloadState
+	{	/// Previous file list in its order, restored if the scan is aborted.
+		ET_FileList::list_type List;
+		/// Files of the previous scan by path.
+		std::unordered_map<std::string, xPtr<ET_File>> Files;
+		std::vector<xPtr<ET_File>> Selection;
+		xPtr<ET_File> Displayed;
+	};
+
+protected:
+	// captured settings
+	const bool Recursive;
+	const bool BrowseHidden;
+	const size_t NumWorkers;
+	/// Publish the files while the scan is in progress.
+	const bool Incremental;
+	/// Only stat the files and read the tags later by ReadTagWorker.
+	const bool DeferTags;
+	/// Verify the file type by the file content.
+	const bool SniffType;
+	/// Read files in disk order with read-ahead and limit concurrent reads per device.
+	/// Always off if DeferTags, because the scan reads no file content then.
+	/// The deferred tags are read later by ReadTagWorker in the order of the file list.
+	const bool IoSchedule;
+	/// Watch the scanned directories for changes by other programs when done.
+	const bool WatchFiles;
+
+	const gString RootPath;
+	/// Tag cache of the previous scan of RootPath, if enabled.
+	const std::unique_ptr<const ET_FileCache> Cache;
+	/// Only set for an incremental reload.
+	const std::unique_ptr<const ReloadState> Reload;
+
+	/// Directory or audio file to process.
+	struct Job
+	{	gObject<GFile> File;
+		bool IsDir;
+		/// Inode number for I/O scheduling, 0 if unknown.
+		guint64 Inode = 0;
+		/// Device for I/O scheduling, 0 if unknown.
+		guint64 Device = 0;
+		/// File opened in advance with read-ahead of the tag regions, only if IoSchedule.
+		/// The reader continues with this descriptor.
+		std::unique_ptr<ET_FileHead> Head;
+	};
+	/// Job queue and results of one worker thread.
+	struct WorkerQueue
+	{	/// Synchronize access to Jobs.
+		std::mutex Sync;
+		/// Directories at the front to get the total count ASAP, files at the back.
+		/// The owner takes jobs from the front, thieves from the back.
+		std::deque<Job> Jobs;
+		/// Files found by the owner, only if IoSchedule.
+		/// They are moved to Jobs in disk order when there are no more directories in Jobs.
+		/// So the order covers all files found in the meantime, not just one directory.
+		/// @remarks Only accessed by the owner.
+		std::vector<Job> Batch;
+		/// Files read by this worker, only accessed by the owner until the scan completed.
+		ET_FileList::list_type Results;
+		/// Directories scanned by this worker, only if WatchFiles.
+		std::vector<gObject<GFile>> Dirs;
+		// statistics for tuning
+		/// Number of jobs executed by the owner.
+		unsigned Executed = 0;
+		/// Number of jobs the owner has stolen from other queues.
+		unsigned Steals = 0;
+		/// Maximum number of jobs in the queue.
+		size_t MaxDepth = 0;
+	};
+	std::vector<std::unique_ptr<WorkerQueue>> Queues;
+
+	/// Number of audio files found so far.
+	std::atomic<int> FilesTotal;
+
+private:
+	/// worker threads
+	std::vector<std::thread> Worker;
+
+	/// Number of jobs queued or in progress.
+	/// The scan is complete when it drops to zero.
+	std::atomic<size_t> Pending;
+	/// Number of workers waiting for jobs.
+	std::atomic<unsigned> Idle;
+	/// Synchronize idle workers.
+	std::mutex IdleSync;
+	std::condition_variable IdleCond;
+	/// Incremented whenever idle workers are notified about new jobs.
+	unsigned IdleGeneration = 0;
+
+	/// Number of file reads in progress per device, only used if IoSchedule.
+	std::unordered_map<guint64, unsigned> DeviceReaders;
+	std::mutex DeviceSync;
+	std::condition_variable DeviceCond;
+	/// Maximum number of concurrent file reads per device if IoSchedule.
+	static constexpr unsigned ReadersPerDevice = 2;
+	/// Number of files in front of the local queue with read-ahead in progress if IoSchedule.
+	/// Enough to keep the device busy while the workers parse.
+	static constexpr size_t PrefetchDistance = 4;
+
+	/// Get the file of the previous scan if it is unchanged.
+	xPtr<ET_File> Reuse(const gchar* path, GFile* file) const;
+	/// Queue a new job in the local queue of a worker.
+	/// @remarks Files are collected in WorkerQueue::Batch if IoSchedule.
+	void Push(size_t self, Job&& job);
+	/// Move the files of WorkerQueue::Batch to the local queue in disk order.
+	/// @pre WorkerQueue::Sync must be locked.
+	void QueueBatch(WorkerQueue& queue);
+	/// Wake up idle workers to steal new jobs.
+	void WakeIdle();
+	/// Fetch the next job from the local queue or steal one from another worker.
+	/// @return \c false if there are no more jobs.
+	bool Fetch(size_t self, Job& job);
+	/// Mark a job as completed.
+	void Completed();
+	/// Open the next PrefetchDistance files of the local queue
+	/// and request their tag regions in advance unless already done.
+	void Prefetch(size_t self);
+	/// Wait until less than ReadersPerDevice files of \a device are read.
+	/// @remarks Not called for an unknown device.
+	void AcquireDevice(guint64 device);
+	void ReleaseDevice(guint64 device);
+	void DirScan(size_t self, gObject<GFileEnumerator> dir_enumerator);
+#ifndef G_OS_WIN32
+	/// Fast path of DirScan for local directories.
+	void LocalDirScan(size_t self, const gchar* path, LocalDirReader& dir);
+#endif
+	void ItemWorker(size_t self);
+
+protected:
+	/// Capture the settings and queue the root directory.
+	/// @param path Root directory in file system encoding.
+	/// @param reload Keep unchanged files of the previous scan.
+	DirectoryScanner(gString&& path, std::unique_ptr<const ReloadState> reload);
+	/// Start the worker threads.
+	/// @remarks Not done by the constructor, because the workers call the virtual functions.
+	void StartWorkers();
+	/// Collect the files read by all workers.
+	/// @pre The scan is finished.
+	ET_FileList::list_type TakeResults();
+
+	/// A directory could not be read.
+	/// @remarks Called in the main thread.
+	virtual void OnDirCompleted(GFile* dir, const char* error) = 0;
+	/// A file has been read.
+	/// @param reused Unchanged file of the previous scan.
+	/// @remarks Called by the worker threads.
+	virtual void OnFileCompleted(xPtr<ET_File> file, xString error, bool reused) = 0;
+	/// All jobs are done, i.e. the results are complete.
+	/// @remarks Called in the main thread.
+	virtual void OnFinished() = 0;
+
+public:
+	virtual ~DirectoryScanner();
+};
+
+#endif /* ET_DIRECTORY_SCANNER_H_ */
@@ -28,8 +28,11 @@
 
 #include "application_window.h"
 #include "browser.h"
+#include "directory_scanner.h"
 #include "file_description.h"
+#include "file_cache.h"
 #include "file_list.h"
+#include "file_watcher.h"
 #include "id3_tag.h"
 #include "log.h"
 #include "misc.h"
@@ -47,11 +50,16 @@
 
 #include <vector>
 #include <deque>
+#include <unordered_set>
+#include <unordered_map>
+#include <string>
 #include <algorithm>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
+#include <memory>
+#include <cstring>
 using namespace std;
 
 /* Referenced in the header. */
@@ -67,8 +75,304 @@ static gboolean SF_HideMsgbox_Rename_File;
 /* To remember which button was pressed when renaming file */
 static gint SF_ButtonPressed_Rename_File;
 
-static gboolean Write_File_Tag (ET_File *ETFile, gboolean hide_msgbox);
-static gint Save_File (ET_File *ETFile, gboolean multiple_files,
+
+/// Background execution of the file operations of Save_List_Of_Files.
+/// @details The main thread asks for confirmations and queues the files in list order.
+/// Worker threads write the tags concurrently, while the renames are executed in queue order
+/// to keep the semantics of sequential saving, e.g. when files swap their names.
+/// The results are processed by the main thread in queue order and in batches.
+class SaveWorker : public xObj
+{
+public:
+	/// Operations on one file
+	struct Job
+	{	xPtr<ET_File> File;
+		/// Write the tag of the file.
+		bool WriteTag;
+		/// Report tag write errors only in the log and continue.
+		bool HideTagError;
+		/// Rename the file to this absolute path if not \c nullptr.
+		gString NewPath;
+		/// Report rename errors only in the log and continue.
+		bool HideRenameError;
+
+		// results, owned by the worker until Done is set, errors are freed by OnJobCompleted
+		bool Done = false;
+		/// The job has been executed, i.e. not skipped because of a previous error.
+		bool Executed = false;
+		gboolean TagWritten = FALSE;
+		ET_File::Stat Stat;
+		GError* TagError = nullptr;
+		gboolean Renamed = FALSE;
+		GError* RenameError = nullptr;
+
+		Job(xPtr<ET_File> file) : File(move(file)), WriteTag(false), HideTagError(false), HideRenameError(false) {}
+	};
+
+private:
+	// captured settings
+	const size_t NumWorkers;
+	/// Number of files to save, for the progress bar.
+	const int Total;
+
+	/// All jobs in queue order.
+	/// @remarks Only the main thread appends jobs.
+	/// So it may access the deque without lock while the workers need the lock.
+	deque<Job> Jobs;
+	/// Next job to execute.
+	size_t NextJob = 0;
+	/// Next job that may rename its file.
+	size_t NextRename = 0;
+	/// No more jobs will be queued.
+	bool Closed = false;
+	/// A fatal error occurred, do not execute further jobs.
+	bool Stopped = false;
+	/// A notification of the main thread is on the way.
+	bool NotifyPending = false;
+	/// worker threads
+	vector<thread> Worker;
+	/// Synchronize access to the above data
+	mutex Sync;
+	condition_variable Cond;
+
+	// data of the main thread
+	/// Next job to be processed by the main thread.
+	size_t NextResult = 0;
+	/// OnCompleted is active, dialogs may recurse into the main loop.
+	bool Processing = false;
+	/// An error message box has been shown, log further errors only.
+	bool ErrorShown = false;
+
+private:
+	void Run();
+	void OnCompleted();
+	void OnJobCompleted(Job& job);
+
+public:
+	SaveWorker(int total);
+	~SaveWorker();
+	/// Queue the operations on a file.
+	void Queue(Job&& job);
+	/// Check whether further jobs are useless because of a previous error.
+	bool Failed() { lock_guard<mutex> lock(Sync); return Stopped; }
+	/// Wait for completion of all jobs.
+	/// @return \c false if saving stopped because of an error.
+	bool Finish();
+};
+
+SaveWorker::SaveWorker(int total)
+:	NumWorkers(max(g_settings_get_uint(MainSettings, "background-threads"), 1U))
+,	Total(total)
+{	Worker.reserve(NumWorkers);
+}
+
+SaveWorker::~SaveWorker()
+{	for (auto& w : Worker)
+		if (w.joinable())
+			w.join();
+}
+
+void SaveWorker::Queue(Job&& job)
+{	lock_guard<mutex> lock(Sync);
+	Jobs.emplace_back(move(job));
+	// start more workers?
+	if (Worker.size() < min(NumWorkers, Jobs.size() - NextJob))
+		Worker.emplace_back(&SaveWorker::Run, ref(*this));
+	else
+		Cond.notify_all();
+}
+
+bool SaveWorker::Finish()
+{	{	lock_guard<mutex> lock(Sync);
+		Closed = true;
+		Cond.notify_all();
+	}
+
+	while (NextResult < Jobs.size())
+		gtk_main_iteration();
+
+	for (auto& w : Worker)
+		w.join();
+	Worker.clear();
+
+	return !Stopped;
+}
+
+void SaveWorker::Run()
+{	unique_lock<mutex> lock(Sync);
+	while (true)
+	{	// fetch next job
+		while (NextJob == Jobs.size() && !Closed)
+			Cond.wait(lock);
+		if (NextJob == Jobs.size())
+			return;
+		const size_t index = NextJob++;
+		Job& job = Jobs[index];
+		job.Executed = !Stopped && !Main_Stop_Button_Pressed;
+		lock.unlock();
+
+		if (job.Executed && job.WriteTag)
+			job.TagWritten = job.File->write_file_tag(job.Stat, &job.TagError);
+
+		lock.lock();
+		// A tag write error stops saving unless errors are hidden. This includes the rename of the file.
+		if (job.WriteTag && !job.TagWritten && !job.HideTagError)
+			Stopped = true;
+
+		// rename files strictly in list order
+		while (NextRename != index)
+			Cond.wait(lock);
+		if (job.Executed && job.NewPath && !Stopped)
+		{	lock.unlock();
+			job.Renamed = et_rename_file(job.File->FilePath, job.NewPath, &job.RenameError);
+			lock.lock();
+			if (!job.Renamed && !job.HideRenameError)
+				Stopped = true;
+		}
+		++NextRename;
+		job.Done = true;
+		Cond.notify_all();
+
+		if (!NotifyPending)
+		{	NotifyPending = true;
+			gIdleAdd(new function<void()>([that = xPtr<SaveWorker>(this)]() { that->OnCompleted(); }));
+		}
+	}
+}
+
+void SaveWorker::OnCompleted()
+{	{	lock_guard<mutex> lock(Sync);
+		NotifyPending = false;
+	}
+	// A message box of OnJobCompleted runs a nested main loop.
+	// The outer invocation will take care of the remaining jobs.
+	if (Processing)
+		return;
+	Processing = true;
+
+	while (true)
+	{	{	lock_guard<mutex> lock(Sync);
+			if (NextResult == Jobs.size() || !Jobs[NextResult].Done)
+				break;
+		}
+		OnJobCompleted(Jobs[NextResult]);
+		++NextResult;
+	}
+
+	Processing = false;
+}
+
+void SaveWorker::OnJobCompleted(Job& job)
+{
+	EtApplicationWindow* const window = MainWindow;
+	ET_File* const file = job.File.get();
+	const File_Name& filename_cur = *file->FileNameCur();
+	const File_Name& filename_new = *file->FileNameNew();
+
+	if (job.Executed && job.WriteTag)
+	{
+		file->file_tag_written(job.Stat, job.TagWritten);
+
+		const char* basename_utf8 = filename_cur.file().get();
+		if (job.TagWritten)
+			et_application_window_status_bar_message(window,
+				strprintf(_("Wrote tag of ‘%s’"), basename_utf8).c_str(), TRUE);
+		else
+		{	Log_Print (LOG_ERROR, "%s", job.TagError->message);
+
+			if (!job.HideTagError && !ErrorShown)
+			{	ErrorShown = true;
+				GtkWidget *msgdialog;
+#ifdef ENABLE_ID3LIB
+				if (g_error_matches (job.TagError, ET_ID3_ERROR, ET_ID3_ERROR_BUGGY_ID3LIB))
+				{
+					msgdialog = gtk_message_dialog_new (GTK_WINDOW (MainWindow),
+														GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+														GTK_MESSAGE_ERROR,
+														GTK_BUTTONS_CLOSE,
+														"%s",
+														_("You have tried to save "
+														"this tag to Unicode but it "
+														"was detected that your "
+														"version of id3lib is buggy"));
+					gtk_message_dialog_format_secondary_text (GTK_MESSAGE_DIALOG (msgdialog),
+															  _("If you reload this "
+															  "file, some characters "
+															  "in the tag may not be "
+															  "displayed correctly. "
+															  "Please, apply the "
+															  "patch "
+															  "src/id3lib/patch_id3lib_3.8.3_UTF16_writing_bug.diff "
+															  "to id3lib, which is "
+															  "available in the "
+															  "EasyTAG package "
+															  "sources.\nNote that "
+															  "this message will "
+															  "appear only "
+															  "once.\n\nFile: %s"),
+															  basename_utf8);
+				}
+				else
+#endif
+				{
+					msgdialog = gtk_message_dialog_new (GTK_WINDOW (MainWindow),
+														GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+														GTK_MESSAGE_ERROR,
+														GTK_BUTTONS_CLOSE,
+														_("Cannot write tag in file ‘%s’"),
+														basename_utf8);
+					gtk_message_dialog_format_secondary_text (GTK_MESSAGE_DIALOG (msgdialog),
+															  "%s", job.TagError->message);
+					gtk_window_set_title (GTK_WINDOW (msgdialog),
+										  _("Tag Write Error"));
+				}
+
+				gtk_dialog_run(GTK_DIALOG(msgdialog));
+				gtk_widget_destroy(msgdialog);
+			}
+
+			g_clear_error(&job.TagError);
+		}
+	}
+
+	if (job.Renamed)
+		file->file_renamed(move(job.NewPath));
+	else if (job.RenameError)
+	{
+		if (!job.HideRenameError && !ErrorShown)
+		{	ErrorShown = true;
+			GtkWidget *msgdialog = gtk_message_dialog_new (GTK_WINDOW (MainWindow),
+												GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+												GTK_MESSAGE_ERROR,
+												GTK_BUTTONS_CLOSE,
+												_("Cannot rename file ‘%s’ to ‘%s’"),
+												filename_cur.full_name().get(),
+												filename_new.full_name().get());
+			gtk_message_dialog_format_secondary_text (GTK_MESSAGE_DIALOG (msgdialog),
+													  "%s",
+													  job.RenameError->message);
+			gtk_window_set_title (GTK_WINDOW (msgdialog),
+								  _("Rename File Error"));
+
+			gtk_dialog_run (GTK_DIALOG (msgdialog));
+			gtk_widget_destroy (msgdialog);
+		}
+
+		Log_Print (LOG_ERROR,
+				   _("Cannot rename file ‘%s’ to ‘%s’: %s"),
+				   filename_cur.full_name().get(),
+				   filename_new.full_name().get(),
+				   job.RenameError->message);
+
+		et_application_window_status_bar_message(window, _("File(s) not renamed"), TRUE);
+		g_clear_error(&job.RenameError);
+	}
+
+	et_application_window_progress_set(window, NextResult + 1, Total);
+}
+
+
+static gint Save_File (SaveWorker::Job& job, gboolean multiple_files,
                        gboolean force_saving_files);
 
 
@@ -81,12 +385,10 @@ static gint
 Save_List_Of_Files(const vector<xPtr<ET_File>>& etfilelist, gboolean force_saving_files)
 {
     EtApplicationWindow *window;
-    gint       progress_bar_index;
-    gint       saving_answer;
+    gint       saving_answer = 1;
     gint       nb_files_to_save;
     gint       nb_files_changed_by_ext_program;
     GtkWidget *widget_focused;
-    GtkTreePath *currentPath = NULL;
 
     window = MainWindow;
 
@@ -128,7 +430,6 @@ Save_List_Of_Files(const vector<xPtr<ET_File>>& etfilelist, gboolean force_savin
     }
 
     /* Initialize status bar */
-    progress_bar_index = 0;
     et_application_window_progress_set(window, 0, nb_files_to_save);
 
     /* Set to unsensitive all command buttons (except Quit button) */
@@ -187,49 +488,45 @@ Save_List_Of_Files(const vector<xPtr<ET_File>>& etfilelist, gboolean force_savin
         }
     }
 
+    // The workers write the tags and rename the files in the background
+    // while the confirmations of the following files are requested.
+    xPtr<SaveWorker> worker(new SaveWorker(nb_files_to_save));
+
     for (auto& ETFile : etfilelist)
     {
-        if (Main_Stop_Button_Pressed)
+        if (Main_Stop_Button_Pressed || worker->Failed())
             break;
 
         /* We process only the files changed and not saved, or we force to save all
          * files if force_saving_files==TRUE */
         if (force_saving_files || !ETFile->is_saved())
         {
-            /* ET_Display_File_Data_To_UI ((ET_File *)l->data);
-             * Use of 'currentPath' to try to increase speed. Indeed, in many
-             * cases, the next file to select, is the next in the list. */
-            currentPath = et_browser_select_file_by_et_file2(window->browser(), ETFile, FALSE, currentPath);
-
-            et_application_window_progress_set(window, ++progress_bar_index, nb_files_to_save);
-            /* Needed to refresh status bar */
-            while (gtk_events_pending())
-                gtk_main_iteration();
-
-            // Save tag and rename file
-            saving_answer = Save_File(ETFile.get(), nb_files_to_save > 1, force_saving_files);
+            // Ask for confirmation of tag writing and renaming
+            SaveWorker::Job job(ETFile);
+            saving_answer = Save_File(job, nb_files_to_save > 1, force_saving_files);
 
             if (saving_answer == -1)
-            {
-                /* Stop saving files + reinit progress bar */
-                et_application_window_progress_set (window, 0, 0);
-                et_application_window_status_bar_message (window, _("Saving files was stopped"), TRUE);
-                /* To update state of command buttons */
-                et_application_window_update_actions (window);
-                et_browser_set_sensitive(window->browser(), TRUE);
-                window->displayed_file_sensitive(true);
-
-                if (currentPath)
-                {
-                    gtk_tree_path_free (currentPath);
-                }
-                return -1; /* We stop all actions */
-            }
+                break; /* We stop all actions */
+
+            worker->Queue(move(job));
         }
     }
 
-    if (currentPath)
-        gtk_tree_path_free(currentPath);
+    if (!worker->Finish())
+        saving_answer = -1;
+
+    if (saving_answer == -1)
+    {
+        /* Stop saving files + reinit progress bar */
+        et_application_window_progress_set (window, 0, 0);
+        et_application_window_status_bar_message (window, _("Saving files was stopped"), TRUE);
+        /* To update state of command buttons */
+        et_application_window_update_actions (window);
+        et_browser_set_sensitive(window->browser(), TRUE);
+        window->displayed_file_sensitive(true);
+        et_browser_refresh_list(window->browser());
+        return -1; /* We stop all actions */
+    }
 
     const gchar* msg = Main_Stop_Button_Pressed ? _("Saving files was stopped") : _("All files have been saved");
 
@@ -272,15 +569,17 @@ gint Save_Selected_Files_With_Answer(gboolean force_saving_files)
 
 
 /*
- * Save changes of the ETFile (write tag and rename file)
+ * Ask for the changes of the ETFile to save (write tag and rename file)
+ * and store the answers in job.
  *  - multiple_files = TRUE  : when saving files, a msgbox appears with ability
  *                             to do the same action for all files.
  *  - multiple_files = FALSE : appears only a msgbox to ask confirmation.
  */
 static gint
-Save_File (ET_File *ETFile, gboolean multiple_files,
+Save_File (SaveWorker::Job& job, gboolean multiple_files,
            gboolean force_saving_files)
 {
+    const ET_File *ETFile = job.File.get();
     g_return_val_if_fail (ETFile != NULL, 0);
 
     const File_Name& filename_cur = *ETFile->FileNameCur();
@@ -348,11 +647,10 @@ Save_File (ET_File *ETFile, gboolean multiple_files,
         switch (response)
         {
             case GTK_RESPONSE_YES:
+                job.WriteTag = true;
                 // if 'SF_HideMsgbox_Write_Tag is TRUE', then errors are displayed only in log
-                if (!Write_File_Tag(ETFile,SF_HideMsgbox_Write_Tag)
-                    // if an error occurs when 'SF_HideMsgbox_Write_Tag is TRUE', we don't stop saving...
-                    && !SF_HideMsgbox_Write_Tag)
-                    return -1;
+                // and we don't stop saving...
+                job.HideTagError = SF_HideMsgbox_Write_Tag;
             case GTK_RESPONSE_NO:
                 break;
             case GTK_RESPONSE_CANCEL:
@@ -457,47 +755,11 @@ Save_File (ET_File *ETFile, gboolean multiple_files,
         switch(response)
         {
             case GTK_RESPONSE_YES:
-            {
-                GError *error = NULL;
-                gboolean rc = ETFile->rename_file(&error);
-
+                job.NewPath = ETFile->rename_target();
                 // if 'SF_HideMsgbox_Rename_File is TRUE', then errors are displayed only in log
-                if (!rc)
-                {
-                    if (!SF_HideMsgbox_Rename_File)
-                    {
-                        msgdialog = gtk_message_dialog_new (GTK_WINDOW (MainWindow),
-                                                            GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
-                                                            GTK_MESSAGE_ERROR,
-                                                            GTK_BUTTONS_CLOSE,
-                                                            _("Cannot rename file ‘%s’ to ‘%s’"),
-                                                            filename_cur.full_name().get(),
-                                                            filename_new.full_name().get());
-                        gtk_message_dialog_format_secondary_text (GTK_MESSAGE_DIALOG (msgdialog),
-                                                                  "%s",
-                                                                  error->message);
-                        gtk_window_set_title (GTK_WINDOW (msgdialog),
-                                              _("Rename File Error"));
-
-                        gtk_dialog_run (GTK_DIALOG (msgdialog));
-                        gtk_widget_destroy (msgdialog);
-                    }
-
-                    Log_Print (LOG_ERROR,
-                               _("Cannot rename file ‘%s’ to ‘%s’: %s"),
-                               filename_cur.full_name().get(),
-                               filename_new.full_name().get(),
-                               error->message);
-
-                    et_application_window_status_bar_message(MainWindow, _("File(s) not renamed"), TRUE);
-                    g_error_free (error);
-                }
-
-                // if an error occurs when 'SF_HideMsgbox_Rename_File is TRUE', we don't stop saving...
-                if (!rc && !SF_HideMsgbox_Rename_File)
-                    return -1;
+                // and we don't stop saving...
+                job.HideRenameError = SF_HideMsgbox_Rename_File;
                 break;
-            }
             case GTK_RESPONSE_NO:
                 break;
             case GTK_RESPONSE_CANCEL:
@@ -509,91 +771,9 @@ Save_File (ET_File *ETFile, gboolean multiple_files,
         }
     }
 
-    /* Refresh file into browser list */
-    // Browser_List_Refresh_File_In_List(ETFile);
-
     return 1;
 }
 
-/*
- * Write tag of the ETFile
- * Return TRUE => OK
- *        FALSE => error
- */
-static gboolean
-Write_File_Tag (ET_File *ETFile, gboolean hide_msgbox)
-{
-    GError *error = NULL;
-
-    const char* basename_utf8 = ETFile->FileNameCur()->file().get();
-    et_application_window_status_bar_message(MainWindow,
-        strprintf(_("Writing tag of ‘%s’"), basename_utf8).c_str(), TRUE);
-
-    if (ETFile->save_file_tag(&error))
-    {
-        et_application_window_status_bar_message(MainWindow,
-            strprintf(_("Wrote tag of ‘%s’"), basename_utf8).c_str(), TRUE);
-        return TRUE;
-    }
-
-    Log_Print (LOG_ERROR, "%s", error->message);
-
-    if (!hide_msgbox)
-    {
-        GtkWidget *msgdialog;
-#ifdef ENABLE_ID3LIB
-        if (g_error_matches (error, ET_ID3_ERROR, ET_ID3_ERROR_BUGGY_ID3LIB))
-        {
-            msgdialog = gtk_message_dialog_new (GTK_WINDOW (MainWindow),
-                                                GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
-                                                GTK_MESSAGE_ERROR,
-                                                GTK_BUTTONS_CLOSE,
-                                                "%s",
-                                                _("You have tried to save "
-                                                "this tag to Unicode but it "
-                                                "was detected that your "
-                                                "version of id3lib is buggy"));
-            gtk_message_dialog_format_secondary_text (GTK_MESSAGE_DIALOG (msgdialog),
-                                                      _("If you reload this "
-                                                      "file, some characters "
-                                                      "in the tag may not be "
-                                                      "displayed correctly. "
-                                                      "Please, apply the "
-                                                      "patch "
-                                                      "src/id3lib/patch_id3lib_3.8.3_UTF16_writing_bug.diff "
-                                                      "to id3lib, which is "
-                                                      "available in the "
-                                                      "EasyTAG package "
-                                                      "sources.\nNote that "
-                                                      "this message will "
-                                                      "appear only "
-                                                      "once.\n\nFile: %s"),
-                                                      basename_utf8);
-        }
-        else
-#endif
-        {
-            msgdialog = gtk_message_dialog_new (GTK_WINDOW (MainWindow),
-                                                GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
-                                                GTK_MESSAGE_ERROR,
-                                                GTK_BUTTONS_CLOSE,
-                                                _("Cannot write tag in file ‘%s’"),
-                                                basename_utf8);
-            gtk_message_dialog_format_secondary_text (GTK_MESSAGE_DIALOG (msgdialog),
-                                                      "%s", error->message);
-            gtk_window_set_title (GTK_WINDOW (msgdialog),
-                                  _("Tag Write Error"));
-        }
-
-        gtk_dialog_run(GTK_DIALOG(msgdialog));
-        gtk_widget_destroy(msgdialog);
-    }
-
-    g_clear_error (&error);
-
-    return FALSE;
-}
-
 #ifdef ENABLE_REPLAYGAIN
 class ReplayGainWorker : public xObj
 {
@@ -603,7 +783,9 @@ class ReplayGainWorker : public xObj
 	/// The currently running instance if any.
 	static xPtr<ReplayGainWorker> Instance;
 
+	/// Album aggregation, used by the Run thread only.
 	ReplayGainAnalyzer Analyzer;
+	const size_t NumWorkers;
 
 	gint (*AlbumComparer)(const ET_File *ETFile1, const ET_File *ETFile2) = nullptr;
 	unsigned CompareLevel = 1;
@@ -615,6 +797,25 @@ class ReplayGainWorker : public xObj
 
 	FileList::iterator AlbumFirst;
 
+	/// Result of a track analysis.
+	struct TrackResult
+	{	bool Done = false;
+		string Error;
+		unique_ptr<ReplayGainAnalyzer::Result> Result;
+	};
+	/// Track results in the order of Files.
+	vector<TrackResult> Results;
+	/// Next file to analyze.
+	size_t NextFile = 0;
+	/// Next result to aggregate.
+	size_t NextAggregate = 0;
+	/// Maximum number of files the analysis may run ahead of the aggregation.
+	/// This bounds the memory of buffered results if a file takes long.
+	const size_t MaxAhead;
+	/// Synchronize access to Results, NextFile and NextAggregate.
+	mutex Sync;
+	condition_variable Cond;
+
 private:
 	double GetFileDuration(const ET_File* file)
 	{	double duration = file->ETFileInfo.duration;
@@ -627,8 +828,10 @@ private:
 
 	ReplayGainWorker(vector<xPtr<ET_File>>&& files);
 	void FinishAlbum(FileListIterator first, FileListIterator last, bool error);
-	/// Background thread
+	/// Background thread, collects the track results in order.
 	void Run();
+	/// Background threads, analyze tracks in parallel.
+	void AnalyzeTracks();
 public:
 	/// Start a new worker instance.
 	/// @return Instance pointer or \c nullptr if there is another instance still running.
@@ -639,7 +842,10 @@ xPtr<ReplayGainWorker> ReplayGainWorker::Instance;
 
 ReplayGainWorker::ReplayGainWorker(vector<xPtr<ET_File>>&& files)
 :	Analyzer((EtReplayGainModel)g_settings_get_enum(MainSettings, "replaygain-model"))
+,	NumWorkers(max(g_settings_get_uint(MainSettings, "background-threads"), 1U))
 ,	Files(files)
+,	Results(Files.size())
+,	MaxAhead(4 * NumWorkers)
 {
 	switch ((EtReplayGainGroupBy)g_settings_get_enum(MainSettings, "replaygain-groupby"))
 	{	EtSortMode mode;
@@ -733,11 +939,41 @@ ReplayGainWorker* ReplayGainWorker::Start(vector<xPtr<ET_File>>&& files)
 	return Instance.get();
 }
 
+void ReplayGainWorker::AnalyzeTracks()
+{	// one analyzer instance per thread
+	ReplayGainAnalyzer analyzer(Analyzer.Model);
+	unique_lock<mutex> lock(Sync);
+	while (NextFile < Files.size())
+	{	// back-pressure
+		if (NextFile >= NextAggregate + MaxAhead)
+		{	Cond.wait(lock);
+			continue;
+		}
+		size_t i = NextFile++;
+		lock.unlock();
+
+		string err = analyzer.AnalyzeFile(Files[i]->FilePath);
+		auto result = analyzer.TakeLastResult();
+
+		lock.lock();
+		TrackResult& track = Results[i];
+		track.Error = move(err);
+		if (track.Error.empty())
+			track.Result = move(result);
+		track.Done = true;
+		Cond.notify_all();
+	}
+}
+
 void ReplayGainWorker::Run()
 {
 	bool error = false;
 	auto first = Files.begin();
 
+	vector<thread> workers;
+	for (size_t i = min(NumWorkers, Files.size()); i; --i)
+		workers.emplace_back(&ReplayGainWorker::AnalyzeTracks, ref(*this));
+
 	for (auto cur = first; cur != Files.end(); ++cur)
 	{	ET_File* file = cur->get();
 		// Group processing for album gain
@@ -748,7 +984,14 @@ void ReplayGainWorker::Run()
 			first = cur;
 		}
 
-		string err = Analyzer.AnalyzeFile(file->FilePath);
+		// Aggregate the track results strictly in order
+		// to get exactly the same album result as a serial analysis.
+		TrackResult& track = Results[cur - Files.begin()];
+		{	unique_lock<mutex> lock(Sync);
+			while (!track.Done)
+				Cond.wait(lock);
+		}
+		string err = move(track.Error);
 		if (err == "$Aborted")
 		{abort:
 			error = true;
@@ -756,9 +999,16 @@ void ReplayGainWorker::Run()
 		}
 		if (!err.empty())
 			error = true;
-
-		float track_gain = Analyzer.GetLastResult().Gain();
-		float track_peak = Analyzer.GetLastResult().Peak();
+		else
+			Analyzer.Aggregate(*track.Result);
+
+		float track_gain = track.Result ? track.Result->Gain() : 0;
+		float track_peak = track.Result ? track.Result->Peak() : 0;
+		track.Result.reset();
+		{	lock_guard<mutex> lock(Sync);
+			++NextAggregate;
+			Cond.notify_all();
+		}
 		gIdleAdd(new function<void()>([that = xPtr<ReplayGainWorker>(this), cur, err, track_gain, track_peak]()
 			{ that->OnFileCompleted(cur, err, track_gain, track_peak); }));
 
@@ -772,6 +1022,14 @@ void ReplayGainWorker::Run()
 	error = false;
 
 end:
+	// no more tracks to analyze
+	{	lock_guard<mutex> lock(Sync);
+		NextFile = Files.size();
+		Cond.notify_all();
+	}
+	for (auto& w : workers)
+		w.join();
+
 	gIdleAdd(new function<void()>([that = xPtr<ReplayGainWorker>(this), error]()
 		{ that->OnFinished(error); }));
 
@@ -794,88 +1052,351 @@ void ReplayGain_For_Selected_Files (void)
 	auto etfilelist = MainWindow->browser()->get_selected_files();
 	if (!etfilelist.size())
 		return; // nothing to do
+	// The worker threads access the tags.
+	for (const ET_File* file : etfilelist)
+		file->require_tag();
 
 	ReplayGainWorker::Start(move(etfilelist));
 }
 #endif
 
 
-class ReadDirectoryWorker : public xObj
+/// Background reading of tags deferred by a two-phase directory scan.
+/// @details Files requested by the UI, i.e. visible rows, are read first,
+/// the remaining files in list order afterwards. The worker threads only read
+/// into temporary instances, the results are applied in the main thread.
+class ReadTagWorker : public xObj
 {
 	/// The currently running instance if any.
-	static xPtr<ReadDirectoryWorker> Instance;
+	static xPtr<ReadTagWorker> Instance;
 
-	// captured settings
-	const bool Recursive;
-	const bool BrowseHidden;
 	const size_t NumWorkers;
+	/// Verify the file type by the file content.
+	const bool SniffType;
+	/// Update the tag cache of this root when all tags have been read, optional.
+	gString CacheRoot;
+
+	/// File to read with a copy of its path, that might change in the main thread.
+	struct Job
+	{	xPtr<ET_File> File;
+		gString Path;
+	};
+	/// Tag read, not yet applied.
+	struct Result
+	{	xPtr<ET_File> File;
+		/// Temporary instance with the path that has been read.
+		xPtr<ET_File> Source;
+		xString Error;
+	};
+
+	/// Synchronize access to Jobs, Running, Results and ResultsScheduled.
+	mutex Sync;
+	/// Requests of the UI at the front, background jobs at the back.
+	deque<Job> Jobs;
+	/// Number of running worker threads.
+	size_t Running = 0;
+	vector<Result> Results;
+	/// OnFilesCompleted is scheduled.
+	bool ResultsScheduled = false;
+	/// Minimum interval of UI updates in milliseconds.
+	static constexpr guint CompletionInterval = 50;
+
+	/// Files requested by the UI and not yet applied, to avoid duplicate requests on redraw.
+	/// @remarks Only accessed by the main thread.
+	unordered_set<const ET_File*> Requested;
+
+private:
+	ReadTagWorker()
+	:	NumWorkers(max(g_settings_get_uint(MainSettings, "background-threads"), 1U))
+	,	SniffType(g_settings_get_boolean(MainSettings, "scan-sniff-type"))
+	{}
+	static ReadTagWorker& Get();
+	/// Queue a job for a pending file.
+	void Push(const ET_File* file, bool front);
+	/// Start worker threads as needed.
+	/// @pre Sync must be locked.
+	void Spawn();
+	/// Schedule OnFilesCompleted unless already done.
+	/// @pre Sync must be locked.
+	void ScheduleCompletion();
+	void Run();
+	/// Apply all read tags in the UI thread.
+	void OnFilesCompleted();
 
-	const gString RootPath;
+public:
+	/// Read a deferred tag into a temporary instance.
+	/// @param description File type determined by the directory scan.
+	/// @param sniff Verify the file type by the file content.
+	/// @return Instance with the tag of the file at \a path.
+	static xPtr<ET_File> ReadSource(gString&& path, const ET_File_Description* description, bool sniff, xString& error);
+	/// Read all deferred tags of \a files in the background.
+	/// @param root Update the tag cache of this root when done, optional.
+	static void Start(const ET_FileList::list_type& files, gString&& root);
+	/// Read the tag of a file with priority, e.g. because it became visible.
+	static void Request(const ET_File* file);
+	/// Discard all jobs, e.g. because another directory is read.
+	static void Stop();
+	/// Discard the queued jobs, e.g. because all pending tags are read at once.
+	/// Running jobs are still applied and the tag cache is updated when they are done.
+	static void Drain();
+};
 
-	/// worker queue
-	/// @details
-	/// GFile, false => audio file,
-	/// GFile, true => directory,
-	/// nullptr, false => end marker,
-	/// nullptr, true => last end marker
-	deque<pair<gObject<GFile>, bool>> Files;
-	ET_FileList::list_type ResultList;
-	/// worker threads
-	vector<thread> Worker;
-	/// Synchronize access to the above data
-	mutex Sync;
-	condition_variable Cond;
+xPtr<ReadTagWorker> ReadTagWorker::Instance;
+
+ReadTagWorker& ReadTagWorker::Get()
+{	if (!Instance)
+		Instance = xPtr<ReadTagWorker>(new ReadTagWorker());
+	return *Instance;
+}
+
+xPtr<ET_File> ReadTagWorker::ReadSource(gString&& path, const ET_File_Description* description, bool sniff, xString& error)
+{	xPtr<ET_File> source(new ET_File(move(path)));
+	source->ETFileDescription = description;
+	gObject<GFile> file(g_file_new_for_path(source->FilePath));
+	GError* err = nullptr;
+	source->read_file(file.get(), nullptr, &err, nullptr, false, sniff);
+	if (err)
+	{	error = xString(err->message);
+		g_error_free(err);
+	}
+	return source;
+}
+
+void ReadTagWorker::Push(const ET_File* file, bool front)
+{	Job job{ xPtr<ET_File>(const_cast<ET_File*>(file)), gString(g_strdup(file->FilePath)) };
+	if (front)
+		Jobs.emplace_front(move(job));
+	else
+		Jobs.emplace_back(move(job));
+}
+
+void ReadTagWorker::Spawn()
+{	while (Running < NumWorkers && Running < Jobs.size())
+	{	++Running;
+		thread([that = xPtr<ReadTagWorker>(this)]() { that->Run(); }).detach();
+	}
+}
+
+void ReadTagWorker::Start(const ET_FileList::list_type& files, gString&& root)
+{	ReadTagWorker& worker = Get();
+	worker.CacheRoot = move(root);
+	lock_guard<mutex> lock(worker.Sync);
+	for (const ET_File* file : files)
+		if (file->tag_pending())
+			worker.Push(file, false);
+	worker.Spawn();
+	if (!worker.Running)
+		worker.ScheduleCompletion();
+}
+
+void ReadTagWorker::Request(const ET_File* file)
+{	ReadTagWorker& worker = Get();
+	if (!worker.Requested.insert(file).second)
+		return; // already requested
+	lock_guard<mutex> lock(worker.Sync);
+	worker.Push(file, true);
+	worker.Spawn();
+}
+
+void ReadTagWorker::Stop()
+{	if (!Instance)
+		return;
+	{	lock_guard<mutex> lock(Instance->Sync);
+		Instance->Jobs.clear();
+	}
+	Instance.reset();
+}
+
+void ReadTagWorker::Drain()
+{	if (!Instance)
+		return;
+	Instance->Requested.clear();
+	lock_guard<mutex> lock(Instance->Sync);
+	Instance->Jobs.clear();
+	// Without running jobs there is no further result that completes the work.
+	Instance->ScheduleCompletion();
+}
+
+void ReadTagWorker::ScheduleCompletion()
+{	if (ResultsScheduled)
+		return;
+	ResultsScheduled = true;
+	gTimeoutAdd(CompletionInterval, new function<void()>([that = xPtr<ReadTagWorker>(this)]()
+		{	that->OnFilesCompleted(); }));
+}
+
+void ReadTagWorker::Run()
+{	unique_lock<mutex> lock(Sync);
+	while (Jobs.size())
+	{	Job job = move(Jobs.front());
+		Jobs.pop_front();
+		if (!job.File->tag_pending())
+			continue; // requested and read meanwhile
+		lock.unlock();
+
+		xString error;
+		xPtr<ET_File> source = ReadSource(move(job.Path), job.File->ETFileDescription, SniffType, error);
+
+		lock.lock();
+		Results.emplace_back(Result{ move(job.File), move(source), move(error) });
+		// Only the first result after the last UI update schedules the next one.
+		ScheduleCompletion();
+	}
+	// The last worker completes the work even if it only skipped jobs.
+	if (!--Running)
+		ScheduleCompletion();
+}
+
+void ReadTagWorker::OnFilesCompleted()
+{	vector<Result> results;
+	{	lock_guard<mutex> lock(Sync);
+		results.swap(Results);
+		ResultsScheduled = false;
+	}
+	if (Instance.get() != this)
+		return; // stopped
+
+	bool refresh = false;
+	for (Result& result : results)
+	{	if (result.File->tag_pending() && strcmp(result.File->FilePath, result.Source->FilePath) != 0)
+		{	// Renamed while it has been read, read it again at the new location.
+			lock_guard<mutex> lock(Sync);
+			Push(result.File.get(), true);
+			Spawn();
+			continue;
+		}
+		Requested.erase(result.File.get());
+		refresh |= result.File->complete_tag(*result.Source, result.Error);
+	}
+	if (refresh)
+		MainWindow->browser()->refresh_rows();
+
+	bool done;
+	{	lock_guard<mutex> lock(Sync);
+		done = Jobs.empty() && !Running && Results.empty();
+	}
+	if (done)
+	{	if (CacheRoot)
+			ET_FileCache::store(CacheRoot, ET_FileList::all_files());
+		Instance.reset();
+	}
+}
+
+void Request_Tag(const ET_File* file)
+{	ReadTagWorker::Request(file);
+}
+
+void Read_Pending_Tags()
+{	// The files are read here, the background reader would read them a second time.
+	ReadTagWorker::Drain();
+
+	vector<ET_File*> files;
+	for (const xPtr<ET_File>& file : ET_FileList::all_files())
+		if (file->tag_pending())
+			files.emplace_back(file.get());
+	if (files.empty())
+		return;
+
+	// The main thread waits anyway, so read in parallel.
+	vector<pair<xPtr<ET_File>, xString>> sources(files.size());
+	atomic<size_t> next(0);
+	const bool sniff = g_settings_get_boolean(MainSettings, "scan-sniff-type");
+	auto worker = [&files, &sources, &next, sniff]()
+	{	size_t i;
+		while ((i = next++) < files.size())
+			sources[i].first = ReadTagWorker::ReadSource(gString(g_strdup(files[i]->FilePath)),
+				files[i]->ETFileDescription, sniff, sources[i].second);
+	};
+	vector<thread> threads;
+	for (size_t i = min<size_t>(g_settings_get_uint(MainSettings, "background-threads"), files.size()); i > 1; --i)
+		threads.emplace_back(worker);
+	worker();
+	for (auto& t : threads)
+		t.join();
+
+	for (size_t i = 0; i < files.size(); ++i)
+		files[i]->complete_tag(*sources[i].first, sources[i].second);
+	MainWindow->browser()->refresh_rows();
+}
+
+
+/// Directory scan of the main window.
+class ReadDirectoryWorker : public DirectoryScanner
+{
+	/// The currently running instance if any.
+	static xPtr<ReadDirectoryWorker> Instance;
+
+	/// File read, not yet processed by the UI.
+	struct Completion
+	{	xPtr<ET_File> File;
+		xString Error;
+		/// Unchanged file of the previous scan.
+		bool Reused;
+		Completion* Next;
+	};
+	/// Lock-free stack of completions, newest first.
+	atomic<Completion*> Completions;
+	/// OnFilesCompleted is scheduled.
+	atomic<bool> CompletionsScheduled;
+	/// Minimum interval of UI updates in milliseconds.
+	static constexpr guint CompletionInterval = 50;
 
-	atomic<int> DirCount;
 	// data for the UI
-	atomic<int> FilesTotal;
 	int FilesCompleted;
+	/// Files read but not yet added to ET_FileList in incremental mode.
+	ET_FileList::list_type Unpublished;
+	/// Time of the last update of ET_FileList in incremental mode.
+	gint64 LastPublished = 0;
+	/// Minimum interval of file list updates in microseconds.
+	static constexpr gint64 PublishInterval = 500000;
+
+	ReadDirectoryWorker(gString&& path, unique_ptr<const ReloadState> reload);
+	/// Process all queued completions in the UI thread.
+	void OnFilesCompleted();
+	/// Append the unpublished files to ET_FileList and the browser.
+	void PublishFiles();
+	/// Restore the file list before an aborted reload.
+	void RestoreFileList();
+
+protected:
+	void OnDirCompleted(GFile* child_dir, const char* error) override;
+	/// Queue a read file for the UI.
+	void OnFileCompleted(xPtr<ET_File> ETFile, xString error, bool reused) override;
+	void OnFinished() override;
 
-private:
-	void OnDirCompleted(GFile* child_dir, const char* error);
-	void OnFileCompleted(xPtr<ET_File> ETFile, const char* error);
-	void OnFinished();
-
-	ReadDirectoryWorker(gString&& path);
-	void DirScan(gObject<GFileEnumerator> dir_enumerator);
-	void ItemWorker();
 public:
-	static bool Start(gString&& path);
+	/// Start reading a directory.
+	/// @param reload Keep unchanged files of the previous scan.
+	static bool Start(gString&& path, unique_ptr<const ReloadState> reload = nullptr);
 	static bool IsReadingDirectory() { return !!Instance; }
 	~ReadDirectoryWorker();
 };
 
-ReadDirectoryWorker::ReadDirectoryWorker(gString&& path)
-:	Recursive(g_settings_get_boolean(MainSettings, "browse-subdir"))
-,	BrowseHidden(g_settings_get_boolean(MainSettings, "browse-show-hidden"))
-,	NumWorkers(g_settings_get_uint(MainSettings, "background-threads"))
-,	RootPath(move(path))
-,	Worker()
-,	DirCount(1)
-,	FilesTotal(0)
+ReadDirectoryWorker::ReadDirectoryWorker(gString&& path, unique_ptr<const ReloadState> reload)
+:	DirectoryScanner(move(path), move(reload))
+,	Completions(nullptr)
+,	CompletionsScheduled(false)
 ,	FilesCompleted(0)
-{	Worker.reserve(NumWorkers);
-	// kick off root dir worker
-	lock_guard<mutex> lock(Sync);
-	Files.emplace_front(move(gObject<GFile>(g_file_new_for_path(RootPath))), true);
-	// from here continue in background thread
-	Worker.emplace_back(&ReadDirectoryWorker::ItemWorker, ref(*this));
-}
+{}
 
 xPtr<ReadDirectoryWorker> ReadDirectoryWorker::Instance;
 
 ReadDirectoryWorker::~ReadDirectoryWorker()
-{	for (auto& w : Worker)
-		if (w.joinable())
-			w.join();
+{	Completion* c = Completions.exchange(nullptr);
+	while (c)
+	{	Completion* next = c->Next;
+		delete c;
+		c = next;
+	}
 }
 
-bool ReadDirectoryWorker::Start(gString&& path)
+bool ReadDirectoryWorker::Start(gString&& path, unique_ptr<const ReloadState> reload)
 {
 	if (Instance)
 		return false;
 
-	Instance = xPtr<ReadDirectoryWorker>(new ReadDirectoryWorker(move(path)));
+	Instance = xPtr<ReadDirectoryWorker>(new ReadDirectoryWorker(move(path), move(reload)));
+	Instance->StartWorkers();
 
 	// Set to unsensitive the Browser Area, to avoid to select another file while loading the first one
 	EtApplicationWindow* window = MainWindow;
@@ -887,60 +1408,162 @@ bool ReadDirectoryWorker::Start(gString&& path)
 }
 
 void ReadDirectoryWorker::OnDirCompleted(GFile* child_dir, const char* error)
-{	if (!child_dir)
-		Log_Print(LOG_ERROR, _("Cannot read directory ‘%s’"), error);
+{	gString child_path(g_file_get_path(child_dir));
+	gString display_path(g_filename_display_name(child_path));
+	if (strcmp(child_path, RootPath) != 0)
+		Log_Print(LOG_ERROR, _("Error opening directory ‘%s’: %s"), display_path.get(), error);
 	else
-	{	gString child_path(g_file_get_path(child_dir));
-		gString display_path(g_filename_display_name(child_path));
-		if (DirCount)
-			Log_Print(LOG_ERROR, _("Error opening directory ‘%s’: %s"), display_path.get(), error);
-		else
-		{	// Message if the root directory doesn't exist...
-			GtkWidget *msgdialog = gtk_message_dialog_new(GTK_WINDOW(MainWindow),
-				GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
-				GTK_MESSAGE_ERROR,
-				GTK_BUTTONS_CLOSE,
-				_("Cannot read directory ‘%s’"),
-				display_path.get());
-			gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(msgdialog), "%s", error);
-			gtk_window_set_title(GTK_WINDOW(msgdialog), _("Directory Read Error"));
-
-			gtk_dialog_run(GTK_DIALOG(msgdialog));
-			gtk_widget_destroy(msgdialog);
-		}
+	{	// Message if the root directory doesn't exist...
+		GtkWidget *msgdialog = gtk_message_dialog_new(GTK_WINDOW(MainWindow),
+			GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+			GTK_MESSAGE_ERROR,
+			GTK_BUTTONS_CLOSE,
+			_("Cannot read directory ‘%s’"),
+			display_path.get());
+		gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(msgdialog), "%s", error);
+		gtk_window_set_title(GTK_WINDOW(msgdialog), _("Directory Read Error"));
+
+		gtk_dialog_run(GTK_DIALOG(msgdialog));
+		gtk_widget_destroy(msgdialog);
 	}
 }
 
-void ReadDirectoryWorker::OnFileCompleted(xPtr<ET_File> ETFile, const char* error)
-{	if (error)
-		Log_Print(LOG_ERROR, _("Error reading tag from %s ‘%s’: %s"),
-			ETFile->ETFileDescription->FileType, ETFile->FileNameNew()->full_name().get(), error);
-	else if (ETFile->autofix())
-		Log_Print(LOG_INFO, _("Automatic corrections applied for file ‘%s’"), ETFile->FileNameNew()->full_name().get());
+void ReadDirectoryWorker::OnFileCompleted(xPtr<ET_File> ETFile, xString error, bool reused)
+{	Completion* c = new Completion{ move(ETFile), move(error), reused, Completions.load(memory_order_relaxed) };
+	while (!Completions.compare_exchange_weak(c->Next, c, memory_order_release, memory_order_relaxed));
+	// Only the first completion after the last UI update schedules the next one.
+	if (!CompletionsScheduled.exchange(true))
+		gTimeoutAdd(CompletionInterval, new function<void()>([that = xPtr<ReadDirectoryWorker>(this)]()
+			{	that->OnFilesCompleted(); }));
+}
+
+void ReadDirectoryWorker::OnFilesCompleted()
+{	CompletionsScheduled = false;
+	// take all completions and restore their order
+	Completion* c = Completions.exchange(nullptr, memory_order_acquire);
+	if (!c)
+		return;
+	Completion* list = nullptr;
+	do
+	{	Completion* next = c->Next;
+		c->Next = list;
+		list = c;
+		c = next;
+	} while (c);
+
+	do
+	{	ET_File* ETFile = list->File.get();
+		const char* error = list->Error;
+		if (error)
+			Log_Print(LOG_ERROR, _("Error reading tag from %s ‘%s’: %s"),
+				ETFile->ETFileDescription->FileType, ETFile->FileNameNew()->full_name().get(), error);
+		else if (!list->Reused && !ETFile->tag_pending() && ETFile->autofix())
+			Log_Print(LOG_INFO, _("Automatic corrections applied for file ‘%s’"), ETFile->FileNameNew()->full_name().get());
+		++FilesCompleted;
+		if (Incremental)
+			Unpublished.emplace_back(move(list->File));
+
+		c = list->Next;
+		delete list;
+		list = c;
+	} while (list);
+
+	/* Update the progress bar. */
+	et_application_window_progress_set(MainWindow, FilesCompleted, FilesTotal);
+
+	if (Unpublished.size() && g_get_monotonic_time() - LastPublished >= PublishInterval)
+		PublishFiles();
+}
 
-  /* Update the progress bar. */
-  et_application_window_progress_set(MainWindow, ++FilesCompleted, FilesTotal);
+void ReadDirectoryWorker::PublishFiles()
+{	LastPublished = g_get_monotonic_time();
+	if (Unpublished.empty())
+		return;
+	unsigned first = ET_FileList::append_files(move(Unpublished));
+	Unpublished.clear();
+	MainWindow->browser()->append_files(first);
+}
+
+void ReadDirectoryWorker::RestoreFileList()
+{	EtApplicationWindow* window = MainWindow;
+	ET_FileList::list_type list(Reload->List);
+	// Files read again may have been edited in the meantime.
+	for (const xPtr<ET_File>& file : ET_FileList::all_files())
+	{	if (file->is_saved())
+			continue;
+		auto it = Reload->Files.find(file->FilePath.get());
+		if (it == Reload->Files.end())
+			list.emplace_back(file);
+		else if (it->second != file)
+			*find(list.begin(), list.end(), it->second) = file;
+	}
+
+	window->browser()->clear();
+	ET_FileList::set_file_list(move(list));
+	if (Reload->Displayed && ET_FileList::contains(Reload->Displayed.get()))
+		window->change_displayed_file(Reload->Displayed.get());
+	et_application_window_browser_update_display_mode(window);
+	window->browser()->select_files(Reload->Selection);
+	// The aborted scan did not complete the deferred tags.
+	ReadTagWorker::Start(ET_FileList::all_files(), gString());
 }
 
 void ReadDirectoryWorker::OnFinished()
 {	EtApplicationWindow* window = MainWindow;
 
+	// process outstanding completions before the file list is published
+	OnFilesCompleted();
 	et_application_window_progress_set(window, 0, 0);
 
+	// collect the results of all workers
+	ET_FileList::list_type ResultList = TakeResults();
+
 	const gchar* msg;
 	gString msgBuffer;
 	unsigned count = ResultList.size();
 
 	if (Main_Stop_Button_Pressed)
-		msg = _("Directory scan aborted.");
-	else
+	{	if (Reload)
+		{	RestoreFileList();
+			msg = _("Directory scan aborted, the previous file list has been restored.");
+		} else
+			msg = _("Directory scan aborted.");
+	} else
 	{
-		ET_File::reset_undo_history();
-		ET_FileList::set_file_list(move(ResultList));
+		// With deferred tags the cache is updated when all tags have been read.
+		bool store_cache = Cache && Cache->modified(count);
+		if (store_cache && !DeferTags)
+			ET_FileCache::store(RootPath, ResultList);
+
+		if (Incremental)
+			// Most files are already visible and may have been edited.
+			PublishFiles();
+		else
+		{	if (!Reload)
+				ET_File::reset_undo_history();
+			ET_FileList::set_file_list(move(ResultList));
+		}
+
+		if (DeferTags)
+			ReadTagWorker::Start(ET_FileList::all_files(), store_cache ? gString(g_strdup(RootPath)) : gString());
+
+		if (WatchFiles)
+		{	vector<gObject<GFile>> dirs;
+			for (auto& q : Queues)
+				dirs.insert(dirs.end(), make_move_iterator(q->Dirs.begin()), make_move_iterator(q->Dirs.end()));
+			FileWatcher::Start(gString(g_strdup(RootPath)), move(dirs));
+		}
 
 		if (count)
-		{	/* Load the list of file into the browser list widget */
-			et_application_window_browser_update_display_mode(window);
+		{	// Restore the displayed file before the browser selects the first one.
+			if (Reload && Reload->Displayed && ET_FileList::contains(Reload->Displayed.get()))
+				window->change_displayed_file(Reload->Displayed.get());
+
+			/* Load the list of file into the browser list widget */
+			if (!Incremental)
+				et_application_window_browser_update_display_mode(window);
+			if (Reload)
+				window->browser()->select_files(Reload->Selection);
 
 			/* Prepare message for the status bar */
 			msg = msgBuffer = g_strdup_printf(g_settings_get_boolean(MainSettings, "browse-subdir")
@@ -959,6 +1582,16 @@ void ReadDirectoryWorker::OnFinished()
 		}
 	}
 
+	if (Reload)
+	{	// Files are only dropped if they no longer exist, but never silently with unsaved changes.
+		for (const auto& file : Reload->Files)
+			if (!file.second->is_saved() && !ET_FileList::contains(file.second.get()))
+				Log_Print(LOG_WARNING, _("File ‘%s’ with unsaved changes has been removed by another program"),
+					file.second->FileNameNew()->full_name().get());
+		// Keep the undo history of the files that survived the reload.
+		ET_File::prune_undo_history(&ET_FileList::contains);
+	}
+
 	/* Update sensitivity of buttons and menus */
 	Main_Stop_Button_Pressed = false;
 	et_application_window_update_actions(window);
@@ -967,132 +1600,7 @@ void ReadDirectoryWorker::OnFinished()
 	Instance.reset();
 }
 
-void ReadDirectoryWorker::DirScan(gObject<GFileEnumerator> dir_enumerator)
-{
-	GError *error = NULL;
-	gObject<GFileInfo> info;
-
-	while ((info = gObject<GFileInfo>(g_file_enumerator_next_file(dir_enumerator.get(), NULL, &error))))
-	{
-		if (Main_Stop_Button_Pressed)
-			return;
 
-		/* Hidden directory like '.mydir' will also be browsed if allowed. */
-		if (!BrowseHidden && g_file_info_get_is_hidden(info.get()))
-			continue;
-
-		const char *file_name = g_file_info_get_name(info.get());
-		GFileType type = g_file_info_get_file_type(info.get());
-		switch (type)
-		{case G_FILE_TYPE_REGULAR:
-			if (ET_File_Description::Get(file_name)->IsSupported())
-				break;
-			continue;
-		 case G_FILE_TYPE_DIRECTORY:
-			if (Recursive)
-				break;
-		 default:
-			continue;
-		}
-
-		GFile* file = g_file_enumerator_get_child(dir_enumerator.get(), info.get());
-		lock_guard<mutex> lock(Sync);
-		if (type == G_FILE_TYPE_REGULAR)
-		{	Files.emplace_back(gObject<GFile>(file), false);
-			++FilesTotal;
-		} else
-		{	// place directories to the front to get total count ASAP
-			Files.emplace_front(gObject<GFile>(file), true);
-			++DirCount;
-		}
-
-		// notification required?
-		if (Files.size() < Worker.size())
-			Cond.notify_one();
-		// start more workers?
-		if (Worker.size() < min(NumWorkers, Files.size()))
-			Worker.emplace_back(&ReadDirectoryWorker::ItemWorker, ref(*this));
-	}
-
-	if (error)
-	{	gIdleAdd(new function<void()>([this, msg = xString(error->message)]()
-			{	OnDirCompleted(nullptr, msg); }));
-		g_error_free(error);
-	}
-}
-
-void ReadDirectoryWorker::ItemWorker()
-{	while (true)
-	{	// fetch next item
-		pair<gObject<GFile>, bool> item;
-		{	unique_lock<mutex> lock(Sync);
-			while (!Files.size()) Cond.wait(lock);
-
-			item = move(Files.front());
-
-			if (item.first && Main_Stop_Button_Pressed)
-			{	// cancel immediately
-				Files.clear();
-				// force termination of all workers
-				for (size_t i = Worker.size(); --i; )
-					Files.emplace_back();
-				Files.emplace_back(nullptr, true);
-				Cond.notify_all();
-				item = move(Files.front());
-			}
-
-			Files.pop_front();
-		}
-
-		if (!item.first) // deadly termination pill
-		{	if (item.second)
-			{	gIdleAdd(new function<void()>([this]() { OnFinished(); }));
-				EtPicture::GarbageCollector(); // release orphaned images
-				xStringD::garbage_collector(); // ... and strings
-			}
-			return;
-		}
-
-		GError *error = NULL;
-
-		if (!item.second)
-		{	/* Get description of the file */
-			xPtr<ET_File> ETFile(new ET_File(gString(g_file_get_path(item.first.get()))));
-
-			ETFile->read_file(item.first.get(), RootPath, &error);
-
-			/* Add the item to the "result list" */
-			{	lock_guard<mutex> lock(Sync);
-				ResultList.emplace_back(ETFile);
-			}
-
-			gIdleAdd(new function<void()>([this, ETFile = move(ETFile), msg = xString(error ? error->message : nullptr)]()
-				{	OnFileCompleted(move(ETFile), msg); }));
-		} else
-		{	// Searching for files recursively.
-			gObject<GFileEnumerator> childdir_enumerator(g_file_enumerate_children(item.first.get(),
-				G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_STANDARD_TYPE "," G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN,
-				G_FILE_QUERY_INFO_NONE, NULL, &error));
-			if (childdir_enumerator)
-				DirScan(move(childdir_enumerator));
-			else
-				gIdleAdd(new function<void()>([this, child_dir = move(item.first), msg = xString(error->message)]()
-					{	OnDirCompleted(child_dir.get(), msg); }));
-
-			if (--DirCount == 0)
-			{	// last directory processed => put termination markers in the queue
-				lock_guard<mutex> lock(Sync);
-				for (size_t i = Worker.size(); --i; )
-					Files.emplace_back();
-				Files.emplace_back(nullptr, true);
-				Cond.notify_all();
-			}
-		}
-
-		if (error)
-			g_error_free(error);
-	}
-}
 
 bool IsReadingDirectory()
 {	return ReadDirectoryWorker::IsReadingDirectory();
@@ -1122,6 +1630,8 @@ gboolean Read_Directory(gString path_real)
     et_application_window_search_dialog_clear (window);
 
     /* Initialize file list */
+    FileWatcher::Stop();
+    ReadTagWorker::Stop();
     ET_File::reset_undo_history();
     ET_FileList::clear();
     et_application_window_update_actions(MainWindow);
@@ -1129,6 +1639,38 @@ gboolean Read_Directory(gString path_real)
     return ReadDirectoryWorker::Start(move(path_real));
 }
 
+gboolean Reload_Directory(gString path_real)
+{
+	g_return_val_if_fail(path_real != NULL, FALSE);
+	if (IsReadingDirectory())
+		return FALSE;
+
+	EtApplicationWindow* window = MainWindow;
+	EtBrowser* browser = window->browser();
+	et_application_window_update_et_file_from_ui(window);
+
+	// Remember the current state.
+	unique_ptr<ReadDirectoryWorker::ReloadState> reload(new ReadDirectoryWorker::ReloadState());
+	reload->Selection = browser->get_selected_files();
+	reload->Displayed = window->get_displayed_file();
+	reload->List = ET_FileList::all_files();
+	reload->Files.reserve(reload->List.size());
+	for (const xPtr<ET_File>& file : reload->List)
+		reload->Files.emplace(file->FilePath.get(), file);
+
+	window->change_displayed_file(nullptr);
+	browser->clear();
+	et_application_window_search_dialog_clear(window);
+
+	// Pending tags are queued again and the watch restarts when the scan completed.
+	FileWatcher::Stop();
+	ReadTagWorker::Stop();
+	ET_FileList::clear();
+	et_application_window_update_actions(window);
+
+	return ReadDirectoryWorker::Start(move(path_real), move(reload));
+}
+
 
 /*
  * To stop the recursive search within directories or saving files
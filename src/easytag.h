@@ -58,6 +58,15 @@ void Action_Main_Stop_Button_Pressed (void);
 /* A flag to start/avoid a new reading while another one is running */
 bool IsReadingDirectory();
 gboolean Read_Directory(gString path);
+/// Read the directory again, but only read new or changed files.
+/// @details Unchanged files of the current file list are kept including
+/// their undo history and selection. Removed files are dropped.
+gboolean Reload_Directory(gString path);
+/// Read the deferred tag of a file in the background with priority.
+void Request_Tag(const ET_File* file);
+/// Read all deferred tags of the file list before continuing.
+/// @details Used before operations that need the tags of all files, e.g. sorting by a tag field.
+void Read_Pending_Tags();
 
 bool et_run_audio_player(std::vector<xPtr<ET_File>>::const_iterator from, std::vector<xPtr<ET_File>>::const_iterator to);
 gboolean et_run_program (const gchar *program_name, GList *args_list, GError **error);
@@ -39,6 +39,7 @@
 #include "misc.h"
 #include "setting.h"
 #include "charset.h"
+#include "file_cache.h"
 
 #include "win32/win32dep.h"
 
@@ -63,9 +64,12 @@ ET_File::ET_File(gString&& filepath) noexcept
 :	FilePath(move(filepath))
 ,	FileSize(0)
 ,	FileModificationTime(0)
+,	FileChangeTime(0)
 ,	ETFileDescription(nullptr)
 ,	ETFileInfo{}
 ,	force_tag_save_(false)
+,	read_failed_(false)
+,	tag_pending_(false)
 ,	activate_bg_color(false)
 ,	IndexKey(~0) // invalid value
 {
@@ -447,6 +451,184 @@ gint (*ET_File::get_comp_func(EtBrowserMode browser_mode))(const ET_File *ETFile
 	}
 }
 
+/*
+ * Store a string that is likely an integer (e.g. track number).
+ * Sorted by the leading number first, like CmpInt, then by the entire string.
+ * Empty values sort first, values without a leading number last.
+ */
+void ET_File::SortKey::add_int(const xStringD0& value)
+{	Item& item = add();
+	bool complete;
+	item.Num = et_int_sort_value(value, complete);
+	if (!complete)
+		item.Str = value;
+}
+
+void ET_File::SortKey::add_path(const ET_File* file)
+{	const File_Name* name = file->FileNameCur();
+	add().Str = name->path();
+	add().Str = name->file();
+}
+
+void ET_File::SortKey::add_track(const ET_File* file)
+{	const File_Tag* tag = file->FileTagNew();
+	add_int(tag->track);
+	add_int(tag->track_total);
+	add_path(file);
+}
+
+void ET_File::SortKey::add_disc(const ET_File* file)
+{	const File_Tag* tag = file->FileTagNew();
+	add_int(tag->disc_number);
+	add_int(tag->disc_total);
+	add_track(file);
+}
+
+gint ET_File::SortKey::compare(const SortKey& r) const
+{	for (unsigned i = 0; i < Count; ++i)
+	{	const Item& li = Items[i];
+		const Item& ri = r.Items[i];
+		gint c;
+		if (li.Num != ri.Num)
+			c = li.Num < ri.Num ? -1 : 1;
+		else if (li.Str == ri.Str) // deduplicated => cheap
+			continue;
+		else if ((c = li.Str.compare(ri.Str)) == 0)
+			continue;
+		return sign(c) * (gint)(i + 1);
+	}
+	return 0;
+}
+
+const ET_File::SortKey& ET_File::sort_key(EtSortMode sort_order) const
+{
+	if (SortKeyCache && SortKeyCache->Mode == sort_order)
+		return *SortKeyCache;
+
+	SortKey* key = new SortKey(sort_order);
+	SortKeyCache.reset(key);
+	// Do not read deferred tags for sort modes that do not need them.
+	const File_Tag* tag = needs_tag(sort_order) ? FileTagNew() : nullptr;
+	switch (sort_order)
+	{
+	case ET_SORT_MODE_FILEPATH:
+		key->add_path(this);
+		break;
+	case ET_SORT_MODE_FILENAME:
+		key->add().Str = FileNameCur()->file();
+		break;
+	case ET_SORT_MODE_TITLE:
+		key->add().Str = tag->title;
+		key->add_path(this);
+		break;
+	case ET_SORT_MODE_VERSION:
+		key->add().Str = tag->version;
+		key->add_path(this);
+		break;
+	case ET_SORT_MODE_SUBTITLE:
+		key->add().Str = tag->subtitle;
+		key->add_disc(this);
+		break;
+	case ET_SORT_MODE_ARTIST:
+		key->add().Str = tag->artist;
+		key->add_path(this);
+		break;
+	case ET_SORT_MODE_ALBUM_ARTIST:
+		key->add().Str = tag->album_artist;
+		key->add_disc(this);
+		break;
+	case ET_SORT_MODE_ALBUM:
+		key->add().Str = tag->album;
+		key->add_disc(this);
+		break;
+	case ET_SORT_MODE_DISC_SUBTITLE:
+		key->add().Str = tag->disc_subtitle;
+		key->add_disc(this);
+		break;
+	case ET_SORT_MODE_YEAR:
+		key->add_int(tag->year);
+		key->add_path(this);
+		break;
+	case ET_SORT_MODE_RELEASE_YEAR:
+		key->add_int(tag->release_year);
+		key->add_path(this);
+		break;
+	case ET_SORT_MODE_DISC_NUMBER:
+		key->add_disc(this);
+		break;
+	case ET_SORT_MODE_TRACK_NUMBER:
+		key->add_track(this);
+		break;
+	case ET_SORT_MODE_GENRE:
+		key->add().Str = tag->genre;
+		key->add_path(this);
+		break;
+	case ET_SORT_MODE_COMMENT:
+		key->add().Str = tag->comment;
+		key->add_path(this);
+		break;
+	case ET_SORT_MODE_COMPOSER:
+		key->add().Str = tag->composer;
+		key->add_path(this);
+		break;
+	case ET_SORT_MODE_ORIG_ARTIST:
+		key->add().Str = tag->orig_artist;
+		key->add_path(this);
+		break;
+	case ET_SORT_MODE_ORIG_YEAR:
+		key->add_int(tag->orig_year);
+		key->add_path(this);
+		break;
+	case ET_SORT_MODE_COPYRIGHT:
+		key->add().Str = tag->copyright;
+		key->add_path(this);
+		break;
+	case ET_SORT_MODE_URL:
+		key->add().Str = tag->url;
+		key->add_path(this);
+		break;
+	case ET_SORT_MODE_ENCODED_BY:
+		key->add().Str = tag->encoded_by;
+		key->add_path(this);
+		break;
+	case ET_SORT_MODE_CREATION_DATE:
+		// Use the change time from the last scan rather than querying the file system.
+		key->add().Num = FileChangeTime;
+		key->add_path(this);
+		break;
+	case ET_SORT_MODE_FILE_TYPE:
+		if (ETFileDescription)
+			key->add().Str = ETFileDescription->Extension;
+		else
+			key->add().Num = -HUGE_VAL;
+		key->add_path(this);
+		break;
+	case ET_SORT_MODE_FILE_SIZE:
+		key->add().Num = FileSize;
+		key->add_path(this);
+		break;
+	case ET_SORT_MODE_FILE_DURATION:
+		key->add().Num = ETFileInfo.duration;
+		key->add_path(this);
+		break;
+	case ET_SORT_MODE_FILE_BITRATE:
+		key->add().Num = ETFileInfo.bitrate;
+		key->add_path(this);
+		break;
+	case ET_SORT_MODE_FILE_SAMPLERATE:
+		key->add().Num = ETFileInfo.samplerate;
+		key->add_path(this);
+		break;
+	case ET_SORT_MODE_REPLAYGAIN:
+		key->add().Num = isnan(tag->track_gain) ? -HUGE_VAL : tag->track_gain;
+		key->add_path(this);
+		break;
+	default:
+		break;
+	}
+	return *key;
+}
+
 
 ET_File::~ET_File()
 {
@@ -490,7 +672,7 @@ bool ET_File::autofix()
 /*
  * Save data contained into File_Tag structure to the file on hard disk.
  */
-gboolean ET_File::save_file_tag(GError **error)
+gboolean ET_File::write_file_tag(Stat& stat, GError **error) const
 {
     gboolean state = FALSE;
     GFile *file;
@@ -498,6 +680,16 @@ gboolean ET_File::save_file_tag(GError **error)
 
     g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
+    /* Picture data deferred to this file, including those in the tag history,
+     * must be loaded before the file is rewritten. */
+    if (!EtPicture::LoadFromFile (FilePath, error))
+        return FALSE;
+    /* The pictures to write might come from other files,
+     * the writers rely on their data to be available. */
+    for (const EtPicture& pic : FileTagNew()->pictures)
+        if (pic.storage && !pic.data(error))
+            return FALSE;
+
     /* Store the file timestamps (in case they are to be preserved) */
     file = g_file_new_for_path (FilePath);
     fileinfo = g_file_query_info (file, "time::*", G_FILE_QUERY_INFO_NONE,
@@ -524,9 +716,10 @@ gboolean ET_File::save_file_tag(GError **error)
         g_object_unref (fileinfo);
     }
 
-    /* Update the stored file modification time to prevent EasyTAG from warning
+    /* Fetch the new file modification time to prevent EasyTAG from warning
      * that an external program has changed the file. */
-    read_fileinfo(file);
+    stat = { FileSize, FileModificationTime, FileChangeTime };
+    query_fileinfo(file, stat);
 
     g_object_unref (file);
 
@@ -545,9 +738,6 @@ gboolean ET_File::save_file_tag(GError **error)
             g_free (path);
         }
 
-        // mark as saved
-        force_tag_save_ = false;
-        FileTag.mark_saved();
         return TRUE;
     }
     else
@@ -558,37 +748,85 @@ gboolean ET_File::save_file_tag(GError **error)
     }
 }
 
-gboolean ET_File::rename_file(GError **error)
+void ET_File::file_tag_written(const Stat& stat, gboolean success)
+{
+	FileSize = stat.Size;
+	FileModificationTime = stat.ModificationTime;
+	FileChangeTime = stat.ChangeTime;
+	SortKeyCache.reset();
+
+	if (success)
+	{	// mark as saved
+		force_tag_save_ = false;
+		FileTag.mark_saved();
+	}
+}
+
+gboolean ET_File::save_file_tag(GError **error)
+{
+	Stat stat;
+	gboolean rc = write_file_tag(stat, error);
+	file_tag_written(stat, rc);
+	return rc;
+}
+
+gString ET_File::rename_target() const
 {
 	// Make absolute path of the file in file system notation.
 	gString raw_name(filename_from_display(FileName.New()->full_name().get()));
-	raw_name = g_canonicalize_filename(raw_name.get(),
-		et_application_window_get_current_path_name(MainWindow));
+	return gString(g_canonicalize_filename(raw_name.get(),
+		et_application_window_get_current_path_name(MainWindow)));
+}
+
+void ET_File::file_renamed(gString&& new_path)
+{
+	FileName.mark_saved();
+	EtPicture::FileRenamed(FilePath, new_path);
+	FilePath.swap(new_path);
+	SortKeyCache.reset();
+}
+
+gboolean ET_File::rename_file(GError **error)
+{
+	gString raw_name(rename_target());
 
 	gboolean rc = et_rename_file(FilePath, raw_name, error);
 	if (rc)
-	{	FileName.mark_saved();
-		FilePath.swap(raw_name);
-	}
+		file_renamed(move(raw_name));
 
 	return rc;
 }
 
-bool ET_File::read_fileinfo(GFile* file, GError** error)
+bool ET_File::query_fileinfo(GFile* file, Stat& stat, GError** error)
 {
 	GFileInfo* fileinfo = g_file_query_info(file,
-		G_FILE_ATTRIBUTE_STANDARD_SIZE "," G_FILE_ATTRIBUTE_TIME_MODIFIED,
+		G_FILE_ATTRIBUTE_STANDARD_SIZE "," G_FILE_ATTRIBUTE_TIME_MODIFIED "," G_FILE_ATTRIBUTE_TIME_CHANGED,
 		G_FILE_QUERY_INFO_NONE, NULL, error);
 	if (!fileinfo)
 		return false;
 
-	FileSize = g_file_info_get_attribute_uint64(fileinfo, G_FILE_ATTRIBUTE_STANDARD_SIZE);
-	FileModificationTime = g_file_info_get_attribute_uint64(fileinfo, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+	stat.Size = g_file_info_get_attribute_uint64(fileinfo, G_FILE_ATTRIBUTE_STANDARD_SIZE);
+	stat.ModificationTime = g_file_info_get_attribute_uint64(fileinfo, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+	// not available on all platforms => 0
+	stat.ChangeTime = g_file_info_get_attribute_uint64(fileinfo, G_FILE_ATTRIBUTE_TIME_CHANGED);
 	g_object_unref (fileinfo);
 	return true;
 }
 
-bool ET_File::read_file(GFile *file, const gchar *root, GError **error)
+bool ET_File::read_fileinfo(GFile* file, GError** error)
+{
+	Stat stat;
+	if (!query_fileinfo(file, stat, error))
+		return false;
+
+	FileSize = stat.Size;
+	FileModificationTime = stat.ModificationTime;
+	FileChangeTime = stat.ChangeTime;
+	return true;
+}
+
+bool ET_File::read_file(GFile *file, const gchar *root, GError **error, const ET_FileCache* cache,
+	bool defer_tag, bool sniff, ET_FileHead* head)
 {
   /* Get description of the file */
   const char* filename = FilePath;
@@ -614,20 +852,90 @@ bool ET_File::read_file(GFile *file, const gchar *root, GError **error)
 	{	// bypass handler if we did not even get the file size.
 		ETFileDescription = ET_File_Description::Get(nullptr);
 	} else
-	{	ETFileDescription = ET_File_Description::Get(filename);
+	{	if (!ETFileDescription)
+			ETFileDescription = ET_File_Description::Get(filename);
 		if (ETFileDescription->read_file)
-			fileTag = (*ETFileDescription->read_file)(file, this, error);
+		{	if (cache)
+				fileTag = cache->restore(*this);
+			if (!fileTag && defer_tag)
+			{	// placeholder until the tag is read, the type is verified then
+				tag_pending_ = true;
+				fileTag = new File_Tag();
+			} else if (!fileTag)
+			{	// The reader continues with the file opened by the caller or the type check if it can.
+				ET_FileHead local;
+				if (!head)
+					head = &local;
+				if (sniff && ETFileDescription->sniff && head->read(FilePath))
+					ETFileDescription = ETFileDescription->Verify(*head);
+				if (head->Fd >= 0 && ETFileDescription->read_file_head)
+					fileTag = (*ETFileDescription->read_file_head)(*head, this, error);
+				else
+					fileTag = (*ETFileDescription->read_file)(file, this, error);
+			}
+		}
 	}
 
-	bool rc = true;
+	read_failed_ = !fileTag;
 	if (!fileTag)
-	{	fileTag = new File_Tag(); // add empty tag in doubt
-		rc = false;
-	}
+		fileTag = new File_Tag(); // add empty tag in doubt
 	FileTag.add(fileTag, 0);
 	FileTag.mark_saved();
 
-	return rc;
+	return !read_failed_;
+}
+
+void ET_File::load_tag()
+{
+	ET_File source(gString(g_strdup(FilePath)));
+	source.ETFileDescription = ETFileDescription;
+	gObject<GFile> file(g_file_new_for_path(FilePath));
+	GError* error = nullptr;
+	source.read_file(file.get(), nullptr, &error, nullptr, false, g_settings_get_boolean(MainSettings, "scan-sniff-type"));
+	complete_tag(source, error ? error->message : nullptr);
+	if (error)
+		g_error_free(error);
+}
+
+bool ET_File::complete_tag(ET_File& source, const gchar* error)
+{
+	if (!tag_pending_)
+		return false;
+	// The placeholder is never edited because any access reads the tag first.
+	g_assert(FileTag.is_saved() && !FileTag.undo_key());
+	tag_pending_ = false;
+
+	take_over(source, error);
+	return true;
+}
+
+bool ET_File::update_from(ET_File& source, const gchar* error)
+{
+	if (tag_pending_ || !is_saved())
+		return false;
+
+	take_over(source, error);
+	return true;
+}
+
+void ET_File::take_over(ET_File& source, const gchar* error)
+{
+	FileSize = source.FileSize;
+	FileModificationTime = source.FileModificationTime;
+	FileChangeTime = source.FileChangeTime;
+	ETFileDescription = source.ETFileDescription;
+	swap(ETFileInfo, source.ETFileInfo);
+	other = move(source.other);
+	read_failed_ = source.read_failed_;
+	force_tag_save_ |= source.force_tag_save_;
+	FileTag.reset(new File_Tag(*source.FileTag.Cur()));
+	SortKeyCache.reset();
+
+	if (error)
+		Log_Print(LOG_ERROR, _("Error reading tag from %s ‘%s’: %s"),
+			ETFileDescription->FileType, FileNameNew()->full_name().get(), error);
+	else if (autofix())
+		Log_Print(LOG_INFO, _("Automatic corrections applied for file ‘%s’"), FileNameNew()->full_name().get());
 }
 
 /*
@@ -665,6 +973,7 @@ bool ET_File::apply_changes(File_Name *fileName, File_Tag *fileTag)
 		FileName.add(fileName, undo_key);
 	if (fileTag)
 		FileTag.add(fileTag, undo_key);
+	SortKeyCache.reset();
 
 	if (undo_key)
 	{	// Add the item to the list (cut end of list from the current element)
@@ -695,6 +1004,7 @@ bool ET_File::undo()
 	if (undo_key == FileTag.undo_key())
 		FileTag.undo();
 
+	SortKeyCache.reset();
 	return true;
 }
 
@@ -717,9 +1027,23 @@ bool ET_File::redo()
 	if (undo_key == FileTag.redo_key())
 		FileTag.redo();
 
+	SortKeyCache.reset();
 	return true;
 }
 
+void ET_File::prune_undo_history(bool (*keep)(const ET_File* file))
+{
+	unsigned redo = ETHistoryFileListRedo;
+	auto dst = ETHistoryFileList.begin();
+	for (auto src = dst; src != ETHistoryFileList.end(); ++src)
+		if (keep(src->get()))
+			*dst++ = move(*src);
+		else if ((unsigned)(src - ETHistoryFileList.begin()) < ETHistoryFileListRedo)
+			--redo;
+	ETHistoryFileList.erase(dst, ETHistoryFileList.end());
+	ETHistoryFileListRedo = redo;
+}
+
 ET_File* ET_File::global_undo()
 {
 	if (!has_global_undo())
@@ -752,5 +1076,7 @@ bool ET_File::update_directory_name(const UpdateDirectoyNameArgs& args)
 		FileName.foreach([&args, &changed](File_Name* file_name)
 		{	changed |= file_name->update_directory_name(args);
 		});
+	if (changed)
+		SortKeyCache.reset();
 	return changed;
 }
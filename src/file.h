@@ -30,6 +30,8 @@
 #include "xptr.h"
 #include "acoustid.h"
 
+class ET_FileCache;
+
 #include <vector>
 #include <atomic>
 
@@ -60,10 +62,49 @@ typedef struct
 class ET_File : public xObj
 {
 public:
+	/// Precomputed sort criteria of a file for one sort mode.
+	/// @details Comparing two keys is much cheaper than the functions
+	/// from \ref get_comp_func, since numbers are parsed only once
+	/// and strings are compared by their cached collation keys.
+	class SortKey
+	{	friend class ET_File;
+		/// One criterion, either numeric or string or both.
+		struct Item
+		{	double Num = 0;
+			xStringD0 Str;
+		};
+		/// Max. number of criteria of any sort mode.
+		static constexpr unsigned MaxItems = 7;
+		EtSortMode Mode;
+		unsigned char Count = 0;
+		Item Items[MaxItems];
+
+		SortKey(EtSortMode mode) : Mode(mode) {}
+		Item& add() { g_assert(Count < MaxItems); return Items[Count++]; }
+		void add_int(const xStringD0& value);
+		void add_path(const ET_File* file);
+		void add_track(const ET_File* file);
+		void add_disc(const ET_File* file);
+	public:
+		/// Relational comparison (spaceship operator)
+		/// @return The absolute value is the 1 based index of the first differing criterion,
+		/// i.e. 1 if the primary criterion differs, like the functions from \ref get_comp_func.
+		/// @pre Both keys must be of the same sort mode.
+		gint compare(const SortKey& r) const;
+	};
+
+	/// File system information of a file.
+	struct Stat
+	{	guint64 Size;             ///< File size in bytes
+		guint64 ModificationTime; ///< Modification time of the file
+		guint64 ChangeTime;       ///< Status change time of the file
+	};
+
 	gString FilePath;             ///< Full raw path of the file, do not use in UI.
 
 	guint64 FileSize;             ///< File size in bytes
 	guint64 FileModificationTime; ///< Save modification time of the file
+	guint64 FileChangeTime;       ///< Status change time of the file, used to validate cached tag data
 
 	const ET_File_Description *ETFileDescription;
 	ET_File_Info        ETFileInfo; ///< Header infos: bitrate, duration, ...
@@ -73,6 +114,12 @@ private:
 	UndoList<File_Name> FileName; ///< File name data with change history
 	UndoList<File_Tag>  FileTag;  ///< File tag data with change history
 	bool force_tag_save_;
+	bool read_failed_;
+	/// Tag and header information not yet read, see \ref read_file.
+	/// @remarks Only modified by the main thread.
+	std::atomic<bool> tag_pending_;
+	/// Cached sort key of the last used sort mode, discarded on changes.
+	mutable std::unique_ptr<SortKey> SortKeyCache;
 
 	/// Key for Undo, strongly monotonic
 	static std::atomic<unsigned> ETUndoKey;
@@ -100,10 +147,18 @@ public: // Injection from Acoustid
 #endif
 
 private:
-	/// Populate FileSize and FileModificationTime
+	/// Populate FileSize, FileModificationTime and FileChangeTime
 	bool read_fileinfo(GFile* file, GError **error = nullptr);
+	/// Read the deferred tag synchronously.
+	void load_tag();
+	/// Replace file information and tag by those of \a source
+	/// and discard the tag history.
+	void take_over(ET_File& source, const gchar* error);
 
 public:
+	/// Query size, modification time and change time of a file.
+	static bool query_fileinfo(GFile* file, Stat& stat, GError **error = nullptr);
+
 	/// Create file
 	/// @param filepath Full file path in file system encoding.
 	ET_File(gString&& filepath) noexcept;
@@ -119,11 +174,44 @@ public:
 	const File_Name* FileNameNew() const { return FileName.New(); }
 
 	/// Currently saved tag data
-	const File_Tag* FileTagCur() const { return FileTag.Cur(); }
+	const File_Tag* FileTagCur() const { require_tag(); return FileTag.Cur(); }
 	/// Current, possibly unsaved tag data
-	const File_Tag* FileTagNew() const { return FileTag.New(); }
-
-	bool read_file(GFile *file, const gchar *root, GError **error);
+	const File_Tag* FileTagNew() const { require_tag(); return FileTag.New(); }
+
+	/// Read file information and tag data.
+	/// @param cache Optional tag cache. If the cache contains a valid entry
+	/// the file is not parsed at all.
+	/// @param defer_tag Only read the file system information unless the cache has a valid entry.
+	/// The tag is read on first access or supplied later by \ref complete_tag.
+	/// @param sniff Verify the file type by the first bytes of the file rather than trusting the extension.
+	/// Only done when the tag is actually read, i.e. neither restored from \a cache nor deferred.
+	/// The file is opened once for the check and the reader if the reader supports it.
+	/// @param head File opened in advance by the caller, optional.
+	bool read_file(GFile *file, const gchar *root, GError **error, const ET_FileCache* cache = nullptr,
+		bool defer_tag = false, bool sniff = false, ET_FileHead* head = nullptr);
+	/// Check whether the last call to \ref read_file failed.
+	bool read_failed() const { return read_failed_; }
+	/// Check whether the tag and header information has been deferred and is still not read.
+	/// @remarks This function is thread-safe.
+	bool tag_pending() const { return tag_pending_; }
+	/// Read a deferred tag synchronously if not yet done.
+	/// @remarks Must be called from the main thread.
+	void require_tag() const { if (G_UNLIKELY(tag_pending_)) const_cast<ET_File*>(this)->load_tag(); }
+	/// Take over the tag and header information of a deferred tag read by a worker thread.
+	/// @param source Temporary instance of the same file filled by \ref read_file.
+	/// @param error Error message of \ref read_file, \c nullptr on success.
+	/// @return \c false if the tag of this instance is no longer pending.
+	/// @remarks Must be called from the main thread.
+	bool complete_tag(ET_File& source, const gchar* error);
+	/// Replace file information and tag by a fresh read, e.g. after another program modified the file.
+	/// @param source Temporary instance of the same file filled by \ref read_file.
+	/// @param error Error message of \ref read_file, \c nullptr on success.
+	/// @return \c false if the file has unsaved changes or a deferred tag and has not been updated.
+	/// @remarks Must be called from the main thread.
+	bool update_from(ET_File& source, const gchar* error);
+	/// Check whether a sort mode or column depends on tag or header information.
+	static bool needs_tag(EtSortMode mode)
+	{	return mode > ET_SORT_MODE_FILENAME && (mode < ET_SORT_MODE_CREATION_DATE || mode > ET_SORT_MODE_FILE_SIZE); }
 
 	/// Add new version of file and tag data to the undo list.
 	/// @return Undo key generated, i.e. at least one of \a fileName or \a fileTag caused a change.
@@ -161,6 +249,9 @@ public:
 
 	/// Discard any global undo history
 	static void reset_undo_history() { ETHistoryFileListRedo = 0; ETHistoryFileList.clear(); }
+	/// Discard the global undo history of some files, e.g. files that disappeared on reload.
+	/// @param keep Predicate that returns \c false for the files to remove.
+	static void prune_undo_history(bool (*keep)(const ET_File* file));
 
 	bool is_filename_saved() const { return FileName.is_saved(); }
 	bool is_filetag_saved() const { return FileTag.is_saved() && !force_tag_save_; }
@@ -171,10 +262,30 @@ public:
 	/// Used by read_tag implementations to identify invisible changes,
 	/// e.g. automatic tag version upgrades.
 	void force_tag_save() { force_tag_save_ = true; }
+	/// Check whether \ref force_tag_save has been called since the last save.
+	bool tag_save_forced() const { return force_tag_save_; }
 
 	bool autofix();
 
+	/// Write the tag to the file.
+	/// @details This is the I/O part of \ref save_file_tag. It does not modify the instance
+	/// and may be called from a worker thread while the main thread only reads the instance.
+	/// \ref file_tag_written must be called in the main thread afterwards.
+	/// @param stat [out] File information after the write operation.
+	gboolean write_file_tag(Stat& stat, GError **error) const;
+	/// Update the state after \ref write_file_tag completed.
+	/// @param success Return value of \ref write_file_tag.
+	void file_tag_written(const Stat& stat, gboolean success);
+	/// Write the tag to the file and mark it as saved.
 	gboolean save_file_tag(GError **error);
+
+	/// Absolute target path of a pending rename in file system encoding.
+	/// @remarks The path depends on the current directory of the browser,
+	/// so the function must be called from the main thread.
+	gString rename_target() const;
+	/// Update the state after the file has been moved to \a new_path.
+	void file_renamed(gString&& new_path);
+	/// Rename the file to the current file name and mark it as saved.
 	gboolean rename_file(GError **error);
 
 	/// Notify about a directory rename operation.
@@ -183,6 +294,10 @@ public:
 	bool update_directory_name(const UpdateDirectoyNameArgs& args);
 
 	static gint (*get_comp_func(EtSortMode sort_order, gboolean desc))(const ET_File *ETFile1, const ET_File *ETFile2);
+	/// Get the sort key of this file for a sort mode.
+	/// @details The key is cached until the file name or the tag changes or another mode is requested.
+	/// Must be called from the main thread.
+	const SortKey& sort_key(EtSortMode sort_order) const;
 	static gint (*get_comp_func(EtBrowserMode browser_mode))(const ET_File *ETFile1, const ET_File *ETFile2);
 };
 
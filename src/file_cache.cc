@@ -0,0 +1,407 @@
+/* EasyTAG - tag editor for audio files
+ * Copyright (C) 2026  Marcel Müller <github@maazl.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "config.h"
+
+#include "file_cache.h"
+
+#include <glib/gstdio.h>
+
+#include "file.h"
+#include "file_tag.h"
+#include "picture.h"
+#include "log.h"
+
+#include <cerrno>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+using namespace std;
+
+
+/// Increment whenever the layout of the cache changes.
+static const guint32 CacheVersion = 3;
+
+/// GVariant type of one file entry:
+/// path, size, mtime, ctime, forced save, extension of the file type,
+/// ET_File_Info, tag strings, ReplayGain, pictures (type, description, width, height, index, offset, size), other.
+/// Pictures that are loaded from the file on demand have an offset &ge; 0 and no index.
+#define ENTRY_TYPE "(aytttbs(itibiidmsms)ams(dddd)a(usiiuxu)as)"
+/// GVariant type of the cache file: version, picture data, entries.
+#define ROOT_TYPE "(uaaya" ENTRY_TYPE ")"
+
+/// Text fields of File_Tag in the order of the cache entries.
+static xStringD0 File_Tag::* const TagFields[] =
+{	&File_Tag::title,
+	&File_Tag::subtitle,
+	&File_Tag::version,
+	&File_Tag::artist,
+	&File_Tag::album_artist,
+	&File_Tag::album,
+	&File_Tag::disc_subtitle,
+	&File_Tag::disc_number,
+	&File_Tag::disc_total,
+	&File_Tag::year,
+	&File_Tag::release_year,
+	&File_Tag::track,
+	&File_Tag::track_total,
+	&File_Tag::genre,
+	&File_Tag::comment,
+	&File_Tag::composer,
+	&File_Tag::orig_artist,
+	&File_Tag::orig_year,
+	&File_Tag::copyright,
+	&File_Tag::url,
+	&File_Tag::encoded_by,
+	&File_Tag::description
+};
+
+gString ET_FileCache::CacheFileName(const gchar* root)
+{	gString hash(g_compute_checksum_for_string(G_CHECKSUM_SHA1, root, -1));
+	gString name(g_strconcat("scan-", hash.get(), ".cache", NULL));
+	return gString(g_build_filename(g_get_user_cache_dir(), PACKAGE_TARNAME, name.get(), NULL));
+}
+
+ET_FileCache::ET_FileCache(const gchar* root)
+:	Root(nullptr)
+,	Entries(nullptr)
+,	Pictures(nullptr)
+,	Misses(0)
+{
+	gString path(CacheFileName(root));
+	GError* error = nullptr;
+	GMappedFile* mapped = g_mapped_file_new(path, FALSE, &error);
+	if (!mapped)
+	{	g_debug("No tag cache for %s: %s", root, error->message);
+		g_error_free(error);
+		return;
+	}
+	GBytes* bytes = g_mapped_file_get_bytes(mapped);
+	g_mapped_file_unref(mapped);
+	Root = g_variant_ref_sink(g_variant_new_from_bytes(G_VARIANT_TYPE(ROOT_TYPE), bytes, FALSE));
+	g_bytes_unref(bytes);
+
+	guint32 version;
+	g_variant_get_child(Root, 0, "u", &version);
+	if (version != CacheVersion)
+	{	g_debug("Discarding tag cache of %s with version %u", root, version);
+		return;
+	}
+	Pictures = g_variant_get_child_value(Root, 1);
+	Entries = g_variant_get_child_value(Root, 2);
+
+	gsize count = g_variant_n_children(Entries);
+	Index.reserve(count);
+	for (gsize i = 0; i < count; ++i)
+	{	GVariant* entry = g_variant_get_child_value(Entries, i);
+		GVariant* path = g_variant_get_child_value(entry, 0);
+		Index.emplace(g_variant_get_bytestring(path), i);
+		g_variant_unref(path);
+		g_variant_unref(entry);
+	}
+}
+
+ET_FileCache::~ET_FileCache()
+{	if (Entries)
+		g_variant_unref(Entries);
+	if (Pictures)
+		g_variant_unref(Pictures);
+	if (Root)
+		g_variant_unref(Root);
+}
+
+File_Tag* ET_FileCache::restore(ET_File& file) const
+{
+	auto it = Index.find(file.FilePath.get());
+	if (it == Index.end())
+	{	++Misses;
+		return nullptr;
+	}
+
+	GVariant* entry = g_variant_get_child_value(Entries, it->second);
+	const gchar* path;
+	guint64 size, mtime, ctime;
+	gboolean forced;
+	const gchar* extension;
+	ET_File_Info info{};
+	guint64 layer;
+	GVariantIter* strings;
+	double gains[4];
+	GVariantIter* pictures;
+	GVariantIter* other;
+	g_variant_get(entry, "(^&aytttb&s(itibiidmsms)ams(dddd)a(usiiuxu)as)",
+		&path, &size, &mtime, &ctime, &forced, &extension,
+		&info.version, &layer, &info.bitrate, &info.variable_bitrate, &info.samplerate, &info.mode, &info.duration,
+		&info.mpc_profile, &info.mpc_version,
+		&strings, gains, gains + 1, gains + 2, gains + 3, &pictures, &other);
+	g_variant_unref(entry);
+
+	File_Tag* tag = nullptr;
+	if (size != file.FileSize || mtime != file.FileModificationTime || ctime != file.FileChangeTime)
+	{	++Misses;
+		g_free(info.mpc_profile);
+		g_free(info.mpc_version);
+		goto end;
+	}
+
+	// The type might have been verified by the content.
+	if (strcmp(extension, file.ETFileDescription->Extension) != 0)
+	{	const ET_File_Description* desc = ET_File_Description::Get(extension);
+		if (desc->read_file)
+			file.ETFileDescription = desc;
+	}
+
+	tag = new File_Tag();
+	{	const gchar* value;
+		for (auto field : TagFields)
+			if (g_variant_iter_next(strings, "m&s", &value))
+				tag->*field = value;
+	}
+	tag->track_gain = gains[0];
+	tag->track_peak = gains[1];
+	tag->album_gain = gains[2];
+	tag->album_peak = gains[3];
+
+	{	guint32 type, index, len32;
+		const gchar* description;
+		gint32 width, height;
+		gint64 offset;
+		gsize count = g_variant_n_children(Pictures);
+		while (g_variant_iter_next(pictures, "(u&siiuxu)", &type, &description, &width, &height, &index, &offset, &len32))
+		{	if (offset >= 0)
+			{	tag->pictures.emplace_back((EtPictureType)type, xStringD0(description), width, height, file, offset, len32);
+				continue;
+			}
+			if (index >= count)
+				continue; // corrupt cache
+			GVariant* data = g_variant_get_child_value(Pictures, index);
+			gsize len;
+			gconstpointer bytes = g_variant_get_fixed_array(data, &len, 1);
+			tag->pictures.emplace_back((EtPictureType)type, xStringD0(description), width, height, bytes, len);
+			g_variant_unref(data);
+		}
+	}
+
+	{	gsize count = g_variant_iter_n_children(other);
+		if (count)
+		{	gString* arr = new gString[count + 1];
+			gchar* value;
+			for (gString* dst = arr; g_variant_iter_next(other, "s", &value); ++dst)
+				*dst = value;
+			file.other.reset(arr);
+		}
+	}
+
+	info.layer = layer;
+	g_free(file.ETFileInfo.mpc_profile);
+	g_free(file.ETFileInfo.mpc_version);
+	file.ETFileInfo = info;
+	if (forced)
+		file.force_tag_save();
+
+end:
+	g_variant_iter_free(strings);
+	g_variant_iter_free(pictures);
+	g_variant_iter_free(other);
+	return tag;
+}
+
+/// Data of one file to store, captured by the main thread
+/// because the ET_File may change while the cache is written.
+struct ET_FileCache::StoreEntry
+{	gString Path;
+	guint64 Size;
+	guint64 ModificationTime;
+	guint64 ChangeTime;
+	bool Forced;
+	/// Extension of the file type, static.
+	const char* Type;
+	/// Copy with own strings.
+	ET_File_Info Info;
+	File_Tag Tag;
+	vector<gString> Other;
+	/// File offset of each picture of Tag if it is loaded from the file on demand, -1 otherwise.
+	vector<goffset> PictureOffsets;
+
+	StoreEntry(const ET_File& file);
+	StoreEntry(StoreEntry&& r) noexcept;
+	~StoreEntry();
+};
+
+ET_FileCache::StoreEntry::StoreEntry(const ET_File& file)
+:	Path(g_strdup(file.FilePath))
+,	Size(file.FileSize)
+,	ModificationTime(file.FileModificationTime)
+,	ChangeTime(file.FileChangeTime)
+,	Forced(file.tag_save_forced())
+,	Type(file.ETFileDescription->Extension)
+,	Info(file.ETFileInfo)
+,	Tag(*file.FileTagCur())
+{	Info.mpc_profile = g_strdup(Info.mpc_profile);
+	Info.mpc_version = g_strdup(Info.mpc_version);
+	if (file.other)
+		for (const gString* l = file.other.get(); *l; ++l)
+			Other.emplace_back(g_strdup(*l));
+	PictureOffsets.reserve(Tag.pictures.size());
+	for (const EtPicture& pic : Tag.pictures)
+		PictureOffsets.push_back(pic.file_offset(file));
+}
+
+ET_FileCache::StoreEntry::StoreEntry(StoreEntry&& r) noexcept
+:	Path(move(r.Path))
+,	Size(r.Size)
+,	ModificationTime(r.ModificationTime)
+,	ChangeTime(r.ChangeTime)
+,	Forced(r.Forced)
+,	Type(r.Type)
+,	Info(r.Info)
+,	Tag(move(r.Tag))
+,	Other(move(r.Other))
+,	PictureOffsets(move(r.PictureOffsets))
+{	r.Info.mpc_profile = nullptr;
+	r.Info.mpc_version = nullptr;
+}
+
+ET_FileCache::StoreEntry::~StoreEntry()
+{	g_free(Info.mpc_profile);
+	g_free(Info.mpc_version);
+}
+
+// Synchronize the background writers.
+static mutex StoreMutex;
+static condition_variable StoreCond;
+// Number of pending background writes.
+static unsigned StorePending = 0;
+// Sequence number of the latest store request per cache file,
+// older requests are discarded.
+static unordered_map<string, unsigned> StoreLatest;
+static unsigned StoreSequence = 0;
+
+void ET_FileCache::store(const gchar* root, const vector<xPtr<ET_File>>& files)
+{
+	// The snapshot is cheap, strings and pictures are shared.
+	vector<StoreEntry> entries;
+	entries.reserve(files.size());
+	for (const ET_File* file : files)
+		if (!file->read_failed())
+			entries.emplace_back(*file);
+
+	string path(CacheFileName(root).get());
+	unsigned sequence;
+	{	lock_guard<mutex> lock(StoreMutex);
+		sequence = StoreLatest[path] = ++StoreSequence;
+		++StorePending;
+	}
+
+	thread([path = move(path), entries = move(entries), sequence]()
+	{	auto latest = [&path, sequence]()
+		{	auto it = StoreLatest.find(path);
+			return it != StoreLatest.end() && it->second == sequence ? it : StoreLatest.end();
+		};
+		bool superseded;
+		{	lock_guard<mutex> lock(StoreMutex);
+			superseded = latest() == StoreLatest.end();
+		}
+		if (!superseded)
+			write(path.c_str(), entries);
+
+		lock_guard<mutex> lock(StoreMutex);
+		auto it = latest();
+		if (it != StoreLatest.end())
+			StoreLatest.erase(it);
+		--StorePending;
+		StoreCond.notify_all();
+	}).detach();
+}
+
+void ET_FileCache::wait()
+{	unique_lock<mutex> lock(StoreMutex);
+	while (StorePending)
+		StoreCond.wait(lock);
+}
+
+void ET_FileCache::write(const gchar* path, const vector<StoreEntry>& files)
+{
+	GVariantBuilder pictures;
+	g_variant_builder_init(&pictures, G_VARIANT_TYPE("aay"));
+	unordered_map<const EtPicture::Data*, guint32> picture_index;
+
+	GVariantBuilder entries;
+	g_variant_builder_init(&entries, G_VARIANT_TYPE("a" ENTRY_TYPE));
+
+	for (const StoreEntry& file : files)
+	{	const File_Tag* tag = &file.Tag;
+		const ET_File_Info& info = file.Info;
+
+		GVariantBuilder strings;
+		g_variant_builder_init(&strings, G_VARIANT_TYPE("ams"));
+		for (auto field : TagFields)
+			// preserve the distinction between null and empty
+			g_variant_builder_add(&strings, "ms", static_cast<const xStringD&>(tag->*field).get());
+
+		GVariantBuilder pics;
+		g_variant_builder_init(&pics, G_VARIANT_TYPE("a(usiiuxu)"));
+		for (size_t i = 0; i < tag->pictures.size(); ++i)
+		{	const EtPicture& pic = tag->pictures[i];
+			if (!pic.storage)
+				continue;
+			// Do not load deferred image data just to cache it.
+			goffset offset = file.PictureOffsets[i];
+			if (offset >= 0)
+			{	g_variant_builder_add(&pics, "(usiiuxu)", (guint32)pic.type, pic.description.get(),
+					(gint32)pic.storage->Width, (gint32)pic.storage->Height, G_MAXUINT32, (gint64)offset, pic.storage->Size);
+				continue;
+			}
+			const EtPicture::Data* data = pic.data();
+			if (!data)
+				continue;
+			auto ins = picture_index.emplace(data, (guint32)picture_index.size());
+			if (ins.second)
+				g_variant_builder_add_value(&pictures, g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE,
+					data->Bytes, data->Size, 1));
+			g_variant_builder_add(&pics, "(usiiuxu)", (guint32)pic.type, pic.description.get(),
+				(gint32)pic.storage->Width, (gint32)pic.storage->Height, ins.first->second, (gint64)-1, 0U);
+		}
+
+		GVariantBuilder other;
+		g_variant_builder_init(&other, G_VARIANT_TYPE_STRING_ARRAY);
+		for (const gString& l : file.Other)
+			g_variant_builder_add(&other, "s", l.get());
+
+		g_variant_builder_add(&entries, "(^aytttbs(itibiidmsms)ams(dddd)a(usiiuxu)as)",
+			file.Path.get(), file.Size, file.ModificationTime, file.ChangeTime, (gboolean)file.Forced, file.Type,
+			info.version, (guint64)info.layer, info.bitrate, info.variable_bitrate, info.samplerate, info.mode, info.duration,
+			info.mpc_profile, info.mpc_version,
+			&strings, (double)tag->track_gain, (double)tag->track_peak, (double)tag->album_gain, (double)tag->album_peak,
+			&pics, &other);
+	}
+
+	GVariant* cache = g_variant_ref_sink(g_variant_new("(u@aay@a" ENTRY_TYPE ")", CacheVersion,
+		g_variant_builder_end(&pictures), g_variant_builder_end(&entries)));
+
+	gString dir(g_path_get_dirname(path));
+	GError* error = nullptr;
+	if (g_mkdir_with_parents(dir, S_IRWXU) == -1
+		|| !g_file_set_contents(path, (const gchar*)g_variant_get_data(cache), g_variant_get_size(cache), &error))
+	{	Log_Print(LOG_WARNING, "Failed to write tag cache %s: %s", path, error ? error->message : g_strerror(errno));
+		if (error)
+			g_error_free(error);
+	}
+
+	g_variant_unref(cache);
+}
@@ -0,0 +1,95 @@
+/* EasyTAG - tag editor for audio files
+ * Copyright (C) 2026  Marcel Müller <github@maazl.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef ET_FILE_CACHE_H_
+#define ET_FILE_CACHE_H_
+
+#include <glib.h>
+
+#include "misc.h"
+#include "xptr.h"
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <atomic>
+
+class ET_File;
+struct File_Tag;
+
+/// Persistent cache of parsed tag data of a root directory.
+/// @details The cache stores File_Tag, ET_File_Info and the pictures
+/// of all files of a directory scan in the user's cache directory.
+/// Entries are validated by file size, modification time and change time,
+/// so files with unchanged stat data need not to be parsed again.
+/// @remarks Once loaded the instance is read-only and may be used
+/// by multiple worker threads concurrently.
+class ET_FileCache
+{
+	/// Serialized cache content, mapped from the cache file.
+	GVariant* Root;
+	/// File entries of \ref Root.
+	GVariant* Entries;
+	/// Picture data of \ref Root, each distinct picture is stored only once.
+	GVariant* Pictures;
+	/// Map file path to index in \ref Entries.
+	std::unordered_map<std::string, gsize> Index;
+	/// Number of lookups that did not hit a valid cache entry.
+	mutable std::atomic<unsigned> Misses;
+
+	/// Location of the cache file for a root directory.
+	static gString CacheFileName(const gchar* root);
+
+public:
+	/// Load the cache of a root directory.
+	/// @param root Root directory in file system encoding.
+	/// @remarks If there is no valid cache for \a root the cache is just empty.
+	explicit ET_FileCache(const gchar* root);
+	~ET_FileCache();
+
+	/// Restore tag and header data from the cache.
+	/// @param file File to restore. FilePath, FileSize, FileModificationTime
+	/// and FileChangeTime must already be valid.
+	/// @return Restored tag data or \c nullptr if there is no matching cache entry.
+	/// In the latter case \a file is not modified.
+	File_Tag* restore(ET_File& file) const;
+	/// Check whether there is an entry for \a path, it might be outdated.
+	bool contains(const gchar* path) const { return Index.count(path) != 0; }
+
+	/// Check whether \ref store would write anything different from the current content.
+	/// @param count Number of files in the new scan result.
+	bool modified(std::size_t count) const { return Misses || count != Index.size(); }
+
+	/// Write the cache of a root directory.
+	/// @details The data of the files is captured immediately,
+	/// the cache is serialized and written by a background thread.
+	/// @param root Root directory in file system encoding.
+	/// @param files Result of the directory scan.
+	/// Files that could not be read successfully are not stored.
+	/// @remarks Must be called from the thread that owns \a files.
+	static void store(const gchar* root, const std::vector<xPtr<ET_File>>& files);
+	/// Wait until all pending writes of \ref store completed.
+	static void wait();
+
+private:
+	/// Serialize and write the cache file.
+	struct StoreEntry;
+	static void write(const gchar* path, const std::vector<StoreEntry>& files);
+};
+
+#endif /* ET_FILE_CACHE_H_ */
@@ -21,6 +21,16 @@
 #include "misc.h"
 
 #include <glib/gi18n.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifdef G_OS_WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
 
 #include <vector>
 #include <algorithm>
@@ -46,16 +56,84 @@ ET_File_Description::ET_File_Description()
 	support_multiple_pictures = [](const ET_File* file) { return true; };
 }
 
+/// Maximum length of a registered extension including the dot.
+static constexpr size_t MaxExtension = 15;
+
+const vector<const ET_File_Description*>& ET_File_Description::Sorted()
+{	// All instances are static, so the registration is complete at the first call.
+	static const vector<const ET_File_Description*> sorted = []()
+	{	vector<const ET_File_Description*> sorted;
+		for (auto desc = Root; desc; desc = desc->Link)
+		{	g_assert(strlen(desc->Extension) <= MaxExtension);
+			sorted.push_back(desc);
+		}
+		// Registered extensions are lower case.
+		stable_sort(sorted.begin(), sorted.end(),
+			[](const ET_File_Description* l, const ET_File_Description* r) { return strcmp(l->Extension, r->Extension) < 0; });
+		return sorted;
+	}();
+	return sorted;
+}
+
 const ET_File_Description* ET_File_Description::Get(const gchar *filename)
 {	filename = ET_Get_File_Extension(filename);
 	if (!et_str_empty(filename))
-		for (auto desc = Root; desc; desc = desc->Link)
-			if (g_ascii_strcasecmp(desc->Extension, filename) == 0)
-				return desc;
+	{	char ext[MaxExtension + 1];
+		size_t i = 0;
+		for (; filename[i] && i < MaxExtension; ++i)
+			ext[i] = g_ascii_tolower(filename[i]);
+		if (!filename[i])
+		{	ext[i] = 0;
+			const auto& sorted = Sorted();
+			auto it = binary_find(sorted.begin(), sorted.end(), ext,
+				[](const ET_File_Description* desc, const char* ext) { return strcmp(desc->Extension, ext); });
+			if (it.second)
+				return *it.first;
+		}
+	}
 	// If not found in the list
 	return &NotSupportedDescription;
 }
 
+const ET_File_Description* ET_File_Description::Verify(const ET_FileHead& head) const
+{	if (!sniff || sniff(head.Data, head.Len))
+		return this;
+	// ID3v2 may precede several file types.
+	if (head.Len >= 3 && memcmp(head.Data, "ID3", 3) == 0)
+		return this;
+	for (auto other : Sorted())
+		if (other->sniff && other->read_file != read_file && other->sniff(head.Data, head.Len))
+			return other;
+	return this;
+}
+
+ET_FileHead::~ET_FileHead()
+{	if (Fd >= 0)
+		close(Fd);
+}
+
+bool ET_FileHead::open(const gchar* path)
+{	Fd = g_open(path, O_RDONLY | O_BINARY, 0);
+	return Fd >= 0;
+}
+
+bool ET_FileHead::read(const gchar* path)
+{	if (Fd < 0 && !open(path))
+		return false;
+	while (Len < sizeof Data)
+	{	auto r = ::read(Fd, Data + Len, sizeof Data - Len);
+		if (r < 0)
+		{	if (errno == EINTR)
+				continue;
+			return false;
+		}
+		if (r == 0)
+			break; // EOF
+		Len += r;
+	}
+	return true;
+}
+
 string ET_Remove_File_Extension(const gchar *filename)
 {	string ret;
 	if (filename)
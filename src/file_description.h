@@ -28,8 +28,10 @@
 
 struct ET_File;
 struct File_Tag;
+struct ET_FileHead;
 
 #include <string>
+#include <vector>
 
 /*
  * EtFileHeaderFields:
@@ -81,6 +83,9 @@ struct ET_File_Description
     // temporary vtable for ET_File...
     /// read tag and file information from file
     File_Tag* (*read_file)(GFile* gfile, ET_File* FileTag, GError** error);
+    /// Like \ref read_file but continue with the file opened by the type check.
+    /// @remarks Optional, readers that open the file by a library use \ref read_file.
+    File_Tag* (*read_file_head)(ET_FileHead& head, ET_File* FileTag, GError** error);
     /// write tag to file
     gboolean (*write_file_tag)(const ET_File* file, GError** error);
     /// extract file header information for UI
@@ -89,15 +94,54 @@ struct ET_File_Description
     unsigned (*unsupported_fields)(const ET_File* file);
     /// Check whether the tag supports multiple pictures with description. true by default.
     bool (*support_multiple_pictures)(const ET_File* file);
+    /// Check the first bytes of a file for the signature of this file type.
+    /// @param head Start of the file, \ref SniffSize bytes unless the file is shorter.
+    /// @remarks Leave empty if the file type has no reliable signature.
+    bool (*sniff)(const guchar* head, gsize len);
+
+    /// Number of bytes passed to \ref sniff.
+    static constexpr gsize SniffSize = 36;
 
     /// Determines description of file.
     /// @returns If \p filename is NULL or no registered instance of ET_File_Description matches the file extension,
     /// it returns a default instance that represents unsupported files.
     static const ET_File_Description* Get(const gchar *filename);
+    /// Verify this file type by the file content.
+    /// @details If the start of the file does not match the signature of this type
+    /// but the signature of another type, the latter is returned.
+    /// So mislabelled files are passed to the right reader.
+    /// @param head Start of the file.
+    const ET_File_Description* Verify(const ET_FileHead& head) const;
 
 private:
     static const ET_File_Description* Root;
     const ET_File_Description* Link;
+    /// All registered instances ordered by extension.
+    static const std::vector<const ET_File_Description*>& Sorted();
+};
+
+/// Start of a file read for the type check and handed over to the reader,
+/// so the file is opened and its head is read only once.
+struct ET_FileHead
+{
+    /// Open file descriptor, -1 if none. Closed by the destructor unless released.
+    int Fd = -1;
+    /// Number of valid bytes in \ref Data, less than SniffSize only for short files.
+    gsize Len = 0;
+    guchar Data[ET_File_Description::SniffSize];
+
+    ET_FileHead() {}
+    ET_FileHead(const ET_FileHead&) = delete;
+    void operator=(const ET_FileHead&) = delete;
+    ~ET_FileHead();
+    /// Open the file without reading.
+    /// @return \c false on error.
+    bool open(const gchar* path);
+    /// Open the file unless already done and read its head.
+    /// @return \c false on error, the reader will report it when it opens the file itself.
+    bool read(const gchar* path);
+    /// Take over the file descriptor.
+    int release() { int fd = Fd; Fd = -1; return fd; }
 };
 
 /// Returns the extension of the file
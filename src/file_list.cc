@@ -108,6 +108,24 @@ void ET_FileList::set_file_list(list_type&& list)
 	set_display_mode(BrowserMode);
 }
 
+unsigned ET_FileList::append_files(list_type&& list)
+{	unsigned first = FileList.size();
+	FileList.reserve(first + list.size());
+	for (auto& file : list)
+	{	file->IndexKey = FileList.size();
+		FileList.emplace_back(move(file));
+	}
+
+	if (BrowserMode == ET_BROWSER_MODE_FILE)
+	{	for (auto i = FileList.begin() + End; i != FileList.end(); ++i)
+		{	TotalSize     += (*i)->FileSize;
+			TotalDuration += (*i)->ETFileInfo.duration;
+		}
+		End = FileList.size();
+	}
+	return first;
+}
+
 void ET_FileList::set_visible_range(const xStringD0* artist, const xStringD0* album)
 {
 	if (!artist)
@@ -148,7 +166,10 @@ void ET_FileList::set_display_mode(EtBrowserMode mode)
 	ArtistAlbumIndex.clear();
 
 	if (!FileList.empty())
-	{	//(re)create ArtistAlbumIndex
+	{	// The index needs the tags of all files.
+		Read_Pending_Tags();
+
+		//(re)create ArtistAlbumIndex
 		auto cmp = ET_File::get_comp_func(ET_BROWSER_MODE_ARTIST_ALBUM);
 		sort(FileList.begin(), FileList.end(), [cmp](const ET_File* l, const ET_File* r)
 		{	return cmp(l, r) < 0;
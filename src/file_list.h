@@ -88,10 +88,18 @@ public:
 
 	static bool empty() { return FileList.empty(); }
 	static const list_type& all_files() { return FileList; }
+	/// Check whether a file is part of the list.
+	static bool contains(const ET_File* file)
+	{	return file->IndexKey < FileList.size() && FileList[file->IndexKey] == file; }
 	/// Set a new list of visible files.
 	/// @details This resets all state information except for SortMode and BrowserMode.
 	/// You should call \ref display_file afterwards to set the focus to a certain file.
 	static void set_file_list(list_type&& list);
+	/// Append files to the list, e.g. while a directory scan is in progress.
+	/// @return Index of the first appended file.
+	/// @remarks In file mode the new files are immediately visible.
+	/// Otherwise \ref set_display_mode must be called to update the artist/album index.
+	static unsigned append_files(list_type&& list);
 
 	static range_type visible_range()
 	{	return range_type(FileList.begin() + Start, FileList.begin() + End); }
@@ -0,0 +1,359 @@
+/* EasyTAG - tag editor for audio files
+ * Copyright (C) 2026  Marcel Müller <github@maazl.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "config.h"
+
+#include "file_watcher.h"
+
+#include <glib/gi18n.h>
+
+#include "application_window.h"
+#include "browser.h"
+#include "easytag.h"
+#include "file.h"
+#include "file_list.h"
+#include "log.h"
+#include "setting.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+using namespace std;
+
+
+/// One active watch of a root directory.
+class DirectoryWatch : public xObj
+{
+	/// The currently active watch if any.
+	static xPtr<DirectoryWatch> Instance;
+	friend class FileWatcher;
+
+	const gString RootPath;
+	const bool Recursive;
+	const bool BrowseHidden;
+	const bool SniffType;
+	vector<gObject<GFileMonitor>> Monitors;
+	/// Creating a monitor failed, do not try further.
+	bool MonitorFailed = false;
+
+	/// Changed paths in order of arrival.
+	vector<string> Changed;
+	/// Deduplicate Changed.
+	unordered_set<string> ChangedSet;
+	/// Process is scheduled.
+	bool Scheduled = false;
+	/// Time to collect changes in milliseconds, writers usually do not close files at once.
+	static constexpr guint Delay = 500;
+
+	/// File to read in the background.
+	struct Job
+	{	/// File of the list to update, \c nullptr for new files.
+		xPtr<ET_File> File;
+		/// Freshly read instance.
+		xPtr<ET_File> Source;
+		xString Error;
+	};
+
+	/// Synchronize access to Jobs.
+	mutex Sync;
+	condition_variable Cond;
+	/// Files to read by Worker.
+	vector<Job> Jobs;
+	/// Close has been called, i.e. Worker should terminate ASAP.
+	atomic<bool> Closing;
+	/// Worker thread, started on demand and joined by Close.
+	thread Worker;
+
+	/// Monitor a directory.
+	/// @return \c false on error.
+	bool Watch(GFile* dir);
+	/// Monitor a new directory and its subdirectories, queue the files in it.
+	void AddDirectory(GFile* dir);
+	static void OnChanged(GFileMonitor* monitor, GFile* file, GFile* other, GFileMonitorEvent event, DirectoryWatch* that);
+	void Queue(GFile* file);
+	/// Sort out the changed paths and start reading.
+	void Process();
+	/// Worker thread function, read the jobs until Close.
+	void Run();
+	/// Apply the results in the main thread.
+	void OnRead(vector<Job>& jobs);
+
+public:
+	DirectoryWatch(gString&& root, vector<gObject<GFile>>&& dirs);
+	~DirectoryWatch() { Close(); }
+	/// Stop all monitors.
+	void Close();
+};
+
+xPtr<DirectoryWatch> DirectoryWatch::Instance;
+
+DirectoryWatch::DirectoryWatch(gString&& root, vector<gObject<GFile>>&& dirs)
+:	RootPath(move(root))
+,	Recursive(g_settings_get_boolean(MainSettings, "browse-subdir"))
+,	BrowseHidden(g_settings_get_boolean(MainSettings, "browse-show-hidden"))
+,	SniffType(g_settings_get_boolean(MainSettings, "scan-sniff-type"))
+,	Closing(false)
+{	Monitors.reserve(dirs.size());
+	for (auto& dir : dirs)
+		if (!Watch(dir.get()))
+			break;
+}
+
+bool DirectoryWatch::Watch(GFile* dir)
+{	if (MonitorFailed)
+		return false;
+	GError* error = nullptr;
+	gObject<GFileMonitor> monitor(g_file_monitor_directory(dir, G_FILE_MONITOR_WATCH_MOVES, nullptr, &error));
+	if (!monitor)
+	{	// Most likely the inotify watch limit, so do not try further.
+		Log_Print(LOG_WARNING, _("Cannot watch directory for changes: %s"), error->message);
+		g_error_free(error);
+		MonitorFailed = true;
+		return false;
+	}
+	g_signal_connect(monitor.get(), "changed", G_CALLBACK(&DirectoryWatch::OnChanged), this);
+	Monitors.emplace_back(move(monitor));
+	return true;
+}
+
+void DirectoryWatch::AddDirectory(GFile* dir)
+{	if (!Watch(dir))
+		return;
+	// Files might have been created before the monitor.
+	gObject<GFileEnumerator> children(g_file_enumerate_children(dir,
+		G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_STANDARD_TYPE "," G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN,
+		G_FILE_QUERY_INFO_NONE, nullptr, nullptr));
+	if (!children)
+		return;
+	gObject<GFileInfo> info;
+	while ((info = gObject<GFileInfo>(g_file_enumerator_next_file(children.get(), nullptr, nullptr))))
+	{	if (!BrowseHidden && g_file_info_get_is_hidden(info.get()))
+			continue;
+		gObject<GFile> child(g_file_enumerator_get_child(children.get(), info.get()));
+		if (g_file_info_get_file_type(info.get()) == G_FILE_TYPE_DIRECTORY)
+			AddDirectory(child.get());
+		else
+			Queue(child.get());
+	}
+}
+
+void DirectoryWatch::Close()
+{	for (auto& monitor : Monitors)
+	{	g_signal_handlers_disconnect_by_data(monitor.get(), this);
+		g_file_monitor_cancel(monitor.get());
+	}
+	Monitors.clear();
+
+	{	lock_guard<mutex> lock(Sync);
+		Closing = true;
+		Jobs.clear();
+	}
+	Cond.notify_all();
+	if (Worker.joinable())
+		Worker.join();
+}
+
+void DirectoryWatch::OnChanged(GFileMonitor* monitor, GFile* file, GFile* other, GFileMonitorEvent event, DirectoryWatch* that)
+{	switch (event)
+	{case G_FILE_MONITOR_EVENT_RENAMED:
+		that->Queue(other);
+		// and the old name
+	 case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+	 case G_FILE_MONITOR_EVENT_DELETED:
+	 case G_FILE_MONITOR_EVENT_MOVED_OUT:
+		that->Queue(file);
+		break;
+	 case G_FILE_MONITOR_EVENT_CREATED:
+	 case G_FILE_MONITOR_EVENT_MOVED_IN:
+		// New subdirectories are watched as well.
+		if (that->Recursive && g_file_query_file_type(file, G_FILE_QUERY_INFO_NONE, nullptr) == G_FILE_TYPE_DIRECTORY)
+		{	gString name(g_file_get_basename(file));
+			if (that->BrowseHidden || name.get()[0] != '.')
+				that->AddDirectory(file);
+		} else if (event == G_FILE_MONITOR_EVENT_MOVED_IN)
+			that->Queue(file);
+		break;
+	 default:
+		break;
+	}
+}
+
+void DirectoryWatch::Queue(GFile* file)
+{	if (!file)
+		return;
+	gString path(g_file_get_path(file));
+	if (!path || !ChangedSet.emplace(path.get()).second)
+		return;
+	Changed.emplace_back(path.get());
+
+	if (!Scheduled)
+	{	Scheduled = true;
+		gTimeoutAdd(Delay, new function<void()>([that = xPtr<DirectoryWatch>(this)]() { that->Process(); }));
+	}
+}
+
+void DirectoryWatch::Process()
+{	Scheduled = false;
+	if (Instance.get() != this)
+		return; // stopped
+	// Do not interfere with directory scans, retry later.
+	if (IsReadingDirectory())
+	{	Scheduled = true;
+		gTimeoutAdd(Delay, new function<void()>([that = xPtr<DirectoryWatch>(this)]() { that->Process(); }));
+		return;
+	}
+
+	EtApplicationWindow* window = MainWindow;
+	// Pending edits in the UI count as unsaved changes.
+	et_application_window_update_et_file_from_ui(window);
+
+	unordered_map<string, ET_File*> files;
+	files.reserve(ET_FileList::all_files().size());
+	for (const xPtr<ET_File>& file : ET_FileList::all_files())
+		files.emplace(file->FilePath.get(), file.get());
+
+	vector<Job> jobs;
+	for (const string& path : Changed)
+	{	auto it = files.find(path);
+		ET_File* file = it != files.end() ? it->second : nullptr;
+		gObject<GFile> gfile(g_file_new_for_path(path.c_str()));
+		ET_File::Stat stat;
+		if (!ET_File::query_fileinfo(gfile.get(), stat))
+		{	// deleted
+			if (file && file->is_saved())
+			{	Log_Print(LOG_INFO, _("File ‘%s’ has been removed by another program"), file->FileNameNew()->full_name().get());
+				if (window->get_displayed_file() == file)
+					window->change_displayed_file(nullptr);
+				window->browser()->remove_file(file);
+				ET_FileList::remove_file(file);
+			}
+		} else if (file)
+		{	// Own changes and deferred tags are not read again.
+			if (file->tag_pending() || (stat.Size == file->FileSize && stat.ModificationTime == file->FileModificationTime))
+				continue;
+			if (file->is_saved())
+				jobs.emplace_back(Job{ file, nullptr, xString() });
+			else
+				Log_Print(LOG_WARNING, _("File ‘%s’ has been changed by another program, but it is not read again because of unsaved changes"),
+					file->FileNameNew()->full_name().get());
+		} else
+		{	// new file
+			const gchar* name = strrchr(path.c_str(), G_DIR_SEPARATOR);
+			name = name ? name + 1 : path.c_str();
+			if ((BrowseHidden || name[0] != '.')
+				&& g_file_query_file_type(gfile.get(), G_FILE_QUERY_INFO_NONE, nullptr) == G_FILE_TYPE_REGULAR
+				&& ET_File_Description::Get(name)->IsSupported())
+				jobs.emplace_back(Job{ nullptr, xPtr<ET_File>(new ET_File(gString(g_strdup(path.c_str())))), xString() });
+		}
+	}
+	Changed.clear();
+	ChangedSet.clear();
+
+	if (jobs.empty())
+		return;
+	for (Job& job : jobs)
+		if (job.File)
+			job.Source = xPtr<ET_File>(new ET_File(gString(g_strdup(job.File->FilePath))));
+	{	lock_guard<mutex> lock(Sync);
+		Jobs.insert(Jobs.end(), make_move_iterator(jobs.begin()), make_move_iterator(jobs.end()));
+	}
+	if (!Worker.joinable())
+		Worker = thread(&DirectoryWatch::Run, this);
+	Cond.notify_one();
+}
+
+void DirectoryWatch::Run()
+{	unique_lock<mutex> lock(Sync);
+	while (true)
+	{	Cond.wait(lock, [this]() { return Closing || !Jobs.empty(); });
+		if (Closing)
+			return;
+		vector<Job> jobs;
+		jobs.swap(Jobs);
+		lock.unlock();
+
+		for (Job& job : jobs)
+		{	if (Closing)
+				return;
+			gObject<GFile> file(g_file_new_for_path(job.Source->FilePath));
+			GError* error = nullptr;
+			job.Source->read_file(file.get(), RootPath, &error, nullptr, false, SniffType);
+			if (error)
+			{	job.Error = xString(error->message);
+				g_error_free(error);
+			}
+		}
+		// The reference keeps the instance alive until the results are applied.
+		gIdleAdd(new function<void()>([that = xPtr<DirectoryWatch>(this), jobs = move(jobs)]() mutable { that->OnRead(jobs); }));
+
+		lock.lock();
+	}
+}
+
+void DirectoryWatch::OnRead(vector<Job>& jobs)
+{	if (Instance.get() != this)
+		return; // stopped
+
+	EtApplicationWindow* window = MainWindow;
+	EtBrowser* browser = window->browser();
+	ET_FileList::list_type added;
+	for (Job& job : jobs)
+	{	if (!job.File)
+		{	// new file
+			const char* error = job.Error;
+			if (error)
+				Log_Print(LOG_ERROR, _("Error reading tag from %s ‘%s’: %s"),
+					job.Source->ETFileDescription->FileType, job.Source->FileNameNew()->full_name().get(), error);
+			else if (job.Source->autofix())
+				Log_Print(LOG_INFO, _("Automatic corrections applied for file ‘%s’"), job.Source->FileNameNew()->full_name().get());
+			added.emplace_back(move(job.Source));
+		} else if (!ET_FileList::contains(job.File.get()))
+			continue;
+		else if (job.File->update_from(*job.Source, job.Error))
+		{	Log_Print(LOG_INFO, _("File ‘%s’ has been changed by another program"), job.File->FileNameNew()->full_name().get());
+			if (window->get_displayed_file() == job.File.get())
+				et_application_window_update_ui_from_et_file(window);
+			et_browser_refresh_file_in_list(browser, job.File.get());
+		} else if (!job.File->is_saved())
+			// edited while the file was read
+			Log_Print(LOG_WARNING, _("File ‘%s’ has been changed by another program, but it is not read again because of unsaved changes"),
+				job.File->FileNameNew()->full_name().get());
+	}
+
+	if (added.size())
+		browser->append_files(ET_FileList::append_files(move(added)));
+	et_application_window_update_actions(window);
+}
+
+void FileWatcher::Start(gString&& root, vector<gObject<GFile>>&& dirs)
+{	Stop();
+	DirectoryWatch::Instance = xPtr<DirectoryWatch>(new DirectoryWatch(move(root), move(dirs)));
+}
+
+void FileWatcher::Stop()
+{	if (!DirectoryWatch::Instance)
+		return;
+	DirectoryWatch::Instance->Close();
+	DirectoryWatch::Instance.reset();
+}
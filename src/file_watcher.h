@@ -0,0 +1,46 @@
+/* EasyTAG - tag editor for audio files
+ * Copyright (C) 2026  Marcel Müller <github@maazl.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef ET_FILE_WATCHER_H_
+#define ET_FILE_WATCHER_H_
+
+#include <gio/gio.h>
+
+#include "misc.h"
+
+#include <vector>
+
+/// Watch the directories of the loaded file list for changes by other programs.
+/// @details Changed paths are collected for a short while and then processed at once.
+/// Modified files without unsaved changes are read again in the background,
+/// new audio files are appended to the file list and deleted files are removed.
+/// Changes made by EasyTAG itself are ignored because the size and modification time
+/// of the file already match.
+/// @remarks All functions must be called from the main thread.
+class FileWatcher
+{
+public:
+	/// Start watching, replaces any previous watch.
+	/// @param root Root directory of the file list in file system encoding.
+	/// @param dirs Directories of the file list, including the root.
+	static void Start(gString&& root, std::vector<gObject<GFile>>&& dirs);
+	/// Stop watching, e.g. because another directory is read.
+	static void Stop();
+};
+
+#endif /* ET_FILE_WATCHER_H_ */
@@ -356,7 +356,13 @@ Log_Print (EtLogAreaKind error_type, const gchar * const format, ...)
 	gchar* message = g_strdup_vprintf(format, args);
 	va_end(args);
 
-	if (std::this_thread::get_id() != MainThreadId)
+	if (!MainWindow)
+	{	// headless, e.g. batch mode
+		g_printerr("%s %s\n", time, message);
+		g_free(time);
+		g_free(message);
+	}
+	else if (std::this_thread::get_id() != MainThreadId)
 		// If invoked from a background thread dispatch to the main thread.
 		gIdleAdd(new function<void()>([error_type, time, message]()
 		{	DoLogPrint(error_type, time, message); }));
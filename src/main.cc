@@ -21,6 +21,7 @@
 #include <glib/gi18n.h>
 
 #include "application.h"
+#include "batch.h"
 #include "xstring.h"
 #include "picture.h"
 
@@ -31,6 +32,7 @@ extern "C" {
 #endif
 
 #include <string>
+#include <cstring>
 
 int
 main (int argc, char *argv[])
@@ -66,9 +68,17 @@ main (int argc, char *argv[])
 
 #endif
 
-    application = et_application_new ();
-    status = g_application_run (G_APPLICATION (application), argc, argv);
-    g_object_unref (application);
+    if (argc > 1 && strcmp (argv[1], ET_BATCH_OPTION) == 0)
+    {
+        /* No user interface, do not even connect to the display. */
+        status = et_batch_run (argc, argv);
+    }
+    else
+    {
+        application = et_application_new ();
+        status = g_application_run (G_APPLICATION (application), argc, argv);
+        g_object_unref (application);
+    }
 
     EtPicture::GarbageCollector();
     xStringD::garbage_collector();
@@ -16,9 +16,15 @@
  * Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
  */
 
+#include "config.h"
+
 #include "mask.h"
 #include "misc.h"
 #include "file_name.h"
+#include "scan.h"
+#include "setting.h"
+#include "log.h"
+#include "crc32.h"
 
 #include <glib/gi18n.h>
 
@@ -228,3 +234,300 @@ void entry_check_mask (GtkEntry *entry, gpointer user_data)
 	gtk_entry_set_icon_from_icon_name (entry, GTK_ENTRY_ICON_SECONDARY, "emblem-unreadable");
 	gtk_entry_set_icon_tooltip_text (entry, GTK_ENTRY_ICON_SECONDARY, error.c_str());
 }
+
+
+static void et_set_file_tag_for_mask_item
+(File_Tag *file_tag, const Scan_Mask_Item *item, gboolean overwrite)
+{	if (item->code == 'i')
+		return; // ignore field
+	xStringD0 File_Tag::*field = et_mask_field(item->code);
+	if (!field)
+		Log_Print(LOG_ERROR, "Scanner: Invalid code '%%%c' found!", item->code);
+	else if (overwrite || et_str_empty(file_tag->*field))
+		(file_tag->*field).assignNFC(item->string);
+}
+
+/*
+ * Uses the filename and path to fill tag information
+ * Note: mask and source are read from the right to the left
+ */
+File_Tag *
+et_fill_tag_with_mask (const ET_File *ETFile, string mask)
+{
+    GList *fill_tag_list = NULL;
+    GList *l;
+    File_Tag *FileTag;
+
+    g_return_val_if_fail (ETFile != NULL, NULL);
+
+    if (mask.empty())
+        return NULL;
+
+    // Create a new File_Tag item
+    FileTag = new File_Tag(*ETFile->FileTagNew());
+
+    // Process this mask with file
+    fill_tag_list = Scan_Generate_New_Tag_From_Mask(ETFile, move(mask));
+    gboolean overwrite = g_settings_get_boolean(MainSettings, "fill-overwrite-tag-fields");
+
+    for (l = fill_tag_list; l != NULL; l = g_list_next (l))
+    {
+        const Scan_Mask_Item *mask_item = (const Scan_Mask_Item*)l->data;
+        /* We display the text affected to the code. */
+        et_set_file_tag_for_mask_item (FileTag, mask_item, overwrite);
+    }
+
+    Scan_Free_File_Fill_Tag_List(fill_tag_list);
+
+    /* Set the default text to comment. */
+    if (g_settings_get_boolean (MainSettings, "fill-set-default-comment")
+        && (g_settings_get_boolean (MainSettings, "fill-overwrite-tag-fields")
+            || et_str_empty (FileTag->comment)))
+    {
+        gchar *default_comment = g_settings_get_string (MainSettings,
+                                                        "fill-default-comment");
+        FileTag->comment.assignNFC(default_comment);
+        g_free (default_comment);
+    }
+
+#ifdef ENABLE_MP3
+    /* Set CRC-32 value as default comment (for files with ID3 tag only). */
+    if (g_settings_get_boolean (MainSettings, "fill-crc32-comment")
+        && (g_settings_get_boolean (MainSettings, "fill-overwrite-tag-fields")
+            || et_str_empty (FileTag->comment)))
+    {
+        GFile *file;
+        GError *error = NULL;
+        guint32 crc32_value;
+
+        if (g_ascii_strcasecmp(ETFile->ETFileDescription->Extension, ".mp3"))
+        {
+            file = g_file_new_for_path (ETFile->FilePath);
+
+            if (crc32_file_with_ID3_tag (file, &crc32_value, &error))
+            {
+                FileTag->comment = strprintf("%.8" G_GUINT32_FORMAT, crc32_value).c_str();
+            }
+            else
+            {
+                Log_Print (LOG_ERROR,
+                           _("Cannot calculate CRC value of file ‘%s’"),
+                           error->message);
+                g_error_free (error);
+            }
+
+            g_object_unref (file);
+        }
+    }
+#endif
+
+    return FileTag;
+}
+
+GList *
+Scan_Generate_New_Tag_From_Mask (const ET_File *ETFile, string&& mask)
+{
+    GList *fill_tag_list = NULL;
+    gchar *tmp;
+    gchar *buf;
+    gchar *separator;
+    gchar *string;
+    gsize len, loop=0;
+    gchar **mask_splitted;
+    gchar **file_splitted;
+    guint mask_splitted_number;
+    guint file_splitted_number;
+    guint mask_splitted_index;
+    guint file_splitted_index;
+    Scan_Mask_Item *mask_item;
+    EtConvertSpaces convert_mode;
+
+    g_return_val_if_fail (ETFile != NULL && !mask.empty(), NULL);
+
+    std::string filename_utf8(ETFile->FileNameNew()->full_name());
+    if (filename_utf8.empty()) return NULL;
+
+    // Remove extension of file (if found)
+    const ET_File_Description* desc = ET_File_Description::Get(filename_utf8.c_str());
+    if (desc->IsSupported())
+        filename_utf8[filename_utf8.length() - strlen(desc->Extension)] = 0; //strrchr(source,'.') = 0;
+    else
+        Log_Print(LOG_ERROR, _("The extension ‘%s’ was not found in filename ‘%s’"),
+            ET_Get_File_Extension(filename_utf8.c_str()), ETFile->FileNameNew()->file().get());
+
+    /* Replace characters into mask and filename before parsing. */
+    convert_mode = (EtConvertSpaces)g_settings_get_enum (MainSettings, "fill-convert-spaces");
+
+    switch (convert_mode)
+    {
+        case ET_CONVERT_SPACES_SPACES:
+            Scan_Convert_Underscore_Into_Space (mask);
+            Scan_Convert_Underscore_Into_Space (filename_utf8);
+            Scan_Convert_P20_Into_Space (mask);
+            Scan_Convert_P20_Into_Space (filename_utf8);
+            break;
+        case ET_CONVERT_SPACES_UNDERSCORES:
+            Scan_Convert_Space_Into_Underscore (mask);
+            Scan_Convert_Space_Into_Underscore (filename_utf8);
+            break;
+        case ET_CONVERT_SPACES_NO_CHANGE:
+            break;
+        /* FIXME: Check if this is intentional. */
+        case ET_CONVERT_SPACES_REMOVE:
+        default:
+            g_assert_not_reached ();
+    }
+
+    // Split the Scanner mask
+    mask_splitted = g_strsplit(mask.c_str(), G_DIR_SEPARATOR_S, 0);
+    // Get number of arguments into 'mask_splitted'
+    for (mask_splitted_number = 0; mask_splitted[mask_splitted_number]; mask_splitted_number++);
+
+    // Split the File Path
+    file_splitted = g_strsplit(filename_utf8.c_str(), G_DIR_SEPARATOR_S, 0);
+    // Get number of arguments into 'file_splitted'
+    for (file_splitted_number = 0; file_splitted[file_splitted_number]; file_splitted_number++);
+
+    // Set the starting position for each tab
+    if (mask_splitted_number <= file_splitted_number)
+    {
+        mask_splitted_index = 0;
+        file_splitted_index = file_splitted_number - mask_splitted_number;
+    }else
+    {
+        mask_splitted_index = mask_splitted_number - file_splitted_number;
+        file_splitted_index = 0;
+    }
+
+    loop = 0;
+    while ( mask_splitted[mask_splitted_index]!= NULL && file_splitted[file_splitted_index]!=NULL )
+    {
+        gchar *mask_seq = mask_splitted[mask_splitted_index];
+        gchar *file_seq = file_splitted[file_splitted_index];
+        gchar *file_seq_utf8 = g_filename_display_name (file_seq);
+
+        //g_print(">%d> seq '%s' '%s'\n",loop,mask_seq,file_seq);
+        while (!et_str_empty (mask_seq))
+        {
+
+            /*
+             * Determine (first) code and destination
+             */
+            if ( (tmp=strchr(mask_seq,'%')) == NULL || strlen(tmp) < 2 )
+            {
+                break;
+            }
+
+            /*
+             * Allocate a new iten for the fill_tag_list
+             */
+            mask_item = g_slice_new0 (Scan_Mask_Item);
+
+            // Get the code (used to determine the corresponding target entry)
+            mask_item->code = tmp[1];
+
+            /*
+             * Delete text before the code
+             */
+            if ( (len = strlen(mask_seq) - strlen(tmp)) > 0 )
+            {
+                // Get this text in 'mask_seq'
+                buf = g_strndup(mask_seq,len);
+                // We remove it in 'mask_seq'
+                mask_seq = mask_seq + len;
+                // Find the same text at the begining of 'file_seq' ?
+                if ( (strstr(file_seq,buf)) == file_seq )
+                {
+                    file_seq = file_seq + len; // We remove it
+                }else
+                {
+                    Log_Print (LOG_ERROR,
+                               _("Cannot find separator ‘%s’ within ‘%s’"),
+                               buf, file_seq_utf8);
+                }
+                g_free(buf);
+            }
+
+            // Remove the current code into 'mask_seq'
+            mask_seq = mask_seq + 2;
+
+            /*
+             * Determine separator between two code or trailing text (after code)
+             */
+            if (!et_str_empty (mask_seq))
+            {
+                if ( (tmp=strchr(mask_seq,'%')) == NULL || strlen(tmp) < 2 )
+                {
+                    // No more code found
+                    len = strlen(mask_seq);
+                }else
+                {
+                    len = strlen(mask_seq) - strlen(tmp);
+                }
+                separator = g_strndup(mask_seq,len);
+
+                // Remove the current separator in 'mask_seq'
+                mask_seq = mask_seq + len;
+
+                // Try to find the separator in 'file_seq'
+                if ( (tmp=strstr(file_seq,separator)) == NULL )
+                {
+                    Log_Print (LOG_ERROR,
+                               _("Cannot find separator ‘%s’ within ‘%s’"),
+                               separator, file_seq_utf8);
+                    separator[0] = 0; // Needed to avoid error when calculting 'len' below
+                }
+
+                // Get the string affected to the code (or the corresponding entry field)
+                len = strlen(file_seq) - (tmp!=NULL?strlen(tmp):0);
+                string = g_strndup(file_seq,len);
+
+                // Remove the current separator in 'file_seq'
+                file_seq = file_seq + strlen(string) + strlen(separator);
+                g_free(separator);
+
+                // We get the text affected to the code
+                mask_item->string = string;
+            }else
+            {
+                // We display the remaining text, affected to the code (no more data in 'mask_seq')
+                mask_item->string = g_strdup(file_seq);
+            }
+
+            // Add the filled mask_iten to the list
+            fill_tag_list = g_list_append(fill_tag_list,mask_item);
+        }
+
+        g_free(file_seq_utf8);
+
+        // Next sequences
+        mask_splitted_index++;
+        file_splitted_index++;
+        loop++;
+    }
+
+    g_strfreev(mask_splitted);
+    g_strfreev(file_splitted);
+
+    // The 'fill_tag_list' must be freed after use
+    return fill_tag_list;
+}
+
+void
+Scan_Free_File_Fill_Tag_List (GList *list)
+{
+    GList *l;
+
+    list = g_list_first (list);
+
+    for (l = list; l != NULL; l = g_list_next (l))
+    {
+        if (l->data)
+        {
+            g_free (((Scan_Mask_Item *)l->data)->string);
+            g_slice_free (Scan_Mask_Item, l->data);
+        }
+    }
+
+    g_list_free (list);
+}
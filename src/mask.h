@@ -43,6 +43,33 @@ std::string et_check_mask(const gchar* mask);
  */
 std::string et_evaluate_mask(const ET_File *file, const gchar *mask, gboolean no_dir_check_or_conversion);
 
+/// Item of the fill tag scanner
+typedef struct _Scan_Mask_Item Scan_Mask_Item;
+struct _Scan_Mask_Item
+{
+    gchar  code;   // The code of the mask without % (ex: %a => a)
+    gchar *string; // The string found by the scanner for the code defined the line above
+};
+
+/**
+ * Split the file name and path of a file according to a fill tag mask.
+ * @param file
+ * @param mask
+ * @return List of Scan_Mask_Item, must be freed with Scan_Free_File_Fill_Tag_List.
+ */
+GList *Scan_Generate_New_Tag_From_Mask(const ET_File *file, std::string&& mask);
+void Scan_Free_File_Fill_Tag_List(GList *list);
+
+/**
+ * Fill tag fields from the file name and path according to a fill tag mask
+ * and the fill-* settings.
+ * @param file
+ * @param mask
+ * @return New tag to be passed to ET_File::apply_changes
+ * or \c nullptr if the mask is empty.
+ */
+File_Tag *et_fill_tag_with_mask(const ET_File *file, std::string mask);
+
 /**
  * Display an icon in the entry if the current text contains an invalid mask.
  * @param entry The entry for which to check the mask
@@ -25,9 +25,14 @@
 #include <glib.h>
 #include <glib/gi18n.h>
 #include <glib/gstdio.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <stdarg.h>
+#include <errno.h>
+#ifndef G_OS_WIN32
+#include <fcntl.h>
+#endif
 
 #include "setting.h"
 
@@ -131,6 +136,80 @@ guint gIdleAdd(std::function<void()>* func, gint priority)
 		[](void* user_data) { delete static_cast<std::function<void()>*>(user_data); });
 }
 
+guint gTimeoutAdd(guint interval, std::function<void()>* func, gint priority)
+{	return g_timeout_add_full(
+		priority,
+		interval,
+		[](void* user_data) { (*static_cast<std::function<void()>*>(user_data))(); return G_SOURCE_REMOVE; },
+		func,
+		[](void* user_data) { delete static_cast<std::function<void()>*>(user_data); });
+}
+
+#ifndef G_OS_WIN32
+LocalDirReader::LocalDirReader(const gchar* path)
+:	Dir(opendir(path))
+,	Error(Dir ? 0 : errno)
+{}
+
+LocalDirReader::~LocalDirReader()
+{	if (Dir)
+		closedir(Dir);
+}
+
+const gchar* LocalDirReader::next(GFileType& type)
+{	if (!Dir)
+		return nullptr;
+	const dirent* entry;
+	do
+	{	errno = 0;
+		if (!(entry = readdir(Dir)))
+		{	Error = errno;
+			return nullptr;
+		}
+	} while (entry->d_name[0] == '.'
+		&& (entry->d_name[1] == 0 || (entry->d_name[1] == '.' && entry->d_name[2] == 0)));
+	Inode = entry->d_ino;
+
+#ifdef DT_UNKNOWN
+	switch (entry->d_type)
+	{case DT_REG:
+		type = G_FILE_TYPE_REGULAR;
+		break;
+	 case DT_DIR:
+		type = G_FILE_TYPE_DIRECTORY;
+		break;
+	 case DT_LNK: // need to follow
+	 case DT_UNKNOWN: // file system does not tell
+		type = G_FILE_TYPE_UNKNOWN;
+		break;
+	 default:
+		type = G_FILE_TYPE_SPECIAL;
+	}
+#else
+	type = G_FILE_TYPE_UNKNOWN;
+#endif
+	return entry->d_name;
+}
+
+GFileType LocalDirReader::type_of(const gchar* name) const
+{	struct stat st;
+	if (fstatat(dirfd(Dir), name, &st, 0) != 0)
+		return G_FILE_TYPE_UNKNOWN;
+	if (S_ISREG(st.st_mode))
+		return G_FILE_TYPE_REGULAR;
+	if (S_ISDIR(st.st_mode))
+		return G_FILE_TYPE_DIRECTORY;
+	return G_FILE_TYPE_SPECIAL;
+}
+
+guint64 LocalDirReader::device() const
+{	struct stat st;
+	if (!Dir || fstat(dirfd(Dir), &st) != 0)
+		return 0;
+	return st.st_dev;
+}
+#endif
+
 
 /*
  * Add the 'string' passed in parameter to the list store
@@ -294,6 +373,20 @@ GVariant* et_variant_string_array_set(GVariant* variant, const char* value, gboo
 	return g_variant_new_strv(newvalue, next - newvalue);
 }
 
+double et_int_sort_value(const gchar* value, bool& complete)
+{	if (et_str_empty(value))
+	{	complete = true;
+		return -HUGE_VAL;
+	}
+	int i, l;
+	if (sscanf(value, "%d%n", &i, &l) != 1)
+	{	complete = false;
+		return HUGE_VAL;
+	}
+	complete = value[l] == 0;
+	return i;
+}
+
 string et_file_duration_to_string(double duration)
 {	string result;
 	if (duration > 0 && duration < numeric_limits<unsigned>::max())
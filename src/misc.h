@@ -29,6 +29,9 @@
 #include <cmath>
 #include <type_traits>
 #include <functional>
+#ifndef G_OS_WIN32
+#include <dirent.h>
+#endif
 
 std::string strprintf(const char* format, ...)
 #ifdef __GNUC__
@@ -161,6 +164,51 @@ public:
 /// @param priority Optional priority level, G_PRIORITY_DEFAULT_IDLE by default.
 /// @return ID of the registered event source.
 guint gIdleAdd(std::function<void()>* func, gint priority = G_PRIORITY_DEFAULT_IDLE);
+/// Execute function once in main loop after a delay.
+/// @param interval Delay in milliseconds.
+/// @param func Pointer to the function to be executed.
+/// The function takes the ownership of this object.
+/// @param priority Optional priority level, G_PRIORITY_DEFAULT by default.
+/// @return ID of the registered event source.
+guint gTimeoutAdd(guint interval, std::function<void()>* func, gint priority = G_PRIORITY_DEFAULT);
+
+#ifndef G_OS_WIN32
+/// Fast enumeration of a local directory without GIO.
+/// @details The entries are read in bulk by \c readdir and the file type is taken
+/// from \c d_type if the file system provides it, so most entries need no \c stat call.
+class LocalDirReader
+{	DIR* Dir;
+	int Error;
+	guint64 Inode = 0;
+public:
+	/// Open a directory.
+	/// @param path Directory in file system encoding.
+	explicit LocalDirReader(const gchar* path);
+	LocalDirReader(const LocalDirReader&) = delete;
+	void operator=(const LocalDirReader&) = delete;
+	~LocalDirReader();
+	/// Directory could be opened.
+	bool is_open() const { return Dir != nullptr; }
+	/// \c errno of the last failed operation, 0 if none.
+	int error() const { return Error; }
+	/// Fetch the next entry, "." and ".." are skipped.
+	/// @param type [out] Type of the entry or \c G_FILE_TYPE_UNKNOWN
+	/// if only \ref type_of can tell, e.g. for symbolic links.
+	/// @return Name of the entry in file system encoding, valid until the next call,
+	/// or \c nullptr at the end or on error.
+	const gchar* next(GFileType& type);
+	/// Query the type of an entry by \c stat, symbolic links are followed like GIO does.
+	/// @return \c G_FILE_TYPE_UNKNOWN if the entry is inaccessible.
+	GFileType type_of(const gchar* name) const;
+	/// Inode number of the entry last returned by \ref next.
+	/// @remarks Files with ascending inode numbers are likely stored in ascending disk order.
+	guint64 inode() const { return Inode; }
+	/// Device of the directory, 0 if unknown.
+	guint64 device() const;
+	/// Whether the entry is hidden by the Unix convention.
+	static bool is_hidden(const gchar* name) { return name[0] == '.'; }
+};
+#endif
 
 
 /// Binary search with exact match handling.
@@ -194,6 +242,14 @@ struct Guid
 /// Convert file duration into a human readable format.
 std::string et_file_duration_to_string(double seconds);
 
+/// Numeric sort value of a string that is likely an integer, e.g. a track number.
+/// @param value String to classify.
+/// @param complete [out] Set to \c true if the number is the entire string,
+/// i.e. the string need not be compared any further.
+/// @return Value of the leading integer, -HUGE_VAL for empty strings
+/// and HUGE_VAL if the string does not start with a number.
+double et_int_sort_value(const gchar* value, bool& complete);
+
 /*
  * Combobox misc functions
  */
@@ -33,7 +33,11 @@
 
 #include "win32/win32dep.h"
 #include <unordered_set>
+#include <unordered_map>
 #include <mutex>
+#include <string>
+#include <vector>
+#include <typeinfo>
 using namespace std;
 
 
@@ -80,7 +84,7 @@ EtPicture::Data* EtPicture::GetOrAllocate(const void* data, unsigned size)
 	return storage;
 }
 
-void EtPicture::Deduplicate()
+EtPicture::Data* EtPicture::Deduplicate(Data* storage)
 {	lock_guard<mutex> lock(InstancesMutex);
 	auto it = Instances.find(storage);
 	if (it != Instances.end())
@@ -90,6 +94,172 @@ void EtPicture::Deduplicate()
 	} else
 		Instances.insert(storage);
 	++storage->RefCount;
+	return storage;
+}
+
+// Pictures with deferred image data by file path.
+// Used to load the data before a file is modified and to follow renames.
+// Each instance is a weak reference.
+static unordered_multimap<string, EtPicture::Data*> FileSources;
+// Protect the dictionary above and EtPictureFileSource::Path
+static mutex FileSourcesMutex;
+
+void EtPicture::Release(Data* storage)
+{	if (!storage || --storage->RefCount)
+		return;
+	if (storage->Lazy)
+	{	auto source = dynamic_cast<const EtPictureFileSource*>(storage->Lazy);
+		if (source)
+		{	lock_guard<mutex> lock(FileSourcesMutex);
+			auto range = FileSources.equal_range(source->Path);
+			for (auto it = range.first; it != range.second; ++it)
+				if (it->second == storage)
+				{	FileSources.erase(it);
+					break;
+				}
+		}
+		Release(storage->Loaded);
+		delete storage->Lazy;
+	}
+	storage->~Data();
+	g_free(storage);
+}
+
+const EtPicture::Data* EtPicture::data(GError** error) const
+{	if (!storage || !storage->Lazy)
+		return storage;
+	return Load(storage, error);
+}
+
+EtPicture::Data* EtPicture::Load(Data* storage, GError** error)
+{	Data* loaded = storage->Loaded;
+	if (loaded)
+		return loaded;
+
+	Data* tmp = (Data*)g_malloc(offsetof(Data, Bytes) + storage->Size);
+	if (!storage->Lazy->load(tmp->Bytes, storage->Size, error))
+	{	g_free(tmp);
+		return nullptr;
+	}
+	new(tmp) Data(storage->Size);
+	tmp = Deduplicate(tmp);
+	if (!tmp->Width)
+		tmp->Width = storage->Width;
+	if (!tmp->Height)
+		tmp->Height = storage->Height;
+	// Another thread might have been faster.
+	if (!storage->Loaded.compare_exchange_strong(loaded, tmp))
+	{	Release(tmp);
+		return loaded;
+	}
+	return tmp;
+}
+
+EtPictureFileSource::EtPictureFileSource(const ET_File& file, goffset offset)
+:	Path(file.FilePath.get())
+,	FileSize(file.FileSize)
+,	ModificationTime(file.FileModificationTime)
+,	ChangeTime(file.FileChangeTime)
+,	Offset(offset)
+{}
+
+bool EtPictureFileSource::load(void* bytes, unsigned size, GError** error) const
+{	string path;
+	{	lock_guard<mutex> lock(FileSourcesMutex);
+		path = Path;
+	}
+	gObject<GFile> file(g_file_new_for_path(path.c_str()));
+	gObject<GFileInputStream> istream(g_file_read(file.get(), NULL, error));
+	if (!istream)
+		return false;
+	// Query the opened file, so it is surely the one that is read.
+	gObject<GFileInfo> info(g_file_input_stream_query_info(istream.get(),
+		G_FILE_ATTRIBUTE_STANDARD_SIZE "," G_FILE_ATTRIBUTE_TIME_MODIFIED "," G_FILE_ATTRIBUTE_TIME_CHANGED, NULL, error));
+	if (!info)
+		return false;
+	if (!unchanged(g_file_info_get_attribute_uint64(info.get(), G_FILE_ATTRIBUTE_STANDARD_SIZE),
+		g_file_info_get_attribute_uint64(info.get(), G_FILE_ATTRIBUTE_TIME_MODIFIED),
+		g_file_info_get_attribute_uint64(info.get(), G_FILE_ATTRIBUTE_TIME_CHANGED)))
+	{	gString display(g_filename_display_name(path.c_str()));
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+			_("Cannot load the image because the file ‘%s’ has been changed"), display.get());
+		return false;
+	}
+	return read(G_INPUT_STREAM(istream.get()), bytes, size, error);
+}
+
+bool EtPictureFileSource::read(GInputStream* in, void* bytes, unsigned size, GError** error) const
+{	if (!g_seekable_seek(G_SEEKABLE(in), Offset, G_SEEK_SET, NULL, error))
+		return false;
+	gsize bytes_read;
+	if (!g_input_stream_read_all(in, bytes, size, &bytes_read, NULL, error))
+		return false;
+	if (bytes_read != size)
+	{	g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "%s", _("Input truncated or empty"));
+		return false;
+	}
+	return true;
+}
+
+bool EtPictureFileSource::equals(const Source& r) const
+{	// Derived sources interpret the offset differently.
+	if (typeid(r) != typeid(*this))
+		return false;
+	auto& source = static_cast<const EtPictureFileSource&>(r);
+	if (source.Offset != Offset || !source.unchanged(FileSize, ModificationTime, ChangeTime))
+		return false;
+	lock_guard<mutex> lock(FileSourcesMutex);
+	return source.Path == Path;
+}
+
+bool EtPicture::LoadFromFile(const gchar* path, GError** error)
+{	vector<Data*> pending;
+	{	lock_guard<mutex> lock(FileSourcesMutex);
+		auto range = FileSources.equal_range(path);
+		for (auto it = range.first; it != range.second; ++it)
+		{	Data* storage = it->second;
+			if (storage->Loaded)
+				continue;
+			// Take a reference unless the instance is just about to die.
+			unsigned count = storage->RefCount;
+			while (count && !storage->RefCount.compare_exchange_weak(count, count + 1));
+			if (count)
+				pending.push_back(storage);
+		}
+	}
+	bool ok = true;
+	for (Data* storage : pending)
+	{	if (ok && !Load(storage, error))
+			ok = false;
+		Release(storage);
+	}
+	return ok;
+}
+
+void EtPicture::FileRenamed(const gchar* old_path, const gchar* new_path)
+{	lock_guard<mutex> lock(FileSourcesMutex);
+	auto range = FileSources.equal_range(old_path);
+	if (range.first == range.second)
+		return;
+	vector<Data*> moved;
+	for (auto it = range.first; it != range.second; ++it)
+	{	static_cast<const EtPictureFileSource*>(it->second->Lazy)->Path = new_path;
+		moved.push_back(it->second);
+	}
+	FileSources.erase(range.first, range.second);
+	for (Data* storage : moved)
+		FileSources.emplace(new_path, storage);
+}
+
+goffset EtPicture::file_offset(const ET_File& file) const
+{	if (!storage || !storage->Lazy)
+		return -1;
+	auto source = dynamic_cast<const EtPictureFileSource*>(storage->Lazy);
+	// The offset is outdated once the file has been written.
+	if (!source || source->raw_offset() < 0 || !source->unchanged(file.FileSize, file.FileModificationTime, file.FileChangeTime))
+		return -1;
+	lock_guard<mutex> lock(FileSourcesMutex);
+	return source->Path == file.FilePath.get() ? source->raw_offset() : -1;
 }
 
 void EtPicture::GarbageCollector()
@@ -121,6 +291,24 @@ EtPicture::EtPicture(EtPictureType type, const xStringD0& description, guint wid
 		storage->Height = height;
 }
 
+EtPicture::EtPicture(EtPictureType type, const xStringD0& description, unsigned size, const Source* source)
+:	storage(new(g_malloc(sizeof(Data))) Data(size, source))
+,	description(description)
+,	type(type)
+{}
+
+EtPicture::EtPicture(EtPictureType type, const xStringD0& description, guint width, guint height, const ET_File& file, goffset offset, unsigned size)
+:	EtPicture(type, description, width, height, file, new EtPictureFileSource(file, offset), size)
+{}
+
+EtPicture::EtPicture(EtPictureType type, const xStringD0& description, guint width, guint height, const ET_File& file, const EtPictureFileSource* source, unsigned size)
+:	EtPicture(type, description, size, source)
+{	storage->Width = width;
+	storage->Height = height;
+	lock_guard<mutex> lock(FileSourcesMutex);
+	FileSources.emplace(file.FilePath.get(), storage);
+}
+
 EtPicture::EtPicture(const EtPicture& r) noexcept
 :	storage(r.storage)
 ,	description(r.description)
@@ -130,10 +318,7 @@ EtPicture::EtPicture(const EtPicture& r) noexcept
 }
 
 EtPicture::~EtPicture()
-{	if (storage && !--storage->RefCount)
-	{	storage->RefCount.~atomic();
-		g_free(storage);
-	}
+{	Release(storage);
 }
 
 bool operator==(const EtPicture& l, const EtPicture& r)
@@ -141,10 +326,15 @@ bool operator==(const EtPicture& l, const EtPicture& r)
 		return false;
 	if (l.storage == r.storage)
 		return true;
-	if (!l.storage || !r.storage)
+	if (!l.storage || !r.storage || l.storage->Size != r.storage->Size)
+		return false;
+	if (l.storage->Lazy && r.storage->Lazy && l.storage->Lazy->equals(*r.storage->Lazy))
+		return true;
+	const EtPicture::Data* ld = l.data();
+	const EtPicture::Data* rd = r.data();
+	if (!ld || !rd)
 		return false;
-	return l.storage->Size == r.storage->Size
-		&& memcmp(l.storage->Bytes, r.storage->Bytes, l.storage->Size) == 0;
+	return ld == rd || memcmp(ld->Bytes, rd->Bytes, ld->Size) == 0;
 }
 
 EtPictureType EtPicture::type_from_filename(const gchar *filename_utf8)
@@ -207,10 +397,11 @@ EtPictureType EtPicture::type_from_filename(const gchar *filename_utf8)
  * and cache the result in EtPictureData */
 Picture_Format EtPicture::Format() const
 {
-    g_return_val_if_fail(storage != NULL, PICTURE_FORMAT_UNKNOWN);
+    const Data* data = this->data();
+    g_return_val_if_fail(data != NULL, PICTURE_FORMAT_UNKNOWN);
 
-    size_t size = storage->Size;
-    const void* raw = storage->Bytes;
+    size_t size = data->Size;
+    const void* raw = data->Bytes;
 
     /* JPEG : "\xff\xd8\xff". */
     if (size > 3 && (memcmp(raw, "\xff\xd8\xff", 3) == 0))
@@ -407,7 +598,7 @@ EtPicture::EtPicture(GFile *file, GError **error)
     storage = (Data*)g_memory_output_stream_steal_data(G_MEMORY_OUTPUT_STREAM(ostream.get()));
     new(storage) Data(size);
 
-    Deduplicate();
+    storage = Deduplicate(storage);
 
     g_assert (error == NULL || *error == NULL);
 }
@@ -415,9 +606,12 @@ EtPicture::EtPicture(GFile *file, GError **error)
 gObject<GdkPixbuf> EtPicture::get_pix_buf(GError **error) const
 {
     gObject<GdkPixbuf> pixbuf;
+    const Data* data = this->data(error);
+    if (!data)
+        return pixbuf;
     // analyze file data
     gObject<GdkPixbufLoader> loader(gdk_pixbuf_loader_new());
-    if (!gdk_pixbuf_loader_write_bytes(loader.get(), bytes().get(), error))
+    if (!gdk_pixbuf_loader_write(loader.get(), (const guchar*)data->Bytes, data->Size, error))
         return pixbuf;
 
     if (!gdk_pixbuf_loader_close(loader.get(), error))
@@ -444,6 +638,10 @@ bool EtPicture::save_file_data(GFile *file, GError **error) const
 
     g_return_val_if_fail (storage != NULL && (error == NULL || *error == NULL), false);
 
+    const Data* data = this->data(error);
+    if (!data)
+        return false;
+
     file_ostream = g_file_replace (file, NULL, FALSE, G_FILE_CREATE_NONE, NULL,
                                    error);
 
@@ -454,10 +652,10 @@ bool EtPicture::save_file_data(GFile *file, GError **error) const
     }
 
     if (!g_output_stream_write_all (G_OUTPUT_STREAM (file_ostream),
-        storage->Bytes, storage->Size, &bytes_written, NULL, error))
+        data->Bytes, data->Size, &bytes_written, NULL, error))
     {
         g_debug ("Only %" G_GSIZE_FORMAT " bytes out of %u"
-                 " bytes of picture data were written", bytes_written, storage->Size);
+                 " bytes of picture data were written", bytes_written, data->Size);
         g_object_unref (file_ostream);
         g_assert (error == NULL || *error != NULL);
         return false;
@@ -29,8 +29,10 @@ GType et_picture_get_type (void);
 #include "misc.h"
 #include "xstring.h"
 #include <atomic>
+#include <string>
 
 struct ET_File;
+class EtPictureFileSource;
 
 typedef enum // Picture types
 {
@@ -77,13 +79,32 @@ typedef enum
  * @bytes: image data
  */
 typedef struct EtPicture
-{	/// Backing store in EtPicture.
+{	/// Origin of image data that is not loaded before it is needed.
+	/// @details Implementations are owned by the \ref Data instance and must be thread-safe.
+	struct Source
+	{	virtual ~Source() {}
+		/// Fetch the image data.
+		/// @param bytes Target buffer.
+		/// @param size Number of bytes to fetch, i.e. \ref Data::Size\.
+		/// @param error Set on error.
+		/// @return \c true on success.
+		virtual bool load(void* bytes, unsigned size, GError** error) const = 0;
+		/// Check whether \a r refers to the same image data without loading it.
+		/// @return \c false if unknown.
+		virtual bool equals(const Source& r) const { return false; }
+	};
+
+	/// Backing store in EtPicture.
 	struct Data
 	{	std::atomic<unsigned> RefCount; ///< Reference counter. 0 = tag for use of bytes_ptr.
 		const unsigned        Size;     ///< size of \ref bytes or \ref bytes_ref\.
-		const guint           Hash;     ///< hash value of \ref bytes or \ref bytes_ref\.
+		const guint           Hash;     ///< hash value of \ref bytes or \ref bytes_ref\, 0 if deferred.
 		gint                  Width;    ///< image width (pixels) or 0 if unknown.
 		gint                  Height;   ///< image height (pixels) or 0 if unknown.
+		/// Source of deferred image data or \c nullptr if \ref Bytes are in place.
+		const Source* const   Lazy;
+		/// Deduplicated storage of deferred image data once it has been loaded.
+		std::atomic<Data*>    Loaded;
 		union
 		{	char                Bytes[1]; ///< inline image data.
 			const void*         DataRef;  ///< referenced image data - <b>internal use only</b>
@@ -93,13 +114,16 @@ typedef struct EtPicture
 	public:
 		/// Constructor <b>for placement new only!</b>
 		explicit Data(unsigned size, unsigned hash) noexcept
-		:	RefCount(2), Size(size), Hash(hash), Width(0), Height(0) {}
+		:	RefCount(2), Size(size), Hash(hash), Width(0), Height(0), Lazy(nullptr), Loaded(nullptr) {}
 		/// Constructor <b>for placement new only!</b> Assumes that \ref bytes are already in place.
 		explicit Data(unsigned size) noexcept
-		:	RefCount(1), Size(size), Hash(CalcHash(&Bytes, size)), Width(0), Height(0) {}
+		:	RefCount(1), Size(size), Hash(CalcHash(&Bytes, size)), Width(0), Height(0), Lazy(nullptr), Loaded(nullptr) {}
 		/// Constructor for unowned data storage. <b>No reference counting, internal use only!</b>
 		Data(const void* data, unsigned size) noexcept
-		:	RefCount(0), Size(size), Hash(CalcHash(data, size)), Width(0), Height(0), DataRef(data) {}
+		:	RefCount(0), Size(size), Hash(CalcHash(data, size)), Width(0), Height(0), Lazy(nullptr), Loaded(nullptr), DataRef(data) {}
+		/// Constructor for deferred image data <b>for placement new only!</b> Takes the ownership of \a source.
+		Data(unsigned size, const Source* source) noexcept
+		:	RefCount(1), Size(size), Hash(0), Width(0), Height(0), Lazy(source), Loaded(nullptr) {}
 	};
 
 	Data* storage;
@@ -107,11 +131,32 @@ typedef struct EtPicture
 	EtPictureType type;
 
 	static Data* GetOrAllocate(const void* data, unsigned size);
-	void Deduplicate();
+	/// Replace \a storage by an existing instance with the same content if any.
+	/// @return Deduplicated instance with one reference for the caller.
+	static Data* Deduplicate(Data* storage);
+	static void Release(Data* storage);
+	/// Load deferred image data.
+	/// @return Storage with the image data in place.
+	static Data* Load(Data* storage, GError** error);
 public:
 	EtPicture(const EtPicture& r) noexcept;
 	constexpr EtPicture(EtPicture&& r) noexcept : storage(r.storage), description(std::move(r.description)), type(r.type) { r.storage = nullptr; }
 	EtPicture(EtPictureType type, const xStringD0& description, guint width, guint height, const void* data, unsigned size);
+	/// Create a picture with deferred image data.
+	/// @param size Number of bytes \a source will provide.
+	/// @param source Origin of the image data, the picture takes the ownership.
+	EtPicture(EtPictureType type, const xStringD0& description, unsigned size, const Source* source);
+	/// Create a picture whose image data is read from a file when it is needed.
+	/// @param file The image data is taken from this file, as long as the file is unchanged,
+	/// i.e. it has still the size, modification time and change time of \a file.
+	/// @param offset Position of the image data in the file.
+	/// @param size Number of bytes of the image data.
+	EtPicture(EtPictureType type, const xStringD0& description, guint width, guint height, const ET_File& file, goffset offset, unsigned size);
+	/// Create a picture whose image data is read from a file by a custom \a source when it is needed.
+	/// @param file The file \a source reads.
+	/// @param source Origin of the image data, the picture takes the ownership.
+	/// @param size Number of bytes \a source will provide.
+	EtPicture(EtPictureType type, const xStringD0& description, guint width, guint height, const ET_File& file, const EtPictureFileSource* source, unsigned size);
 	/// Load an image from the supplied \a file.
 	/// @param File the GFile from which to load an image
 	/// @param Error a GError to provide information on errors, or \c NULL to ignore
@@ -124,7 +169,12 @@ public:
 	EtPicture& operator=(EtPicture&& r) = default;
 	friend bool operator==(const EtPicture& l, const EtPicture& r);
 	friend bool operator!=(const EtPicture& l, const EtPicture& r) { return !(l == r); }
-	gBytes bytes() const { return storage ? gBytes(g_bytes_new_static(storage->Bytes, storage->Size)) : gBytes(); }
+	/// Access the image data.
+	/// @details Deferred image data is loaded on the first call.
+	/// @param error Set if the image data could not be loaded.
+	/// @return Storage with the image data in place or \c nullptr if there is no data.
+	const Data* data(GError** error = nullptr) const;
+	gBytes bytes() const { const Data* d = data(); return d ? gBytes(g_bytes_new_static(d->Bytes, d->Size)) : gBytes(); }
 
 	/// Use some heuristics to provide an estimate of the type of the picture,
 	/// based on the filename.
@@ -152,8 +202,49 @@ public:
 	/// @return \c TRUE on success
 	bool save_file_data(GFile* file, GError** error) const;
 
+	/// Position of the image data in a file.
+	/// @param file File with the current size, modification time and change time.
+	/// @return File offset or -1 if the image data is not read from \a file on demand,
+	/// e.g. because \a file has been written in the meantime or the data is encoded.
+	goffset file_offset(const ET_File& file) const;
+
 	/// Clean up the internal picture store from orphaned references.
 	static void GarbageCollector();
+	/// Load all image data that is deferred to file \a path, e.g. because the file is about to be modified.
+	/// @param path File in file system encoding.
+	/// @return \c false on error.
+	static bool LoadFromFile(const gchar* path, GError** error);
+	/// Deferred image data of file \a old_path is now found at \a new_path.
+	static void FileRenamed(const gchar* old_path, const gchar* new_path);
 } EtPicture;
 
+/// Image data that is read from a file as long as the file is unchanged.
+/// @details Pictures with such a source follow renames of the file
+/// and load their data before the file is written.
+class EtPictureFileSource : public EtPicture::Source
+{	friend struct EtPicture;
+	/// File in file system encoding, protected by a mutex because it changes on rename.
+	mutable std::string Path;
+	const guint64 FileSize;
+	const guint64 ModificationTime;
+	/// Status change time, 0 if not supported by the platform.
+	/// Size and modification time might survive an in place tag update, the change time does not.
+	const guint64 ChangeTime;
+protected:
+	/// Position of the data in the file.
+	const goffset Offset;
+	/// Fetch the image data from the opened file after it has been checked to be unchanged.
+	/// @details The default implementation reads the raw image data at \ref Offset\.
+	virtual bool read(GInputStream* in, void* bytes, unsigned size, GError** error) const;
+public:
+	EtPictureFileSource(const ET_File& file, goffset offset);
+	/// Check whether the file is still the one the image data has been found in.
+	bool unchanged(guint64 size, guint64 mtime, guint64 ctime) const
+	{	return size == FileSize && mtime == ModificationTime && ctime == ChangeTime; }
+	/// Position of the raw image data in the file or -1 if the data is encoded.
+	virtual goffset raw_offset() const { return Offset; }
+	bool load(void* bytes, unsigned size, GError** error) const override;
+	bool equals(const Source& r) const override;
+};
+
 #endif /* ET_PICTURE_H_ */
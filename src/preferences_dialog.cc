@@ -101,6 +101,7 @@ typedef struct
     GtkWidget *split_url_check;
     GtkWidget *split_encoded_by_check;
     GtkWidget *split_delimiter;
+    GtkWidget *ogg_scan_chained_check;
 
     GtkWidget *id3_strip_check;
     GtkWidget *id3_v2_convert_check;
@@ -171,6 +172,12 @@ typedef struct
     GtkWidget *confirm_unsaved_files_check;
     GtkWidget *scanner_dialog_startup_check;
     GtkWidget *background_threads;
+    GtkWidget *scan_cache_check;
+    GtkWidget *scan_incremental_check;
+    GtkWidget *scan_defer_tags_check;
+    GtkWidget *watch_files_check;
+    GtkWidget *scan_sniff_type_check;
+    GtkWidget *scan_io_schedule_check;
 
     GtkListStore *default_path_model;
     GtkListStore *file_player_model;
@@ -453,6 +460,7 @@ et_preferences_dialog_init (EtPreferencesDialog *self)
     et_settings_bind_flags("ogg-split-fields", priv->split_orig_artist_check);
     et_settings_bind_flags("ogg-split-fields", priv->split_url_check);
     et_settings_bind_flags("ogg-split-fields", priv->split_encoded_by_check);
+    et_settings_bind_boolean("ogg-scan-chained", priv->ogg_scan_chained_check);
 
     /*
      * ID3 Tag Settings
@@ -644,6 +652,14 @@ et_preferences_dialog_init (EtPreferencesDialog *self)
     /* background processing */
     g_settings_bind (MainSettings, "background-threads",
         priv->background_threads, "value", G_SETTINGS_BIND_DEFAULT);
+    et_settings_bind_boolean("scan-cache", priv->scan_cache_check);
+    et_settings_bind_boolean("scan-incremental", priv->scan_incremental_check);
+    et_settings_bind_boolean("scan-defer-tags", priv->scan_defer_tags_check);
+    et_settings_bind_boolean("watch-files", priv->watch_files_check);
+    et_settings_bind_boolean("scan-sniff-type", priv->scan_sniff_type_check);
+    et_settings_bind_boolean("scan-io-schedule", priv->scan_io_schedule_check);
+    g_settings_bind (MainSettings, "scan-defer-tags", priv->scan_io_schedule_check,
+        "sensitive", G_SETTINGS_BIND_GET | G_SETTINGS_BIND_INVERT_BOOLEAN);
 
     /* Properties of the scanner window */
     et_settings_bind_boolean("scan-startup", priv->scanner_dialog_startup_check);
@@ -929,6 +945,7 @@ et_preferences_dialog_class_init (EtPreferencesDialogClass *klass)
     gtk_widget_class_bind_template_child_private(widget_class, EtPreferencesDialog, split_url_check);
     gtk_widget_class_bind_template_child_private(widget_class, EtPreferencesDialog, split_encoded_by_check);
     gtk_widget_class_bind_template_child_private(widget_class, EtPreferencesDialog, split_delimiter);
+    gtk_widget_class_bind_template_child_private(widget_class, EtPreferencesDialog, ogg_scan_chained_check);
     gtk_widget_class_bind_template_child_private(widget_class, EtPreferencesDialog, id3_strip_check);
     gtk_widget_class_bind_template_child_private(widget_class, EtPreferencesDialog, id3_v2_convert_check);
     gtk_widget_class_bind_template_child_private(widget_class, EtPreferencesDialog, id3_v2_crc32_check);
@@ -998,6 +1015,12 @@ et_preferences_dialog_class_init (EtPreferencesDialogClass *klass)
     gtk_widget_class_bind_template_child_private(widget_class, EtPreferencesDialog, confirm_unsaved_files_check);
     gtk_widget_class_bind_template_child_private(widget_class, EtPreferencesDialog, scanner_dialog_startup_check);
     gtk_widget_class_bind_template_child_private(widget_class, EtPreferencesDialog, background_threads);
+    gtk_widget_class_bind_template_child_private(widget_class, EtPreferencesDialog, scan_cache_check);
+    gtk_widget_class_bind_template_child_private(widget_class, EtPreferencesDialog, scan_incremental_check);
+    gtk_widget_class_bind_template_child_private(widget_class, EtPreferencesDialog, scan_defer_tags_check);
+    gtk_widget_class_bind_template_child_private(widget_class, EtPreferencesDialog, watch_files_check);
+    gtk_widget_class_bind_template_child_private(widget_class, EtPreferencesDialog, scan_sniff_type_check);
+    gtk_widget_class_bind_template_child_private(widget_class, EtPreferencesDialog, scan_io_schedule_check);
     gtk_widget_class_bind_template_callback(widget_class, et_preferences_on_response);
     gtk_widget_class_bind_template_callback(widget_class, et_prefs_current_folder_changed);
 }
@@ -42,6 +42,45 @@ using namespace std;
 
 static constexpr int SampleRate = 48000;
 
+/// Vector of 2 doubles, native on SSE2 and NEON, emulated elsewhere.
+typedef double vdouble2 __attribute__((vector_size(2*sizeof(double))));
+/// Vector of 4 doubles, only used by the AVX2 kernels.
+typedef double vdouble4 __attribute__((vector_size(4*sizeof(double))));
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define REPLAYGAIN_AVX2
+#endif
+
+static ReplayGainAnalyzer::Kernel DetectKernel()
+{
+#ifdef REPLAYGAIN_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return ReplayGainAnalyzer::KERNEL_AVX2;
+#endif
+	return ReplayGainAnalyzer::KERNEL_VECTOR;
+}
+
+/// Filter implementation in use.
+static ReplayGainAnalyzer::Kernel ActiveKernel = DetectKernel();
+
+bool ReplayGainAnalyzer::SetKernel(Kernel kernel)
+{
+#ifdef REPLAYGAIN_AVX2
+	if (kernel == KERNEL_AVX2 && !__builtin_cpu_supports("avx2"))
+		return false;
+#else
+	if (kernel == KERNEL_AVX2)
+		return false;
+#endif
+	ActiveKernel = kernel;
+	return true;
+}
+
+ReplayGainAnalyzer::Kernel ReplayGainAnalyzer::GetKernel()
+{	return ActiveKernel;
+}
+
 
 class ReplayGain : public ReplayGainAnalyzer::Result
 {
@@ -49,7 +88,7 @@ protected:
 #if LIBAVCODEC_VERSION_MAJOR >= 60
 	using channel_layout_t = const AVChannelLayout&;
 #else
-	using channel_tayout_t = uint64_t;
+	using channel_layout_t = uint64_t;
 #endif
 
 protected:
@@ -58,6 +97,10 @@ protected:
 	int Channels = 0;
 	float Maximum = 0;
 	virtual void Feed(int channel, const float* data, int count) = 0;
+	/// Feed \a count samples of all channels, never crossing a block boundary.
+	/// @details The default implementation feeds each channel separately.
+	/// Derived classes may override it to process several channels at once.
+	virtual void FeedBlock(const float*const* data, int count);
 	virtual void ProcessBlock() = 0;
 public:
 	ReplayGain(int blockSize) : BlockSize(blockSize), BlockLevel(blockSize) {}
@@ -67,6 +110,11 @@ public:
 	virtual float Peak() const { return Maximum; }
 };
 
+void ReplayGain::FeedBlock(const float*const* data, int count)
+{	for (int ch = 0; ch < Channels; ++ch)
+		Feed(ch, data[ch], count);
+}
+
 void ReplayGain::Feed(const float*const* data, int samples)
 {	float* x[Channels];
 	memcpy(x, data, Channels * sizeof(float*));
@@ -74,10 +122,9 @@ void ReplayGain::Feed(const float*const* data, int samples)
 	{	// Fragment at BlockSize
 		int block = min(BlockLevel, samples);
 
+		FeedBlock(x, block);
 		for (int ch = 0; ch < Channels; ++ch)
-		{	Feed(ch, x[ch], block);
 			x[ch] += block;
-		}
 		samples -= block;
 
 		if ((BlockLevel -= block) == 0)
@@ -112,8 +159,15 @@ class ReplayGain1 : public ReplayGain
 	int BlockCount = 0;
 	// dB bins for quantile calculation
 	int Bins[Bins4dB * dBRange];
+private:
+	/// Filter up to sizeof(V)/sizeof(double) channels in parallel, one per vector lane.
+	template <typename V> void FeedLanes(const float*const* data, int count);
+#ifdef REPLAYGAIN_AVX2
+	__attribute__((target("avx2"))) void FeedAVX2(const float*const* data, int count);
+#endif
 protected:
 	virtual void Feed(int channel, const float* data, int count);
+	virtual void FeedBlock(const float*const* data, int count);
 	virtual void ProcessBlock();
 public:
 	ReplayGain1(int blockSize = SampleRate * 50 / 1000);
@@ -200,6 +254,110 @@ float ReplayGain1::Channel::Feed(const float* x, int count)
 	return max;
 }
 
+template <typename V>
+inline __attribute__((always_inline)) void ReplayGain1::FeedLanes(const float*const* data, int count)
+{	constexpr int L = sizeof(V) / sizeof(double);
+	for (int ch0 = 0; ch0 < Channels; ch0 += L)
+	{	Channel* cp = &ChannelBuf[ch0];
+		const int n = min(L, Channels - ch0);
+		// Unused lanes duplicate the first channel, their results are discarded.
+		const float* src[L];
+		V X[2] = {}, Y[16] = {}, Z[16] = {}, sum = {}, max = {};
+		for (int l = 0; l < L; ++l)
+		{	src[l] = data[ch0 + (l < n ? l : 0)];
+			if (l >= n)
+				continue;
+			X[0][l] = cp[l].X[0];
+			X[1][l] = cp[l].X[1];
+			for (int i = 0; i < 16; ++i)
+			{	Y[i][l] = cp[l].Y[i];
+				Z[i][l] = cp[l].Z[i];
+			}
+		}
+		// The ring buffer positions are the same for all channels.
+		bool xi = cp->Xi;
+		int yzi = cp->YZi;
+
+		for (int s = 0; s < count; ++s)
+		{	V in;
+			for (int l = 0; l < L; ++l)
+				in[l] = src[l][s];
+			// Peak
+			max = in > max ? in : max;
+			// Butterworth filter
+			V& y0 = Y[yzi];
+			y0 = (X[xi] + in) * 0.98621192462708
+			    + X[!xi] * -1.97242384925416
+			    + Y[(yzi - 2) & 15] * -0.97261396931306
+			    + Y[(yzi - 1) & 15] * 1.97223372919527;
+			X[xi] = in;
+			xi = !xi;
+			// Yule filter
+			V res = Y[(yzi - 10) & 15] * 0.00288463683916
+			    + Y[(yzi - 9) & 15] * 0.00012025322027
+			    + Y[(yzi - 8) & 15] * 0.00306428023191
+			    + Y[(yzi - 7) & 15] * 0.00594298065125
+			    + Y[(yzi - 6) & 15] * -0.02074045215285
+			    + Y[(yzi - 5) & 15] * 0.02161526843274
+			    + Y[(yzi - 4) & 15] * -0.01655260341619
+			    + Y[(yzi - 3) & 15] * -0.00009291677959
+			    + Y[(yzi - 2) & 15] * -0.00123395316851
+			    + Y[(yzi - 1) & 15] * -0.02160367184185
+			    + y0 * 0.03857599435200
+			    + Z[(yzi - 10) & 15] * -0.13919314567432
+			    + Z[(yzi - 9) & 15] * 0.86984376593551
+			    + Z[(yzi - 8) & 15] * -2.75465861874613
+			    + Z[(yzi - 7) & 15] * 5.87257861775999
+			    + Z[(yzi - 6) & 15] * -9.48293806319790
+			    + Z[(yzi - 5) & 15] * 12.28759895145294
+			    + Z[(yzi - 4) & 15] * -13.05504219327545
+			    + Z[(yzi - 3) & 15] * 11.34170355132042
+			    + Z[(yzi - 2) & 15] * -7.81501653005538
+			    + Z[(yzi - 1) & 15] * 3.84664617118067;
+			Z[yzi] = res;
+			// RMS calculation
+			sum += res * res;
+			yzi = (yzi + 1) & 15;
+		}
+
+		for (int l = 0; l < n; ++l)
+		{	Channel& c = cp[l];
+			c.Sum += sum[l];
+			c.X[0] = X[0][l];
+			c.X[1] = X[1][l];
+			for (int i = 0; i < 16; ++i)
+			{	c.Y[i] = Y[i][l];
+				c.Z[i] = Z[i][l];
+			}
+			c.Xi = xi;
+			c.YZi = yzi;
+			if (max[l] > Maximum)
+				Maximum = max[l];
+		}
+	}
+}
+
+#ifdef REPLAYGAIN_AVX2
+void ReplayGain1::FeedAVX2(const float*const* data, int count)
+{	FeedLanes<vdouble4>(data, count);
+}
+#endif
+
+void ReplayGain1::FeedBlock(const float*const* data, int count)
+{	switch (ActiveKernel)
+	{case ReplayGainAnalyzer::KERNEL_VECTOR:
+		FeedLanes<vdouble2>(data, count);
+		break;
+#ifdef REPLAYGAIN_AVX2
+	 case ReplayGainAnalyzer::KERNEL_AVX2:
+		FeedAVX2(data, count);
+		break;
+#endif
+	 default:
+		ReplayGain::FeedBlock(data, count);
+	}
+}
+
 void ReplayGain1::ProcessBlock()
 {	double sum = 0;
 	for (Channel* cp = ChannelBuf.get(), *cpe = cp + Channels; cp != cpe; ++cp)
@@ -291,10 +449,19 @@ class ReplayGain2 : public ReplayGain
 	};
 	double Zsum[4] = {0};
 	unique_ptr<Channel[]> ChannelBuf;
+	/// Indices of the channels with non-zero gain.
+	vector<int> Active;
 	double Ljsum = 0;
 	vector<float> Lj;
+private:
+	/// Filter up to sizeof(V)/sizeof(double) active channels in parallel, one per vector lane.
+	template <typename V> void FeedLanes(const float*const* data, int count);
+#ifdef REPLAYGAIN_AVX2
+	__attribute__((target("avx2"))) void FeedAVX2(const float*const* data, int count);
+#endif
 protected:
 	virtual void Feed(int channel, const float* data, int count);
+	virtual void FeedBlock(const float*const* data, int count);
 	virtual void ProcessBlock();
 public:
 	ReplayGain2() : ReplayGain(BlockSize / 4), Lj(100) {}
@@ -340,8 +507,10 @@ void ReplayGain2::Setup(channel_layout_t channel_layout)
 #endif
 
 	ChannelBuf.reset(new Channel[Channels]);
+	Active.clear();
 	for (int ch = 0; ch < Channels; ++ch)
-		ChannelBuf[ch].Gain = gain[ch];
+		if ((ChannelBuf[ch].Gain = gain[ch]) != 0)
+			Active.emplace_back(ch);
 }
 
 void ReplayGain2::Feed(int channel, const float* data, int count)
@@ -375,6 +544,88 @@ void ReplayGain2::Feed(int channel, const float* data, int count)
 	ch.XYi = i;
 }
 
+template <typename V>
+inline __attribute__((always_inline)) void ReplayGain2::FeedLanes(const float*const* data, int count)
+{	constexpr int L = sizeof(V) / sizeof(double);
+	const int active = Active.size();
+	for (int a0 = 0; a0 < active; a0 += L)
+	{	const int n = min(L, active - a0);
+		// Unused lanes duplicate the first channel with zero gain.
+		const float* src[L];
+		V X[2] = {}, Y[2] = {}, G = {}, sum = {}, max = {};
+		for (int l = 0; l < L; ++l)
+		{	const Channel& c = ChannelBuf[Active[a0 + (l < n ? l : 0)]];
+			src[l] = data[Active[a0 + (l < n ? l : 0)]];
+			if (l >= n)
+				continue;
+			X[0][l] = c.X[0];
+			X[1][l] = c.X[1];
+			Y[0][l] = c.Y[0];
+			Y[1][l] = c.Y[1];
+			G[l] = c.Gain;
+		}
+		// The ring buffer position is the same for all channels.
+		int i = ChannelBuf[Active[a0]].XYi;
+
+		for (int s = 0; s < count; ++s)
+		{	V in;
+			for (int l = 0; l < L; ++l)
+				in[l] = src[l][s];
+			max = in > max ? in : max;
+			// Highpass
+			V tmp = in
+				+ 1.99004745483398 * X[i]
+				- 0.99007225036621 * X[!i];
+			V acc = tmp - 2. * X[i] + X[!i];
+			X[!i] = tmp;
+			// Head filter
+			tmp = acc
+				+ 1.69065929318241 * Y[i]
+				- 0.73248077421585 * Y[!i];
+			acc = 1.53512485958697 * tmp
+				- 2.69169618940638 * Y[i]
+				+ 1.19839281085285 * Y[!i];
+			Y[!i] = tmp;
+			// RMS
+			sum += acc * acc * G;
+			i = !i;
+		}
+
+		for (int l = 0; l < n; ++l)
+		{	Channel& c = ChannelBuf[Active[a0 + l]];
+			c.X[0] = X[0][l];
+			c.X[1] = X[1][l];
+			c.Y[0] = Y[0][l];
+			c.Y[1] = Y[1][l];
+			c.XYi = i;
+			Zsum[0] += sum[l];
+			if (max[l] > Maximum)
+				Maximum = max[l];
+		}
+	}
+}
+
+#ifdef REPLAYGAIN_AVX2
+void ReplayGain2::FeedAVX2(const float*const* data, int count)
+{	FeedLanes<vdouble4>(data, count);
+}
+#endif
+
+void ReplayGain2::FeedBlock(const float*const* data, int count)
+{	switch (ActiveKernel)
+	{case ReplayGainAnalyzer::KERNEL_VECTOR:
+		FeedLanes<vdouble2>(data, count);
+		break;
+#ifdef REPLAYGAIN_AVX2
+	 case ReplayGainAnalyzer::KERNEL_AVX2:
+		FeedAVX2(data, count);
+		break;
+#endif
+	 default:
+		ReplayGain::FeedBlock(data, count);
+	}
+}
+
 void ReplayGain2::ProcessBlock()
 {	double sum = Zsum[3];
 	sum += Zsum[3] = Zsum[2];
@@ -424,6 +675,26 @@ static ReplayGain* Factory(EtReplayGainModel model)
 	}
 }
 
+void ReplayGainAnalyzer::Aggregate(const Result& r)
+{	if (!Aggregated)
+		Aggregated.reset(Factory(Model));
+	*Aggregated += r;
+}
+
+void ReplayGainAnalyzer::AnalyzeSamples(const float*const* data, int channels, int samples)
+{	ReplayGain* acc = Factory(Model);
+	Last.reset(acc);
+#if LIBAVCODEC_VERSION_MAJOR >= 60
+	AVChannelLayout layout;
+	av_channel_layout_default(&layout, channels);
+	acc->Setup(layout);
+	av_channel_layout_uninit(&layout);
+#else
+	acc->Setup(av_get_default_channel_layout(channels));
+#endif
+	acc->Feed(data, samples);
+}
+
 string ReplayGainAnalyzer::AnalyzeFile(const char* fileName)
 {
 	char err[AV_ERROR_MAX_STRING_SIZE];
@@ -550,11 +821,6 @@ found_stream:
 	if (count > 0)
 		acc->Feed(buffer, count);
 
-	// album gain
-	if (!Aggregated)
-		Aggregated.reset(Factory(Model));
-	*Aggregated += *acc;
-
 	// all cleanup is done by unique_ptr destructors
 	return string();
 }
@@ -42,6 +42,12 @@ public:
 		/** aggregate results */
 		virtual void operator+=(const Result& r) = 0;
 	};
+	/// Implementation of the audio filters.
+	enum Kernel
+	{	KERNEL_SCALAR, ///< One channel after another, reference implementation.
+		KERNEL_VECTOR, ///< Several channels in parallel using the native vector unit.
+		KERNEL_AVX2    ///< Four channels in parallel using AVX2.
+	};
 	const EtReplayGainModel Model;
 private:
 	std::unique_ptr<Result> Last;
@@ -49,20 +55,39 @@ private:
 public:
 	ReplayGainAnalyzer(EtReplayGainModel model) : Model(model) {}
 
-	/** Analyze a file and aggregate the results in the current instance.
+	/** Analyze a file.
 	 * @param fileName
 	 * @return Error message if any, empty on success,
 	 * "$Aborted" if Main_Stop_Button_Pressed has been set. */
 	std::string AnalyzeFile(const char* fileName);
+	/** Analyze raw samples at 48kHz rather than a file, e.g. for testing.
+	 * @param data Planar sample data, one array per channel.
+	 * @param channels Number of channels, the default layout is assumed.
+	 * @param samples Number of samples per channel. */
+	void AnalyzeSamples(const float*const* data, int channels, int samples);
 
 	/** Retrieve the last file result (for track gain). */
 	const Result& GetLastResult() const { return *Last; }
+	/** Take the ownership of the last file result,
+	 * e.g. to aggregate it in another instance. */
+	std::unique_ptr<Result> TakeLastResult() { return std::move(Last); }
+
+	/** Aggregate a file result in the current instance.
+	 * @remarks The result of the aggregation might depend on the order of the calls. */
+	void Aggregate(const Result& r);
 
 	/** Retrieve the current aggregated result (for album gain). */
 	const Result& GetAggregatedResult() const { return *Aggregated; }
 
 	/** Reset state of the analyzer, i.e. discard results. */
 	void Reset() { Last.reset(); Aggregated.reset(); }
+
+	/** Select the filter implementation, e.g. for testing.
+	 * By default the fastest kernel supported by the CPU is used.
+	 * @return false if the kernel is not supported by the CPU. */
+	static bool SetKernel(Kernel kernel);
+	/** Get the currently used filter implementation. */
+	static Kernel GetKernel();
 };
 
 #endif
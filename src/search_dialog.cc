@@ -157,6 +157,8 @@ Search_File (GtkWidget *search_button,
         : [](const gchar* value) { return g_utf8_casefold(value, -1); };
     gchar* string_to_search_normalized = normalize(string_to_search);
 
+    Read_Pending_Tags();
+
     GEnumClass *enum_class = (GEnumClass*)g_type_class_ref(ET_TYPE_SORT_MODE);
     for (const ET_File* ETFile : ET_FileList::all_files())
     {
@@ -49,6 +49,9 @@ const struct MusePack_Description : ET_File_Description
 		read_file = mpc_read_file;
 		write_file_tag = ape_tag_write_file_tag;
 		display_file_info_to_ui = et_mpc_header_display_file_info_to_ui;
+		// stream version 8 or 7
+		sniff = [](const guchar* head, gsize len)
+		{	return len >= 4 && (memcmp(head, "MPCK", 4) == 0 || memcmp(head, "MP+", 3) == 0); };
 	}
 }
 MPC_Description(".mpc"),
@@ -63,6 +66,7 @@ const struct MonkeysAudio_Description : ET_File_Description
 		read_file = mac_read_file;
 		write_file_tag = ape_tag_write_file_tag;
 		display_file_info_to_ui = et_mac_header_display_file_info_to_ui;
+		sniff = [](const guchar* head, gsize len) { return len >= 4 && memcmp(head, "MAC ", 4) == 0; };
 	}
 }
 APE_Description(".ape"),
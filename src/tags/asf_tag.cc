@@ -53,6 +53,9 @@ const struct Asf_Description : ET_File_Description
 		display_file_info_to_ui = et_asf_header_display_file_info_to_ui;
 		unsupported_fields = asftag_unsupported_fields;
 		support_multiple_pictures = [](const ET_File*) { return false; };
+		// header object GUID
+		sniff = [](const guchar* head, gsize len)
+		{	return len >= 16 && memcmp(head, "\x30\x26\xb2\x75\x8e\x66\xcf\x11\xa6\xd9\x00\xaa\x00\x62\xce\x6c", 16) == 0; };
 	}
 }
 WMA_Description(".wma", _("Windows Media File")),
@@ -208,10 +211,11 @@ gboolean asftag_write_file_tag (const ET_File *ETFile, GError **error)
 	// Pictures
 	tag->removeItem("WM/Picture");
 	for (const EtPicture& pic : FileTag->pictures)
-	{	ASF::Picture picture;
+	{	const EtPicture::Data* data = pic.data();
+		ASF::Picture picture;
 		picture.setType((ASF::Picture::Type)pic.type); // EtPictureType and ASF::Picture::Type are compatible
 		picture.setMimeType(EtPicture::Mime_Type_String(pic.Format()));
-		picture.setPicture(ByteVector((const char*)pic.storage->Bytes, pic.storage->Size));
+		picture.setPicture(ByteVector((const char*)data->Bytes, data->Size));
 		picture.setDescription(pic.description.get());
 
 		tag->setAttribute("WM/Picture", ASF::Attribute(picture));
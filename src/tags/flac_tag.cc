@@ -39,6 +39,7 @@
 #include "../file.h"
 
 #include <memory>
+#include <vector>
 
 using namespace std;
 
@@ -51,6 +52,7 @@ const struct Flac_Description : ET_File_Description
 		read_file = flac_read_file;
 		write_file_tag = flac_tag_write_file_tag;
 		display_file_info_to_ui = et_flac_header_display_file_info_to_ui;
+		sniff = [](const guchar* head, gsize len) { return len >= 4 && memcmp(head, "fLaC", 4) == 0; };
 	}
 }
 FLAC_Description(".flac"),
@@ -58,99 +60,197 @@ FLA_Description(".fla");
 
 
 /*
- * Read tag data from a FLAC file using the level 2 flac interface,
+ * Read tag data from a FLAC file.
+ * The metadata blocks are parsed directly, blocks that EasyTAG does not use
+ * are skipped without reading them and the Vorbis comments are taken from
+ * the raw block in place.
  * Note:
  *  - if field is found but contains no info (strlen(str)==0), we don't read it
  */
 File_Tag* flac_read_file (GFile *file, ET_File *ETFile, GError **error)
 {
-    EtFlacReadState state;
-    FLAC__IOCallbacks callbacks = { et_flac_read_func,
-                                    NULL, /* Do not set a write callback. */
-                                    et_flac_seek_func, et_flac_tell_func,
-                                    et_flac_eof_func,
-                                    et_flac_read_close_func };
     g_return_val_if_fail (file != NULL && ETFile != NULL, nullptr);
     g_return_val_if_fail (error == NULL || *error == NULL, nullptr);
 
-    auto chain = make_unique(FLAC__metadata_chain_new(), FLAC__metadata_chain_delete);
-
-    if (chain == NULL)
-    {
-        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_NOMEM, "%s",
-                     g_strerror (ENOMEM));
+    gObject<GFileInputStream> istream(g_file_read(file, NULL, error));
+    if (!istream)
         return nullptr;
-    }
-
-    state.eof = FALSE;
-    state.error = NULL;
-    state.istream = g_file_read (file, NULL, &state.error);
-    state.seekable = G_SEEKABLE (state.istream);
-
-    if (!FLAC__metadata_chain_read_with_callbacks(chain.get(), &state, callbacks))
-    {
-        /* TODO: Provide a dedicated error enum corresponding to status. */
+    GInputStream* in = G_INPUT_STREAM(istream.get());
+
+    auto read = [in, error](void* buffer, gsize size)
+    {   gsize bytes_read;
+        if (!g_input_stream_read_all(in, buffer, size, &bytes_read, NULL, error))
+            return false;
+        if (bytes_read == size)
+            return true;
         g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED, "%s",
                      _("Error opening FLAC file"));
-        et_flac_read_close_func (&state);
-
+        return false;
+    };
+    auto skip = [in, error](goffset size)
+    {   return g_seekable_seek(G_SEEKABLE(in), size, G_SEEK_CUR, NULL, error);
+    };
+    auto read32 = [](const guchar* p) -> guint32
+    {   return (guint32)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+    };
+
+    guchar header[10];
+    if (!read(header, 4))
         return nullptr;
+    /* Skip an ID3v2 tag in front of the stream like libFLAC does. */
+    if (memcmp(header, "ID3", 3) == 0)
+    {
+        if (!read(header + 4, 6))
+            return nullptr;
+        goffset size = (header[6] & 0x7f) << 21 | (header[7] & 0x7f) << 14
+            | (header[8] & 0x7f) << 7 | (header[9] & 0x7f);
+        if (header[5] & 0x10) // footer present
+            size += 10;
+        if (!skip(size) || !read(header, 4))
+            return nullptr;
     }
-
-    auto iter = make_unique(FLAC__metadata_iterator_new(), FLAC__metadata_iterator_delete);
-
-    if (iter == NULL)
+    if (memcmp(header, "fLaC", 4) != 0)
     {
-        et_flac_read_close_func (&state);
-        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_NOMEM, "%s",
-                     g_strerror (ENOMEM));
+        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED, "%s",
+                     _("Error opening FLAC file"));
         return nullptr;
     }
 
-    File_Tag* FileTag = new File_Tag();
+    unique_ptr<File_Tag> FileTag(new File_Tag());
     ET_File_Info* ETFileInfo = &ETFile->ETFileInfo;
 
-    FLAC__metadata_iterator_init(iter.get(), chain.get());
+    /* Bytes to read of picture blocks before deciding to defer the image data. */
+    const guint32 picture_head = 4096;
+    vector<guchar> buffer;
     uint32_t metadata_len = 0;
+    bool last;
     do
     {
-        FLAC__StreamMetadata *block;
+        if (!read(header, 4))
+            return nullptr;
+        last = (header[0] & 0x80) != 0;
+        FLAC__MetadataType type = (FLAC__MetadataType)(header[0] & 0x7f);
+        guint32 length = header[1] << 16 | header[2] << 8 | header[3];
+        metadata_len += length;
+
+        if (type != FLAC__METADATA_TYPE_STREAMINFO
+            && type != FLAC__METADATA_TYPE_VORBIS_COMMENT
+            && type != FLAC__METADATA_TYPE_PICTURE)
+        {
+            /* Padding, seek table, cue sheet... */
+            if (!skip(length))
+                return nullptr;
+            continue;
+        }
+
+        /* Of large pictures only the head is read,
+         * the image data is loaded from the file on demand. */
+        guint32 avail = length;
+        goffset offset = 0;
+        if (type == FLAC__METADATA_TYPE_PICTURE && length > picture_head)
+        {
+            offset = g_seekable_tell(G_SEEKABLE(in));
+            avail = picture_head;
+        }
 
-        block = FLAC__metadata_iterator_get_block(iter.get());
-        metadata_len += block->length;
+        /* One extra byte to terminate the last comment of the block. */
+        buffer.resize(avail + 1);
+        if (!read(buffer.data(), avail))
+            return nullptr;
+        buffer[avail] = 0;
+        const guchar* data = buffer.data();
 
-        if (block->type == FLAC__METADATA_TYPE_VORBIS_COMMENT)
+        if (type == FLAC__METADATA_TYPE_VORBIS_COMMENT)
         {
-            const FLAC__StreamMetadata_VorbisComment* vc = &block->data.vorbis_comment;
-            vorbis_tags tags(vc->num_comments);
+            vorbis_tags tags(0);
 
             /* Get comments from block. */
-            for (int i = 0; i < vc->num_comments; i++)
-            {
-                auto& comment = vc->comments[i];
-                tags.emplace((const char*)comment.entry, comment.length);
-            }
+            if (!tags.parse(data, length))
+                g_debug("Truncated FLAC Vorbis comment: %s", ETFile->FilePath.get());
 
-            tags.to_file_tags(FileTag);
+            tags.to_file_tags(FileTag.get());
 
             /* Save unsupported fields. */
             tags.to_other_tags(ETFile);
         }
-        else if (block->type == FLAC__METADATA_TYPE_PICTURE)
+        else if (type == FLAC__METADATA_TYPE_PICTURE)
         {
-            /* Picture. */
-            const FLAC__StreamMetadata_Picture *p;
-            /* Get picture data from block. */
-            p = &block->data.picture;
-
-            FileTag->pictures.emplace_back((EtPictureType)p->type,
-                xStringD0((const char*)p->description), 0, 0, p->data, p->data_length);
+            /* Picture: type, MIME type, description, width, height, depth,
+             * number of colors and the image data. */
+            EtPictureType pic_type;
+            guint32 pos, mimelen, desclen, width, height, data_length;
+            /* Read the remainder of the block if the header exceeds the head. */
+            auto need = [&](guint32 end)
+            {   if (end <= avail)
+                    return true;
+                buffer.resize(length + 1);
+                if (!read(buffer.data() + avail, length - avail))
+                    return false;
+                avail = length;
+                buffer[avail] = 0;
+                data = buffer.data();
+                return true;
+            };
+            if (length < 8 * 4)
+            {invalid_picture:
+                g_debug("Invalid FLAC picture block: %s", ETFile->FilePath.get());
+                if (avail < length && !skip(length - avail))
+                    return nullptr;
+                continue;
+            }
+            pic_type = (EtPictureType)read32(data);
+            mimelen = read32(data + 4);
+            pos = 8;
+            if (mimelen > length - pos - 6 * 4)
+                goto invalid_picture;
+            /* Skip over the MIME type, as gdk-pixbuf does not use it. */
+            pos += mimelen;
+            if (!need(pos + 4))
+                return nullptr;
+            desclen = read32(data + pos);
+            pos += 4;
+            if (desclen > length - pos - 5 * 4)
+                goto invalid_picture;
+            if (!need(pos + desclen + 5 * 4))
+                return nullptr;
+
+            xStringD0 description;
+            description.assignNFC((const char*)data + pos, desclen);
+            pos += desclen;
+            width = read32(data + pos);
+            height = read32(data + pos + 4);
+            /* Skip the color depth and number-of-colors fields. */
+            pos += 16;
+
+            data_length = read32(data + pos);
+            pos += 4;
+            if (data_length > length - pos)
+                goto invalid_picture;
+
+            if (pos + data_length <= avail)
+                FileTag->pictures.emplace_back(pic_type, description, width, height, data + pos, data_length);
+            else
+            {
+                FileTag->pictures.emplace_back(pic_type, description, width, height, *ETFile, offset + pos, data_length);
+                if (!skip(length - avail))
+                    return nullptr;
+            }
         }
-        else if (block->type == FLAC__METADATA_TYPE_STREAMINFO)
+        else /* FLAC__METADATA_TYPE_STREAMINFO */
         {
             /* header info */
-            const FLAC__StreamMetadata_StreamInfo *stream_info = &block->data.stream_info;
-            if (stream_info->sample_rate == 0)
+            if (length < 18)
+            {
+                g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED, "%s",
+                             _("Error opening FLAC file"));
+                return nullptr;
+            }
+            /* 20 bits sample rate, 3 bits channels - 1, 5 bits bits per sample - 1,
+             * 36 bits total samples */
+            guint sample_rate = data[10] << 12 | data[11] << 4 | data[12] >> 4;
+            guint channels = ((data[12] >> 1) & 7) + 1;
+            guint64 total_samples = (guint64)(data[13] & 0x0f) << 32 | read32(data + 14);
+            if (sample_rate == 0)
             {
                 gchar *filename;
 
@@ -164,18 +264,16 @@ File_Tag* flac_read_file (GFile *file, ET_File *ETFile, GError **error)
             }
             else
             {
-                ETFileInfo->duration = (double)stream_info->total_samples / stream_info->sample_rate;
+                ETFileInfo->duration = (double)total_samples / sample_rate;
             }
 
-            ETFileInfo->mode = stream_info->channels;
-            ETFileInfo->samplerate = stream_info->sample_rate;
+            ETFileInfo->mode = channels;
+            ETFileInfo->samplerate = sample_rate;
             ETFileInfo->version = 0; /* Not defined in FLAC file. */
         }
-    } while (FLAC__metadata_iterator_next(iter.get()));
+    } while (!last);
 
-    iter.reset();
-    chain.reset();
-    et_flac_read_close_func (&state);
+    istream.reset();
     /* End of decoding FLAC file */
 
     if (ETFileInfo->duration > 0 && ETFile->FileSize > 0)
@@ -193,8 +291,7 @@ File_Tag* flac_read_file (GFile *file, ET_File *ETFile, GError **error)
         File_Tag* FileTag2 = id3_read_file(file, ETFile, NULL);
         if (FileTag2)
         {
-            delete FileTag;
-            FileTag = FileTag2;
+            FileTag.reset(FileTag2);
 
             // If an ID3 tag has been found (and no FLAC tag), we mark the file as
             // unsaved to rewrite a flac tag.
@@ -207,7 +304,7 @@ File_Tag* flac_read_file (GFile *file, ET_File *ETFile, GError **error)
     // validate date fields
     FileTag->check_dates(3, true, *ETFile->FileNameCur()); // From field 3 arbitrary strings are allowed
 
-    return FileTag;
+    return FileTag.release();
 }
 
 /*
@@ -511,8 +608,9 @@ flac_tag_write_file_tag (const ET_File *ETFile,
         /* Picture data. */
         /* Safe to pass const data, if the last argument (copy) is
          * TRUE, according the the FLAC API reference. */
+        const EtPicture::Data* data = pic.data();
         FLAC__metadata_object_picture_set_data(picture_block,
-            (FLAC__byte *)pic.storage->Bytes, (FLAC__uint32)pic.storage->Size, true);
+            (FLAC__byte *)data->Bytes, (FLAC__uint32)data->Size, true);
 
         if (!FLAC__metadata_object_picture_is_legal (picture_block,
                                                      &violation))
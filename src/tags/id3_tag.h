@@ -41,6 +41,7 @@ GQuark et_id3_error_quark (void);
 
 struct ET_File;
 struct File_Tag;
+struct ET_FileHead;
 struct EtFileHeaderFields;
 
 /*
@@ -55,6 +56,7 @@ typedef enum
 } EtID3Error;
 
 File_Tag* id3_read_file (GFile *file, ET_File *ETFile, GError **error);
+File_Tag* id3_read_file_head (ET_FileHead& head, ET_File *ETFile, GError **error);
 gboolean id3tag_write_file_v24tag (const ET_File *ETFile, GError **error);
 gboolean id3tag_write_file_tag (const ET_File *ETFile, GError **error);
 void et_mpeg_header_display_file_info_to_ui (EtFileHeaderFields *fields, const ET_File *ETFile);
@@ -30,6 +30,11 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/fcntl.h>
+#ifdef G_OS_WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 #include "id3_tag.h"
 #include "picture.h"
@@ -47,6 +52,7 @@
 #include <id3/globals.h>
 #include "genres.h"
 
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <cstring>
@@ -60,9 +66,13 @@ struct MPEG_Description : ET_File_Description
 		FileType = description;
 		TagType = _("ID3 Tag");
 		read_file = id3_read_file;
+		read_file_head = id3_read_file_head;
 		write_file_tag = id3tag_write_file_tag;
 		display_file_info_to_ui = et_mpeg_header_display_file_info_to_ui;
 		unsupported_fields = id3tag_unsupported_fields;
+		// frame sync, layer 0 is AAC in ADTS
+		sniff = [](const guchar* head, gsize len)
+		{	return len >= 2 && head[0] == 0xff && (head[1] & 0xe0) == 0xe0 && (head[1] & 0x06) != 0; };
 	}
 };
 
@@ -86,14 +96,51 @@ enum {
 
 #define PEEK_MPEG_DATA_LEN 4096
 
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* Padding policy of ID3v2 tags, see etag_set_padding(). */
+#define ID3V2_PADDING_STEP 4096
+#define ID3V2_MAX_PADDING (64 * 1024)
+/* Chunk size to move the audio data when the size of the ID3v2 tag changes. */
+#define MOVE_DATA_CHUNK_SIZE (256 * 1024)
+/* Pictures of at least this size are loaded from the file on demand. */
+#define DEFER_PICTURE_SIZE 4096
+
 /**************
  * Prototypes *
  **************/
-static void   get_audio_frame_header    (ET_File_Info* info, const id3_byte_t* data, int len);
+namespace { struct frame_header; }
+class ID3FileView;
+/// Parse the first audio frame and an optional Xing/Info, LAME or VBRI header.
+/// @param hdr [out] Header of the first frame.
+/// @return -1: no audio frame found, 0: no VBR header, 1: exact duration from the VBR header.
+static int    get_audio_frame_header    (ET_File_Info* info, const id3_byte_t* data, int len, frame_header& hdr);
+/// Count the complete frames of the stream of \a first in a chunk of audio data.
+/// @param bytes [in,out] Incremented by the length of the frames.
+/// @param vbr [in,out] Set if a frame has another bitrate than \a first.
+/// @return Number of frames.
+static unsigned count_audio_frames      (const id3_byte_t* sp, const id3_byte_t* spe, const frame_header& first, guint64& bytes, bool& vbr);
+/// Estimate duration and bitrate from the average frame length at a few points of the audio data.
+/// @param first Header of the first frame.
+/// @param start File offset of the audio data.
+/// @param end End of the audio data.
+/// @param pos Buffer position for the samples, behind all data that is still needed.
+static void   sample_audio_frames       (ET_File_Info* info, ID3FileView& view, const frame_header& first, goffset start, goffset end, gsize pos);
 static bool   etag_guess_byteorder      (const id3_ucs4_t *ustr, gchar **ret);
 static bool   etag_ucs42gchar           (const id3_ucs4_t *usrc, unsigned is_latin, unsigned is_utf16, gchar **res);
 static bool   libid3tag_Get_Frame_Str   (const struct id3_frame *frame, unsigned etag_field_type, const gchar* split_delimiter, string& retstr);
-static bool   apply_tag(File_Tag* FileTag, id3_tag* tag);
+/// Raw ID3v2 tag in the read buffer to locate picture data in the file.
+struct id3_tag_region
+{	const ET_File* File;
+	const id3_byte_t* Data;
+	gsize Size;
+	goffset Offset; ///< File offset of Data
+};
+/// Assign the tag values to \a FileTag.
+/// @param region Raw data of \a tag to defer loading of pictures, optional.
+static bool   apply_tag(File_Tag* FileTag, id3_tag* tag, const id3_tag_region* region = nullptr);
 
 static void   Id3tag_delete_frames      (struct id3_tag *tag, const gchar *name, int start);
 static void   Id3tag_delete_txxframes   (struct id3_tag *tag, const gchar *param1, int start);
@@ -101,127 +148,350 @@ static struct id3_frame *Id3tag_find_and_create_frame    (struct id3_tag *tag, c
 static int    id3taglib_set_field       (struct id3_frame *frame, const gchar *str, enum id3_field_type type, int num, int clear, int id3v1);
 static void   etag_set_tags             (const gchar *str, const char *frame_name, enum id3_field_type field_type, struct id3_tag *v1tag, struct id3_tag *v2tag, gboolean *strip_tags);
 static void   etag_set_txxxtag          (const gchar *str, const char *frame_desc, enum id3_field_type field_type, struct id3_tag *v2tag, gboolean *strip_tags);
+static void   etag_set_padding          (struct id3_tag *v2tag, id3_length_t filev2size);
+static gboolean etag_move_data          (GSeekable *seekable, goffset from, goffset to, goffset length, GError **error);
 static gboolean etag_write_tags (const gchar *filename, struct id3_tag const *v1tag,
-                            struct id3_tag const *v2tag, gboolean strip_tags, GError **error);
+                            struct id3_tag *v2tag, gboolean strip_tags, GError **error);
 
 /*************
  * Functions *
  *************/
 
+static uint32_t read32u(const id3_byte_t* data)
+{
+	return (((((data[0] << 8) | data[1]) << 8) | data[2]) << 8) | data[3];
+}
+
+namespace
+{
+	struct frame_header
+	{
+		static const uint8_t brx[2][2][16];
+		static const int srx[3];
+		static const uint8_t xingoff[3];
+
+		uint8_t version;
+		uint8_t layer;
+		uint8_t bitrate;
+		uint8_t srate;
+		uint8_t mode;
+		uint8_t padding;
+
+		bool Fill(const id3_byte_t* sp)
+		{
+			if (sp[0] != 0xff || sp[1] < 0xe0)
+				return false;
+
+			version = (sp[1] >> 3) & 3;
+			layer = (sp[1] >> 1) & 3;
+			bitrate = (sp[2] >> 4) & 15;
+			srate = (sp[2] >> 2) & 3;
+			mode = (sp[3] >> 6) & 3;
+			padding = (sp[2] >> 1) & 1;
+			if (version == 1 || layer == 0 || bitrate == 15 || srate == 3
+				|| (layer == 2 && (mode == 3 ? bitrate > 10 : bitrate < 6 && (bitrate & 3))))
+				return false;
+
+			return true;
+		}
+
+		int Bitrate() const
+		{	if (version == 3 && layer == 3) // V1L1
+				return (bitrate << 5) * 1000;
+			else
+				return (version & 1 ? brx[0][layer & 1] : brx[1][layer < 3])[bitrate] * 8000;
+		}
+
+		int Samplerate() const
+		{	return srx[srate] / (4 - version);
+		}
+
+		int XingOffset() const
+		{	return xingoff[(version & 1) + (mode != 3)];
+		}
+
+		int FrameSamples() const
+		{	return layer == 3 ? 384 : layer == 1 && version != 3 ? 576 : 1152;
+		}
+
+		int FrameLength() const
+		{	int shift = (layer == 3) << 1; // Layer I => 2**2, 2**0 otherwise
+			return ((FrameSamples() >> (shift + 3)) * Bitrate() / Samplerate() + padding) << shift;
+		}
+
+		bool Matches(const frame_header& r) const
+		{	return version == r.version
+				&& layer == r.layer
+				&& srate == r.srate
+				&& mode == r.mode;
+		}
+	};
+
+	const uint8_t frame_header::brx[2][2][16] =
+	{	{	{ 0, 4, 6, 7, 8, 10, 12, 14, 16, 20, 24, 28, 32, 40, 48, 0 } // V1L2
+		,	{ 0, 4, 5, 6, 7,  8, 10, 12, 14, 16, 20, 24, 28, 32, 40, 0 } // V1L3
+		},
+		{	{ 0, 4, 6, 7, 8, 10, 12, 14, 16, 18, 20, 22, 24, 28, 32, 0 } // V2L1
+		,	{ 0, 1, 2, 3, 4,  5,  6,  7,  8, 10, 12, 14, 16, 18, 20, 0 } // V2L23
+	}	};
+	const int frame_header::srx[3] = { 44100, 48000, 32000 };
+	const uint8_t frame_header::xingoff[3] = { 9+1, 17+4, 32+4 };
+}
+
+/// Positioned reads of a local file into one reusable buffer per thread.
+/// @details The buffer is addressed by positions rather than pointers
+/// because it might be reallocated when it grows.
+class ID3FileView
+{	int Fd;
+	/// Number of bytes at the start of the buffer taken from the type check.
+	gsize Preloaded = 0;
+	/// Read buffer, kept between files unless it grew too large.
+	static thread_local vector<id3_byte_t> Buffer;
+	/// Keep at most this buffer capacity for the next file.
+	static constexpr gsize MaxKeep = 256 * 1024;
+
+	static goffset seek(int fd, goffset offset, int whence)
+#ifdef G_OS_WIN32
+	{	return _lseeki64(fd, offset, whence); }
+#else
+	{	return lseek(fd, offset, whence); }
+#endif
+	static gboolean set_error(GError** error)
+	{	int err = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err), "%s", g_strerror(err));
+		return FALSE;
+	}
+
+public:
+	ID3FileView() : Fd(-1) {}
+	~ID3FileView();
+	ID3FileView(const ID3FileView&) = delete;
+	void operator=(const ID3FileView&) = delete;
+	/// Open the file.
+	/// @return Size of the file or -1 on error.
+	goffset open(const gchar* path, GError** error);
+	/// Continue with the file opened by the type check, its head is taken into the buffer.
+	/// @return Size of the file or -1 on error.
+	goffset open(ET_FileHead& head, GError** error);
+	/// Number of bytes at the start of the buffer that are already read by \ref open.
+	gsize preloaded() const { return Preloaded; }
+	/// Read file data into the buffer.
+	/// @param pos Target position in the buffer, the buffer grows as required.
+	/// @param offset File offset.
+	/// @param len Number of bytes to read.
+	/// @return Number of bytes read, less than \a len only at the end of the file, or -1 on error.
+	gssize read(gsize pos, goffset offset, gsize len, GError** error);
+	/// Access buffer data.
+	/// @remarks The pointer is invalidated by the next \ref read.
+	id3_byte_t* data(gsize pos) { return Buffer.data() + pos; }
+};
+
+thread_local vector<id3_byte_t> ID3FileView::Buffer;
+
+ID3FileView::~ID3FileView()
+{	if (Fd >= 0)
+		close(Fd);
+	if (Buffer.capacity() > MaxKeep)
+		vector<id3_byte_t>().swap(Buffer);
+}
+
+goffset ID3FileView::open(const gchar* path, GError** error)
+{	Fd = g_open(path, O_RDONLY | O_BINARY, 0);
+	if (Fd < 0)
+		return set_error(error), -1;
+	goffset size = seek(Fd, 0, SEEK_END);
+	if (size < 0)
+		return set_error(error), -1;
+	return size;
+}
+
+goffset ID3FileView::open(ET_FileHead& head, GError** error)
+{	Fd = head.release();
+	if (Buffer.size() < head.Len)
+		Buffer.resize(head.Len);
+	memcpy(Buffer.data(), head.Data, head.Len);
+	Preloaded = head.Len;
+	goffset size = seek(Fd, 0, SEEK_END);
+	if (size < 0)
+		return set_error(error), -1;
+	return size;
+}
+
+gssize ID3FileView::read(gsize pos, goffset offset, gsize len, GError** error)
+{	if (Buffer.size() < pos + len)
+		Buffer.resize(pos + len);
+#ifdef G_OS_WIN32
+	if (seek(Fd, offset, SEEK_SET) < 0)
+		return set_error(error), -1;
+#endif
+	gsize done = 0;
+	while (done < len)
+	{
+#ifdef G_OS_WIN32
+		int r = ::read(Fd, Buffer.data() + pos + done, len - done);
+#else
+		ssize_t r = pread(Fd, Buffer.data() + pos + done, len - done, offset + done);
+#endif
+		if (r < 0)
+		{	if (errno == EINTR)
+				continue;
+			return set_error(error), -1;
+		}
+		if (r == 0)
+			break; // EOF
+		done += r;
+	}
+	return done;
+}
+
 /*
  * Read id3v1.x / id3v2 tag and load data into the File_Tag structure.
  * Returns TRUE on success, else FALSE.
  * If a tag entry exists (ex: title), we allocate memory, else value stays to NULL
+ *
+ * The file is opened once and all regions are read into the same buffer:
+ * the head including the ID3v2 tag and the first audio frames as a mirror of the file,
+ * followed by the ID3v1 tag and the optional appended ID3v2 tag.
  */
-File_Tag* id3_read_file(GFile *gfile, ET_File *ETFile, GError **error)
+static File_Tag* id3_read_view(ID3FileView& view, goffset filesize, ET_File *ETFile, GError **error)
 {
-    g_return_val_if_fail (gfile != NULL && ETFile != NULL, nullptr);
-    g_return_val_if_fail (error == NULL || *error == NULL, nullptr);
-
-    File_Tag *FileTag = new File_Tag();
     ET_File_Info* info = &ETFile->ETFileInfo;
 
-    gObject<GInputStream> istream(G_INPUT_STREAM(g_file_read(gfile, NULL, error)));
-    if (!istream)
-        return nullptr; // cannot open
-
-    vector<id3_byte_t> string1(PEEK_MPEG_DATA_LEN);
-    gsize bytes_read;
     goffset tagbytes = 0;
 
     /* Check if the file has an ID3v2 tag or/and an ID3v1 tags.
-     * 1) ID3v2 tag. */
-    if (!g_input_stream_read_all(istream.get(), string1.data(), string1.size(), &bytes_read, NULL, error))
-        return FALSE;
-    else if (bytes_read < ID3_TAG_QUERYSIZE)
+     * 1) ID3v2 tag. The buffer position equals the file offset. */
+    gsize preloaded = view.preloaded();
+    gssize headlen = view.read(preloaded, preloaded, PEEK_MPEG_DATA_LEN - preloaded, error);
+    if (headlen < 0)
+        return nullptr;
+    headlen += preloaded;
+    if (headlen < ID3_TAG_QUERYSIZE)
         return g_set_error(error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT, "%s", _("Error reading tags from file")), nullptr;
 
     auto v2tag = make_unique((id3_tag*)nullptr, id3_tag_delete);
 
-    long tagsize = id3_tag_query(string1.data(), ID3_TAG_QUERYSIZE);
+    long tagsize = id3_tag_query(view.data(0), ID3_TAG_QUERYSIZE);
+    goffset audiostart = 0;
+    /* Buffer position, file offset and size of the ID3v2 tags at start and end. */
+    gsize v2pos = 0, v2epos = 0;
+    goffset v2offset = 0, v2eoffset = 0;
+    long v2size = 0, v2esize = 0;
+    gsize bufend = headlen;
     if (tagsize > ID3_TAG_QUERYSIZE)
     {   /* ID3v2 tag found at the beginning => read */
-        if (tagsize > (long)string1.size())
-        {   string1.resize(tagsize);
-            if (!g_input_stream_read_all(istream.get(), &string1[PEEK_MPEG_DATA_LEN], tagsize - PEEK_MPEG_DATA_LEN, &bytes_read, NULL, error))
-                return FALSE;
-            if (bytes_read != (gsize)(tagsize - PEEK_MPEG_DATA_LEN))
+        if (tagsize > headlen)
+        {   gssize len = view.read(headlen, headlen, tagsize - headlen, error);
+            if (len < 0)
+                return nullptr;
+            if (len != tagsize - headlen)
                 return g_set_error(error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT, "%s", _("Error reading tags from file")), nullptr;
+            headlen = tagsize;
         }
-        v2tag.reset(id3_tag_parse(string1.data(), tagsize));
+        v2tag.reset(id3_tag_parse(view.data(0), tagsize));
         if (!v2tag)
             return g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "%s", _("Error reading tags from file")), nullptr;
         tagbytes += tagsize;
+        audiostart = tagsize;
+        v2size = tagsize;
     }
 
+    frame_header hdr;
+    int vbrinfo = -1;
+    bool sample = false;
     // skip for cross call by flac_tag
     if (ETFile->ETFileDescription == &MP3_Description || ETFile->ETFileDescription == &MP2_Description)
     {   /* after the tag the MP3 data should start
          * => read the first audio frame header */
-        if (tagsize >= PEEK_MPEG_DATA_LEN)
-            tagsize = PEEK_MPEG_DATA_LEN;
-        else
-            memmove(string1.data(), string1.data() + tagsize, PEEK_MPEG_DATA_LEN - tagsize);
-        if (!g_input_stream_read_all(istream.get(), string1.data() + PEEK_MPEG_DATA_LEN - tagsize, tagsize, &bytes_read, NULL, error))
-            return nullptr;
-        bytes_read += PEEK_MPEG_DATA_LEN - tagsize;
-        get_audio_frame_header(info, string1.data(), bytes_read);
+        goffset peekend = audiostart + PEEK_MPEG_DATA_LEN;
+        if (peekend > headlen && filesize > headlen)
+        {   gssize len = view.read(headlen, headlen, peekend - headlen, error);
+            if (len < 0)
+                return nullptr;
+            headlen += len;
+        }
+        bufend = headlen;
+        vbrinfo = get_audio_frame_header(info, view.data(audiostart), (int)(min(headlen, peekend) - audiostart), hdr);
+        // VBR files without VBR header need sampling, but CBR files should not pay for it.
+        if (vbrinfo == 0)
+        {   guint64 bytes = 0;
+            bool vbr = info->variable_bitrate;
+            count_audio_frames(view.data(audiostart), view.data(min(headlen, peekend)), hdr, bytes, vbr);
+            sample = vbr;
+        }
     }
 
     auto v2etag = make_unique((id3_tag*)nullptr, id3_tag_delete);
     auto v1tag = make_unique((id3_tag*)nullptr, id3_tag_delete);
+    goffset audioend = filesize;
 
-    /* 2) ID3v1 tag and V2 tag at the end */
-    GSeekable *seekable = G_SEEKABLE(istream.get());
-    /* Go to the beginning of ID3v1 tag and read optional V2 header at the end too. */
-    if (g_seekable_can_seek(seekable))
-    {
-        if (!g_seekable_seek(seekable, -ID3V1_TAG_SIZE-ID3_TAG_QUERYSIZE, G_SEEK_END, NULL, error)
-            || !g_input_stream_read_all(istream.get(), string1.data(), ID3V1_TAG_SIZE+ID3_TAG_QUERYSIZE, &bytes_read, NULL, error))
+    /* 2) ID3v1 tag and V2 tag at the end, placed behind the head in the buffer. */
+    const gsize taillen = ID3V1_TAG_SIZE + ID3_TAG_QUERYSIZE;
+    if (filesize >= (goffset)taillen)
+    {   gssize len = view.read(headlen, filesize - taillen, taillen, error);
+        if (len < 0)
             return nullptr;
-        if (bytes_read != ID3V1_TAG_SIZE+ID3_TAG_QUERYSIZE)
+        if (len != (gssize)taillen)
             return g_set_error(error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT, "%s", _("Error reading tags from file")), nullptr;
+        bufend = headlen + taillen;
 
         /* check for V1 tag */
-        v1tag.reset(id3_tag_parse(&string1[ID3_TAG_QUERYSIZE], ID3V1_TAG_SIZE));
+        v1tag.reset(id3_tag_parse(view.data(headlen + ID3_TAG_QUERYSIZE), ID3V1_TAG_SIZE));
         if (v1tag)
-            tagsize += ID3V1_TAG_SIZE;
+        {   tagbytes += ID3V1_TAG_SIZE;
+            audioend -= ID3V1_TAG_SIZE;
+        }
 
         /* check for V2 tag */
-        long v2read = v1tag ? 0 : ID3V1_TAG_SIZE;
-        tagsize = -id3_tag_query(&string1[v2read], ID3_TAG_QUERYSIZE);
+        gsize v2read = v1tag ? 0 : ID3V1_TAG_SIZE;
+        tagsize = -id3_tag_query(view.data(headlen + v2read), ID3_TAG_QUERYSIZE);
         if (tagsize > ID3_TAG_QUERYSIZE) // footer?
-        {   if (tagsize > v2read)
-            {   // read tag unless it happens to fit into the buffer
-                if (!g_seekable_seek(seekable, -tagsize-ID3V1_TAG_SIZE+v2read, G_SEEK_END, NULL, error))
-                    return nullptr;
-                if (tagsize > (long)string1.size())
-                    string1.resize(tagsize);
-                v2read += ID3_TAG_QUERYSIZE;
-                memcpy(string1.data()+tagsize-v2read, string1.data(), v2read);
-                if (g_input_stream_read_all(istream.get(), &string1[0], tagsize - v2read, &bytes_read, NULL, error))
-                    return nullptr;
-                if (bytes_read == (gsize)(tagsize - v2read))
-                    return g_set_error(error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT, "%s", _("Error reading tags from file")), nullptr;
-            }
-            v2tag.reset(id3_tag_parse(string1.data(), tagsize));
-            if (!v2tag)
+        {   // read the whole tag behind the tail
+            goffset tagend = filesize - (v1tag ? ID3V1_TAG_SIZE : 0);
+            if (tagsize > tagend)
                 return g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "%s", _("Error reading tags from file")), nullptr;
-            tagbytes -= tagsize;
+            gsize pos = headlen + taillen;
+            len = view.read(pos, tagend - tagsize, tagsize, error);
+            if (len < 0)
+                return nullptr;
+            if (len != tagsize)
+                return g_set_error(error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT, "%s", _("Error reading tags from file")), nullptr;
+            v2etag.reset(id3_tag_parse(view.data(pos), tagsize));
+            if (!v2etag)
+                return g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "%s", _("Error reading tags from file")), nullptr;
+            tagbytes += tagsize;
+            audioend -= tagsize;
+            v2epos = pos;
+            v2eoffset = tagend - tagsize;
+            v2esize = tagsize;
+            bufend = pos + tagsize;
         }
     }
 
+    /* The bitrate of the first frames varies but there is no VBR header.
+     * The result is kept by the tag cache, otherwise this is repeated on each scan. */
+    if (sample)
+        sample_audio_frames(info, view, hdr, audiostart, audioend, bufend);
+
     // post processing of stream length and bit rate
-    if (info->variable_bitrate)
-    {   if (info->duration > 0)
-            info->bitrate = (int)lround((ETFile->FileSize - tagbytes) / info->duration * 8.);
-    } else
-    {   if (info->duration <= 0 && info->bitrate)
-            info->duration = (ETFile->FileSize - tagbytes) * 8. / info->bitrate;
-    }
+    if (info->duration <= 0)
+    {   // Neither a VBR header nor a usable sample, e.g. of a short file
+        // => extrapolate from the first frame.
+        if (info->bitrate)
+            info->duration = (filesize - tagbytes) * 8. / info->bitrate;
+    } else if (info->variable_bitrate)
+        info->bitrate = (int)lround((filesize - tagbytes) / info->duration * 8.);
+
+    File_Tag *FileTag = new File_Tag();
+
+    // The buffer is not read any further, so the raw tags stay valid.
+    id3_tag_region v2region = { ETFile, view.data(v2pos), (gsize)v2size, v2offset };
+    id3_tag_region v2eregion = { ETFile, view.data(v2epos), (gsize)v2esize, v2eoffset };
 
     if (!v2tag) // treat V2 tag at the end like tag at start
-        v2tag.reset(v2etag.release());
+    {   v2tag.reset(v2etag.release());
+        v2region = v2eregion;
+    }
 
     if (v1tag || v2tag) // no tag at all => nothing to do
     {
@@ -252,8 +522,8 @@ File_Tag* id3_read_file(GFile *gfile, ET_File *ETFile, GError **error)
 
         // Assign tag values, last wins
         if (apply_tag(FileTag, v1tag.get())
-            | apply_tag(FileTag, v2tag.get())
-            | apply_tag(FileTag, v2etag.get()))
+            | apply_tag(FileTag, v2tag.get(), &v2region)
+            | apply_tag(FileTag, v2etag.get(), &v2eregion))
             ETFile->force_tag_save();
     }
 
@@ -270,7 +540,31 @@ File_Tag* id3_read_file(GFile *gfile, ET_File *ETFile, GError **error)
     return FileTag;
 }
 
-static bool apply_tag(File_Tag* FileTag, id3_tag* tag)
+File_Tag* id3_read_file(GFile *gfile, ET_File *ETFile, GError **error)
+{
+    g_return_val_if_fail (gfile != NULL && ETFile != NULL, nullptr);
+    g_return_val_if_fail (error == NULL || *error == NULL, nullptr);
+
+    ID3FileView view;
+    goffset filesize = view.open(ETFile->FilePath, error);
+    if (filesize < 0)
+        return nullptr; // cannot open
+    return id3_read_view(view, filesize, ETFile, error);
+}
+
+File_Tag* id3_read_file_head(ET_FileHead& head, ET_File *ETFile, GError **error)
+{
+    g_return_val_if_fail (head.Fd >= 0 && ETFile != NULL, nullptr);
+    g_return_val_if_fail (error == NULL || *error == NULL, nullptr);
+
+    ID3FileView view;
+    goffset filesize = view.open(head, error);
+    if (filesize < 0)
+        return nullptr;
+    return id3_read_view(view, filesize, ETFile, error);
+}
+
+static bool apply_tag(File_Tag* FileTag, id3_tag* tag, const id3_tag_region* region)
 {
     if (!tag)
         return false;
@@ -394,8 +688,8 @@ static bool apply_tag(File_Tag* FileTag, id3_tag* tag)
     for (i = 0; (frame = id3_tag_findframe(tag, "APIC", i)); i++)
     {
         EtPictureType type = ET_PICTURE_TYPE_FRONT_COVER;
-        id3_length_t size;
-        id3_byte_t const *data;
+        id3_length_t size = 0;
+        id3_byte_t const *data = nullptr;
 
         /* Picture file data. */
         for (j = 0; (field = id3_frame_field(frame, j)); j++)
@@ -414,6 +708,24 @@ static bool apply_tag(File_Tag* FileTag, id3_tag* tag)
         string description;
         update |= libid3tag_Get_Frame_Str (frame, EASYTAG_ID3_FIELD_STRING, nullptr, description);
 
+        /* Large pictures are loaded from the file on demand if they are stored
+         * verbatim, i.e. neither unsynchronised nor compressed. */
+        if (region && size >= DEFER_PICTURE_SIZE && size <= region->Size)
+        {
+            const id3_byte_t* const end = region->Data + region->Size;
+            const id3_byte_t* pattern_end = data + 16;
+            const id3_byte_t* p = region->Data;
+            while ((p = std::search(p, end, data, pattern_end)) != end
+                && ((gsize)(end - p) < size || memcmp(p, data, size) != 0))
+                ++p;
+            if (p != end)
+            {
+                FileTag->pictures.emplace_back(type, xStringD0(description), 0, 0,
+                    *region->File, region->Offset + (p - region->Data), size);
+                continue;
+            }
+        }
+
         FileTag->pictures.emplace_back(type, xStringD0(description), 0, 0, data, size);
     }
 
@@ -492,96 +804,14 @@ static bool apply_tag(File_Tag* FileTag, id3_tag* tag)
     return update;
 }
 
-static uint32_t read32u(const id3_byte_t* data)
-{
-	return (((((data[0] << 8) | data[1]) << 8) | data[2]) << 8) | data[3];
-}
-
-namespace
-{
-	struct frame_header
-	{
-		static const uint8_t brx[2][2][16];
-		static const int srx[3];
-		static const uint8_t xingoff[3];
-
-		uint8_t version;
-		uint8_t layer;
-		uint8_t bitrate;
-		uint8_t srate;
-		uint8_t mode;
-		uint8_t padding;
-
-		bool Fill(const id3_byte_t* sp)
-		{
-			if (sp[0] != 0xff || sp[1] < 0xe0)
-				return false;
-
-			version = (sp[1] >> 3) & 3;
-			layer = (sp[1] >> 1) & 3;
-			bitrate = (sp[2] >> 4) & 15;
-			srate = (sp[2] >> 2) & 3;
-			mode = (sp[3] >> 6) & 3;
-			padding = (sp[2] >> 1) & 1;
-			if (version == 1 || layer == 0 || bitrate == 15 || srate == 3
-				|| (layer == 2 && (mode == 3 ? bitrate > 10 : bitrate < 6 && (bitrate & 3))))
-				return false;
-
-			return true;
-		}
-
-		int Bitrate() const
-		{	if (version == 3 && layer == 3) // V1L1
-				return (bitrate << 5) * 1000;
-			else
-				return (version & 1 ? brx[0][layer & 1] : brx[1][layer < 3])[bitrate] * 8000;
-		}
-
-		int Samplerate() const
-		{	return srx[srate] / (4 - version);
-		}
-
-		int XingOffset() const
-		{	return xingoff[(version & 1) + (mode != 3)];
-		}
-
-		int FrameSamples() const
-		{	return layer == 3 ? 384 : layer == 1 && version != 3 ? 576 : 1152;
-		}
-
-		int FrameLength() const
-		{	int shift = (layer == 3) << 1; // Layer I => 2**2, 2**0 otherwise
-			return ((FrameSamples() >> (shift + 3)) * Bitrate() / Samplerate() + padding) << shift;
-		}
-
-		bool Matches(const frame_header& r) const
-		{	return version == r.version
-				&& layer == r.layer
-				&& srate == r.srate
-				&& mode == r.mode;
-		}
-	};
-
-	const uint8_t frame_header::brx[2][2][16] =
-	{	{	{ 0, 4, 6, 7, 8, 10, 12, 14, 16, 20, 24, 28, 32, 40, 48, 0 } // V1L2
-		,	{ 0, 4, 5, 6, 7,  8, 10, 12, 14, 16, 20, 24, 28, 32, 40, 0 } // V1L3
-		},
-		{	{ 0, 4, 6, 7, 8, 10, 12, 14, 16, 18, 20, 22, 24, 28, 32, 0 } // V2L1
-		,	{ 0, 1, 2, 3, 4,  5,  6,  7,  8, 10, 12, 14, 16, 18, 20, 0 } // V2L23
-	}	};
-	const int frame_header::srx[3] = { 44100, 48000, 32000 };
-	const uint8_t frame_header::xingoff[3] = { 9+1, 17+4, 32+4 };
-}
-
-static void get_audio_frame_header(ET_File_Info* info, const id3_byte_t* data, int len)
+static int get_audio_frame_header(ET_File_Info* info, const id3_byte_t* data, int len, frame_header& hdr)
 {
 	if (len < 4)
-		return;
+		return -1;
 
 	// sync
 	const id3_byte_t* sp = data;
 	const id3_byte_t* spe = sp + len - 3;
-	frame_header hdr;
 	for (; sp != spe; ++sp)
 	{	if (!hdr.Fill(sp))
 			continue;
@@ -593,11 +823,11 @@ static void get_audio_frame_header(ET_File_Info* info, const id3_byte_t* data, i
 		{	frame_header hdr2;
 			if (!hdr2.Fill(f2) || !hdr2.Matches(hdr))
 				continue;
-			bool vbr = hdr2.srate != hdr.srate;
+			bool vbr = hdr2.bitrate != hdr.bitrate;
 			f2 += hdr2.FrameLength();
 			if (f2 < spe && (!hdr2.Fill(f2) || !hdr2.Matches(hdr)))
 				continue;
-			if (vbr || hdr2.srate != hdr.srate)
+			if (vbr || hdr2.bitrate != hdr.bitrate)
 				info->variable_bitrate = TRUE;
 		}
 
@@ -607,29 +837,101 @@ static void get_audio_frame_header(ET_File_Info* info, const id3_byte_t* data, i
 		info->samplerate = hdr.Samplerate();
 		info->mode = hdr.mode;
 
+		// detect VBRI header of the Fraunhofer encoder, always 32 bytes after the frame header
+		const id3_byte_t* vp = sp + 36;
+		if (vp + 18 <= spe + 3 && memcmp(vp, "VBRI", 4) == 0)
+		{	info->variable_bitrate = TRUE;
+			uint32_t frames = read32u(vp + 14);
+			if (!frames)
+				return 0;
+			info->duration = (double)frames * hdr.FrameSamples() / info->samplerate;
+			return 1;
+		}
+
 		// detect Xing header
 		sp += hdr.XingOffset();
-		if (sp >= spe)
-			return;
-		if (sp[0] == 'X' && sp[1] == 'i' && sp[2] == 'n' && sp[3] == 'g')
+		if (sp + 8 > spe + 3)
+			return 0;
+		if (memcmp(sp, "Xing", 4) == 0)
 			info->variable_bitrate = TRUE;
-		else if (!(sp[0] == 'I' && sp[1] == 'n' && sp[2] == 'f' && sp[3] == 'o'))
-			return;
+		else if (memcmp(sp, "Info", 4) != 0)
+			return 0;
+		uint32_t flags = read32u(sp + 4);
+		sp += 8;
+
+		if (!(flags & 1) || sp + 4 > spe + 3)
+			return 0;
+		double samples = (double)read32u(sp) * hdr.FrameSamples();
 		sp += 4;
 
-		if (sp >= spe)
-			return;
-		uint32_t flags = read32u(sp);
-		sp += 4;
+		// skip optional byte count, TOC and quality to the LAME extension
+		sp += (flags & 2 ? 4 : 0) + (flags & 4 ? 100 : 0) + (flags & 8 ? 4 : 0);
+		if (sp + 24 <= spe + 3 && (memcmp(sp, "LAME", 4) == 0 || memcmp(sp, "Lavc", 4) == 0 || memcmp(sp, "Lavf", 4) == 0))
+		{	// encoder delay and padding, 12 bits each
+			unsigned delay = (sp[21] << 4) | (sp[22] >> 4);
+			unsigned padding = ((sp[22] & 15) << 8) | sp[23];
+			if (samples > delay + padding)
+				samples -= delay + padding;
+		}
 
-		if (sp >= spe || !(flags & 1))
-			return;
-		uint32_t frames = read32u(sp);
+		info->duration = samples / info->samplerate;
+		return 1;
+	}
+	return -1;
+}
 
-		info->duration = (double)frames * hdr.FrameSamples() / info->samplerate;
+static unsigned count_audio_frames(const id3_byte_t* sp, const id3_byte_t* spe, const frame_header& first, guint64& bytes, bool& vbr)
+{
+	// sync to a frame of the same stream followed by another one
+	frame_header hdr;
+	for (; sp + 4 <= spe; ++sp)
+	{	if (!hdr.Fill(sp) || !hdr.Matches(first) || hdr.FrameLength() <= 0)
+			continue;
+		const id3_byte_t* f2 = sp + hdr.FrameLength();
+		frame_header hdr2;
+		if (f2 + 4 <= spe && hdr2.Fill(f2) && hdr2.Matches(first))
+			break;
+	}
 
-		return;
+	// count the complete frames in the chunk
+	unsigned frames = 0;
+	while (sp + 4 <= spe && hdr.Fill(sp) && hdr.Matches(first))
+	{	int framelen = hdr.FrameLength();
+		if (framelen <= 0 || sp + framelen > spe)
+			break;
+		bytes += framelen;
+		++frames;
+		vbr |= hdr.bitrate != first.bitrate;
+		sp += framelen;
+	}
+	return frames;
+}
+
+static void sample_audio_frames(ET_File_Info* info, ID3FileView& view, const frame_header& first, goffset start, goffset end, gsize pos)
+{
+	constexpr int points = 4;
+	constexpr gsize chunk = 4096;
+	const goffset audio = end - start;
+	if (audio < (goffset)(2 * points * chunk))
+		return; // small file, the extrapolation from the first frame is good enough
+
+	guint64 bytes = 0;
+	unsigned frames = 0;
+	bool vbr = false;
+	for (int i = 1; i <= points; ++i)
+	{	gssize len = view.read(pos, start + audio * i / (points + 1), chunk, nullptr);
+		if (len < 4)
+			continue;
+		const id3_byte_t* sp = view.data(pos);
+		frames += count_audio_frames(sp, sp + len, first, bytes, vbr);
 	}
+	if (!frames)
+		return;
+
+	if (vbr)
+		info->variable_bitrate = TRUE;
+	info->duration = (double)audio * frames / bytes * first.FrameSamples() / first.Samplerate();
+	info->bitrate = (int)lround(audio * 8. / info->duration);
 }
 
 
@@ -1027,11 +1329,8 @@ id3tag_write_file_v24tag (const ET_File *ETFile,
 
         id3_file_close(file);
 
-        /* Set padding  XXX */
-        if ((v2tag->paddedsize < 1024)
-        || ((v2tag->paddedsize > 4096) && (tagsize < 1024))
-        )
-            v2tag->paddedsize = 1024;
+        /* Padding is set by etag_write_tags() according to the size of the
+         * tag in the file. */
 
         /* Set options */
         id3_tag_options(v2tag, ID3_TAG_OPTION_UNSYNCHRONISATION
@@ -1215,7 +1514,7 @@ id3tag_write_file_v24tag (const ET_File *ETFile,
                 else if (field_type == ID3_FIELD_TYPE_INT8)
                     id3_field_setint (field, pic.type);
                 else if (field_type == ID3_FIELD_TYPE_BINARYDATA)
-                    id3_field_setbinarydata(field, (id3_byte_t const*)pic.storage->Bytes, pic.storage->Size);
+                    id3_field_setbinarydata(field, (id3_byte_t const*)pic.data()->Bytes, pic.storage->Size);
             }
 
             if (!pic.description.empty())
@@ -1616,10 +1915,102 @@ frame:
     id3taglib_set_field(frame, str, field_type, 1, 0, 0);
 }
 
+/*
+ * Padding policy of ID3v2 tags: the space of the tag in the file is reused as
+ * long as the new tag fits and no more than ID3V2_MAX_PADDING bytes are
+ * wasted, so only the tag needs to be rewritten. Otherwise the tag grows to
+ * the next multiple of ID3V2_PADDING_STEP bytes, leaving room for later edits.
+ */
+static void
+etag_set_padding (struct id3_tag *v2tag,
+                  id3_length_t filev2size)
+{
+    id3_length_t size;
+
+    v2tag->paddedsize = 0;
+    size = id3_tag_render (v2tag, NULL);
+
+    if (size <= filev2size && filev2size - size <= ID3V2_MAX_PADDING)
+    {
+        v2tag->paddedsize = filev2size;
+    }
+    else
+    {
+        v2tag->paddedsize = (size / ID3V2_PADDING_STEP + 1)
+                            * ID3V2_PADDING_STEP;
+    }
+}
+
+/*
+ * Move @length bytes of the file at @from to @to in chunks of
+ * MOVE_DATA_CHUNK_SIZE bytes. The ranges may overlap.
+ */
+static gboolean
+etag_move_data (GSeekable *seekable,
+                goffset from,
+                goffset to,
+                goffset length,
+                GError **error)
+{
+    GInputStream *istream;
+    GOutputStream *ostream;
+    gchar *buffer;
+    goffset done;
+    gsize bytes_read;
+    gsize bytes_written;
+    gboolean success = TRUE;
+
+    if (length == 0 || from == to)
+    {
+        return TRUE;
+    }
+
+    istream = g_io_stream_get_input_stream (G_IO_STREAM (seekable));
+    ostream = g_io_stream_get_output_stream (G_IO_STREAM (seekable));
+    buffer = (gchar*)g_malloc (MIN (length, MOVE_DATA_CHUNK_SIZE));
+
+    for (done = 0; done < length; )
+    {
+        gsize chunk = MIN (length - done, MOVE_DATA_CHUNK_SIZE);
+        /* Start at the end if the data moves towards the end of the file, so
+         * that no data is overwritten before it has been read. */
+        goffset offset = to > from ? length - done - chunk : done;
+
+        if (!g_seekable_seek (seekable, from + offset, G_SEEK_SET, NULL, error)
+            || !g_input_stream_read_all (istream, buffer, chunk, &bytes_read,
+                                         NULL, error))
+        {
+            success = FALSE;
+            break;
+        }
+
+        if (bytes_read != chunk)
+        {
+            g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "%s",
+                         _("Unexpected end of file"));
+            success = FALSE;
+            break;
+        }
+
+        if (!g_seekable_seek (seekable, to + offset, G_SEEK_SET, NULL, error)
+            || !g_output_stream_write_all (ostream, buffer, chunk,
+                                           &bytes_written, NULL, error))
+        {
+            success = FALSE;
+            break;
+        }
+
+        done += chunk;
+    }
+
+    g_free (buffer);
+    return success;
+}
+
 static gboolean
 etag_write_tags (const gchar *filename, 
                  struct id3_tag const *v1tag,
-                 struct id3_tag const *v2tag,
+                 struct id3_tag *v2tag,
                  gboolean strip_tags,
                  GError **error)
 {
@@ -1632,7 +2023,6 @@ etag_write_tags (const gchar *filename,
     GInputStream *istream;
     GOutputStream *ostream;
     long filev2size;
-    gchar *audio_buffer = NULL;
     gboolean success = TRUE;
     gsize bytes_read;
     gsize bytes_written;
@@ -1658,34 +2048,12 @@ etag_write_tags (const gchar *filename,
                 }
             }
         }
-
-        /* Render v2 tag */
-        if (v2tag)
-        {
-            v2size = id3_tag_render (v2tag, NULL);
-
-            if (v2size > 10)
-            {
-                v2buf = (id3_byte_t*)g_malloc0 (v2size);
-
-                if ((v2size = id3_tag_render (v2tag, v2buf)) == 0)
-                {
-                    /* NOTREACHED */
-                    g_free (v2buf);
-                    v2buf = NULL;
-                }
-            }
-        }
     }
     
     if (v1buf == NULL)
     {
         v1size = 0;
     }
-    if (v2buf == NULL)
-    {
-        v2size = 0;
-    }
 
     file = g_file_new_for_path (filename);
     iostream = g_file_open_readwrite (file, NULL, error);
@@ -1828,6 +2196,30 @@ etag_write_tags (const gchar *filename,
 
     filev2size = id3_tag_query ((id3_byte_t const *)tmp, ID3_TAG_QUERYSIZE);
 
+    /* Render v2 tag, now that the space available in the file is known. */
+    if (!strip_tags && v2tag)
+    {
+        etag_set_padding (v2tag, MAX (filev2size, 0));
+        v2size = id3_tag_render (v2tag, NULL);
+
+        if (v2size > 10)
+        {
+            v2buf = (id3_byte_t*)g_malloc0 (v2size);
+
+            if ((v2size = id3_tag_render (v2tag, v2buf)) == 0)
+            {
+                /* NOTREACHED */
+                g_free (v2buf);
+                v2buf = NULL;
+            }
+        }
+    }
+
+    if (v2buf == NULL)
+    {
+        v2size = 0;
+    }
+
     /* No ID3v2 tag in the file, and no new tag. */
     if ((filev2size == 0) && (v2size == 0))
     {
@@ -1853,9 +2245,9 @@ etag_write_tags (const gchar *filename,
     }
     else
     {
-        gsize audio_length;
+        goffset audio_length;
 
-        /* New and old tag differ in length, so copy the audio data to after
+        /* New and old tag differ in length, so move the audio data to after
          * the new tag. */
         if (!g_seekable_seek (seekable, 0, G_SEEK_END, NULL, error))
         {
@@ -1863,24 +2255,9 @@ etag_write_tags (const gchar *filename,
         }
 
         audio_length = g_seekable_tell (seekable) - filev2size;
-        audio_buffer = (gchar*)g_malloc (audio_length);
 
-        if (!g_seekable_seek (seekable, filev2size, G_SEEK_SET, NULL, error))
-        {
-            goto err;
-        }
-
-        if (audio_length != 0)
-        {
-            if (!g_input_stream_read_all (istream, audio_buffer, audio_length,
-                                          &bytes_read, NULL, error))
-            {
-                goto err;
-            }
-        }
-        
-        /* Return to the beginning of the file. */
-        if (!g_seekable_seek (seekable, 0, G_SEEK_SET, NULL, error))
+        if (!etag_move_data (seekable, filev2size, v2size, audio_length,
+                             error))
         {
             goto err;
         }
@@ -1888,25 +2265,19 @@ etag_write_tags (const gchar *filename,
         /* Write the ID3v2 tag. */
         if (v2buf)
         {
-            if (!g_output_stream_write_all (ostream, v2buf, v2size,
-                                            &bytes_written, NULL, error))
+            if (!g_seekable_seek (seekable, 0, G_SEEK_SET, NULL, error))
             {
                 goto err;
             }
-        }
 
-        /* Write audio data. */
-        if (audio_length != 0)
-        {
-            if (!g_output_stream_write_all (ostream, audio_buffer,
-                                            audio_length, &bytes_written, NULL,
-                                            error))
+            if (!g_output_stream_write_all (ostream, v2buf, v2size,
+                                            &bytes_written, NULL, error))
             {
                 goto err;
             }
         }
 
-        if (!g_seekable_truncate (seekable, g_seekable_tell (seekable), NULL,
+        if (!g_seekable_truncate (seekable, v2size + audio_length, NULL,
                                   error))
         {
             goto err;
@@ -1916,7 +2287,6 @@ etag_write_tags (const gchar *filename,
     success = TRUE;
 
 err:
-    g_free (audio_buffer);
     g_object_unref (file);
     g_clear_object (&iostream);
     g_free (v1buf);
@@ -47,6 +47,7 @@
 #pragma GCC diagnostic pop
 #include <taglib/tpropertymap.h>
 
+#include <cstring>
 #include <limits>
 using namespace std;
 using namespace TagLib;
@@ -84,6 +85,7 @@ const struct QuickTime_Description : ET_File_Description
 		display_file_info_to_ui = et_mp4_header_display_file_info_to_ui;
 		unsupported_fields = mp4tag_unsupported_fields;
 		support_multiple_pictures = [](const ET_File*) { return false; };
+		sniff = [](const guchar* head, gsize len) { return len >= 8 && memcmp(head + 4, "ftyp", 4) == 0; };
 	}
 }
 MP4_Description(".mp4", _("MPEG4 File")),
@@ -93,6 +95,61 @@ M4P_Description(".m4p", _("MPEG4 File")),
 M4V_Description(".m4v", _("MPEG4 File")),
 AAC_Description(".aac", _("AAC File")); // TODO .aac is typically ADTS rather than MPEG4
 
+/// Locate the image data of the first cover art in the file.
+/// @param image Image data as parsed by TagLib.
+/// @return File offset of the image data or -1 if not found.
+static goffset mp4_find_cover(IOStream& stream, const ByteVector& image)
+{
+    static const char* const path[] = { "moov", "udta", "meta", "ilst", "covr", "data" };
+    goffset pos = 0;
+    goffset end = stream.length();
+    for (const char* name : path)
+    {
+        for (;;) // sibling atoms
+        {
+            if (pos + 8 > end)
+                return -1;
+            stream.seek(pos);
+            ByteVector header = stream.readBlock(8);
+            if (header.size() != 8)
+                return -1;
+            goffset size = header.toUInt(0U, true);
+            goffset header_len = 8;
+            if (size == 1) // 64 bit size
+            {
+                ByteVector size64 = stream.readBlock(8);
+                if (size64.size() != 8)
+                    return -1;
+                size = size64.toLongLong(0U, true);
+                header_len = 16;
+            }
+            else if (size == 0) // up to the end of the file
+                size = end - pos;
+            if (size < header_len || size > end - pos)
+                return -1;
+            if (header.containsAt(name, 4))
+            {
+                end = pos + size;
+                pos += header_len;
+                if (strcmp(name, "meta") == 0)
+                    pos += 4; // version and flags
+                break;
+            }
+            pos += size;
+        }
+    }
+    /* Skip type and locale of the data atom. */
+    pos += 8;
+    if (end - pos != (goffset)image.size())
+        return -1;
+    /* Make sure that it is the right picture. */
+    unsigned check = min(image.size(), 64U);
+    stream.seek(pos);
+    if (stream.readBlock(check) != image.mid(0, check))
+        return -1;
+    return pos;
+}
+
 /*
  * Mp4_Tag_Read_File_Tag:
  *
@@ -199,9 +256,15 @@ File_Tag* mp4_read_file(GFile *file, ET_File *ETFile, GError **error)
         const MP4::CoverArtList &covers = cover.toCoverArtList ();
         const MP4::CoverArt &art = covers.front ();
 
-        /* MP4 does not support image types, nor descriptions. */
-        FileTag->pictures.emplace_back(ET_PICTURE_TYPE_FRONT_COVER, nullptr,
-            0, 0, art.data().data(), art.data().size());
+        /* MP4 does not support image types, nor descriptions.
+         * Large pictures are loaded from the file on demand. */
+        goffset offset = art.data().size() >= 4096 ? mp4_find_cover(stream, art.data()) : -1;
+        if (offset >= 0)
+            FileTag->pictures.emplace_back(ET_PICTURE_TYPE_FRONT_COVER, nullptr,
+                0, 0, *ETFile, offset, art.data().size());
+        else
+            FileTag->pictures.emplace_back(ET_PICTURE_TYPE_FRONT_COVER, nullptr,
+                0, 0, art.data().data(), art.data().size());
     }
     else
     {
@@ -318,7 +381,8 @@ mp4tag_write_file_tag (const ET_File *ETFile,
                 break;
         }
 
-        MP4::CoverArt art(f, ByteVector((char*)pic.storage->Bytes, pic.storage->Size));
+        const EtPicture::Data* data = pic.data();
+        MP4::CoverArt art(f, ByteVector((char*)data->Bytes, data->Size));
         tag->setItem("covr", MP4::Item(MP4::CoverArtList().append(art)));
     }
     else
@@ -41,6 +41,7 @@
 /* for mkstemp. */
 #include "win32/win32dep.h"
 
+#include <algorithm>
 #include <cmath>
 #include <limits>
 #include <memory>
@@ -48,22 +49,30 @@ using namespace std;
 
 // registration
 struct Ogg_Description : ET_File_Description
-{	Ogg_Description(const char* extension, const char* description, File_Tag* (*read_file)(GFile* gfile, ET_File* FileTagNew, GError** error))
+{	Ogg_Description(const char* extension, const char* description, File_Tag* (*read_file)(GFile* gfile, ET_File* FileTagNew, GError** error),
+		bool (*sniff)(const guchar* head, gsize len))
 	{	Extension = extension;
 		FileType = description;
 		TagType = _("Ogg Vorbis Tag");
 		this->read_file = read_file;
+		this->sniff = sniff;
 		write_file_tag = ogg_tag_write_file_tag;
 		display_file_info_to_ui = et_ogg_header_display_file_info_to_ui;
 	}
 };
 
+/// First page of an Ogg stream with the identification header of the codec.
+static bool ogg_sniff_vorbis(const guchar* head, gsize len)
+{	return len >= 35 && memcmp(head, "OggS", 4) == 0 && memcmp(head + 28, "\x01vorbis", 7) == 0;
+}
+
 const Ogg_Description
-OGG_Description(".ogg", _("Ogg Vorbis File"), ogg_read_file),
-OGA_Description(".oga", _("Ogg Vorbis File"), ogg_read_file);
+OGG_Description(".ogg", _("Ogg Vorbis File"), ogg_read_file, ogg_sniff_vorbis),
+OGA_Description(".oga", _("Ogg Vorbis File"), ogg_read_file, ogg_sniff_vorbis);
 #ifdef ENABLE_SPEEX
 const Ogg_Description
-SPX_Description(".spx", _("Speex File"), speex_read_file);
+SPX_Description(".spx", _("Speex File"), speex_read_file,
+	[](const guchar* head, gsize len) { return len >= 36 && memcmp(head, "OggS", 4) == 0 && memcmp(head + 28, "Speex   ", 8) == 0; });
 #endif
 
 
@@ -209,6 +218,254 @@ et_ogg_tell_func (void *datasource)
     return g_seekable_tell (G_SEEKABLE (state->istream));
 }
 
+static File_Tag* file_tag_from_vorbis_tags(vorbis_tags& tags, ET_File* ETFile, goffset stream_start = -1);
+
+// Variant of g_base64_decode_step that can deal with length limited input
+static guchar* base64_decode(const char* str, size_t len, gsize& data_size)
+{	gint state = 0;
+	guint save = 0;
+	guchar* out = (guchar*)g_malloc((len / 4 + 1) * 3);
+	data_size = g_base64_decode_step(str, len, out, &state, &save);
+	return out;
+}
+
+namespace
+{
+/// Ogg demultiplexer state of \ref ogg_read_headers.
+struct OggPageReader
+{	/// The sync layer skips up to this many bytes of garbage in front of the first page.
+	static constexpr gsize MaxGarbage = 64 * 1024;
+	static constexpr gsize Chunk = 4096;
+
+	ogg_sync_state Sync;
+	ogg_stream_state Stream;
+	bool StreamInit = false;
+	/// Serial number of the first logical stream.
+	long Serial = 0;
+	gsize Garbage = 0;
+
+	OggPageReader() { ogg_sync_init(&Sync); }
+	~OggPageReader()
+	{	ogg_sync_clear(&Sync);
+		if (StreamInit)
+			ogg_stream_clear(&Stream);
+	}
+	/// Append up to \a len bytes of \a in to the sync buffer.
+	/// @return Number of bytes read, 0 at EOF or -1 on error.
+	gssize feed(GInputStream* in, gsize len, GError** error)
+	{	char* buffer = ogg_sync_buffer(&Sync, len);
+		gssize bytes_read = g_input_stream_read(in, buffer, len, NULL, error);
+		if (bytes_read > 0)
+			ogg_sync_wrote(&Sync, bytes_read);
+		return bytes_read;
+	}
+	/// Fetch the next header packet of the first logical stream.
+	/// @details The packet is only valid until the next call.
+	/// @return \c false if the stream is invalid or truncated, \a error is only set on I/O errors.
+	bool next_packet(GInputStream* in, ogg_packet& packet, GError** error)
+	{	ogg_page page;
+		for (;;)
+		{	if (StreamInit)
+			{	int res = ogg_stream_packetout(&Stream, &packet);
+				if (res < 0)
+					return false; // gap in the headers
+				if (res > 0)
+					return true;
+			}
+			int res = ogg_sync_pageout(&Sync, &page);
+			if (res == 0)
+			{	gssize len = feed(in, Chunk, error);
+				if (len <= 0)
+					return false; // error or truncated
+				if (!StreamInit && (Garbage += len) > MaxGarbage)
+					return false;
+				continue;
+			}
+			if (res < 0)
+				continue; // skipped garbage
+			if (!StreamInit)
+			{	if (!ogg_page_bos(&page))
+					return false;
+				Serial = ogg_page_serialno(&page);
+				ogg_stream_init(&Stream, Serial);
+				StreamInit = true;
+			}
+			else if (ogg_page_serialno(&page) != Serial)
+				continue; // other stream of a multiplexed file
+			ogg_stream_pagein(&Stream, &page);
+		}
+	}
+};
+
+/// Image data of a METADATA_BLOCK_PICTURE comment of an Ogg Vorbis file.
+/// @details The comment header is demultiplexed and decoded again when the picture is needed,
+/// since it is usually split across several pages.
+class vorbis_picture_source : public EtPictureFileSource
+{	/// Index of the comment in the comment header.
+	const unsigned Comment;
+	/// Offset of the image data in the decoded picture block.
+	const unsigned Skip;
+protected:
+	bool read(GInputStream* in, void* bytes, unsigned size, GError** error) const override;
+public:
+	/// @param start Position of the Ogg stream in the file.
+	vorbis_picture_source(const ET_File& file, goffset start, unsigned comment, unsigned skip)
+	:	EtPictureFileSource(file, start), Comment(comment), Skip(skip) {}
+	goffset raw_offset() const override { return -1; }
+	bool equals(const EtPicture::Source& r) const override
+	{	if (!EtPictureFileSource::equals(r))
+			return false;
+		auto& source = static_cast<const vorbis_picture_source&>(r);
+		return source.Comment == Comment && source.Skip == Skip;
+	}
+};
+}
+
+/*
+ * Read the identification and comment header of an Ogg Vorbis file
+ * from the first pages and the duration from the granule position
+ * of the last page, instead of letting libvorbisfile scan the whole file
+ * for chained streams.
+ * Returns nullptr if the file does not start with a plain Vorbis stream;
+ * error is only set on I/O errors.
+ */
+static File_Tag* ogg_read_headers(GInputStream* in, goffset start, ET_File* ETFile, GError** error)
+{
+    const gsize chunk = OggPageReader::Chunk;
+
+    auto read32 = [](const unsigned char* p) -> guint32
+    {   return p[0] | p[1] << 8 | p[2] << 16 | (guint32)p[3] << 24;
+    };
+
+    OggPageReader reader;
+    ogg_page page;
+    ogg_packet packet;
+    vorbis_tags tags(0);
+    vector<unsigned char> comment;
+    ET_File_Info* ETFileInfo = &ETFile->ETFileInfo;
+
+    /* 1) Identification and comment header of the first logical stream. */
+    for (int packets = 0; packets < 2; ++packets)
+    {
+        if (!reader.next_packet(in, packet, error))
+            return nullptr;
+        if (packet.bytes < 7 || packet.packet[0] != (packets ? 3 : 1)
+            || memcmp(packet.packet + 1, "vorbis", 6) != 0)
+            return nullptr;
+        if (packets == 0)
+        {
+            if (packet.bytes < 30)
+                return nullptr;
+            const unsigned char* p = packet.packet;
+            guint32 rate = read32(p + 12);
+            gint32 upper = (gint32)read32(p + 16);
+            gint32 nominal = (gint32)read32(p + 20);
+            gint32 lower = (gint32)read32(p + 24);
+            if (rate == 0 || p[11] == 0)
+                return nullptr;
+            ETFileInfo->version = read32(p + 7);
+            ETFileInfo->mode = p[11];
+            ETFileInfo->samplerate = rate;
+            ETFileInfo->bitrate = nominal;
+            ETFileInfo->variable_bitrate = nominal != lower || nominal != upper;
+        } else
+            /* The packet is only valid up to the next page,
+             * but the pictures refer to the comment. */
+            comment.assign(packet.packet + 7, packet.packet + packet.bytes);
+    }
+    long serial = reader.Serial;
+
+    /* 2) Duration from the last page of the stream. The window grows until
+     * it contains a complete page of the stream with a granule position. */
+    GSeekable* seekable = G_SEEKABLE(in);
+    if (!g_seekable_seek(seekable, 0, G_SEEK_END, NULL, error))
+        return nullptr;
+    goffset end = g_seekable_tell(seekable);
+    ogg_int64_t granule = -1;
+    bool chained = false;
+    for (goffset window = 64 * 1024;; window *= 4)
+    {
+        goffset pos = max(start, end - window);
+        if (!g_seekable_seek(seekable, pos, G_SEEK_SET, NULL, error))
+            return nullptr;
+        ogg_sync_reset(&reader.Sync);
+        for (;;)
+        {
+            gssize len = reader.feed(in, chunk, error);
+            if (len < 0)
+                return nullptr;
+            if (len == 0)
+                break;
+        }
+        bool other_pages = false;
+        int res;
+        while ((res = ogg_sync_pageout(&reader.Sync, &page)) != 0)
+        {
+            if (res < 0)
+                continue;
+            if (ogg_page_serialno(&page) != serial)
+                other_pages = true;
+            else if (ogg_page_granulepos(&page) >= 0)
+                granule = ogg_page_granulepos(&page);
+        }
+        if (granule >= 0)
+            break;
+        if (other_pages)
+        {
+            /* Only other streams at the end, i.e. a chained file.
+             * Only the full scan finds the end of the first link. */
+            chained = true;
+            break;
+        }
+        if (pos == start || window >= 16 * 1024 * 1024)
+            break;
+    }
+
+    if (granule >= 0)
+        ETFileInfo->duration = (double)granule / ETFileInfo->samplerate;
+    else if (ETFileInfo->bitrate > 0)
+    {
+        /* Estimate from the nominal bitrate. */
+        ETFileInfo->duration = (end - start) * 8. / ETFileInfo->bitrate;
+        g_debug("Estimated duration of %s Ogg file: %s", chained ? "chained" : "truncated", ETFile->FilePath.get());
+    }
+
+    /* 3) Comments from the raw packet. */
+    if (!tags.parse(comment.data(), comment.size()))
+        g_debug("Truncated Ogg Vorbis comment: %s", ETFile->FilePath.get());
+
+    return file_tag_from_vorbis_tags(tags, ETFile, start);
+}
+
+bool vorbis_picture_source::read(GInputStream* in, void* bytes, unsigned size, GError** error) const
+{	if (!g_seekable_seek(G_SEEKABLE(in), Offset, G_SEEK_SET, NULL, error))
+		return false;
+	OggPageReader reader;
+	ogg_packet packet;
+	// skip the identification header
+	if (reader.next_packet(in, packet, error) && reader.next_packet(in, packet, error)
+		&& packet.bytes >= 7 && packet.packet[0] == 3)
+	{	vorbis_tags tags(0);
+		tags.parse(packet.packet + 7, packet.bytes - 7);
+		if (Comment < tags.size())
+		{	auto value = tags[Comment].value();
+			gsize quantum = Skip / 3 * 4;
+			gsize skip = Skip % 3;
+			if (quantum <= value.Len)
+			{	gsize len;
+				gAlloc<guchar> data(base64_decode(value.Str + quantum, value.Len - quantum, len));
+				if (len >= skip + size)
+				{	memcpy(bytes, data.get() + skip, size);
+					return true;
+				}
+			}
+		}
+	}
+	if (error && !*error)
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "%s", _("Input truncated or empty"));
+	return false;
+}
+
 /*
  * Read data into an Ogg Vorbis file.
  * Note:
@@ -238,11 +495,10 @@ File_Tag* ogg_read_file(GFile *file, ET_File *ETFile, GError **error)
 
     /* Check for an unsupported ID3v2 tag. */
     guchar tmp_id3[10];
+    goffset start = 0;
 
     if (g_input_stream_read (state.istream, tmp_id3, sizeof(tmp_id3), NULL, error) == sizeof(tmp_id3))
     {
-        goffset start = 0;
-
         /* Calculate ID3v2 length. */
         if (tmp_id3[0] == 'I' && tmp_id3[1] == 'D' && tmp_id3[2] == '3'
             && tmp_id3[3] < 0xFF)
@@ -267,6 +523,27 @@ File_Tag* ogg_read_file(GFile *file, ET_File *ETFile, GError **error)
         }
     }
 
+    /* Fast path unless chained streams are requested explicitly. */
+    if (!g_settings_get_boolean (MainSettings, "ogg-scan-chained"))
+    {
+        File_Tag* FileTag = ogg_read_headers (state.istream, start, ETFile, &state.error);
+        if (FileTag || state.error)
+        {
+            if (state.error)
+                g_set_error (error, state.error->domain, state.error->code,
+                             _("Error while opening file: %s"), state.error->message);
+            et_ogg_close_func (&state);
+            return FileTag;
+        }
+
+        /* No plain Vorbis stream at the start, let libvorbisfile sort it out. */
+        if (!g_seekable_seek (G_SEEKABLE(state.istream), start, G_SEEK_SET, NULL, error))
+        {
+            et_ogg_close_func (&state);
+            return nullptr;
+        }
+    }
+
     if ((res = ov_open_callbacks (&state, &vf, NULL, 0, callbacks)) == 0)
     {
         vorbis_info* vi = ov_info(&vf, 0);
@@ -452,7 +729,7 @@ add_to_guchar_str (guchar *ustr,
  * Returns: Integer which is read
  */
 static guint32
-read_guint32_from_byte (guchar *str, gsize start)
+read_guint32_from_byte (const guchar *str, gsize start)
 {
     gsize i;
     guint32 read = 0;
@@ -465,31 +742,6 @@ read_guint32_from_byte (guchar *str, gsize start)
     return read;
 }
 
-unsigned vorbis_tag::key_hash::operator()(const xString::cstring& tag) const
-{	const char* s = tag.Str;
-	const char* se = s + tag.Len;
-	unsigned hash = 2166136261U;
-	while (s != se && *s != '=')
-	{	hash ^= tolower(*s++);
-		hash *= 16777619U;
-	}
-	return hash;
-}
-
-bool vorbis_tag::key_equal::operator()(const xString::cstring& tag1, const xString::cstring& tag2) const
-{	const char* s1 = tag1.Str;
-	const char* s1e = s1 + tag1.Len;
-	const char* s2 = tag2.Str;
-	const char* s2e = s2 + tag2.Len;
-	do
-	{	if (s1 == s1e || *s1 == '=')
-			return s2 == s2e || *s2 == '=';
-		if (s2 == s2e || *s2 == '=')
-			return false;
-	} while (tolower(*s1++) == tolower(*s2++));
-	return true;
-}
-
 xString::cstring vorbis_tag::key() const
 {	const char* sep = (const char*)memchr(Str, '=', Len);
 	if (!sep)
@@ -504,160 +756,253 @@ xString::cstring vorbis_tag::value() const
 	return xString::cstring(sep + 1, Len - (sep + 1 - Str));
 }
 
-void vorbis_tags::fetch_field(const vorbis_tag& fieldname, xStringD0& target, bool useNewline)
-{	auto range = equal_range(fieldname);
-	if (range.first == range.second)
+/// Switch label of a field name: length and first character.
+template <size_t N>
+static constexpr unsigned field_label(const char (&name)[N])
+{	return (N - 1) << 8 | (unsigned char)name[0];
+}
+
+vorbis_tags::field vorbis_tags::classify(const char* key, size_t len)
+{	if (!len)
+		return OTHER;
+	auto is = [key, len](const char* name) { return g_ascii_strncasecmp(key, name, len) == 0; };
+	switch (len << 8 | (unsigned char)g_ascii_toupper(*key))
+	{case field_label(ET_VORBIS_COMMENT_FIELD_TITLE):
+		return is(ET_VORBIS_COMMENT_FIELD_TITLE) ? TITLE : OTHER;
+	 case field_label(ET_VORBIS_COMMENT_FIELD_VERSION):
+		return is(ET_VORBIS_COMMENT_FIELD_VERSION) ? VERSION : OTHER;
+	 case field_label(ET_VORBIS_COMMENT_FIELD_SUBTITLE):
+		return is(ET_VORBIS_COMMENT_FIELD_SUBTITLE) ? SUBTITLE : OTHER;
+	 case field_label(ET_VORBIS_COMMENT_FIELD_ARTIST):
+		return is(ET_VORBIS_COMMENT_FIELD_ARTIST) ? ARTIST : OTHER;
+	 case field_label(ET_VORBIS_COMMENT_FIELD_ALBUM_ARTIST):
+		return is(ET_VORBIS_COMMENT_FIELD_ALBUM_ARTIST) ? ALBUM_ARTIST : OTHER;
+	 case field_label(ET_VORBIS_COMMENT_FIELD_ALBUM):
+		return is(ET_VORBIS_COMMENT_FIELD_ALBUM) ? ALBUM : OTHER;
+	 case field_label(ET_VORBIS_COMMENT_FIELD_DISC_SUBTITLE):
+		return is(ET_VORBIS_COMMENT_FIELD_DISC_SUBTITLE) ? DISC_SUBTITLE : OTHER;
+	 case field_label(ET_VORBIS_COMMENT_FIELD_DISC_TOTAL):
+		return is(ET_VORBIS_COMMENT_FIELD_DISC_TOTAL) ? DISC_TOTAL : OTHER;
+	 case field_label(ET_VORBIS_COMMENT_FIELD_DISC_NUMBER):
+		return is(ET_VORBIS_COMMENT_FIELD_DISC_NUMBER) ? DISC_NUMBER : OTHER;
+	 case field_label(ET_VORBIS_COMMENT_FIELD_DATE):
+		return is(ET_VORBIS_COMMENT_FIELD_DATE) ? DATE : OTHER;
+	 case field_label(ET_VORBIS_COMMENT_FIELD_RELEASE_DATE):
+		return is(ET_VORBIS_COMMENT_FIELD_RELEASE_DATE) ? RELEASE_DATE : OTHER;
+	 case field_label(ET_VORBIS_COMMENT_FIELD_TRACK_TOTAL):
+		return is(ET_VORBIS_COMMENT_FIELD_TRACK_TOTAL) ? TRACK_TOTAL : OTHER;
+	 case field_label(ET_VORBIS_COMMENT_FIELD_TRACK_NUMBER):
+		return is(ET_VORBIS_COMMENT_FIELD_TRACK_NUMBER) ? TRACK_NUMBER : OTHER;
+	 case field_label(ET_VORBIS_COMMENT_FIELD_GENRE):
+		return is(ET_VORBIS_COMMENT_FIELD_GENRE) ? GENRE : OTHER;
+	 case field_label(ET_VORBIS_COMMENT_FIELD_COMMENT): // same label as CONTACT
+		if (is(ET_VORBIS_COMMENT_FIELD_COMMENT))
+			return COMMENT;
+		return is(ET_VORBIS_COMMENT_FIELD_CONTACT) ? CONTACT : OTHER;
+	 case field_label(ET_VORBIS_COMMENT_FIELD_DESCRIPTION):
+		return is(ET_VORBIS_COMMENT_FIELD_DESCRIPTION) ? DESCRIPTION : OTHER;
+	 case field_label(ET_VORBIS_COMMENT_FIELD_COMPOSER): // same label as COVERART
+		if (is(ET_VORBIS_COMMENT_FIELD_COMPOSER))
+			return COMPOSER;
+		return is(ET_VORBIS_COMMENT_FIELD_COVER_ART) ? COVER_ART : OTHER;
+	 case field_label(ET_VORBIS_COMMENT_FIELD_PERFORMER):
+		return is(ET_VORBIS_COMMENT_FIELD_PERFORMER) ? PERFORMER : OTHER;
+	 case field_label(ET_VORBIS_COMMENT_FIELD_ORIG_DATE):
+		return is(ET_VORBIS_COMMENT_FIELD_ORIG_DATE) ? ORIG_DATE : OTHER;
+	 case field_label(ET_VORBIS_COMMENT_FIELD_COPYRIGHT):
+		return is(ET_VORBIS_COMMENT_FIELD_COPYRIGHT) ? COPYRIGHT : OTHER;
+	 case field_label(ET_VORBIS_COMMENT_FIELD_ENCODED_BY):
+		return is(ET_VORBIS_COMMENT_FIELD_ENCODED_BY) ? ENCODED_BY : OTHER;
+	 case field_label(ET_VORBIS_COMMENT_FIELD_REPLAYGAIN_TRACK_GAIN): // all REPLAYGAIN fields
+		if (is(ET_VORBIS_COMMENT_FIELD_REPLAYGAIN_TRACK_GAIN))
+			return REPLAYGAIN_TRACK_GAIN;
+		if (is(ET_VORBIS_COMMENT_FIELD_REPLAYGAIN_TRACK_PEAK))
+			return REPLAYGAIN_TRACK_PEAK;
+		if (is(ET_VORBIS_COMMENT_FIELD_REPLAYGAIN_ALBUM_GAIN))
+			return REPLAYGAIN_ALBUM_GAIN;
+		return is(ET_VORBIS_COMMENT_FIELD_REPLAYGAIN_ALBUM_PEAK) ? REPLAYGAIN_ALBUM_PEAK : OTHER;
+	 case field_label(ET_VORBIS_COMMENT_FIELD_COVER_ART_TYPE):
+		return is(ET_VORBIS_COMMENT_FIELD_COVER_ART_TYPE) ? COVER_ART_TYPE : OTHER;
+	 case field_label(ET_VORBIS_COMMENT_FIELD_COVER_ART_DESCRIPTION):
+		return is(ET_VORBIS_COMMENT_FIELD_COVER_ART_DESCRIPTION) ? COVER_ART_DESCRIPTION : OTHER;
+	 case field_label(ET_VORBIS_COMMENT_FIELD_METADATA_BLOCK_PICTURE):
+		return is(ET_VORBIS_COMMENT_FIELD_METADATA_BLOCK_PICTURE) ? METADATA_BLOCK_PICTURE : OTHER;
+	 default:
+		return OTHER;
+	}
+}
+
+void vorbis_tags::add(const char* comment, size_t len)
+{	vorbis_tag tag(comment, len);
+	// A comment without '=' is invalid and kept as it is.
+	const char* sep = (const char*)memchr(comment, '=', len);
+	Entries.push_back({ tag, sep ? classify(comment, sep - comment) : OTHER });
+}
+
+bool vorbis_tags::parse(const void* packet, size_t len)
+{	const guchar* p = (const guchar*)packet;
+	const guchar* pe = p + len;
+	guint32 n;
+	auto read32 = [&p, pe](guint32& value)
+	{	if (pe - p < 4)
+			return false;
+		value = p[0] | p[1] << 8 | p[2] << 16 | (guint32)p[3] << 24;
+		p += 4;
+		return true;
+	};
+
+	// skip vendor string
+	if (!read32(n) || n > (size_t)(pe - p))
+		return false;
+	p += n;
+
+	guint32 count;
+	if (!read32(count))
+		return false;
+	// Do not trust count for the allocation, each comment takes at least 4 bytes.
+	Entries.reserve(Entries.size() + min<size_t>(count, (pe - p) / 4));
+	while (count--)
+	{	if (!read32(n) || n > (size_t)(pe - p))
+			return false;
+		add((const char*)p, n);
+		p += n;
+	}
+	return true;
+}
+
+void vorbis_tags::fetch_field(field fieldname, xStringD0& target, bool useNewline)
+{	auto next = [this, fieldname](vector<entry>::iterator it)
+	{	return find_if(it, Entries.end(), [fieldname](const entry& e) { return e.Field == fieldname; });
+	};
+	auto it = next(Entries.begin());
+	if (it == Entries.end())
 	{	target.reset();
 		return;
 	}
-	iterator it = range.first;
-	auto value = it++->value();
-	if (it == range.second)
+	it->Field = DONE;
+	auto value = it->Tag.value();
+	auto it2 = next(it + 1);
+	if (it2 == Entries.end())
 	{	// simple: only one instance
 		target.assignNFC(value.Str, value.Len);
-	} else
-	{	// multiple items => concatenate
-		// calculate length
-		size_t len = value.Len;
-		size_t delim_len = 1;
-		if (!useNewline)
-		{	if (!delimiter)
-				delimiter.reset(g_settings_get_string(MainSettings, "split-delimiter"));
-			delim_len = strlen(delimiter);
-		}
-		for (; it != range.second; ++it)
-			len += delim_len + it->value().Len;
-		// assign value
-		xString res;
-		char* dp = res.alloc(len);
+		return;
+	}
+
+	// multiple items => concatenate
+	// calculate length
+	size_t len = value.Len;
+	size_t delim_len = 1;
+	if (!useNewline)
+	{	if (!delimiter)
+			delimiter.reset(g_settings_get_string(MainSettings, "split-delimiter"));
+		delim_len = strlen(delimiter);
+	}
+	for (it = it2; it != Entries.end(); it = next(it + 1))
+		len += delim_len + it->Tag.value().Len;
+	// assign value
+	xString res;
+	char* dp = res.alloc(len);
+	memcpy(dp, value.Str, value.Len);
+	for (it = it2; it != Entries.end(); it = next(it + 1))
+	{	dp += value.Len;
+		if (useNewline)
+			*dp = '\n';
+		else
+			memcpy(dp, delimiter, delim_len);
+		dp += delim_len;
+		value = it->Tag.value();
 		memcpy(dp, value.Str, value.Len);
-		for (it = range.first; ++it != range.second;)
-		{	dp += value.Len;
-			if (useNewline)
-				*dp = '\n';
-			else
-				memcpy(dp, delimiter, delim_len);
-			dp += delim_len;
-			value = it->value();
-			memcpy(dp, value.Str, value.Len);
-		}
-		target.assignNFC(res);
+		it->Field = DONE;
 	}
-	erase(range.first, range.second);
+	target.assignNFC(res);
 }
 
-float vorbis_tags::fetch_float(const vorbis_tag& fieldname)
-{	auto it = find(fieldname);
-	if (it == end())
+float vorbis_tags::fetch_float(field fieldname)
+{	auto it = find_if(Entries.begin(), Entries.end(), [fieldname](const entry& e) { return e.Field == fieldname; });
+	if (it == Entries.end())
 		return numeric_limits<float>::quiet_NaN();
-	auto value = it->value();
-	float f = File_Tag::parse_float(string(value.Str, value.Len).c_str());
-	erase(it);
-	return f;
+	it->Field = DONE;
+	auto value = it->Tag.value();
+	return File_Tag::parse_float(string(value.Str, value.Len).c_str());
 }
 
 void vorbis_tags::to_file_tags(File_Tag *FileTag)
 {
-	fetch_field(ET_VORBIS_COMMENT_FIELD_TITLE, FileTag->title);
-	fetch_field(ET_VORBIS_COMMENT_FIELD_VERSION, FileTag->version);
-	fetch_field(ET_VORBIS_COMMENT_FIELD_SUBTITLE, FileTag->subtitle);
+	fetch_field(TITLE, FileTag->title);
+	fetch_field(VERSION, FileTag->version);
+	fetch_field(SUBTITLE, FileTag->subtitle);
 
-	fetch_field(ET_VORBIS_COMMENT_FIELD_ARTIST, FileTag->artist);
-	fetch_field(ET_VORBIS_COMMENT_FIELD_ALBUM_ARTIST, FileTag->album_artist);
+	fetch_field(ARTIST, FileTag->artist);
+	fetch_field(ALBUM_ARTIST, FileTag->album_artist);
 
-	fetch_field(ET_VORBIS_COMMENT_FIELD_ALBUM, FileTag->album);
-	fetch_field(ET_VORBIS_COMMENT_FIELD_DISC_SUBTITLE, FileTag->disc_subtitle);
+	fetch_field(ALBUM, FileTag->album);
+	fetch_field(DISC_SUBTITLE, FileTag->disc_subtitle);
 
 	/* Disc number and total discs. */
-	fetch_field(ET_VORBIS_COMMENT_FIELD_DISC_TOTAL, FileTag->disc_total);
-	fetch_field(ET_VORBIS_COMMENT_FIELD_DISC_NUMBER, FileTag->disc_number);
+	fetch_field(DISC_TOTAL, FileTag->disc_total);
+	fetch_field(DISC_NUMBER, FileTag->disc_number);
 	if (!et_str_empty(FileTag->disc_number) && et_str_empty(FileTag->disc_total))
 		FileTag->disc_and_total(FileTag->disc_number);
 
-	fetch_field(ET_VORBIS_COMMENT_FIELD_DATE, FileTag->year);
-	fetch_field(ET_VORBIS_COMMENT_FIELD_RELEASE_DATE, FileTag->release_year);
+	fetch_field(DATE, FileTag->year);
+	fetch_field(RELEASE_DATE, FileTag->release_year);
 
 	/* Track number and total tracks. */
-	fetch_field(ET_VORBIS_COMMENT_FIELD_TRACK_TOTAL, FileTag->track_total);
-	fetch_field(ET_VORBIS_COMMENT_FIELD_TRACK_NUMBER, FileTag->track);
+	fetch_field(TRACK_TOTAL, FileTag->track_total);
+	fetch_field(TRACK_NUMBER, FileTag->track);
 	if (!et_str_empty(FileTag->track) && et_str_empty(FileTag->track_total))
 		FileTag->track_and_total(FileTag->track);
 
-	fetch_field(ET_VORBIS_COMMENT_FIELD_GENRE, FileTag->genre);
-	fetch_field(ET_VORBIS_COMMENT_FIELD_COMMENT, FileTag->comment, g_settings_get_boolean(MainSettings, "tag-multiline-comment"));
-	fetch_field(ET_VORBIS_COMMENT_FIELD_DESCRIPTION, FileTag->description, TRUE);
+	fetch_field(GENRE, FileTag->genre);
+	fetch_field(COMMENT, FileTag->comment, g_settings_get_boolean(MainSettings, "tag-multiline-comment"));
+	fetch_field(DESCRIPTION, FileTag->description, TRUE);
 
-	fetch_field(ET_VORBIS_COMMENT_FIELD_COMPOSER, FileTag->composer);
-	fetch_field(ET_VORBIS_COMMENT_FIELD_PERFORMER, FileTag->orig_artist);
-	fetch_field(ET_VORBIS_COMMENT_FIELD_ORIG_DATE, FileTag->orig_year);
+	fetch_field(COMPOSER, FileTag->composer);
+	fetch_field(PERFORMER, FileTag->orig_artist);
+	fetch_field(ORIG_DATE, FileTag->orig_year);
 
-	fetch_field(ET_VORBIS_COMMENT_FIELD_COPYRIGHT, FileTag->copyright);
-	fetch_field(ET_VORBIS_COMMENT_FIELD_CONTACT, FileTag->url);
-	fetch_field(ET_VORBIS_COMMENT_FIELD_ENCODED_BY, FileTag->encoded_by);
+	fetch_field(COPYRIGHT, FileTag->copyright);
+	fetch_field(CONTACT, FileTag->url);
+	fetch_field(ENCODED_BY, FileTag->encoded_by);
 
-	FileTag->track_gain = fetch_float(ET_VORBIS_COMMENT_FIELD_REPLAYGAIN_TRACK_GAIN);
-	FileTag->track_peak = fetch_float(ET_VORBIS_COMMENT_FIELD_REPLAYGAIN_TRACK_PEAK);
-	FileTag->album_gain = fetch_float(ET_VORBIS_COMMENT_FIELD_REPLAYGAIN_ALBUM_GAIN);
-	FileTag->album_peak = fetch_float(ET_VORBIS_COMMENT_FIELD_REPLAYGAIN_ALBUM_PEAK);
+	FileTag->track_gain = fetch_float(REPLAYGAIN_TRACK_GAIN);
+	FileTag->track_peak = fetch_float(REPLAYGAIN_TRACK_PEAK);
+	FileTag->album_gain = fetch_float(REPLAYGAIN_ALBUM_GAIN);
+	FileTag->album_peak = fetch_float(REPLAYGAIN_ALBUM_PEAK);
 }
 
 void vorbis_tags::to_other_tags(ET_File *ETFile)
-{	gString* arr = new gString[size() + 1];
+{	size_t count = count_if(Entries.begin(), Entries.end(), [](const entry& e) { return e.Field != DONE; });
+	gString* arr = new gString[count + 1];
 	ETFile->other.reset(arr);
-	for (const auto& v : *this)
-		*arr++ = g_strndup(v.Str, v.Len);
+	for (const entry& e : Entries)
+		if (e.Field != DONE)
+			*arr++ = g_strndup(e.Tag.Str, e.Tag.Len);
 	*arr = nullptr;
 }
 
-// Variant of g_base64_decode_step that can deal with length limited input
-static guchar* base64_decode(const char* str, size_t len, gsize& data_size)
-{	gint state = 0;
-	guint save = 0;
-	guchar* out = (guchar*)g_malloc((len / 4 + 1) * 3);
-	data_size = g_base64_decode_step(str, len, out, &state, &save);
-	return out;
-}
-
-/*
- * et_add_file_tags_from_vorbis_comments:
- * @vc: Vorbis comment from which to fill @FileTag
- * @FileTag: tag to populate from @vc
- *
- * Reads Vorbis comments and copies them to file tag.
- */
-File_Tag*
-get_file_tags_from_vorbis_comments (const vorbis_comment *vc, ET_File *ETFile)
+void vorbis_tags::to_pictures(File_Tag *FileTag, ET_File *ETFile, goffset stream_start)
 {
-	if (!vc)
-		return nullptr;
-
-	File_Tag *FileTag = new File_Tag();
-	vorbis_tags tags(vc->comments);
-
-	for (int i = 0; i < vc->comments; i++)
-		tags.emplace(vc->user_comments[i], vc->comment_lengths[i]);
-
-	/* add standard tags */
-	tags.to_file_tags(FileTag);
+	auto next = [this](vector<entry>::iterator it, field fieldname)
+	{	return find_if(it, Entries.end(), [fieldname](const entry& e) { return e.Field == fieldname; });
+	};
 
 	/* Cover art. */
-	auto range = tags.equal_range(ET_VORBIS_COMMENT_FIELD_COVER_ART);
-	if (range.first != range.second)
+	auto l = next(Entries.begin(), COVER_ART);
+	if (l != Entries.end())
 	{
-		auto types = tags.equal_range(ET_VORBIS_COMMENT_FIELD_COVER_ART_TYPE);
-		auto descs = tags.equal_range(ET_VORBIS_COMMENT_FIELD_COVER_ART_DESCRIPTION);
-		vorbis_tags::iterator l = range.first;
-		vorbis_tags::iterator m = types.first;
-		vorbis_tags::iterator n = descs.first;
+		auto m = next(Entries.begin(), COVER_ART_TYPE);
+		auto n = next(Entries.begin(), COVER_ART_DESCRIPTION);
 
 		/* Force marking the file as modified, so that the deprecated cover art
 		 * field is converted to a METADATA_PICTURE_BLOCK field. */
 		ETFile->force_tag_save();
 
-		for (; l != range.second; ++l)
-		{	auto value = l->value();
+		for (; l != Entries.end(); l = next(l + 1, COVER_ART))
+		{	l->Field = DONE;
+			auto value = l->Tag.value();
 			if (!value.Len)
-				break;
+				continue;
 
 			/* Decode picture data. */
 			gsize data_size;
@@ -666,110 +1011,174 @@ get_file_tags_from_vorbis_comments (const vorbis_comment *vc, ET_File *ETFile)
 			/* It is only necessary for there to be image data, but the type
 			 * and description are optional. */
 			EtPictureType type = ET_PICTURE_TYPE_FRONT_COVER;
-			if (m != types.second)
-			{	value = m++->value();
-				if (!value.Len)
+			if (m != Entries.end())
+			{	m->Field = DONE;
+				value = m->Tag.value();
+				if (value.Len)
 					type = (EtPictureType)atoi(string(value.Str, value.Len).c_str());
+				m = next(m + 1, COVER_ART_TYPE);
 			}
 
 			xStringD0 description;
-			if (n != descs.second)
-			{	value = n++->value();
-				if (!value.Len)
-					description.assignNFC(value);
+			if (n != Entries.end())
+			{	n->Field = DONE;
+				value = n->Tag.value();
+				if (value.Len)
+					description.assignNFC(value.Str, value.Len);
+				n = next(n + 1, COVER_ART_DESCRIPTION);
 			}
 
 			FileTag->pictures.emplace_back(type, description, 0, 0, data.get(), data_size);
 		}
 
-		tags.erase(range.first, range.second); // invalidates iterators
-		tags.erase(types.first, types.second);
-		tags.erase(descs.first, descs.second);
+		for (entry& e : Entries)
+			if (e.Field == COVER_ART_TYPE || e.Field == COVER_ART_DESCRIPTION)
+				e.Field = DONE;
 	}
 
-	/* METADATA_BLOCK_PICTURE tag used for picture information. */
-	range = tags.equal_range(ET_VORBIS_COMMENT_FIELD_METADATA_BLOCK_PICTURE);
-	if (range.first != range.second)
+	/* METADATA_BLOCK_PICTURE tag used for picture information.
+	 * Only the header is decoded here, large images are decoded on demand. */
+	const gsize picture_head = 4096;
+	vector<guchar> buffer;
+	for (entry& e : Entries)
 	{
-		for (vorbis_tags::iterator l = range.first; l != range.second; l = ++l)
-		{
-			gsize bytes_pos, mimelen, desclen;
-			EtPictureType type;
-			gsize data_size;
+		if (e.Field != METADATA_BLOCK_PICTURE)
+			continue;
+		e.Field = DONE;
+
+		auto value = e.Tag.value();
+		/* Size of the decoded picture block. */
+		gsize decoded_size = value.Len / 4 * 3 + value.Len % 4 * 3 / 4;
+		if (value.Len >= 1 && value.Str[value.Len - 1] == '=')
+			--decoded_size;
+		if (value.Len >= 2 && value.Str[value.Len - 2] == '=')
+			--decoded_size;
+
+		/* Decode the first bytes of the picture block. */
+		auto header = [&value, &buffer](gsize bytes) -> const guchar*
+		{	gsize chars = min<gsize>((bytes + 2) / 3 * 4, value.Len);
+			buffer.resize(chars / 4 * 3 + 3);
+			gint state = 0;
+			guint save = 0;
+			return g_base64_decode_step(value.Str, chars, buffer.data(), &state, &save) >= bytes ? buffer.data() : nullptr;
+		};
+
+		const guchar* decoded_ustr;
+		gsize bytes_pos, mimelen, desclen, data_size;
+		EtPictureType type;
+
+		/* Check that the comment decoded to a long enough string to hold the
+		 * whole structure (8 fields of 4 bytes each). */
+		if (decoded_size < 8 * 4 || !(decoded_ustr = header(8)))
+		{invalid_picture:
+			/* Mark the file as modified, so that the invalid field is removed upon
+			 * saving. */
+			ETFile->force_tag_save();
+			continue;
+		}
 
-			/* Decode picture data. */
-			auto value = l->value();
-			gsize decoded_size;
-			gAlloc<guchar> decoded_ustr(base64_decode(value.Str, value.Len, decoded_size));
-
-			/* Check that the comment decoded to a long enough string to hold the
-			 * whole structure (8 fields of 4 bytes each). */
-			if (decoded_size < 8 * 4)
-			{invalid_picture:
-				/* Mark the file as modified, so that the invalid field is removed upon
-				 * saving. */
-				ETFile->force_tag_save();
-				continue;
+		/* Reading picture type. */
+		type = (EtPictureType)read_guint32_from_byte(decoded_ustr, 0);
+		bytes_pos = 4;
+
+		/* TODO: Check that there is a maximum of 1 of each of
+		 * ET_PICTURE_TYPE_FILE_ICON and ET_PICTURE_TYPE_OTHER_FILE_ICON types
+		 * in the file. */
+		if (type >= ET_PICTURE_TYPE_UNDEFINED)
+			goto invalid_picture;
+
+		/* Reading MIME data. */
+		mimelen = read_guint32_from_byte(decoded_ustr, bytes_pos);
+		bytes_pos += 4;
+
+		if (mimelen > decoded_size - bytes_pos - (6 * 4)
+			|| !(decoded_ustr = header(bytes_pos + mimelen + 4)))
+			goto invalid_picture;
+
+		/* Check for a valid MIME type. */
+		if (mimelen > 0)
+		{	const gchar *mime = (const gchar*)&decoded_ustr[bytes_pos];
+			/* TODO: Check for "-->" when adding linked image support. */
+			if (strncmp (mime, "image/", mimelen) != 0
+				&& strncmp (mime, "image/png", mimelen) != 0
+				&& strncmp (mime, "image/jpeg", mimelen) != 0)
+			{	g_debug("Invalid Vorbis comment image MIME type: %*s", (int)mimelen, mime);
+				goto invalid_picture;
 			}
+		}
 
-			/* Reading picture type. */
-			type = (EtPictureType)read_guint32_from_byte(decoded_ustr.get(), 0);
-			bytes_pos = 4;
+		/* Skip over the MIME type, as gdk-pixbuf does not use it. */
+		bytes_pos += mimelen;
 
-			/* TODO: Check that there is a maximum of 1 of each of
-			 * ET_PICTURE_TYPE_FILE_ICON and ET_PICTURE_TYPE_OTHER_FILE_ICON types
-			 * in the file. */
-			if (type >= ET_PICTURE_TYPE_UNDEFINED)
-				goto invalid_picture;
+		/* Reading description */
+		desclen = read_guint32_from_byte(decoded_ustr, bytes_pos);
+		bytes_pos += 4;
 
-			/* Reading MIME data. */
-			mimelen = read_guint32_from_byte(decoded_ustr.get(), bytes_pos);
-			bytes_pos += 4;
+		if (desclen > decoded_size - bytes_pos - (5 * 4)
+			|| !(decoded_ustr = header(bytes_pos + desclen + 5 * 4)))
+			goto invalid_picture;
 
-			if (mimelen > decoded_size - bytes_pos - (6 * 4))
-				goto invalid_picture;
+		xStringD0 description;
+		description.assignNFC((const char*)&decoded_ustr[bytes_pos], desclen);
 
-			/* Check for a valid MIME type. */
-			if (mimelen > 0)
-			{	const gchar *mime = (const gchar*)&decoded_ustr.get()[bytes_pos];
-				/* TODO: Check for "-->" when adding linked image support. */
-				if (strncmp (mime, "image/", mimelen) != 0
-					&& strncmp (mime, "image/png", mimelen) != 0
-					&& strncmp (mime, "image/jpeg", mimelen) != 0)
-				{	g_debug("Invalid Vorbis comment image MIME type: %*s", (int)mimelen, mime);
-					goto invalid_picture;
-				}
-			}
+		/* Skip the width, height, color depth and number-of-colors fields. */
+		bytes_pos += desclen + 16;
 
-			/* Skip over the MIME type, as gdk-pixbuf does not use it. */
-			bytes_pos += mimelen;
+		/* Reading picture size */
+		data_size = read_guint32_from_byte(decoded_ustr, bytes_pos);
+		bytes_pos += 4;
 
-			/* Reading description */
-			desclen = read_guint32_from_byte (decoded_ustr.get(), bytes_pos);
-			bytes_pos += 4;
+		if (data_size > decoded_size - bytes_pos)
+			goto invalid_picture;
 
-			if (desclen > decoded_size - bytes_pos - (5 * 4))
-				goto invalid_picture;
+		if (stream_start >= 0 && data_size > picture_head)
+		{	FileTag->pictures.emplace_back(type, description, 0, 0, *ETFile,
+				new vorbis_picture_source(*ETFile, stream_start, &e - Entries.data(), bytes_pos), data_size);
+			continue;
+		}
 
-			xStringD0 description;
-			description.assignNFC((const char*)&decoded_ustr.get()[bytes_pos], desclen);
+		/* Decode the image data, starting with the base64 quantum that contains its first byte. */
+		gsize quantum = bytes_pos / 3 * 4;
+		gsize len;
+		gAlloc<guchar> data(base64_decode(value.Str + quantum, value.Len - quantum, len));
+		gsize skip = bytes_pos % 3;
+		if (len < skip + data_size)
+			goto invalid_picture;
+
+		FileTag->pictures.emplace_back(type, description, 0, 0, data.get() + skip, data_size);
+	}
+}
+
+/*
+ * et_add_file_tags_from_vorbis_comments:
+ * @vc: Vorbis comment from which to fill @FileTag
+ * @FileTag: tag to populate from @vc
+ *
+ * Reads Vorbis comments and copies them to file tag.
+ */
+File_Tag*
+get_file_tags_from_vorbis_comments (const vorbis_comment *vc, ET_File *ETFile)
+{
+	if (!vc)
+		return nullptr;
+
+	vorbis_tags tags(vc->comments);
 
-			/* Skip the width, height, color depth and number-of-colors fields. */
-			bytes_pos += desclen + 16;
+	for (int i = 0; i < vc->comments; i++)
+		tags.add(vc->user_comments[i], vc->comment_lengths[i]);
 
-			/* Reading picture size */
-			data_size = read_guint32_from_byte (decoded_ustr.get(), bytes_pos);
-			bytes_pos += 4;
+	return file_tag_from_vorbis_tags(tags, ETFile);
+}
 
-			if (data_size > decoded_size - bytes_pos)
-				goto invalid_picture;
+static File_Tag* file_tag_from_vorbis_tags(vorbis_tags& tags, ET_File* ETFile, goffset stream_start)
+{
+	File_Tag *FileTag = new File_Tag();
 
-			FileTag->pictures.emplace_back(type, description, 0, 0,
-				decoded_ustr.get() + bytes_pos, data_size);
-		}
+	/* add standard tags */
+	tags.to_file_tags(FileTag);
 
-		tags.erase(range.first, range.second);
-	}
+	/* Cover art. */
+	tags.to_pictures(FileTag, ETFile, stream_start);
 
 	/* Save unsupported fields. */
 	tags.to_other_tags(ETFile);
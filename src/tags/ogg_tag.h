@@ -35,19 +35,11 @@ struct ET_File;
 struct File_Tag;
 struct EtFileHeaderFields;
 
-#include <unordered_set>
+#include <vector>
 #include <string>
 
 struct vorbis_tag : public xString::cstring
 {
-	struct key_hash
-	{	unsigned operator()(const xString::cstring& tag) const;
-	};
-
-	struct key_equal
-	{	bool operator()(const xString::cstring& tag1, const xString::cstring& tag2) const;
-	};
-
 	constexpr vorbis_tag(const char* str, std::size_t len) noexcept : xString::cstring(str, len) {}
 	template <std::size_t N>
 	constexpr vorbis_tag(const char (&str)[N]) noexcept : xString::cstring(str, N-1) {}
@@ -56,13 +48,59 @@ struct vorbis_tag : public xString::cstring
 	xString::cstring value() const;
 };
 
-class vorbis_tags : public std::unordered_multiset<vorbis_tag, vorbis_tag::key_hash, vorbis_tag::key_equal>
-{	gString delimiter;
-	void fetch_field(const vorbis_tag& fieldname, xStringD0& target, bool useNewline = false);
-	float fetch_float(const vorbis_tag& fieldname);
+/// Vorbis comments of a FLAC, Ogg or Opus file.
+/// @details The entries are only views into the comment packet,
+/// so the packet must outlive this instance.
+/// Each field name is classified once when it is added
+/// and the tag fields pick their values by \ref field afterwards.
+class vorbis_tags
+{public:
+	/// Field names with a special meaning.
+	enum field : unsigned char
+	{	OTHER,
+		TITLE, VERSION, SUBTITLE, ARTIST, ALBUM_ARTIST, ALBUM, DISC_SUBTITLE, DISC_TOTAL, DISC_NUMBER,
+		DATE, RELEASE_DATE, TRACK_TOTAL, TRACK_NUMBER, GENRE, COMMENT, DESCRIPTION, COMPOSER, PERFORMER,
+		ORIG_DATE, COPYRIGHT, CONTACT, ENCODED_BY,
+		REPLAYGAIN_TRACK_GAIN, REPLAYGAIN_TRACK_PEAK, REPLAYGAIN_ALBUM_GAIN, REPLAYGAIN_ALBUM_PEAK,
+		COVER_ART, COVER_ART_TYPE, COVER_ART_DESCRIPTION, METADATA_BLOCK_PICTURE,
+		/// Entry has already been consumed.
+		DONE
+	};
+	/// Classify a field name, case insensitive.
+	static field classify(const char* key, std::size_t len);
+
+private:
+	struct entry
+	{	vorbis_tag Tag;
+		field Field;
+	};
+	std::vector<entry> Entries;
+	gString delimiter;
+	void fetch_field(field fieldname, xStringD0& target, bool useNewline = false);
+	float fetch_float(field fieldname);
 public:
-	vorbis_tags(std::size_t capacity) : std::unordered_multiset<vorbis_tag, vorbis_tag::key_hash, vorbis_tag::key_equal>(capacity) {}
+	vorbis_tags(std::size_t capacity) { Entries.reserve(capacity); }
+	/// Add a single comment of the form \c NAME=value.
+	void add(const char* comment, std::size_t len);
+	/// Add all comments of a raw Vorbis comment packet
+	/// (without packet type and framing bit).
+	/// @return \c false if the packet is truncated.
+	/// The comments up to this point are added anyway.
+	bool parse(const void* packet, std::size_t len);
+	/// Number of comments.
+	std::size_t size() const { return Entries.size(); }
+	/// Comment number \a i in the order they have been added.
+	const vorbis_tag& operator[](std::size_t i) const { return Entries[i].Tag; }
+
+	/// Move the values of all supported fields to \a FileTag\.
 	void to_file_tags(File_Tag *FileTag);
+	/// Move the cover art to \a ETFile\.
+	/// @param stream_start Position of the Ogg stream in the file of \a ETFile
+	/// if the comments have been parsed from its comment header alone, -1 otherwise.
+	/// @details Decoding of large \c METADATA_BLOCK_PICTURE images is deferred until the picture is needed
+	/// if \a stream_start is known.
+	void to_pictures(File_Tag *FileTag, ET_File *ETFile, goffset stream_start = -1);
+	/// Move all remaining fields to \a ETFile\.
 	void to_other_tags(ET_File *ETFile);
 };
 
@@ -38,6 +38,8 @@ struct Opus_Description : ET_File_Description
 		read_file = opus_read_file;
 		write_file_tag = ogg_tag_write_file_tag;
 		display_file_info_to_ui = et_opus_header_display_file_info_to_ui;
+		sniff = [](const guchar* head, gsize len)
+		{	return len >= 36 && memcmp(head, "OggS", 4) == 0 && memcmp(head + 28, "OpusHead", 8) == 0; };
 	}
 }
 Opus_Description;
@@ -31,6 +31,9 @@
 #include "ogg_tag.h"
 
 #define CHUNKSIZE 4096
+/* Maximum number of padding bytes left in the comment header when the header
+ * pages are rewritten in place. */
+#define MAX_PADDING 65536
 
 /*
  * et_ogg_error_quark:
@@ -48,6 +51,7 @@ et_ogg_error_quark (void)
 struct _EtOggState
 {
     /*< private >*/
+    GFile *file;
     GFileInputStream *in;
 #ifdef ENABLE_SPEEX
     SpeexHeader *si;
@@ -67,6 +71,10 @@ struct _EtOggState
     glong mainlen;
     glong booklen;
     glong prevW;
+    glong commentlen;
+    gsize headerlen;
+    guint headerpages;
+    gboolean inplace;
     gboolean extrapage;
     gboolean eosin;
 };
@@ -144,6 +152,11 @@ vcedit_clear_internals (EtOggState *state)
         g_object_unref (state->in);
     }
 
+    if (state->file)
+    {
+        g_object_unref (state->file);
+    }
+
     memset (state, 0, sizeof (*state));
 }
 
@@ -171,10 +184,23 @@ _v_writestring (oggpack_buffer *o,
     }
 }
 
-static int
+/*
+ * _commentheader_out:
+ * @state: (in): the reader state with the new comments
+ * @op: (out): the comment header packet, to be freed with ogg_packet_clear()
+ * @padded_size: (in): minimum size of the packet
+ *
+ * Creates the comment header packet. If the comments need less than
+ * @padded_size bytes, the packet is padded with zeros, which decoders ignore.
+ *
+ * Returns: size of the packet without padding
+ */
+static glong
 _commentheader_out (EtOggState *state,
-                    ogg_packet *op)
+                    ogg_packet *op,
+                    glong padded_size)
 {
+    glong bytes;
     vorbis_comment *vc = state->vc;
     const gchar *vendor = state->vendor;
     oggpack_buffer opb;
@@ -222,10 +248,12 @@ _commentheader_out (EtOggState *state,
 
     oggpack_write (&opb, 1, 1);
 
-    op->packet = (unsigned char*)malloc (oggpack_bytes (&opb));
-    memcpy (op->packet, opb.buffer, oggpack_bytes (&opb));
+    bytes = oggpack_bytes (&opb);
+    op->bytes = MAX (bytes, padded_size);
+    op->packet = (unsigned char*)malloc (op->bytes);
+    memcpy (op->packet, opb.buffer, bytes);
+    memset (op->packet + bytes, 0, op->bytes - bytes);
 
-    op->bytes = oggpack_bytes (&opb);
     op->b_o_s = 0;
     op->e_o_s = 0;
     op->granulepos = 0;
@@ -236,7 +264,7 @@ _commentheader_out (EtOggState *state,
     }
 
     oggpack_writeclear (&opb);
-    return 0;
+    return bytes;
 }
 
 static gint64
@@ -497,6 +525,7 @@ vcedit_open (EtOggState *state,
     char *buffer;
     gssize bytes;
     guint i;
+    int sync_result;
     guint chunks = 0;
     guint headerpackets = 0;
     oggpack_buffer opb;
@@ -517,7 +546,9 @@ vcedit_open (EtOggState *state,
         return FALSE;
     }
 
+    state->file = (GFile*)g_object_ref (file);
     state->in = istream;
+    state->inplace = TRUE;
     state->oy = g_slice_new (ogg_sync_state);
     ogg_sync_init (state->oy);
 
@@ -533,8 +564,11 @@ vcedit_open (EtOggState *state,
 
         ogg_sync_wrote(state->oy, bytes);
 
-        if(ogg_sync_pageout(state->oy, &og) == 1)
+        sync_result = ogg_sync_pageout (state->oy, &og);
+        if (sync_result == 1)
             break;
+        if (sync_result < 0) /* Skipped leading garbage */
+            state->inplace = FALSE;
 
         if(chunks++ >= 10) /* Bail if we don't find data in the first 40 kB */
         {
@@ -549,6 +583,10 @@ vcedit_open (EtOggState *state,
     }
 
     state->serial = ogg_page_serialno(&og);
+    state->headerlen = og.header_len + og.body_len;
+    state->headerpages = 1;
+    if (ogg_page_pageno (&og) != 0)
+        state->inplace = FALSE;
 
     state->os = g_slice_new (ogg_stream_state);
     ogg_stream_init (state->os, state->serial);
@@ -669,9 +707,22 @@ vcedit_open (EtOggState *state,
             {
                 break; /* Too little data so far */
             }
+            else if (result < 0)
+            {
+                /* Skipped corrupt data */
+                state->inplace = FALSE;
+            }
             else if (result == 1)
             {
-                ogg_stream_pagein (state->os, &og);
+                /* Only a contiguous sequence of header pages can be
+                 * overwritten in place by vcedit_write(). */
+                if (ogg_stream_pagein (state->os, &og) < 0
+                    || ogg_page_pageno (&og) != (long)state->headerpages)
+                {
+                    state->inplace = FALSE;
+                }
+                state->headerlen += og.header_len + og.body_len;
+                state->headerpages++;
 
                 while (i < headerpackets)
                 {
@@ -687,6 +738,10 @@ vcedit_open (EtOggState *state,
                                      "Corrupt secondary header");
                         goto err;
                     }
+                    if (i == 1)
+                    {
+                        state->commentlen = header->bytes;
+                    }
                     switch (state->oggtype)
                     {
                         case ET_OGG_KIND_VORBIS:
@@ -793,6 +848,14 @@ vcedit_open (EtOggState *state,
     /* Copy the vendor tag */
     state->vendor = g_strdup (state->vc->vendor);
 
+    /* The header pages must not contain anything else than the header
+     * packets, neither a further packet nor the start of one. */
+    if (ogg_stream_packetpeek (state->os, NULL) != 0
+        || (og.header[26] > 0 && og.header[27 + og.header[26] - 1] == 255))
+    {
+        state->inplace = FALSE;
+    }
+
     /* Headers are done! */
     g_assert (error == NULL || *error == NULL);
 
@@ -804,6 +867,197 @@ err:
     return FALSE;
 }
 
+/*
+ * _write_page:
+ * @ostream: (in): the stream to write to
+ * @page: (in): the page to write
+ * @error: (out) (allow-none): return location for a #GError, or %NULL
+ *
+ * Writes header and body of @page to @ostream.
+ *
+ * Returns: %TRUE on success, or %FALSE on error with @error filled in
+ */
+static gboolean
+_write_page (GOutputStream *ostream,
+             const ogg_page *page,
+             GError **error)
+{
+    gsize bytes_written;
+
+    if (!g_output_stream_write_all (ostream, page->header, page->header_len,
+                                    &bytes_written, NULL, error))
+    {
+        g_debug ("Only %" G_GSIZE_FORMAT " bytes out of %ld bytes of data "
+                 "were written", bytes_written, page->header_len);
+        g_assert (error == NULL || *error != NULL);
+        return FALSE;
+    }
+
+    if (!g_output_stream_write_all (ostream, page->body, page->body_len,
+                                    &bytes_written, NULL, error))
+    {
+        g_debug ("Only %" G_GSIZE_FORMAT " bytes out of %ld bytes of data "
+                 "were written", bytes_written, page->body_len);
+        g_assert (error == NULL || *error != NULL);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * _header_packets_in:
+ * @state: (in): the reader state from vcedit_open()
+ * @streamout: (in): the output stream state
+ * @header_comments: (in): the new comment header packet
+ *
+ * Submits the header packets of the logical stream to @streamout.
+ */
+static void
+_header_packets_in (EtOggState *state,
+                    ogg_stream_state *streamout,
+                    ogg_packet *header_comments)
+{
+    ogg_packet header_main;
+    ogg_packet header_codebooks;
+
+    header_main.bytes = state->mainlen;
+    header_main.packet = state->mainbuf;
+    header_main.b_o_s = 1;
+    header_main.e_o_s = 0;
+    header_main.granulepos = 0;
+
+    ogg_stream_packetin (streamout, &header_main);
+    ogg_stream_packetin (streamout, header_comments);
+
+    if (state->oggtype == ET_OGG_KIND_VORBIS)
+    {
+        header_codebooks.bytes = state->booklen;
+        header_codebooks.packet = state->bookbuf;
+        header_codebooks.b_o_s = 0;
+        header_codebooks.e_o_s = 0;
+        header_codebooks.granulepos = 0;
+
+        ogg_stream_packetin (streamout, &header_codebooks);
+    }
+}
+
+/*
+ * _close_input:
+ * @state: (in): the reader state from vcedit_open()
+ *
+ * At least on Windows, writing to a file with an open-for-reading stream
+ * fails, so close the input stream before the file is modified.
+ */
+static void
+_close_input (EtOggState *state)
+{
+    GError *error = NULL;
+
+    if (!g_input_stream_close (G_INPUT_STREAM (state->in), NULL, &error))
+    {
+        /* Ignore the _close() failure, and try the write anyway. */
+        g_warning ("Error closing Ogg file for reading: %s", error->message);
+        g_error_free (error);
+    }
+}
+
+/*
+ * _write_in_place:
+ * @state: (in): the reader state from vcedit_open()
+ * @file: (in): the file being read with @state
+ * @error: (out) (allow-none): return location for a #GError, or %NULL
+ *
+ * Overwrites the header pages of @file if the new header packets, including
+ * the padding of the comment packet, result in exactly the same page layout
+ * as the header pages found by vcedit_open(). The audio pages, and therefore
+ * the page sequence numbers and checksums, are not affected in this case.
+ *
+ * Returns: %TRUE if the header has been rewritten or an error occurred, in
+ *          which case @error is filled in, or %FALSE if the header does not
+ *          fit and the file has to be rewritten entirely
+ */
+static gboolean
+_write_in_place (EtOggState *state,
+                 GFile *file,
+                 GError **error)
+{
+    ogg_stream_state streamout;
+    ogg_packet header_comments;
+    ogg_page ogout;
+    GByteArray *pages;
+    guint count = 0;
+    GFileIOStream *iostream;
+    gsize bytes_written;
+    glong length;
+
+    if (!state->inplace || !g_file_equal (file, state->file))
+    {
+        return FALSE;
+    }
+
+    length = _commentheader_out (state, &header_comments, state->commentlen);
+
+    if (length > state->commentlen
+        || state->commentlen - length > MAX_PADDING)
+    {
+        /* The new comments do not fit, or so much space would be wasted
+         * that it is worth to shrink the file. */
+        ogg_packet_clear (&header_comments);
+        return FALSE;
+    }
+
+    ogg_stream_init (&streamout, state->serial);
+    _header_packets_in (state, &streamout, &header_comments);
+
+    pages = g_byte_array_sized_new (state->headerlen);
+
+    while (ogg_stream_flush (&streamout, &ogout))
+    {
+        g_byte_array_append (pages, ogout.header, ogout.header_len);
+        g_byte_array_append (pages, ogout.body, ogout.body_len);
+        count++;
+    }
+
+    ogg_stream_clear (&streamout);
+    ogg_packet_clear (&header_comments);
+
+    if (count != state->headerpages || pages->len != state->headerlen)
+    {
+        g_byte_array_unref (pages);
+        return FALSE;
+    }
+
+    _close_input (state);
+
+    iostream = g_file_open_readwrite (file, NULL, error);
+
+    if (!iostream)
+    {
+        g_byte_array_unref (pages);
+        g_assert (error == NULL || *error != NULL);
+        return TRUE;
+    }
+
+    if (g_output_stream_write_all (g_io_stream_get_output_stream (G_IO_STREAM (iostream)),
+                                   pages->data, pages->len,
+                                   &bytes_written, NULL, error))
+    {
+        g_io_stream_close (G_IO_STREAM (iostream), NULL, error);
+    }
+    else
+    {
+        g_debug ("Only %" G_GSIZE_FORMAT " bytes out of %u bytes of header "
+                 "data were written", bytes_written, pages->len);
+        g_io_stream_close (G_IO_STREAM (iostream), NULL, NULL);
+    }
+
+    g_object_unref (iostream);
+    g_byte_array_unref (pages);
+
+    return TRUE;
+}
+
 /* vcedit_write:
  * @state: (in): the reader state from vcedit_open() with the header comments
  *   modified as required
@@ -815,6 +1069,12 @@ err:
  * are taken from data in @state and the subsequent (audio) packets are read
  * read using the reader state @state.
  *
+ * If @file is the file being read and the new header pages exactly replace
+ * the old ones, only the header pages are overwritten. Otherwise the
+ * bitstream is streamed to a temporary file next to @file, which atomically
+ * replaces @file when complete. Either way memory usage does not depend on
+ * the size of the audio data.
+ *
  * It is assumed that reading using the reader state @state gives the packets
  * following the header packets.  Therefore, the reader state must be created
  * using vcedit_open().  After writing, @state cannot be used to write again
@@ -829,9 +1089,7 @@ vcedit_write (EtOggState *state,
               GError **error)
 {
     ogg_stream_state streamout;
-    ogg_packet header_main;
     ogg_packet header_comments;
-    ogg_packet header_codebooks;
 
     ogg_page ogout, ogin;
     ogg_packet op;
@@ -839,79 +1097,60 @@ vcedit_write (EtOggState *state,
     gchar *buffer;
     glong bytes;
     GError *read_error = NULL;
+    GError *inplace_error = NULL;
     gboolean needflush = FALSE;
     gboolean needout = FALSE;
+    GFileOutputStream *fstream;
     GOutputStream *ostream;
-    gchar *buf;
-    gsize size;
-    GFileInfo *fileinfo;
+    GCancellable *cancellable;
     gboolean result;
 
     g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
-    fileinfo = g_file_input_stream_query_info (state->in,
-                                               G_FILE_ATTRIBUTE_STANDARD_SIZE,
-                                               NULL, error);
-    if (!fileinfo)
+    if (_write_in_place (state, file, &inplace_error))
+    {
+        vcedit_clear_internals (state);
+
+        if (inplace_error)
+        {
+            g_propagate_error (error, inplace_error);
+            return FALSE;
+        }
+
+        return TRUE;
+    }
+
+    /* Cancelling the close of the output stream discards the temporary file
+     * and leaves @file untouched. */
+    cancellable = g_cancellable_new ();
+    fstream = g_file_replace (file, NULL, FALSE, G_FILE_CREATE_NONE,
+                              cancellable, error);
+
+    if (!fstream)
     {
+        g_object_unref (cancellable);
         vcedit_clear_internals (state);
 
         g_assert (error == NULL || *error != NULL);
         return FALSE;
     }
 
-    size = (gsize)(g_file_info_get_size (fileinfo));
-    buf = (gchar*)g_malloc (size);
-    ostream = g_memory_output_stream_new (buf, size, g_realloc, g_free);
-    g_object_unref (fileinfo);
+    ostream = g_buffered_output_stream_new_sized (G_OUTPUT_STREAM (fstream),
+                                                  16 * CHUNKSIZE);
+    g_object_unref (fstream);
 
     state->eosin = FALSE;
     state->extrapage = FALSE;
 
-    header_main.bytes = state->mainlen;
-    header_main.packet = state->mainbuf;
-    header_main.b_o_s = 1;
-    header_main.e_o_s = 0;
-    header_main.granulepos = 0;
-
-    header_codebooks.bytes = state->booklen;
-    header_codebooks.packet = state->bookbuf;
-    header_codebooks.b_o_s = 0;
-    header_codebooks.e_o_s = 0;
-    header_codebooks.granulepos = 0;
-
     ogg_stream_init (&streamout, state->serial);
 
-    _commentheader_out (state, &header_comments);
-
-    ogg_stream_packetin (&streamout, &header_main);
-    ogg_stream_packetin (&streamout, &header_comments);
-
-    if (state->oggtype == ET_OGG_KIND_VORBIS)
-    {
-        ogg_stream_packetin (&streamout, &header_codebooks);
-    }
+    _commentheader_out (state, &header_comments, 0);
+    _header_packets_in (state, &streamout, &header_comments);
 
     while (ogg_stream_flush (&streamout, &ogout))
     {
-        gsize bytes_written;
-
-        if (!g_output_stream_write_all (ostream, ogout.header,
-                                        ogout.header_len, &bytes_written, NULL,
-                                        error))
-        {
-            g_debug ("Only %" G_GSIZE_FORMAT " bytes out of %ld bytes of data "
-                     "were written", bytes_written, ogout.header_len);
-            g_assert (error == NULL || *error != NULL);
-            goto err;
-        }
-
-        if (!g_output_stream_write_all (ostream, ogout.body, ogout.body_len,
-                                        &bytes_written, NULL, error))
+        if (!_write_page (ostream, &ogout, error))
         {
-            g_debug ("Only %" G_GSIZE_FORMAT " bytes out of %ld bytes of data "
-                     "were written", bytes_written, ogout.body_len);
-            g_assert (error == NULL || *error != NULL);
             goto err;
         }
     }
@@ -923,25 +1162,8 @@ vcedit_write (EtOggState *state,
         {
             if (ogg_stream_flush (&streamout, &ogout))
             {
-                gsize bytes_written;
-
-                if (!g_output_stream_write_all (ostream, ogout.header,
-                                                ogout.header_len, &bytes_written,
-                                                NULL, error))
+                if (!_write_page (ostream, &ogout, error))
                 {
-                    g_debug ("Only %" G_GSIZE_FORMAT " bytes out of %ld bytes of "
-                             "data were written", bytes_written, ogout.header_len);
-                    g_assert (error == NULL || *error != NULL);
-                    goto err;
-                }
-
-                if (!g_output_stream_write_all (ostream, ogout.body,
-                                                ogout.body_len, &bytes_written,
-                                                NULL, error))
-                {
-                    g_debug ("Only %" G_GSIZE_FORMAT " bytes out of %ld bytes of "
-                             "data were written", bytes_written, ogout.body_len);
-                    g_assert (error == NULL || *error != NULL);
                     goto err;
                 }
             }
@@ -950,27 +1172,8 @@ vcedit_write (EtOggState *state,
         {
             if(ogg_stream_pageout (&streamout, &ogout))
             {
-                gsize bytes_written;
-
-                if (!g_output_stream_write_all (ostream, ogout.header,
-                                                ogout.header_len,
-                                                &bytes_written, NULL, error))
+                if (!_write_page (ostream, &ogout, error))
                 {
-                    g_debug ("Only %" G_GSIZE_FORMAT " bytes out of %ld bytes "
-                             "of data were written", bytes_written,
-                             ogout.header_len);
-                    g_assert (error == NULL || *error != NULL);
-                    goto err;
-                }
-
-                if (!g_output_stream_write_all (ostream, ogout.body,
-                                                ogout.body_len, &bytes_written,
-                                                NULL, error))
-                {
-                    g_debug ("Only %" G_GSIZE_FORMAT " bytes out of %ld bytes "
-                             "of data were written", bytes_written,
-                             ogout.body_len);
-                    g_assert (error == NULL || *error != NULL);
                     goto err;
                 }
             }
@@ -1049,48 +1252,16 @@ vcedit_write (EtOggState *state,
 
     while (ogg_stream_flush (&streamout, &ogout))
     {
-        gsize bytes_written;
-
-        if (!g_output_stream_write_all (ostream, ogout.header,
-                                        ogout.header_len, &bytes_written, NULL,
-                                        error))
-        {
-            g_debug ("Only %" G_GSIZE_FORMAT " bytes out of %ld bytes of data "
-                     "were written", bytes_written, ogout.header_len);
-            g_assert (error == NULL || *error != NULL);
-            goto err;
-        }
-
-        if (!g_output_stream_write_all (ostream, ogout.body, ogout.body_len,
-                                        &bytes_written, NULL, error))
+        if (!_write_page (ostream, &ogout, error))
         {
-            g_debug ("Only %" G_GSIZE_FORMAT " bytes out of %ld bytes of data "
-                     "were written", bytes_written, ogout.body_len);
-            g_assert (error == NULL || *error != NULL);
             goto err;
         }
     }
 
     if (state->extrapage)
     {
-        gsize bytes_written;
-
-        if (!g_output_stream_write_all (ostream, ogout.header,
-                                        ogout.header_len, &bytes_written, NULL,
-                                        error))
-        {
-            g_debug ("Only %" G_GSIZE_FORMAT " bytes out of %ld bytes of data "
-                     "were written", bytes_written, ogout.header_len);
-            g_assert (error == NULL || *error != NULL);
-            goto err;
-        }
-
-        if (!g_output_stream_write_all (ostream, ogout.body, ogout.body_len,
-                                        &bytes_written, NULL, error))
+        if (!_write_page (ostream, &ogout, error))
         {
-            g_debug ("Only %" G_GSIZE_FORMAT " bytes out of %ld bytes of data "
-                     "were written", bytes_written, ogout.body_len);
-            g_assert (error == NULL || *error != NULL);
             goto err;
         }
     }
@@ -1128,23 +1299,10 @@ vcedit_write (EtOggState *state,
             }
             else
             {
-                gsize bytes_written;
-
                 /* Don't bother going through the rest, we can just
                  * write the page out now */
-                if (!g_output_stream_write_all (ostream, ogout.header,
-                                                ogout.header_len,
-                                                &bytes_written, NULL, error))
+                if (!_write_page (ostream, &ogout, error))
                 {
-                    g_assert (error == NULL || *error != NULL);
-                    goto err;
-                }
-
-                if (!g_output_stream_write_all (ostream, ogout.body,
-                                                ogout.body_len, &bytes_written,
-                                                NULL, error))
-                {
-                    g_assert (error == NULL || *error != NULL);
                     goto err;
                 }
             }
@@ -1172,50 +1330,35 @@ vcedit_write (EtOggState *state,
 
     g_assert (error == NULL || *error == NULL);
 
-    if (!g_output_stream_close (ostream, NULL, error))
-    {
-        g_assert (error == NULL || *error != NULL);
-        goto err;
-    }
+    _close_input (state);
 
-    g_assert (error == NULL || *error == NULL);
-
-    buf = (gchar*)g_memory_output_stream_steal_data (G_MEMORY_OUTPUT_STREAM (ostream));
-    size = g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (ostream));
-
-    /* At least on Windows, writing to a file with an open-for-reading stream
-     * fails, so close the input stream before writing to the file. */
-    if (!g_input_stream_close (G_INPUT_STREAM (state->in), NULL, error))
-    {
-        /* Ignore the _close() failure, and try the write anyway. */
-        g_warning ("Error closing Ogg file for reading: %s",
-                   (*error)->message);
-        g_clear_error (error);
-    }
-
-    /* Write the in-memory data to file. */
-    if (!g_file_replace_contents (file, buf, size, NULL, FALSE,
-                                  G_FILE_CREATE_NONE, NULL, NULL, error))
+    /* Closing the stream moves the temporary file to @file. */
+    if (!g_output_stream_close (ostream, NULL, error))
     {
-        g_free (buf);
         g_assert (error == NULL || *error != NULL);
         goto err;
     }
 
     g_assert (error == NULL || *error == NULL);
 
-    g_free (buf);
-
     result = TRUE;
     goto cleanup;
 
 err:
     result = FALSE;
 
+    if (!g_output_stream_is_closed (ostream))
+    {
+        /* Discard the temporary file. */
+        g_cancellable_cancel (cancellable);
+        g_output_stream_close (ostream, cancellable, NULL);
+    }
+
 cleanup:
     ogg_stream_clear (&streamout);
     ogg_packet_clear (&header_comments);
     g_object_unref (ostream);
+    g_object_unref (cancellable);
     vcedit_clear_internals (state);
 
     return result;
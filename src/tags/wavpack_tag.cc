@@ -48,6 +48,7 @@ const struct Wavpack_Description : ET_File_Description
 		read_file = wavpack_read_file;
 		write_file_tag = wavpack_tag_write_file_tag;
 		display_file_info_to_ui = et_wavpack_header_display_file_info_to_ui;
+		sniff = [](const guchar* head, gsize len) { return len >= 4 && memcmp(head, "wvpk", 4) == 0; };
 	}
 }
 WV_Description;
@@ -76,6 +76,8 @@ public:
 	~UndoList() {	base::foreach(&delete_item); }
 
 	void add(T* item, unsigned undo_key) { base::add(item, undo_key, &delete_item); }
+	/// Discard all versions and start over with \a item as saved state.
+	void reset(T* item) { base::foreach(&delete_item); base::Cur = base::New = item; }
 };
 
 #endif
@@ -215,39 +215,59 @@ int xString::compare(const xString& r) const
 // Repository with deduplicated xStringD::storage instances.
 // To avoid a C++20 dependency for find operations instead of storage a pointer to the character data is stored.
 // A downcast to the storage instance is always valid. Each intance in this collection is one reference count.
-static unordered_set<const char*, xString::hasher, xString::equal> Instances;
+// The repository is split into shards by the upper bits of the hash to reduce lock contention
+// when many threads deduplicate strings concurrently.
+static constexpr unsigned InstancesShardBits = 6;
 
-static mutex InstancesMutex;
+static struct alignas(64) InstancesShard
+{	mutex Mutex;
+	unordered_set<const char*, xString::hasher, xString::equal> Set;
+} Instances[1U << InstancesShardBits];
+
+static inline InstancesShard& GetShard(const char* str)
+{	return Instances[xString::hasher()(str) >> (numeric_limits<unsigned>::digits - InstancesShardBits)];
+}
 
 xString::storage* xStringD::Factory(const char* str, gssize len)
 {	storage* ptr;
-	unique_lock<mutex> lock(InstancesMutex, defer_lock_t());
-	unordered_set<const char*, hasher, equal>::iterator p;
 	if (len > 0 && str[len])
-	{	// If str is not null terminated Instances.find(str) cannot work (would require C++20).
+	{	// If str is not null terminated Set.find(str) cannot work (would require C++20).
+		if (len < 256)
+		{	// Short slices, e.g. tag values in a comment packet, are terminated on the stack
+			// to avoid a temporary allocation when the string is already known.
+			char tmp[len + 1];
+			memcpy(tmp, str, len);
+			tmp[len] = 0;
+			return Factory(tmp, len);
+		}
 		// => Create null terminated string first.
 		ptr = xString::Factory(str, len);
-		lock.lock();
-		p = Instances.find(ptr->C);
-		if (p != Instances.end())
-		{	delete ptr;
-		match:
-			ptr = (storage*)(data*)*p;
-			++ptr->RefCount;
+		InstancesShard& shard = GetShard(ptr->C);
+		lock_guard<mutex> lock(shard.Mutex);
+		auto p = shard.Set.insert(ptr->C);
+		if (p.second)
+		{	// add previously unknown string
+			ptr->RefCount += DedupRefCount;
 			return ptr;
 		}
-	}
-	else
-	{	lock.lock();
-		p = Instances.find(str);
-		if (p != Instances.end())
-			goto match;
-		ptr = xString::Factory(str, len);
+		delete ptr;
+		ptr = (storage*)(data*)*p.first;
+		++ptr->RefCount;
+		return ptr;
 	}
 
+	InstancesShard& shard = GetShard(str);
+	lock_guard<mutex> lock(shard.Mutex);
+	auto p = shard.Set.find(str);
+	if (p != shard.Set.end())
+	{	ptr = (storage*)(data*)*p;
+		++ptr->RefCount;
+		return ptr;
+	}
 	// add previously unknown string
+	ptr = xString::Factory(str, len);
 	ptr->RefCount += DedupRefCount;
-		Instances.insert(p, ptr->C);
+	shard.Set.insert(p, ptr->C);
 	return ptr;
 }
 
@@ -289,8 +309,9 @@ const xStringD::data* xStringD::Init(const data* ptr)
 		return ptr;
 
 	if (*ptr->C && (static_cast<const storage&>(*ptr).RefCount & DedupRefCount) == 0) // empty or already deduplicated?
-	{	lock_guard<mutex> lock(InstancesMutex);
-		auto p = Instances.insert(ptr->C);
+	{	InstancesShard& shard = GetShard(ptr->C);
+		lock_guard<mutex> lock(shard.Mutex);
+		auto p = shard.Set.insert(ptr->C);
 		if (p.second)
 		{	((const storage*)ptr)->RefCount += DedupRefCount + 1;
 			return ptr;
@@ -320,14 +341,17 @@ const xStringD::data* xStringD::Init(const data* ptr, GNormalizeMode mode)
 
 void xStringD::garbage_collector()
 {
-	lock_guard<mutex> lock(InstancesMutex);
-	auto p = Instances.begin();
-	while (p != Instances.end())
-	{	auto ptr = (storage*)(data*)*p;
-		if (ptr->RefCount == DedupRefCount)
-		{	p = Instances.erase(p);
-			delete ptr;
-		} else ++p;
+	// One shard at a time, so other threads are only blocked when they hit the current shard.
+	for (InstancesShard& shard : Instances)
+	{	lock_guard<mutex> lock(shard.Mutex);
+		auto p = shard.Set.begin();
+		while (p != shard.Set.end())
+		{	auto ptr = (storage*)(data*)*p;
+			if (ptr->RefCount == DedupRefCount)
+			{	p = shard.Set.erase(p);
+				delete ptr;
+			} else ++p;
+		}
 	}
 }
 
@@ -0,0 +1,955 @@
+/* EasyTAG - tag editor for audio files
+ * Copyright (C) 2026 Marcel Müller
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/* Throughput benchmark on a synthetic music library.
+ *
+ * The library is generated from scratch with a fixed seed, so runs with the same
+ * options are comparable. Audio data is crafted directly (MPEG layer III silence,
+ * verbatim FLAC frames, Opus CELT silence packets, Vorbis packets with unused floor,
+ * AAC raw data blocks without spectral data), tags and cover art are written
+ * by EasyTAG itself.
+ *
+ * Run it with "make bench", BENCH_OPTIONS are passed to the program.
+ */
+
+#include "config.h"
+
+#include "application.h"
+#include "directory_scanner.h"
+#include "file.h"
+#include "file_renderer.h"
+#include "file_tag.h"
+#include "mask.h"
+#include "picture.h"
+#include "replaygain.h"
+#include "setting.h"
+#include "xstring.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#if defined(ENABLE_ACOUSTID) || defined(ENABLE_REPLAYGAIN)
+extern "C" {
+#include <libavutil/log.h>
+}
+#endif
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <memory>
+#include <new>
+#include <atomic>
+#include <cmath>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+using namespace std;
+
+
+static gint Files = 200;
+static gint Seconds = 10;
+static gint Seed = 4711;
+static gchar* Directory = nullptr;
+static gchar* Output = nullptr;
+static gboolean Keep = FALSE;
+
+static const GOptionEntry Options[] =
+{	{ "files", 'n', 0, G_OPTION_ARG_INT, &Files, "Number of files to generate", "N" },
+	{ "seconds", 's', 0, G_OPTION_ARG_INT, &Seconds, "Play time of each file", "S" },
+	{ "seed", 0, 0, G_OPTION_ARG_INT, &Seed, "Seed of the library generator", "SEED" },
+	{ "directory", 'd', 0, G_OPTION_ARG_FILENAME, &Directory, "Create the library in this directory instead of a temporary one", "DIR" },
+	{ "output", 'o', 0, G_OPTION_ARG_FILENAME, &Output, "Write the JSON results to this file instead of stdout", "FILE" },
+	{ "keep", 'k', 0, G_OPTION_ARG_NONE, &Keep, "Do not delete the library afterwards", nullptr },
+	{ nullptr }
+};
+
+
+/// Number of heap allocations so far.
+/// @remarks With glibc all allocations are counted including those of g_malloc and GObjects,
+/// so the figures of different versions are comparable. Otherwise only C++ allocations are counted.
+static atomic<guint64> Allocations(0);
+
+#ifdef __GLIBC__
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* p, size_t size);
+
+void* malloc(size_t size)
+{	++Allocations;
+	return __libc_malloc(size);
+}
+void* calloc(size_t count, size_t size)
+{	++Allocations;
+	return __libc_calloc(count, size);
+}
+void* realloc(void* p, size_t size)
+{	++Allocations;
+	return __libc_realloc(p, size);
+}
+}
+#else
+void* operator new(size_t size)
+{	++Allocations;
+	if (void* p = malloc(size ? size : 1))
+		return p;
+	throw bad_alloc();
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+#endif
+
+/// Measurement of one benchmark.
+struct Result
+{	const char* Name;
+	unsigned Count;   ///< Number of processed files
+	guint64 Bytes;    ///< Number of processed bytes
+	gint64 Time;      ///< Elapsed time in µs
+	guint64 Allocs;   ///< Number of heap allocations
+};
+
+static vector<Result> Results;
+
+/// Statistics of one worker of a directory scan for tuning.
+struct WorkerStats
+{	const char* Name; ///< Name of the scan step
+	unsigned Worker;
+	unsigned Executed; ///< Number of jobs executed
+	unsigned Steals;   ///< Number of jobs stolen from other workers
+	size_t MaxDepth;   ///< Maximum number of jobs in the worker's queue
+};
+
+static vector<WorkerStats> ScanStats;
+/// Allocations at the last call to \ref start_timer.
+static guint64 AllocationsAtStart;
+
+/// Start the measurement of a step.
+/// @return Start time for \ref report.
+static gint64 start_timer()
+{	AllocationsAtStart = Allocations;
+	return g_get_monotonic_time();
+}
+
+static void report(const char* name, unsigned count, guint64 bytes, gint64 start)
+{	Result r = { name, count, bytes, g_get_monotonic_time() - start, Allocations - AllocationsAtStart };
+	g_printerr("%-12s %6u files %9.3f s %9.1f µs/file %9.3f ms/MB %9.1f allocs/file\n", name, count, r.Time / 1E6,
+		count ? (double)r.Time / count : 0., bytes ? r.Time / 1E3 / (bytes / 1048576.) : 0.,
+		count ? (double)r.Allocs / count : 0.);
+	Results.push_back(r);
+}
+
+static void write_results(FILE* out)
+{	fprintf(out, "{\n  \"package\": \"%s\",\n  \"version\": \"%s\",\n  \"files\": %i,\n  \"seconds\": %i,\n  \"seed\": %i,\n  \"results\": [",
+		PACKAGE_NAME, PACKAGE_VERSION, Files, Seconds, Seed);
+	const char* sep = "\n";
+	for (const Result& r : Results)
+	{	fprintf(out, "%s    { \"name\": \"%s\", \"count\": %u, \"bytes\": %" G_GUINT64_FORMAT ", \"seconds\": %.6f, \"us_per_file\": %.3f, \"ms_per_mb\": %.3f, \"allocs_per_file\": %.1f }",
+			sep, r.Name, r.Count, r.Bytes, r.Time / 1E6,
+			r.Count ? (double)r.Time / r.Count : 0., r.Bytes ? r.Time / 1E3 / (r.Bytes / 1048576.) : 0.,
+			r.Count ? (double)r.Allocs / r.Count : 0.);
+		sep = ",\n";
+	}
+	fputs("\n  ],\n  \"scan_workers\": [", out);
+	sep = "\n";
+	for (const WorkerStats& w : ScanStats)
+	{	fprintf(out, "%s    { \"name\": \"%s\", \"worker\": %u, \"jobs\": %u, \"steals\": %u, \"max_queue_depth\": %zu }",
+			sep, w.Name, w.Worker, w.Executed, w.Steals, w.MaxDepth);
+		sep = ",\n";
+	}
+	fputs("\n  ]\n}\n", out);
+}
+
+
+/*
+ * Audio data generators
+ */
+
+/// Big endian bit writer
+class BitWriter
+{	string& Out;
+	guint64 Acc = 0;
+	unsigned Bits = 0;
+public:
+	BitWriter(string& out) : Out(out) {}
+	void put(guint64 value, unsigned bits)
+	{	while (bits)
+		{	unsigned n = min(bits, 8U);
+			bits -= n;
+			Acc = Acc << n | ((value >> bits) & ((1U << n) - 1));
+			if ((Bits += n) >= 8)
+				Out += (char)(Acc >> (Bits -= 8));
+		}
+	}
+};
+
+/// Little endian bit writer as used by Vorbis
+class BitWriterLE
+{	string& Out;
+	unsigned Bits = 0;
+public:
+	BitWriterLE(string& out) : Out(out) {}
+	void put(guint32 value, unsigned bits)
+	{	for (unsigned i = 0; i < bits; ++i, ++Bits)
+		{	if (!(Bits & 7))
+				Out += '\0';
+			if (value >> i & 1)
+				Out.back() |= (char)(1 << (Bits & 7));
+		}
+	}
+};
+
+static void put_le32(string& data, guint32 value)
+{	for (int i = 0; i < 4; ++i)
+		data += (char)(value >> (8 * i));
+}
+
+static void put_be(string& data, guint32 value, int bytes)
+{	while (bytes--)
+		data += (char)(value >> (8 * bytes));
+}
+
+static guint8 crc8(const string& data, size_t start)
+{	guint8 crc = 0;
+	for (size_t i = start; i < data.size(); ++i)
+	{	crc ^= (guint8)data[i];
+		for (int b = 0; b < 8; ++b)
+			crc = crc & 0x80 ? crc << 1 ^ 0x07 : crc << 1;
+	}
+	return crc;
+}
+
+static guint16 crc16(const string& data, size_t start)
+{	guint16 crc = 0;
+	for (size_t i = start; i < data.size(); ++i)
+	{	crc ^= (guint16)((guint8)data[i] << 8);
+		for (int b = 0; b < 8; ++b)
+			crc = crc & 0x8000 ? crc << 1 ^ 0x8005 : crc << 1;
+	}
+	return crc;
+}
+
+static guint32 crc32_ogg(const char* data, size_t len)
+{	static guint32 table[256];
+	if (!table[1])
+		for (guint32 i = 0; i < 256; ++i)
+		{	guint32 r = i << 24;
+			for (int b = 0; b < 8; ++b)
+				r = r & 0x80000000U ? r << 1 ^ 0x04C11DB7U : r << 1;
+			table[i] = r;
+		}
+	guint32 crc = 0;
+	while (len--)
+		crc = crc << 8 ^ table[(crc >> 24) ^ (guint8)*data++];
+	return crc;
+}
+
+/// MPEG-1 layer III, 128 kbit/s, 44.1 kHz, stereo frames with zero side info, i.e. digital silence.
+static string make_mp3(GRand*)
+{	static const char header[4] = { '\xFF', '\xFB', '\x90', '\x04' };
+	const unsigned frame_len = 144 * 128000 / 44100;
+	unsigned frames = Seconds * 44100 / 1152;
+	string data;
+	data.reserve(frames * frame_len);
+	while (frames--)
+	{	data.append(header, sizeof header);
+		data.append(frame_len - sizeof header, '\0');
+	}
+	return data;
+}
+
+/// 44.1 kHz, 16 bit stereo FLAC with verbatim subframes of a low level tone with noise.
+static string make_flac(GRand* rand)
+{	const unsigned block = 4096;
+	const guint64 total = (guint64)Seconds * 44100;
+
+	// one block of sample data, reused for all frames
+	gint16 samples[2][block];
+	double freq = g_rand_double_range(rand, 100, 1000) / 44100 * 2 * M_PI;
+	for (unsigned i = 0; i < block; ++i)
+		for (int ch = 0; ch < 2; ++ch)
+			samples[ch][i] = (gint16)(3000 * sin(i * freq * (ch + 1)) + g_rand_int_range(rand, -500, 500));
+
+	string data("fLaC\x80\0\0\x22", 8); // last metadata block: STREAMINFO, 34 bytes
+	BitWriter bw(data);
+	bw.put(block, 16);
+	bw.put(block, 16);
+	bw.put(0, 24); // min frame size unknown
+	bw.put(0, 24); // max frame size unknown
+	bw.put(44100, 20);
+	bw.put(2 - 1, 3);
+	bw.put(16 - 1, 5);
+	bw.put(total, 36);
+	data.append(16, '\0'); // no MD5
+
+	guint32 frame = 0;
+	for (guint64 pos = 0; pos < total; pos += block, ++frame)
+	{	size_t start = data.size();
+		unsigned n = (unsigned)min<guint64>(block, total - pos);
+		data += '\xFF';
+		data += '\xF8';
+		data += (char)((n == block ? 0xC0 : 0x70) | 0x09); // block size, 44.1 kHz
+		data += '\x18'; // independent stereo, 16 bit
+		// frame number UTF-8 like coded
+		if (frame < 0x80)
+			data += (char)frame;
+		else
+		{	int bytes = frame < 0x800 ? 2 : frame < 0x10000 ? 3 : frame < 0x200000 ? 4 : frame < 0x4000000 ? 5 : 6;
+			data += (char)((0xFF00 >> bytes) | (frame >> (6 * (bytes - 1))));
+			for (int i = bytes - 1; i--; )
+				data += (char)(0x80 | ((frame >> (6 * i)) & 0x3F));
+		}
+		if (n != block)
+		{	data += (char)((n - 1) >> 8);
+			data += (char)(n - 1);
+		}
+		data += (char)crc8(data, start);
+		for (int ch = 0; ch < 2; ++ch)
+		{	data += '\x02'; // verbatim subframe
+			for (unsigned i = 0; i < n; ++i)
+			{	data += (char)(samples[ch][i] >> 8);
+				data += (char)samples[ch][i];
+			}
+		}
+		guint16 crc = crc16(data, start);
+		data += (char)(crc >> 8);
+		data += (char)crc;
+	}
+	return data;
+}
+
+/// Write one Ogg page.
+static void ogg_page(string& data, guint32 serial, guint32 seq, guint64 granule, guint8 flags, const vector<string>& packets)
+{	size_t start = data.size();
+	string lacing;
+	for (const string& p : packets)
+	{	lacing.append(p.size() / 255, '\xFF');
+		lacing += (char)(p.size() % 255);
+	}
+	g_assert(lacing.size() <= 255);
+	data.append("OggS\0", 5);
+	data += (char)flags;
+	for (int i = 0; i < 8; ++i)
+		data += (char)(granule >> (8 * i));
+	for (int i = 0; i < 4; ++i)
+		data += (char)(serial >> (8 * i));
+	for (int i = 0; i < 4; ++i)
+		data += (char)(seq >> (8 * i));
+	size_t crcpos = data.size();
+	data.append(4, '\0');
+	data += (char)lacing.size();
+	data += lacing;
+	for (const string& p : packets)
+		data += p;
+	guint32 crc = crc32_ogg(data.data() + start, data.size() - start);
+	for (int i = 0; i < 4; ++i)
+		data[crcpos + i] = (char)(crc >> (8 * i));
+}
+
+/// Ogg Opus stream with 20 ms stereo CELT silence packets.
+static string make_opus(GRand* rand)
+{	const guint32 serial = g_rand_int(rand);
+	const unsigned preskip = 312;
+	string data;
+	ogg_page(data, serial, 0, 0, 0x02, { string("OpusHead\x01\x02\x38\x01\x80\xBB\0\0\0\0\0", 19) });
+	ogg_page(data, serial, 1, 0, 0, { string("OpusTags\x05\0\0\0bench\0\0\0\0", 21) });
+
+	const string packet("\xFC\xFF\xFE", 3);
+	unsigned packets = Seconds * 50;
+	guint32 seq = 2;
+	guint64 granule = preskip;
+	while (packets)
+	{	unsigned n = min(packets, 50U);
+		packets -= n;
+		granule += n * 960;
+		ogg_page(data, serial, seq++, granule, packets ? 0 : 0x04, vector<string>(n, packet));
+	}
+	return data;
+}
+
+/// Ogg Vorbis stream, 44.1 kHz mono, with a minimal setup header
+/// and short block audio packets with unused floor, i.e. digital silence.
+static string make_vorbis(GRand* rand)
+{	const guint32 serial = g_rand_int(rand);
+
+	string ident("\x01vorbis", 7);
+	put_le32(ident, 0); // version
+	ident += '\x01'; // channels
+	put_le32(ident, 44100);
+	put_le32(ident, 0); // max bitrate
+	put_le32(ident, 64000); // nominal bitrate
+	put_le32(ident, 0); // min bitrate
+	ident += '\xB8'; // block sizes 256 and 2048
+	ident += '\x01'; // framing
+
+	string comment("\x03vorbis", 7);
+	put_le32(comment, 5);
+	comment += "bench";
+	put_le32(comment, 0); // no comments
+	comment += '\x01'; // framing
+
+	string setup("\x05vorbis", 7);
+	BitWriterLE bw(setup);
+	bw.put(0, 8); // 1 codebook
+	bw.put(0x564342, 24);
+	bw.put(1, 16); // dimensions
+	bw.put(2, 24); // entries
+	bw.put(0, 1); // not ordered
+	bw.put(0, 1); // not sparse
+	bw.put(0, 5); // length 1
+	bw.put(0, 5); // length 1
+	bw.put(0, 4); // no lookup
+	bw.put(0, 6); // 1 time domain transform
+	bw.put(0, 16);
+	bw.put(0, 6); // 1 floor
+	bw.put(1, 16); // floor type 1
+	bw.put(0, 5); // no partitions
+	bw.put(0, 2); // multiplier 1
+	bw.put(7, 4); // range bits, i.e. 128 = short block size / 2
+	bw.put(0, 6); // 1 residue
+	bw.put(0, 16); // residue type 0
+	bw.put(0, 24); // begin
+	bw.put(0, 24); // end
+	bw.put(0, 24); // partition size 1
+	bw.put(0, 6); // 1 classification
+	bw.put(0, 8); // classbook
+	bw.put(0, 3); // no cascade
+	bw.put(0, 1);
+	bw.put(0, 6); // 1 mapping
+	bw.put(0, 16); // mapping type 0
+	bw.put(0, 1); // 1 submap
+	bw.put(0, 1); // no coupling
+	bw.put(0, 2); // reserved
+	bw.put(0, 8); // unused time config
+	bw.put(0, 8); // floor
+	bw.put(0, 8); // residue
+	bw.put(0, 6); // 1 mode
+	bw.put(0, 1); // short blocks only
+	bw.put(0, 16); // window type
+	bw.put(0, 16); // transform type
+	bw.put(0, 8); // mapping
+	bw.put(1, 1); // framing
+
+	string data;
+	ogg_page(data, serial, 0, 0, 0x02, { ident });
+	ogg_page(data, serial, 1, 0, 0, { comment, setup });
+
+	// Each packet after the first one adds half a short block.
+	const string packet(1, '\0'); // audio packet, mode 0, floor unused
+	unsigned packets = Seconds * 44100 / 128 + 1;
+	guint32 seq = 2;
+	guint64 granule = 0;
+	bool first = true;
+	while (packets)
+	{	unsigned n = min(packets, 255U);
+		packets -= n;
+		granule += (n - first) * 128;
+		first = false;
+		ogg_page(data, serial, seq++, granule, packets ? 0 : 0x04, vector<string>(n, packet));
+	}
+	return data;
+}
+
+/// ISO base media file format box.
+static string mp4_box(const char* type, const string& payload)
+{	string box;
+	put_be(box, 8 + payload.size(), 4);
+	box.append(type, 4);
+	return box + payload;
+}
+
+/// MPEG-4 audio file, AAC LC 44.1 kHz mono, with raw data blocks without spectral data, i.e. digital silence.
+static string make_mp4(GRand*)
+{	static const char frame[4] = { '\x01', '\x18', '\x20', '\x07' }; // SCE, global gain, no bands, END
+	const guint32 rate = 44100;
+	const guint32 frames = Seconds * rate / 1024;
+	const guint32 duration = frames * 1024;
+
+	string matrix;
+	for (guint32 v : { 0x10000U, 0U, 0U, 0U, 0x10000U, 0U, 0U, 0U, 0x40000000U })
+		put_be(matrix, v, 4);
+
+	string mvhd(4, '\0'); // version, flags
+	put_be(mvhd, 0, 4); // creation time
+	put_be(mvhd, 0, 4); // modification time
+	put_be(mvhd, rate, 4); // time scale
+	put_be(mvhd, duration, 4);
+	put_be(mvhd, 0x10000, 4); // rate
+	put_be(mvhd, 0x100, 2); // volume
+	mvhd.append(10, '\0');
+	mvhd += matrix;
+	mvhd.append(24, '\0');
+	put_be(mvhd, 2, 4); // next track ID
+
+	string tkhd("\0\0\0\x07", 4); // enabled, in movie, in preview
+	put_be(tkhd, 0, 4); // creation time
+	put_be(tkhd, 0, 4); // modification time
+	put_be(tkhd, 1, 4); // track ID
+	put_be(tkhd, 0, 4);
+	put_be(tkhd, duration, 4);
+	tkhd.append(8, '\0');
+	put_be(tkhd, 0, 4); // layer, alternate group
+	put_be(tkhd, 0x100, 2); // volume
+	put_be(tkhd, 0, 2);
+	tkhd += matrix;
+	put_be(tkhd, 0, 4); // width
+	put_be(tkhd, 0, 4); // height
+
+	string mdhd(4, '\0');
+	put_be(mdhd, 0, 4); // creation time
+	put_be(mdhd, 0, 4); // modification time
+	put_be(mdhd, rate, 4); // time scale
+	put_be(mdhd, duration, 4);
+	put_be(mdhd, 0x55C4, 2); // language "und"
+	put_be(mdhd, 0, 2);
+
+	string hdlr(8, '\0'); // version, flags, pre-defined
+	hdlr += "soun";
+	hdlr.append(12, '\0');
+	hdlr.append("SoundHandler", 13);
+
+	string dcd("\x40\x15", 2); // MPEG-4 audio, audio stream
+	put_be(dcd, 0, 3); // buffer size
+	put_be(dcd, 0, 4); // max bitrate
+	put_be(dcd, 0, 4); // average bitrate
+	dcd.append("\x05\x02\x12\x08", 4); // AudioSpecificConfig: AAC LC, 44.1 kHz, mono
+	string esd(3, '\0'); // ES ID, flags
+	esd += '\x04';
+	esd += (char)dcd.size();
+	esd += dcd;
+	esd.append("\x06\x01\x02", 3); // SL config
+	string esds(4, '\0');
+	esds += '\x03';
+	esds += (char)esd.size();
+	esds += esd;
+
+	string mp4a(6, '\0');
+	put_be(mp4a, 1, 2); // data reference index
+	mp4a.append(8, '\0');
+	put_be(mp4a, 1, 2); // channels
+	put_be(mp4a, 16, 2); // sample size
+	put_be(mp4a, 0, 4);
+	put_be(mp4a, rate << 16, 4);
+	mp4a += mp4_box("esds", esds);
+
+	string stsd(4, '\0');
+	put_be(stsd, 1, 4);
+	stsd += mp4_box("mp4a", mp4a);
+	string stts(4, '\0');
+	put_be(stts, 1, 4);
+	put_be(stts, frames, 4);
+	put_be(stts, 1024, 4);
+	string stsc(4, '\0');
+	put_be(stsc, 1, 4);
+	put_be(stsc, 1, 4); // first chunk
+	put_be(stsc, frames, 4); // samples per chunk
+	put_be(stsc, 1, 4); // sample description
+	string stsz(4, '\0');
+	put_be(stsz, sizeof frame, 4);
+	put_be(stsz, frames, 4);
+
+	string ftyp("M4A ", 4);
+	put_be(ftyp, 0, 4);
+	ftyp += "M4A mp42isom";
+	ftyp = mp4_box("ftyp", ftyp);
+
+	// All samples in one chunk behind moov. The size of moov does not depend on the offset.
+	auto moov = [&](guint32 offset)
+	{	string stco(4, '\0');
+		put_be(stco, 1, 4);
+		put_be(stco, offset, 4);
+		string stbl = mp4_box("stsd", stsd) + mp4_box("stts", stts) + mp4_box("stsc", stsc)
+			+ mp4_box("stsz", stsz) + mp4_box("stco", stco);
+		string dref("\0\0\0\0\0\0\0\x01", 8);
+		dref += mp4_box("url ", string("\0\0\0\x01", 4)); // self-contained
+		string minf = mp4_box("smhd", string(8, '\0')) + mp4_box("dinf", mp4_box("dref", dref)) + mp4_box("stbl", stbl);
+		string mdia = mp4_box("mdhd", mdhd) + mp4_box("hdlr", hdlr) + mp4_box("minf", minf);
+		string trak = mp4_box("tkhd", tkhd) + mp4_box("mdia", mdia);
+		return mp4_box("moov", mp4_box("mvhd", mvhd) + mp4_box("trak", trak));
+	};
+	string data = ftyp + moov(ftyp.size() + moov(0).size() + 8);
+
+	string mdat;
+	mdat.reserve(frames * sizeof frame);
+	for (guint32 i = 0; i < frames; ++i)
+		mdat.append(frame, sizeof frame);
+	return data + mp4_box("mdat", mdat);
+}
+
+static const struct Format
+{	const char* Extension;
+	string (*Generate)(GRand* rand);
+} Formats[] =
+{
+#ifdef ENABLE_MP3
+	{ ".mp3", make_mp3 },
+#endif
+#ifdef ENABLE_FLAC
+	{ ".flac", make_flac },
+#endif
+#ifdef ENABLE_OPUS
+	{ ".opus", make_opus },
+#endif
+#ifdef ENABLE_OGG
+	{ ".ogg", make_vorbis },
+#endif
+#ifdef ENABLE_MP4
+	{ ".m4a", make_mp4 },
+#endif
+	{ nullptr, nullptr }
+};
+
+
+/*
+ * Tag generator
+ */
+
+static const char* const Artists[] =
+{	"The Beatles", "Björk", "Mötley Crüe", "Sigur Rós", "Ludwig van Beethoven", "Miles Davis",
+	"坂本龍一", "Αλκίνοος Ιωαννίδης", "Daft Punk", "Nina Simone", "AC/DC", "Édith Piaf"
+};
+static const char* const Genres[] =
+{	"Rock", "Pop", "Jazz", "Classical", "Electronic", "Folk", "Soundtrack", "Blues"
+};
+static const char* const Words[] =
+{	"love", "night", "blue", "river", "dream", "fire", "heart", "road", "sky", "rain",
+	"Sommer", "étoile", "corazón", "light", "time", "home", "world", "dance", "song", "moon"
+};
+
+static EtPicture make_cover(GRand* rand)
+{	const int size = 300;
+	GdkPixbuf* pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, size, size);
+	guchar* pixels = gdk_pixbuf_get_pixels(pixbuf);
+	int stride = gdk_pixbuf_get_rowstride(pixbuf);
+	guint8 base[3] = { (guint8)g_rand_int(rand), (guint8)g_rand_int(rand), (guint8)g_rand_int(rand) };
+	for (int y = 0; y < size; ++y)
+		for (int x = 0; x < size; ++x)
+		{	guchar* p = pixels + y * stride + 3 * x;
+			p[0] = base[0] + x;
+			p[1] = base[1] + y;
+			p[2] = base[2] + (x ^ y) + g_rand_int_range(rand, 0, 16);
+		}
+	gchar* buffer;
+	gsize len;
+	gdk_pixbuf_save_to_buffer(pixbuf, &buffer, &len, "jpeg", nullptr, "quality", "85", nullptr);
+	g_object_unref(pixbuf);
+	EtPicture picture(ET_PICTURE_TYPE_FRONT_COVER, xStringD0(), size, size, buffer, len);
+	g_free(buffer);
+	return picture;
+}
+
+static string make_title(GRand* rand)
+{	string title;
+	for (int n = g_rand_int_range(rand, 1, 5); n--; )
+	{	if (title.length())
+			title += ' ';
+		title += Words[g_rand_int_range(rand, 0, G_N_ELEMENTS(Words))];
+	}
+	title[0] = g_ascii_toupper(title[0]);
+	return title;
+}
+
+/// Generated file with its designated tag.
+struct LibraryFile
+{	gString Path;
+	File_Tag* Tag;
+};
+
+static vector<LibraryFile> generate_library(const gchar* root)
+{
+	vector<LibraryFile> files;
+	files.reserve(Files);
+	GRand* rand = g_rand_new_with_seed(Seed);
+
+	const int tracks_per_album = 12;
+	unique_ptr<EtPicture> cover;
+	xStringD0 artist, album, genre, year;
+	gString dir;
+	for (int i = 0; i < Files; ++i)
+	{	int track = i % tracks_per_album + 1;
+		if (track == 1)
+		{	int artist_no = g_rand_int_range(rand, 0, G_N_ELEMENTS(Artists));
+			artist = Artists[artist_no];
+			album = make_title(rand);
+			genre = Genres[g_rand_int_range(rand, 0, G_N_ELEMENTS(Genres))];
+			year = strprintf("%i", g_rand_int_range(rand, 1950, 2026));
+			cover.reset(new EtPicture(make_cover(rand)));
+			dir = g_strdup_printf("%s" G_DIR_SEPARATOR_S "artist-%02i" G_DIR_SEPARATOR_S "album-%04i", root, artist_no, i / tracks_per_album);
+			g_mkdir_with_parents(dir, 0755);
+		}
+
+		const Format& format = Formats[g_rand_int_range(rand, 0, G_N_ELEMENTS(Formats) - 1)];
+		gString path(g_strdup_printf("%s" G_DIR_SEPARATOR_S "%02i%s", dir.get(), track, format.Extension));
+		string data = format.Generate(rand);
+		GError* error = nullptr;
+		if (!g_file_set_contents(path, data.data(), data.size(), &error))
+			g_error("Failed to write %s: %s", path.get(), error->message);
+
+		File_Tag* tag = new File_Tag();
+		tag->title = make_title(rand);
+		tag->artist = artist;
+		tag->album_artist = artist;
+		tag->album = album;
+		tag->genre = genre;
+		tag->year = year;
+		tag->track = strprintf("%02i", track);
+		tag->track_total = strprintf("%02i", tracks_per_album);
+		tag->disc_number = "1";
+		tag->disc_total = "1";
+		if (g_rand_int_range(rand, 0, 4) == 0)
+			tag->comment = make_title(rand);
+		tag->pictures.push_back(*cover);
+		files.push_back(LibraryFile{ move(path), tag });
+	}
+
+	g_rand_free(rand);
+	return files;
+}
+
+/// Directory scan of the application without UI.
+class BenchScanner : public DirectoryScanner
+{	const char* Name;
+	GMainLoop* Loop;
+public:
+	ET_FileList::list_type Files;
+
+	BenchScanner(const char* name, const gchar* root, GMainLoop* loop)
+	:	DirectoryScanner(gString(g_strdup(root)), nullptr), Name(name), Loop(loop) {}
+	using DirectoryScanner::StartWorkers;
+protected:
+	void OnDirCompleted(GFile* dir, const char* error) override
+	{	g_printerr("Failed to read %s: %s\n", gString(g_file_get_path(dir)).get(), error);
+	}
+	void OnFileCompleted(xPtr<ET_File> file, xString error, bool) override
+	{	const char* msg = error;
+		if (msg)
+			g_printerr("Failed to read %s: %s\n", file->FilePath.get(), msg);
+	}
+	void OnFinished() override
+	{	Files = TakeResults();
+		for (auto& q : Queues)
+			ScanStats.push_back(WorkerStats{ Name, (unsigned)(&q - Queues.data()), q->Executed, q->Steals, q->MaxDepth });
+		g_main_loop_quit(Loop);
+	}
+};
+
+/// Scan the library like the browser does.
+/// @param name Name of the step for the worker statistics.
+/// @param defer_tags Only stat the files like the scan-defer-tags option.
+static ET_FileList::list_type scan(const char* name, const gchar* root, bool defer_tags)
+{	g_settings_set_boolean(MainSettings, "scan-defer-tags", defer_tags);
+	GMainLoop* loop = g_main_loop_new(nullptr, FALSE);
+	xPtr<BenchScanner> scanner(new BenchScanner(name, root, loop));
+	scanner->StartWorkers();
+	g_main_loop_run(loop);
+	g_main_loop_unref(loop);
+	return move(scanner->Files);
+}
+
+static guint64 total_size(const ET_FileList::list_type& files)
+{	guint64 bytes = 0;
+	for (const ET_File* file : files)
+		bytes += file->FileSize;
+	return bytes;
+}
+
+static void remove_tree(const gchar* path)
+{	GDir* dir = g_dir_open(path, 0, nullptr);
+	if (dir)
+	{	const gchar* name;
+		while ((name = g_dir_read_name(dir)) != nullptr)
+			remove_tree(gString(g_build_filename(path, name, nullptr)));
+		g_dir_close(dir);
+	}
+	g_remove(path);
+}
+
+
+int main(int argc, char** argv)
+{
+	GOptionContext* context = g_option_context_new("- EasyTAG throughput benchmark");
+	g_option_context_add_main_entries(context, Options, nullptr);
+	GError* error = nullptr;
+	if (!g_option_context_parse(context, &argc, &argv, &error))
+	{	g_printerr("%s\n", error->message);
+		return 2;
+	}
+	g_option_context_free(context);
+	if (Files <= 0 || Seconds <= 0 || !Formats[0].Extension)
+	{	g_printerr("Nothing to do.\n");
+		return 2;
+	}
+
+	// Do not touch the user's configuration.
+	g_setenv("GSETTINGS_BACKEND", "memory", FALSE);
+	MainThreadId = this_thread::get_id();
+	Init_Config_Variables();
+	// Scan like the default settings, but without side effects.
+	g_settings_set_boolean(MainSettings, "browse-subdir", TRUE);
+	g_settings_set_boolean(MainSettings, "scan-cache", FALSE);
+	g_settings_set_boolean(MainSettings, "watch-files", FALSE);
+#if defined(ENABLE_ACOUSTID) || defined(ENABLE_REPLAYGAIN)
+	av_log_set_level(AV_LOG_ERROR);
+#endif
+
+	gString root(Directory ? g_strdup(Directory) : g_dir_make_tmp("easytag-bench-XXXXXX", &error));
+	if (!root)
+		g_error("Failed to create library directory: %s", error->message);
+
+	// Generate the library and write the tags.
+	vector<LibraryFile> library = generate_library(root);
+	vector<xPtr<ET_File>> files;
+	files.reserve(library.size());
+	for (LibraryFile& lf : library)
+	{	ET_File* file = new ET_File(lf.Path);
+		files.emplace_back(file);
+		GFile* gfile = g_file_new_for_path(file->FilePath);
+		file->read_file(gfile, root, nullptr);
+		g_object_unref(gfile);
+		file->apply_changes(nullptr, lf.Tag);
+	}
+
+	guint64 bytes = total_size(files);
+	gint64 start = start_timer();
+	unsigned count = 0;
+	for (ET_File* file : files)
+		if (file->save_file_tag(&error))
+			++count;
+		else
+		{	g_printerr("Failed to write tag of %s: %s\n", file->FilePath.get(), error->message);
+			g_clear_error(&error);
+		}
+	report("tag-write", count, bytes, start);
+	files.clear();
+
+	// Directory scan of the browser, file system information only
+	start = start_timer();
+	files = scan("scan", root, true);
+	bytes = total_size(files);
+	report("scan", files.size(), bytes, start);
+
+	// Directory scan of the browser including the tags
+	start = start_timer();
+	files = scan("scan-read", root, false);
+	report("scan-read", files.size(), total_size(files), start);
+	for (const WorkerStats& w : ScanStats)
+		g_printerr("%-12s worker %u: %u jobs, %u stolen, max queue depth %zu\n", w.Name, w.Worker, w.Executed, w.Steals, w.MaxDepth);
+
+	// Read tags sequentially
+	vector<gString> paths;
+	for (const ET_File* file : files)
+		paths.emplace_back(g_strdup(file->FilePath));
+	files.clear();
+	start = start_timer();
+	for (gString& path : paths)
+	{	ET_File* file = new ET_File(move(path));
+		files.emplace_back(file);
+		GFile* gfile = g_file_new_for_path(file->FilePath);
+		file->read_file(gfile, root, nullptr);
+		g_object_unref(gfile);
+	}
+	report("tag-read", files.size(), total_size(files), start);
+
+	// Read the MPEG files again to isolate the ID3 reader
+	start = start_timer();
+	count = 0;
+	guint64 mp3_bytes = 0;
+	for (const ET_File* file : files)
+		if (strcmp(file->ETFileDescription->Extension, ".mp3") == 0)
+		{	ET_File mp3(gString(g_strdup(file->FilePath)));
+			GFile* gfile = g_file_new_for_path(mp3.FilePath);
+			mp3.read_file(gfile, root, nullptr);
+			g_object_unref(gfile);
+			mp3_bytes += mp3.FileSize;
+			++count;
+		}
+	report("id3-read", count, mp3_bytes, start);
+
+	// Sort like the browser by several criteria
+	static const EtSortMode sort_modes[] =
+	{	ET_SORT_MODE_FILEPATH, ET_SORT_MODE_TITLE, ET_SORT_MODE_ARTIST, ET_SORT_MODE_ALBUM,
+		ET_SORT_MODE_YEAR, ET_SORT_MODE_TRACK_NUMBER, ET_SORT_MODE_FILE_SIZE
+	};
+	start = start_timer();
+	vector<const ET_File*> sorted(files.begin(), files.end());
+	for (EtSortMode mode : sort_modes)
+		sort(sorted.begin(), sorted.end(), [mode](const ET_File* l, const ET_File* r)
+		{	return l->sort_key(mode).compare(r->sort_key(mode)) < 0; });
+	report("sort", files.size() * G_N_ELEMENTS(sort_modes), bytes * G_N_ELEMENTS(sort_modes), start);
+
+	// Search like the search dialog, case insensitive in file name and common tag fields
+	static const char* const search_columns[] = { "filename", "title", "artist", "album", "comment" };
+	start = start_timer();
+	unsigned matches = 0;
+	gchar* needle = g_utf8_casefold("love", -1);
+	for (const ET_File* file : files)
+		for (const char* column : search_columns)
+		{	string text = FileColumnRenderer::Get_Renderer(column)->RenderText(file);
+			gchar* normalized = g_utf8_casefold(text.c_str(), -1);
+			bool match = strstr(normalized, needle) != nullptr;
+			g_free(normalized);
+			if (match)
+			{	++matches;
+				break;
+			}
+		}
+	g_free(needle);
+	report("search", files.size(), bytes, start);
+	g_printerr("%u matches\n", matches);
+
+	// Mask evaluation like the rename scanner
+	start = start_timer();
+	for (const ET_File* file : files)
+		et_evaluate_mask(file, "%a/%b/%n - %t", FALSE);
+	report("mask", files.size(), bytes, start);
+
+#ifdef ENABLE_REPLAYGAIN
+	start = start_timer();
+	ReplayGainAnalyzer analyzer(ET_REPLAYGAIN_MODEL_V2);
+	count = 0;
+	for (const ET_File* file : files)
+	{	string err = analyzer.AnalyzeFile(file->FilePath);
+		if (err.length())
+			g_printerr("ReplayGain of %s failed: %s\n", file->FilePath.get(), err.c_str());
+		else
+			++count;
+	}
+	report("replaygain", count, bytes, start);
+#endif
+
+	files.clear();
+
+	if (Output)
+	{	FILE* out = fopen(Output, "w");
+		if (!out)
+			g_error("Failed to write %s: %s", Output, g_strerror(errno));
+		write_results(out);
+		fclose(out);
+	} else
+		write_results(stdout);
+
+	if (!Keep && !Directory)
+		remove_tree(root);
+	else
+		g_printerr("Library kept in %s\n", root.get());
+
+	return 0;
+}
@@ -152,6 +152,44 @@ misc_str_empty (void)
     }
 }
 
+static void
+misc_int_sort_value (void)
+{
+    static const struct
+    {
+        const gchar *string;
+        double value;
+        bool complete;
+    } strings[] =
+    {
+        { NULL, -HUGE_VAL, true },
+        { "", -HUGE_VAL, true },
+        { "-1", -1, true },
+        { "7", 7, true },
+        { "07", 7, true },
+        { "10", 10, true },
+        { "10a", 10, false },
+        { "1/12", 1, false },
+        { "a", HUGE_VAL, false }
+    };
+
+    for (gsize i = 0; i < G_N_ELEMENTS (strings); i++)
+    {
+        bool complete;
+        double value = et_int_sort_value (strings[i].string, complete);
+        g_assert_cmpfloat (value, ==, strings[i].value);
+        g_assert (complete == strings[i].complete);
+    }
+
+    /* The order is transitive unlike a numeric comparison with a string
+     * fallback: 9 < 10 < 10a but also 9 < 10a. */
+    bool complete;
+    g_assert_cmpfloat (et_int_sort_value ("9", complete), <,
+                       et_int_sort_value ("10a", complete));
+    g_assert_cmpfloat (et_int_sort_value ("2", complete), >,
+                       et_int_sort_value ("1/12", complete));
+}
+
 int
 main (int argc, char** argv)
 {
@@ -160,6 +198,7 @@ main (int argc, char** argv)
     g_test_add_func ("/misc/convert-duration", misc_convert_duration);
     g_test_add_func ("/misc/rename-file", misc_rename_file);
     g_test_add_func ("/misc/str-empty", misc_str_empty);
+    g_test_add_func ("/misc/int-sort-value", misc_int_sort_value);
 
     return g_test_run ();
 }
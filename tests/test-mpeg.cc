@@ -0,0 +1,208 @@
+/* EasyTAG - tag editor for audio files
+ * Copyright (C) 2024 Marcel Müller
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#ifdef ENABLE_MP3
+
+#include "file.h"
+#include "setting.h"
+
+#include <glib/gstdio.h>
+#include <cstdlib>
+#include <string>
+using namespace std;
+
+/* MPEG 1 Layer III frames at 48 kHz, stereo, without CRC and padding,
+ * i.e. 1152 samples and 3 bytes per kbit/s. */
+static const int samplerate = 48000;
+static const int frame_samples = 1152;
+static const unsigned br128 = 9; /* bitrate index of 128 kbit/s */
+static const unsigned br64 = 5;  /* bitrate index of 64 kbit/s */
+/* Position of the Xing and the VBRI header in the frame. */
+static const size_t vbr_header = 36;
+
+static void
+put32 (string& data, size_t pos, guint32 value)
+{
+    data[pos] = (char)(value >> 24);
+    data[pos + 1] = (char)(value >> 16);
+    data[pos + 2] = (char)(value >> 8);
+    data[pos + 3] = (char)value;
+}
+
+/* Silent frame. */
+static string
+make_frame (unsigned bitrate_index)
+{
+    string frame ((bitrate_index == br128 ? 128 : 64) * 3, '\0');
+    frame[0] = (char)0xff;
+    frame[1] = (char)0xfb;
+    frame[2] = (char)(bitrate_index << 4 | 1 << 2);
+    return frame;
+}
+
+/* Read the header information of an MP3 file with the given content. */
+static xPtr<ET_File>
+read_mp3 (const string& data)
+{
+    GError *error = NULL;
+    gchar *path = NULL;
+    gint fd = g_file_open_tmp ("easytag-test-XXXXXX.mp3", &path, &error);
+    g_assert_no_error (error);
+    g_close (fd, NULL);
+    g_file_set_contents (path, data.data (), data.size (), &error);
+    g_assert_no_error (error);
+
+    xPtr<ET_File> file (new ET_File (gString (path)));
+    GFile *gfile = g_file_new_for_path (file->FilePath);
+    g_assert_true (file->read_file (gfile, NULL, &error));
+    g_assert_no_error (error);
+    g_object_unref (gfile);
+
+    g_unlink (file->FilePath);
+    return file;
+}
+
+static void
+mpeg_xing (void)
+{
+    /* Xing header with the frame count, followed by a few frames. */
+    string data = make_frame (br128);
+    data.replace (vbr_header, 4, "Xing");
+    put32 (data, vbr_header + 4, 1);
+    put32 (data, vbr_header + 8, 1000);
+    for (int i = 0; i < 10; ++i)
+        data += make_frame (i & 1 ? br64 : br128);
+
+    xPtr<ET_File> file = read_mp3 (data);
+    const ET_File_Info& info = file->ETFileInfo;
+    g_assert_true (info.variable_bitrate);
+    g_assert_cmpfloat_with_epsilon (info.duration, 1000. * frame_samples / samplerate, 1e-6);
+    g_assert_cmpint (info.samplerate, ==, samplerate);
+
+    /* Info header of CBR files. */
+    data = make_frame (br128);
+    data.replace (vbr_header, 4, "Info");
+    put32 (data, vbr_header + 4, 1);
+    put32 (data, vbr_header + 8, 1000);
+    for (int i = 0; i < 10; ++i)
+        data += make_frame (br128);
+
+    file = read_mp3 (data);
+    g_assert_false (file->ETFileInfo.variable_bitrate);
+    g_assert_cmpint (file->ETFileInfo.bitrate, ==, 128000);
+    g_assert_cmpfloat_with_epsilon (file->ETFileInfo.duration, 1000. * frame_samples / samplerate, 1e-6);
+}
+
+static void
+mpeg_lame (void)
+{
+    /* LAME extension behind a Xing header with only the frame count. */
+    string data = make_frame (br128);
+    data.replace (vbr_header, 4, "Xing");
+    put32 (data, vbr_header + 4, 1);
+    put32 (data, vbr_header + 8, 1000);
+    const size_t lame = vbr_header + 12;
+    data.replace (lame, 9, "LAME3.100");
+    /* encoder delay 576 and padding 1000, 12 bits each */
+    data[lame + 21] = (char)(576 >> 4);
+    data[lame + 22] = (char)((576 & 15) << 4 | 1000 >> 8);
+    data[lame + 23] = (char)(1000 & 0xff);
+    for (int i = 0; i < 10; ++i)
+        data += make_frame (br128);
+
+    xPtr<ET_File> file = read_mp3 (data);
+    g_assert_cmpfloat_with_epsilon (file->ETFileInfo.duration,
+        (1000. * frame_samples - 576 - 1000) / samplerate, 1e-6);
+}
+
+static void
+mpeg_vbri (void)
+{
+    /* VBRI header of the Fraunhofer encoder, always 32 bytes after the frame header. */
+    string data = make_frame (br128);
+    data.replace (vbr_header, 4, "VBRI");
+    put32 (data, vbr_header + 14, 500);
+    for (int i = 0; i < 10; ++i)
+        data += make_frame (i & 1 ? br64 : br128);
+
+    xPtr<ET_File> file = read_mp3 (data);
+    g_assert_true (file->ETFileInfo.variable_bitrate);
+    g_assert_cmpfloat_with_epsilon (file->ETFileInfo.duration, 500. * frame_samples / samplerate, 1e-6);
+}
+
+static void
+mpeg_cbr (void)
+{
+    /* No VBR header and a constant bitrate => extrapolation from the first frame. */
+    string data;
+    for (int i = 0; i < 1000; ++i)
+        data += make_frame (br128);
+
+    xPtr<ET_File> file = read_mp3 (data);
+    g_assert_false (file->ETFileInfo.variable_bitrate);
+    g_assert_cmpint (file->ETFileInfo.bitrate, ==, 128000);
+    g_assert_cmpfloat_with_epsilon (file->ETFileInfo.duration, 1000. * frame_samples / samplerate, 1e-6);
+}
+
+static void
+mpeg_sampled (void)
+{
+    /* No VBR header but a varying bitrate => sampled frame lengths. */
+    string data;
+    for (int i = 0; i < 1000; ++i)
+        data += make_frame (i & 1 ? br64 : br128);
+
+    xPtr<ET_File> file = read_mp3 (data);
+    g_assert_true (file->ETFileInfo.variable_bitrate);
+    /* Only whole frames are counted, so the average frame length is approximate. */
+    g_assert_cmpfloat_with_epsilon (file->ETFileInfo.duration, 1000. * frame_samples / samplerate, 0.05 * 24);
+    g_assert_cmpint (abs (file->ETFileInfo.bitrate - 96000), <, 0.05 * 96000);
+
+    /* Too short to sample => extrapolation from the first frame. */
+    data.resize (20 * (384 + 192));
+    file = read_mp3 (data);
+    g_assert_true (file->ETFileInfo.variable_bitrate);
+    g_assert_cmpfloat_with_epsilon (file->ETFileInfo.duration, data.size () * 8. / 128000, 1e-6);
+}
+
+#endif /* ENABLE_MP3 */
+
+int
+main (int argc, char** argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+#ifdef ENABLE_MP3
+    /* Use the schema of the build tree and do not touch the user's configuration. */
+    g_setenv ("GSETTINGS_SCHEMA_DIR", TEST_SCHEMA_DIR, TRUE);
+    g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+    Init_Config_Variables ();
+
+    g_test_add_func ("/mpeg/xing", mpeg_xing);
+    g_test_add_func ("/mpeg/lame", mpeg_lame);
+    g_test_add_func ("/mpeg/vbri", mpeg_vbri);
+    g_test_add_func ("/mpeg/cbr", mpeg_cbr);
+    g_test_add_func ("/mpeg/sampled", mpeg_sampled);
+#endif
+
+    return g_test_run ();
+}
@@ -0,0 +1,241 @@
+/* EasyTAG - tag editor for audio files
+ * Copyright (C) 2024 Marcel Müller
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#ifdef ENABLE_OGG
+
+#include "ogg_tag.h"
+#include "vcedit.h"
+#include "file.h"
+#include "file_tag.h"
+#include "setting.h"
+
+#include <cstring>
+#include <string>
+#include <initializer_list>
+using namespace std;
+
+static void
+append32 (string& packet, guint32 value)
+{
+    for (int i = 0; i < 4; ++i, value >>= 8)
+        packet += (char)(value & 0xff);
+}
+
+/* Raw comment packet with vendor "test", the given comments and count. */
+static string
+make_packet (initializer_list<const char*> comments, guint32 count)
+{
+    string packet;
+    append32 (packet, 4);
+    packet += "test";
+    append32 (packet, count);
+    for (const char* comment : comments)
+    {
+        append32 (packet, strlen (comment));
+        packet += comment;
+    }
+    return packet;
+}
+
+static string
+make_packet (initializer_list<const char*> comments)
+{
+    return make_packet (comments, comments.size ());
+}
+
+static void
+vorbis_tags_parse (void)
+{
+    string packet = make_packet ({ "TITLE=foo", "artist=bar", "EMPTY=" });
+    vorbis_tags tags (0);
+
+    g_assert_true (tags.parse (packet.data (), packet.size ()));
+    g_assert_cmpuint (tags.size (), ==, 3);
+    g_assert_cmpstr (string (tags[0].key ().Str, tags[0].key ().Len).c_str (), ==, "TITLE");
+    g_assert_cmpstr (string (tags[0].value ().Str, tags[0].value ().Len).c_str (), ==, "foo");
+    g_assert_cmpstr (string (tags[1].key ().Str, tags[1].key ().Len).c_str (), ==, "artist");
+    g_assert_cmpuint (tags[2].value ().Len, ==, 0);
+
+    /* No comments at all. */
+    packet = make_packet ({});
+    vorbis_tags empty (0);
+    g_assert_true (empty.parse (packet.data (), packet.size ()));
+    g_assert_cmpuint (empty.size (), ==, 0);
+}
+
+static void
+vorbis_tags_truncated (void)
+{
+    string packet = make_packet ({ "TITLE=foo", "ARTIST=bar" });
+
+    /* Every truncation fails and keeps the complete comments before it. */
+    for (size_t len = 0; len < packet.size (); ++len)
+    {
+        vorbis_tags tags (0);
+        g_assert_false (tags.parse (packet.data (), len));
+        /* vendor: 8 bytes, count: 4 bytes, comments: 4 + 9 and 4 + 10 bytes */
+        g_assert_cmpuint (tags.size (), ==, len < 12 + 13 ? 0 : 1);
+    }
+
+    /* Vendor length beyond the end of the packet. */
+    packet.clear ();
+    append32 (packet, 100);
+    packet += "test";
+    vorbis_tags tags (0);
+    g_assert_false (tags.parse (packet.data (), packet.size ()));
+
+    /* Comment length beyond the end of the packet. */
+    packet = make_packet ({ "TITLE=foo" });
+    packet[12] = 10;
+    vorbis_tags tags2 (0);
+    g_assert_false (tags2.parse (packet.data (), packet.size ()));
+    g_assert_cmpuint (tags2.size (), ==, 0);
+
+    /* Comment length beyond the address space. */
+    packet[12] = packet[13] = packet[14] = packet[15] = (char)0xff;
+    vorbis_tags tags3 (0);
+    g_assert_false (tags3.parse (packet.data (), packet.size ()));
+}
+
+static void
+vorbis_tags_huge_count (void)
+{
+    /* Must neither allocate nor read according to the count. */
+    string packet = make_packet ({ "TITLE=foo", "ARTIST=bar" }, 0xffffffff);
+    vorbis_tags tags (0);
+
+    g_assert_false (tags.parse (packet.data (), packet.size ()));
+    g_assert_cmpuint (tags.size (), ==, 2);
+
+    /* Fewer comments than the count. */
+    packet = make_packet ({ "TITLE=foo" }, 2);
+    vorbis_tags tags2 (0);
+    g_assert_false (tags2.parse (packet.data (), packet.size ()));
+    g_assert_cmpuint (tags2.size (), ==, 1);
+}
+
+static void
+vorbis_tags_classify (void)
+{
+    auto classify = [](const char* key) { return vorbis_tags::classify (key, strlen (key)); };
+
+    g_assert_cmpint (classify ("TITLE"), ==, vorbis_tags::TITLE);
+    g_assert_cmpint (classify ("title"), ==, vorbis_tags::TITLE);
+    g_assert_cmpint (classify ("TiTlE"), ==, vorbis_tags::TITLE);
+    g_assert_cmpint (classify ("albumartist"), ==, vorbis_tags::ALBUM_ARTIST);
+    g_assert_cmpint (classify ("metadata_block_picture"), ==, vorbis_tags::METADATA_BLOCK_PICTURE);
+
+    /* Names that share the length and the first character. */
+    g_assert_cmpint (classify ("Comment"), ==, vorbis_tags::COMMENT);
+    g_assert_cmpint (classify ("contact"), ==, vorbis_tags::CONTACT);
+    g_assert_cmpint (classify ("COMPOSER"), ==, vorbis_tags::COMPOSER);
+    g_assert_cmpint (classify ("coverart"), ==, vorbis_tags::COVER_ART);
+    g_assert_cmpint (classify ("replaygain_track_gain"), ==, vorbis_tags::REPLAYGAIN_TRACK_GAIN);
+    g_assert_cmpint (classify ("REPLAYGAIN_TRACK_PEAK"), ==, vorbis_tags::REPLAYGAIN_TRACK_PEAK);
+    g_assert_cmpint (classify ("ReplayGain_Album_Gain"), ==, vorbis_tags::REPLAYGAIN_ALBUM_GAIN);
+    g_assert_cmpint (classify ("replaygain_album_PEAK"), ==, vorbis_tags::REPLAYGAIN_ALBUM_PEAK);
+    g_assert_cmpint (classify ("REPLAYGAIN_ALBUM_XXXX"), ==, vorbis_tags::OTHER);
+    g_assert_cmpint (classify ("CONTRACT"), ==, vorbis_tags::OTHER);
+
+    /* Prefixes and extensions of known names. */
+    g_assert_cmpint (classify ("TITL"), ==, vorbis_tags::OTHER);
+    g_assert_cmpint (classify ("TITLES"), ==, vorbis_tags::OTHER);
+    g_assert_cmpint (classify (""), ==, vorbis_tags::OTHER);
+
+    /* Only the key is classified. */
+    g_assert_cmpint (vorbis_tags::classify ("TITLE=foo", 5), ==, vorbis_tags::TITLE);
+}
+
+static void
+vorbis_tags_concatenate (void)
+{
+    g_settings_set_string (MainSettings, "split-delimiter", " / ");
+    g_settings_set_boolean (MainSettings, "tag-multiline-comment", FALSE);
+
+    string packet = make_packet ({ "ARTIST=foo", "TITLE=title", "artist=bar", "Artist=baz",
+        "DESCRIPTION=line 1", "description=line 2", "COMMENT=a", "COMMENT=b" });
+    vorbis_tags tags (0);
+    g_assert_true (tags.parse (packet.data (), packet.size ()));
+
+    File_Tag FileTag;
+    tags.to_file_tags (&FileTag);
+    g_assert_cmpstr (FileTag.artist, ==, "foo / bar / baz");
+    g_assert_cmpstr (FileTag.title, ==, "title");
+    g_assert_cmpstr (FileTag.description, ==, "line 1\nline 2");
+    g_assert_cmpstr (FileTag.comment, ==, "a / b");
+
+    g_settings_set_boolean (MainSettings, "tag-multiline-comment", TRUE);
+    vorbis_tags tags2 (0);
+    g_assert_true (tags2.parse (packet.data (), packet.size ()));
+    File_Tag FileTag2;
+    tags2.to_file_tags (&FileTag2);
+    g_assert_cmpstr (FileTag2.comment, ==, "a\nb");
+
+    g_settings_reset (MainSettings, "split-delimiter");
+    g_settings_reset (MainSettings, "tag-multiline-comment");
+}
+
+static void
+vorbis_tags_no_separator (void)
+{
+    /* A comment without '=' is neither a field nor dropped. */
+    string packet = make_packet ({ "TITLE", "ARTIST=foo", "NOSEPARATOR" });
+    vorbis_tags tags (0);
+    g_assert_true (tags.parse (packet.data (), packet.size ()));
+    g_assert_cmpuint (tags[0].value ().Len, ==, 0);
+
+    ET_File ETFile (gString (g_strdup ("/nonexistent.ogg")));
+    File_Tag FileTag;
+    tags.to_file_tags (&FileTag);
+    tags.to_other_tags (&ETFile);
+
+    g_assert_cmpstr (FileTag.title, ==, "");
+    g_assert_cmpstr (FileTag.artist, ==, "foo");
+    g_assert_nonnull (ETFile.other.get ());
+    g_assert_cmpstr (ETFile.other[0], ==, "TITLE");
+    g_assert_cmpstr (ETFile.other[1], ==, "NOSEPARATOR");
+    g_assert_null (ETFile.other[2].get ());
+}
+
+#endif /* ENABLE_OGG */
+
+int
+main (int argc, char** argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+#ifdef ENABLE_OGG
+    /* Use the schema of the build tree and do not touch the user's configuration. */
+    g_setenv ("GSETTINGS_SCHEMA_DIR", TEST_SCHEMA_DIR, TRUE);
+    g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+    Init_Config_Variables ();
+
+    g_test_add_func ("/ogg/vorbis_tags/parse", vorbis_tags_parse);
+    g_test_add_func ("/ogg/vorbis_tags/truncated", vorbis_tags_truncated);
+    g_test_add_func ("/ogg/vorbis_tags/huge_count", vorbis_tags_huge_count);
+    g_test_add_func ("/ogg/vorbis_tags/classify", vorbis_tags_classify);
+    g_test_add_func ("/ogg/vorbis_tags/concatenate", vorbis_tags_concatenate);
+    g_test_add_func ("/ogg/vorbis_tags/no_separator", vorbis_tags_no_separator);
+#endif
+
+    return g_test_run ();
+}
@@ -60,6 +60,41 @@ picture_difference (void)
     g_assert(*pic1 != *pic2);
 }
 
+/* Source that counts the number of loads. */
+struct counting_source : EtPicture::Source
+{
+    const char* Data;
+    int& Loads;
+    counting_source(const char* data, int& loads) : Data(data), Loads(loads) {}
+    bool load(void* bytes, unsigned size, GError** error) const override
+    {
+        ++Loads;
+        memcpy(bytes, Data, size);
+        return true;
+    }
+};
+
+static void
+picture_deferred (void)
+{
+    int loads = 0;
+    unique_ptr<EtPicture> pic1(new EtPicture(ET_PICTURE_TYPE_LEAFLET_PAGE, foobar, 6, new counting_source("foobar", loads)));
+    unique_ptr<EtPicture> pic2(new EtPicture(*pic1));
+    g_assert(*pic1 == *pic2);
+    g_assert_cmpint(loads, ==, 0);
+    g_assert_cmpuint(pic1->storage->Size, ==, 6);
+
+    // loaded once and deduplicated with eager instances
+    unique_ptr<EtPicture> pic3(new EtPicture(ET_PICTURE_TYPE_LEAFLET_PAGE, foobar, 0, 0, "foobar", 6));
+    g_assert(*pic1 == *pic3);
+    g_assert_cmpint(loads, ==, 1);
+    g_assert(pic2->data() == pic3->storage);
+    g_assert_cmpint(loads, ==, 1);
+
+    pic3.reset(new EtPicture(ET_PICTURE_TYPE_LEAFLET_PAGE, foobar, 0, 0, "barfoo", 6));
+    g_assert(*pic1 != *pic3);
+}
+
 static void
 picture_type_from_filename (void)
 {
@@ -133,6 +168,7 @@ main (int argc, char** argv)
 
     g_test_add_func ("/picture/copy", picture_copy);
     g_test_add_func ("/picture/difference", picture_difference);
+    g_test_add_func ("/picture/deferred", picture_deferred);
     g_test_add_func ("/picture/format-from-data", picture_format_from_data);
     g_test_add_func ("/picture/type-from-filename",
                      picture_type_from_filename);
@@ -0,0 +1,111 @@
+/* EasyTAG - tag editor for audio files
+ * Copyright (C) 2026 Marcel Müller
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include "replaygain.h"
+#include "file_tag.h"
+
+#include <glib.h>
+#include <atomic>
+#include <cmath>
+#include <vector>
+using namespace std;
+
+struct _EtApplicationWindow *MainWindow;
+GSettings *MainSettings;
+atomic<bool> Main_Stop_Button_Pressed;
+
+#ifdef ENABLE_REPLAYGAIN
+
+/// Synthetic test signal of 10 seconds at 48kHz.
+/// Each channel gets a different mix of tones, noise and level changes.
+static vector<vector<float>> make_signal(int channels)
+{
+	const int samples = 480000;
+	vector<vector<float>> data(channels, vector<float>(samples));
+	GRand* rand = g_rand_new_with_seed(4711);
+	for (int ch = 0; ch < channels; ++ch)
+	{	float* dp = data[ch].data();
+		double freq = 110. * (ch + 1) / 48000 * 2 * M_PI;
+		for (int i = 0; i < samples; ++i)
+		{	double level = .05 + .4 * (1 + sin(i * (ch + 1) * 2e-5));
+			dp[i] = level * (.7 * sin(i * freq) + .3 * g_rand_double_range(rand, -1, 1));
+		}
+	}
+	g_rand_free(rand);
+	return data;
+}
+
+static void compare_kernels(int channels)
+{
+	vector<vector<float>> signal = make_signal(channels);
+	vector<const float*> data;
+	for (const auto& ch : signal)
+		data.push_back(ch.data());
+
+	static const ReplayGainAnalyzer::Kernel kernels[] =
+	{	ReplayGainAnalyzer::KERNEL_VECTOR, ReplayGainAnalyzer::KERNEL_AVX2 };
+	static const EtReplayGainModel models[] =
+	{	ET_REPLAYGAIN_MODEL_V1, ET_REPLAYGAIN_MODEL_V15, ET_REPLAYGAIN_MODEL_V2 };
+
+	ReplayGainAnalyzer::Kernel saved = ReplayGainAnalyzer::GetKernel();
+	for (EtReplayGainModel model : models)
+	{	ReplayGainAnalyzer reference(model);
+		g_assert_true(ReplayGainAnalyzer::SetKernel(ReplayGainAnalyzer::KERNEL_SCALAR));
+		reference.AnalyzeSamples(data.data(), channels, signal[0].size());
+		float gain = reference.GetLastResult().Gain();
+		float peak = reference.GetLastResult().Peak();
+		g_assert_false(isnan(gain));
+		g_assert_cmpfloat(peak, >, 0);
+
+		for (auto kernel : kernels)
+		{	if (!ReplayGainAnalyzer::SetKernel(kernel))
+			{	g_test_message("Kernel %i not supported by CPU", kernel);
+				continue;
+			}
+			ReplayGainAnalyzer analyzer(model);
+			analyzer.AnalyzeSamples(data.data(), channels, signal[0].size());
+			g_assert_cmpfloat_with_epsilon(analyzer.GetLastResult().Gain(), gain, File_Tag::gain_epsilon);
+			g_assert_cmpfloat(analyzer.GetLastResult().Peak(), ==, peak);
+		}
+	}
+	ReplayGainAnalyzer::SetKernel(saved);
+}
+
+static void replaygain_kernel_stereo()
+{
+	compare_kernels(2);
+}
+
+static void replaygain_kernel_surround()
+{
+	compare_kernels(6);
+}
+
+#endif
+
+int main(int argc, char** argv)
+{
+	g_test_init(&argc, &argv, NULL);
+
+#ifdef ENABLE_REPLAYGAIN
+	g_test_add_func("/replaygain/kernel/stereo", replaygain_kernel_stereo);
+	g_test_add_func("/replaygain/kernel/surround", replaygain_kernel_surround);
+#endif
+
+	return g_test_run();
+}